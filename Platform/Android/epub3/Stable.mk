@@ -307,6 +307,7 @@ LOCAL_SRC_FILES := \
     $(EPUB3_PATH)/utilities/ring_buffer.cpp \
     $(EPUB3_PATH)/utilities/run_loop_android.cpp \
     $(EPUB3_PATH)/utilities/utfstring.cpp \
+    $(EPUB3_PATH)/utilities/work_stealing_pool.cpp \
     $(wildcard $(EPUB3_PATH)/ePub/*.cpp) \
     $(wildcard $(LOCAL_PATH)/src/main/jni/*.cpp) \
     $(wildcard $(LOCAL_PATH)/src/main/jni/jni/*.cpp)
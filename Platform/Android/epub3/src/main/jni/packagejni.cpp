@@ -819,10 +819,13 @@ JNIEXPORT jobject JNICALL Java_org_readium_sdk_android_Package_nativeInputStream
 	if (manifestItem != nullptr) {
 		auto rawInputbyteStream = PCKG(pckgPtr)->ReadStreamForItemAtPath(path);
 		ePub3::ManifestItemPtr m = std::const_pointer_cast<ePub3::ManifestItem>(manifestItem);
+		ePub3::SeekableByteStream *rawInput = dynamic_cast<ePub3::SeekableByteStream *>(rawInputbyteStream.release());
 		if (isRange == JNI_TRUE) {
-			byteStream = PCKG(pckgPtr)->GetFilterChainByteStreamRange(m, dynamic_cast<ePub3::SeekableByteStream *>(rawInputbyteStream.release()));
-		} else {
-			byteStream = PCKG(pckgPtr)->GetFilterChainByteStream(m, dynamic_cast<ePub3::SeekableByteStream *>(rawInputbyteStream.release()));
+			byteStream = PCKG(pckgPtr)->GetFilterChainByteStreamRange(m, rawInput);
+		}
+		if (!byteStream) {
+			// either not a range request, or this item's filters can't serve ranges
+			byteStream = PCKG(pckgPtr)->GetFilterChainByteStream(m, rawInput);
 		}
 	} else {
 		// In the rare case that the manifest item could not be resolved from the path,
@@ -288,6 +288,22 @@ static jbyteArray GetBytesRange(JNIEnv* env, jobject thiz, jlong nativePtr, jlon
 	ePub3::ByteStream* byteStream = stream->getPtr();
 	ePub3::FilterChainByteStreamRange *rangeByteStream = dynamic_cast<ePub3::FilterChainByteStreamRange *>(byteStream);
 
+	if (rangeByteStream == nullptr) {
+		// Mapped stored items and fully-filtered content can be copied straight into the Java array
+		ePub3::ByteView view = byteStream->ReadView((std::size_t)offset, (std::size_t)length);
+		if (!view.empty()) {
+			LOGD("JNI --- GetBytesRange ByteView\n");
+			ePub3::SeekableByteStream *seekableStream = dynamic_cast<ePub3::SeekableByteStream *>(byteStream);
+			if (seekableStream != nullptr) {
+				seekableStream->Seek((std::size_t)offset + view.size(), std::ios::beg);
+			}
+
+			jbyteArray jviewBuffer = env->NewByteArray((jsize)view.size());
+			env->SetByteArrayRegion(jviewBuffer, 0, (jsize)view.size(), reinterpret_cast<const jbyte*>(view.data()));
+			return jviewBuffer;
+		}
+	}
+
 	jbyte * tmpBuffer = new jbyte[(std::size_t)length];
 
 	std::size_t readBytes;
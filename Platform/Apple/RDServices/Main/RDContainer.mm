@@ -148,10 +148,8 @@
     if (stream == nullptr)
     	return nil;
 
-    void *buffer = nullptr;
-    size_t length = stream->ReadAllBytes(&buffer);
-    std::string nativeContent((char *)buffer, length);
-    free (buffer);
+    ePub3::ByteBuffer buffer = stream->ReadAllBytes();
+    std::string nativeContent((char *)buffer.GetBytes(), buffer.GetBufferSize());
 
     return [NSString stringWithCString:nativeContent.c_str() encoding:encoding];
 }
@@ -434,7 +434,7 @@
 	{
 		byteStream = (ePub3::ByteStream *) currentByteStream; // is actually a SeekableByteStream
 	}
-	else if (numFilters == 1 && isRangeRequest)
+	else if (isRangeRequest)
 	{
 		byteStream = m_package->GetFilterChainByteStreamRange(m, rawInput).release(); // is *not* a SeekableByteStream, but wraps one
 		if (byteStream == nullptr)
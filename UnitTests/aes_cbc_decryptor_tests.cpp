@@ -0,0 +1,159 @@
+//
+//  aes_cbc_decryptor_tests.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/aes_cbc_decryptor.h"
+#include "../ePub3/ePub/filter_chain.h"
+#include "../ePub3/ePub/filter_chain_byte_stream_range.h"
+#include "../ePub3/ePub/filter_manager_impl.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/utilities/byte_stream.h"
+#include "catch.hpp"
+#include <string>
+
+// Generated with `openssl enc -aes-{128,256}-cbc`, with the IV prepended to each resource.
+// Each encrypted item has an unencrypted copy alongside it.
+#define EPUB_PATH "TestData/aes-cbc-encrypted.epub"
+#define CHAPTER_ID "chapter"            // aes128-cbc, 9512 bytes
+#define PLAIN_CHAPTER_ID "chapter-plain"
+#define AUDIO_ID "audio"                // aes256-cbc, 8192 bytes: a whole block of padding
+#define PLAIN_AUDIO_ID "audio-plain"
+
+using namespace ePub3;
+
+static bool TestKeyProvider(ConstManifestItemPtr item, EncryptionInfoPtr encInfo, uint8_t* key, size_t keyLength)
+{
+    // the fixture's keys are 00 01 02 ... for either length
+    for ( size_t i = 0; i < keyLength; i++ )
+        key[i] = uint8_t(i);
+    return true;
+}
+
+static std::string ReadAll(ByteStream& stream)
+{
+    std::string result;
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = stream.ReadBytes(buf, sizeof(buf))) > 0 )
+        result.append(buf, numRead);
+    return result;
+}
+
+static std::string ReadItem(ConstManifestItemPtr item)
+{
+    auto stream = item->Reader();
+    return ReadAll(*stream);
+}
+
+TEST_CASE("AES-CBC resources are decrypted using keys from the application", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr chapter = pkg->ManifestItemWithID(CHAPTER_ID);
+    ManifestItemPtr audio = pkg->ManifestItemWithID(AUDIO_ID);
+    REQUIRE(bool(chapter));
+    REQUIRE(bool(audio));
+
+    auto decryptor = std::make_shared<AESCBCDecryptor>(TestKeyProvider);
+    REQUIRE(decryptor->TypeSniffer()(chapter));
+    REQUIRE(decryptor->TypeSniffer()(audio));
+    REQUIRE_FALSE(decryptor->TypeSniffer()(pkg->ManifestItemWithID(PLAIN_CHAPTER_ID)));
+
+    FilterChain chain(FilterChain::FilterList{ decryptor });
+
+    std::string expected = ReadItem(pkg->ManifestItemWithID(PLAIN_CHAPTER_ID));
+    REQUIRE(expected.size() == 9512);
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(chapter, dynamic_cast<SeekableByteStream*>(chapter->Reader().release()));
+    REQUIRE(ReadAll(*stream) == expected);
+
+    expected = ReadItem(pkg->ManifestItemWithID(PLAIN_AUDIO_ID));
+    REQUIRE(expected.size() == 8192);
+    stream = chain.GetFilterChainByteStream(audio, dynamic_cast<SeekableByteStream*>(audio->Reader().release()));
+    REQUIRE(ReadAll(*stream) == expected);
+
+    // without a key there's nothing to read
+    auto keyless = std::make_shared<AESCBCDecryptor>([](ConstManifestItemPtr, EncryptionInfoPtr, uint8_t*, size_t) { return false; });
+    FilterChain keylessChain(FilterChain::FilterList{ keyless });
+    stream = keylessChain.GetFilterChainByteStreamRange(chapter, dynamic_cast<SeekableByteStream*>(chapter->Reader().release()));
+    REQUIRE(bool(stream));
+    REQUIRE(stream->BytesAvailable() == 0);
+    REQUIRE(ReadAll(*stream).empty());
+}
+
+TEST_CASE("AES-CBC resources serve byte ranges by decrypting only the blocks covering them", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+
+    auto decryptor = std::make_shared<AESCBCDecryptor>(TestKeyProvider);
+    FilterChain chain(FilterChain::FilterList{ decryptor });
+
+    for ( auto ids : { std::make_pair(CHAPTER_ID, PLAIN_CHAPTER_ID), std::make_pair(AUDIO_ID, PLAIN_AUDIO_ID) } )
+    {
+        CAPTURE(ids.first);
+        ManifestItemPtr item = pkg->ManifestItemWithID(ids.first);
+        std::string expected = ReadItem(pkg->ManifestItemWithID(ids.second));
+
+        std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStreamRange(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+        FilterChainByteStreamRange* rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+        REQUIRE(rangeStream != nullptr);
+
+        // the exact size comes from the padding
+        REQUIRE(rangeStream->BytesAvailable() == expected.size());
+
+        // ranges on and off block boundaries, including the first and final blocks
+        uint32_t size = uint32_t(expected.size());
+        const std::pair<uint32_t, uint32_t> ranges[] = { {0, 16}, {0, 1}, {15, 2}, {16, 16}, {100, 1000}, {4095, 3}, {size - 1, 1}, {size - 20, 20}, {7, size - 7} };
+        char buf[16384];
+        for ( auto& r : ranges )
+        {
+            CAPTURE(r.first);
+            CAPTURE(r.second);
+            ByteRange range;
+            range.Location(r.first);
+            range.Length(r.second);
+            REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), range) == r.second);
+            REQUIRE(expected.compare(r.first, r.second, buf, r.second) == 0);
+        }
+
+        // a range running off the end is truncated
+        ByteRange tail;
+        tail.Location(size - 5);
+        tail.Length(100);
+        REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), tail) == 5);
+        REQUIRE(expected.compare(size - 5, 5, buf, 5) == 0);
+
+        // as is the whole resource
+        ByteRange whole;
+        REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), whole) == expected.size());
+        REQUIRE(expected.compare(0, expected.size(), buf, expected.size()) == 0);
+    }
+}
+
+TEST_CASE("Filters registered at the same priority are all kept", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+
+    // decryption filters share a priority
+    FilterManagerImpl manager;
+    auto decryptor = std::make_shared<AESCBCDecryptor>(TestKeyProvider);
+    manager.RegisterFilter("Another", ContentFilter::EPUBDecryption, [](ConstPackagePtr) { return nullptr; });
+    manager.RegisterFilter("AESCBCDecryptor", ContentFilter::EPUBDecryption, [decryptor](ConstPackagePtr) { return decryptor; });
+    REQUIRE(manager.GetFilterByName("AESCBCDecryptor", pkg) == decryptor);
+
+    FilterChainPtr chain = manager.BuildFilterChainForPackage(pkg);
+    REQUIRE(chain->GetFilterChainSize(pkg->ManifestItemWithID(CHAPTER_ID)) == 1);
+}
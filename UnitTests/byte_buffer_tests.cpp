@@ -0,0 +1,74 @@
+//
+//  byte_buffer_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/utilities/byte_buffer.h"
+#include "catch.hpp"
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace ePub3;
+
+TEST_CASE("Byte buffers consume from the front without moving their content", "")
+{
+    const size_t kTotal = 64*1024, kChunk = 16*1024;
+    std::vector<unsigned char> pattern(kTotal);
+    for ( size_t i = 0; i < kTotal; i++ )
+        pattern[i] = static_cast<unsigned char>(i % 251);
+    
+    ByteBuffer buf(pattern.data(), kTotal);
+    buf.SetUsesSecureErasure();
+    const unsigned char* start = buf.GetBytes();
+    
+    // consuming advances the start of the content, leaving it in place
+    buf.RemoveBytes(kChunk);
+    REQUIRE(buf.GetBufferSize() == kTotal - kChunk);
+    REQUIRE(buf.GetBytes() == start + kChunk);
+    REQUIRE(::memcmp(buf.GetBytes(), pattern.data() + kChunk, buf.GetBufferSize()) == 0);
+    
+    unsigned char out[kChunk];
+    REQUIRE(buf.MoveTo(out, kChunk) == kChunk);
+    REQUIRE(::memcmp(out, pattern.data() + kChunk, kChunk) == 0);
+    REQUIRE(buf.GetBytes() == start + 2*kChunk);
+    
+    // removing from the middle still works as before
+    buf.RemoveBytes(kChunk, kChunk);
+    REQUIRE(buf.GetBufferSize() == kChunk);
+    REQUIRE(::memcmp(buf.GetBytes(), pattern.data() + 2*kChunk, kChunk) == 0);
+    
+    // appending reuses the consumed space
+    buf.AddBytes(pattern.data(), kTotal - kChunk);
+    REQUIRE(buf.GetBufferSize() == kTotal);
+    REQUIRE(::memcmp(buf.GetBytes(), pattern.data() + 2*kChunk, kChunk) == 0);
+    REQUIRE(::memcmp(buf.GetBytes() + kChunk, pattern.data(), kTotal - kChunk) == 0);
+    
+    // emptying the buffer returns it to the start of its storage
+    buf.RemoveBytes(kTotal);
+    REQUIRE(buf.IsEmpty());
+    buf.AddBytes(pattern.data(), 1);
+    REQUIRE(buf.GetBytes()[0] == pattern[0]);
+}
+
+TEST_CASE("Benchmark: consuming a 100MB buffer in 16KB reads", "[.][benchmark]")
+{
+    const size_t kTotal = 100*1024*1024, kChunk = 16*1024;
+    ByteBuffer buf(kTotal);
+    buf.SetUsesSecureErasure();
+    
+    std::vector<unsigned char> out(kChunk);
+    auto begin = std::chrono::steady_clock::now();
+    while ( !buf.IsEmpty() )
+        buf.MoveTo(out.data(), kChunk);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    WARN("Consumed " << kTotal << " bytes in " << elapsed.count() << "ms");
+}
@@ -15,22 +15,31 @@
 
 #include "../ePub3/ePub/container.h"
 #include "../ePub3/ePub/font_obfuscation.h"
+#include "../ePub3/ePub/aes_cbc_decryptor.h"
+#include "../ePub3/ePub/resource_inflater.h"
 #include "../ePub3/ePub/package.h"
 #include "../ePub3/ePub/filter_manager.h"
 #include "../ePub3/ePub/filter_chain.h"
 #include "../ePub3/ePub/filter_chain_byte_stream.h"
 #include "../ePub3/ePub/filter_chain_byte_stream_range.h"
+#include "../ePub3/ePub/filter_chain_pipeline.h"
+#include "../ePub3/ePub/zip_archive.h"
 #include "../ePub3/utilities/byte_stream.h"
 #include "../ePub3/utilities/byte_buffer.h"
 #include <atomic>
+#include <vector>
 #include "catch.hpp"
 
 #define EPUB_PATH "TestData/cole-voyage-of-life-20120320.epub"
+#define XHTML_SUBPATH "EPUB/xhtml/0-intro.xhtml"
 
 #define FONT_EPUB_PATH "TestData/wasteland-otf-obf-20120118.epub"
 #define FONT_SUBPATH "EPUB/OldStandard-Regular.obf.otf"
 #define FONT_MANIFEST_ID "font.OldStandard.regular"
 
+#define COMPRESSED_EPUB_PATH "TestData/compressed-encrypted.epub"
+#define COMPRESSED_MANIFEST_ID "video"
+
 static const char* kROT13Content = R"raw(<?kzy irefvba="1.0" rapbqvat="HGS-8"?>
 <ugzy kzyaf="uggc://jjj.j3.bet/1999/kugzy">
     <urnq>
@@ -135,6 +144,504 @@ static void RegisterTestFilter()
 }
 
 
+/// A length-preserving filter working in 16-byte blocks, which XORs each byte with its block number.
+class BlockXORFilter : public ePub3::ContentFilter, public PointerType<BlockXORFilter>
+{
+    class BlockContext : public FilterContext
+    {
+    public:
+        BlockContext() : FilterContext(), position(0) {}
+        ByteStream::size_type position;
+    };
+    
+public:
+    static const ByteStream::size_type BlockSize = 16;
+    
+    BlockXORFilter() : ContentFilter([](ConstManifestItemPtr){ return true; }) {}
+    virtual ~BlockXORFilter() {}
+    
+    virtual bool PreservesLength() const OVERRIDE { return true; }
+    
+    virtual bool PrepareForRange(FilterContext* context, ByteStream::size_type location, ByteStream::size_type length,
+                                 ByteStream::size_type* inputLocation, ByteStream::size_type* inputLength,
+                                 ByteStream::size_type* outputSkip) const OVERRIDE
+    {
+        // whole blocks only
+        ByteStream::size_type start = location - (location % BlockSize);
+        ByteStream::size_type end = location + length;
+        end += (BlockSize - (end % BlockSize)) % BlockSize;
+        
+        dynamic_cast<BlockContext*>(context)->position = start;
+        *inputLocation = start;
+        *inputLength = end - start;
+        *outputSkip = location - start;
+        return true;
+    }
+    
+    virtual void* FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE
+    {
+        BlockContext* ctx = dynamic_cast<BlockContext*>(context);
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(data);
+        for ( size_t i = 0; i < len; i++, ctx->position++ )
+            bytes[i] ^= static_cast<uint8_t>(ctx->position / BlockSize);
+        *outputLen = len;
+        return data;
+    }
+    
+protected:
+    virtual FilterContext* InnerMakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new BlockContext; }
+};
+
+TEST_CASE("Filtered content can be viewed in place", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    
+    // filter a copy of the raw bytes by hand
+    std::string expected;
+    auto rawStream = archive.ByteStreamAtPath(XHTML_SUBPATH);
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = rawStream->ReadBytes(buf, sizeof(buf))) > 0 )
+        expected.append(buf, numRead);
+    ROT13Filter().FilterData(nullptr, &expected[0], expected.size(), nullptr);
+    
+    std::unique_ptr<ByteStream> raw = archive.ByteStreamAtPath(XHTML_SUBPATH);
+    std::unique_ptr<SeekableByteStream> input(dynamic_cast<SeekableByteStream*>(raw.release()));
+    REQUIRE(bool(input));
+    
+    std::vector<ContentFilterPtr> filters{ ROT13Filter::New() };
+    FilterChainByteStream stream(std::move(input), filters, nullptr);
+    
+    size_t size = expected.size();
+    ByteView view = stream.ReadView(0, size + 100);
+    REQUIRE(view.size() == size);
+    REQUIRE(std::string(reinterpret_cast<const char*>(view.data()), view.size()) == expected);
+    
+    // reading doesn't move or consume the viewed bytes
+    REQUIRE(stream.ReadBytes(buf, 100) == 100);
+    REQUIRE(expected.compare(0, 100, buf, 100) == 0);
+    REQUIRE(stream.BytesAvailable() == size - 100);
+    REQUIRE(std::string(reinterpret_cast<const char*>(view.data()), view.size()) == expected);
+    
+    ByteView tail = stream.ReadView(size - 10, 100);
+    REQUIRE(tail.size() == 10);
+    REQUIRE(tail.data() == view.data() + size - 10);
+    REQUIRE(stream.ReadView(size, 1).empty());
+}
+
+TEST_CASE("Length-preserving filters are applied as the content is read", "")
+{
+    ContainerPtr c = Container::OpenContainer(FONT_EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    REQUIRE(bool(item));
+    
+    auto obfuscator = std::make_shared<FontObfuscator>(c, pkg);
+    REQUIRE(obfuscator->PreservesLength());
+    
+    // de-obfuscate a complete copy of the raw bytes in one go
+    std::string expected;
+    auto rawStream = item->Reader();
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = rawStream->ReadBytes(buf, sizeof(buf))) > 0 )
+        expected.append(buf, numRead);
+    std::unique_ptr<FilterContext> ctx(obfuscator->MakeFilterContext(item));
+    size_t outLen = 0;
+    obfuscator->FilterData(ctx.get(), &expected[0], expected.size(), &outLen);
+    REQUIRE(outLen == expected.size());
+    REQUIRE(expected.compare(0, 4, "OTTO") == 0);
+    
+    std::unique_ptr<SeekableByteStream> input(dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    REQUIRE(bool(input));
+    std::vector<ContentFilterPtr> filters{ obfuscator };
+    FilterChainByteStream stream(std::move(input), filters, item);
+    
+    // the final size is known before anything is read
+    REQUIRE(stream.BytesAvailable() == expected.size());
+    
+    // read in chunks which straddle the end of the obfuscated range
+    std::string output;
+    while ( (numRead = stream.ReadBytes(buf, 1000)) > 0 )
+    {
+        output.append(buf, numRead);
+        REQUIRE(stream.BytesAvailable() == expected.size() - output.size());
+    }
+    
+    REQUIRE(output.size() == expected.size());
+    REQUIRE(output == expected);
+    
+    // nothing was cached
+    REQUIRE(stream.ReadView(0, 1).empty());
+}
+
+class StalledRangeFilter : public ePub3::ContentFilter, public PointerType<StalledRangeFilter>
+{
+public:
+    StalledRangeFilter() : ContentFilter([](ConstManifestItemPtr){ return true; }) {}
+    virtual ~StalledRangeFilter() {}
+    
+    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::SupportsByteRanges; }
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    
+    // always claims to need room, but never more than it was given
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE
+    {
+        spans.outputNeeded = spans.outputCapacity;
+        return SpanStatus::NeedsOutputSpace;
+    }
+    virtual void* FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE
+    {
+        *outputLen = 0;
+        return nullptr;
+    }
+    
+protected:
+    virtual FilterContext* InnerMakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new RangeFilterContext; }
+};
+
+TEST_CASE("Byte ranges can be served through a stack of filters", "")
+{
+    ContainerPtr c = Container::OpenContainer(FONT_EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    REQUIRE(bool(item));
+    
+    auto obfuscator = std::make_shared<FontObfuscator>(c, pkg);
+    auto blocks = BlockXORFilter::New();
+    
+    // filter a complete copy of the raw bytes by hand
+    std::string expected;
+    auto rawStream = item->Reader();
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = rawStream->ReadBytes(buf, sizeof(buf))) > 0 )
+        expected.append(buf, numRead);
+    std::unique_ptr<FilterContext> obfuscatorCtx(obfuscator->MakeFilterContext(item));
+    std::unique_ptr<FilterContext> blocksCtx(blocks->MakeFilterContext(item));
+    size_t outLen = 0;
+    obfuscator->FilterData(obfuscatorCtx.get(), &expected[0], expected.size(), &outLen);
+    blocks->FilterData(blocksCtx.get(), &expected[0], expected.size(), &outLen);
+    
+    FilterChain chain(FilterChain::FilterList{ obfuscator, blocks });
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStreamRange(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    FilterChainByteStreamRange* rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+    REQUIRE(rangeStream != nullptr);
+    REQUIRE(rangeStream->BytesAvailable() == expected.size());
+    
+    // ranges which start and end mid-block, and straddle the end of the obfuscated bytes
+    const std::pair<uint32_t, uint32_t> ranges[] = { {0, 4}, {3, 29}, {1000, 100}, {1039, 2}, {4097, 1000}, {uint32_t(expected.size()) - 7, 7} };
+    for ( auto& r : ranges )
+    {
+        CAPTURE(r.first);
+        CAPTURE(r.second);
+        ByteRange range;
+        range.Location(r.first);
+        range.Length(r.second);
+        REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), range) == r.second);
+        REQUIRE(expected.compare(r.first, r.second, buf, r.second) == 0);
+    }
+    
+    // a range running off the end is truncated
+    ByteRange tail;
+    tail.Location(uint32_t(expected.size()) - 5);
+    tail.Length(100);
+    REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), tail) == 5);
+    
+    // filters which need to see more than the requested range can't be stacked
+    auto rot13 = ROT13Filter::New();
+    rot13->SetTypeSniffer([](ConstManifestItemPtr){ return true; });
+    FilterChain wholeChain(FilterChain::FilterList{ obfuscator, rot13 });
+    std::unique_ptr<SeekableByteStream> raw(dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    REQUIRE(wholeChain.GetFilterChainByteStreamRange(item, raw.get()) == nullptr);
+    REQUIRE(raw->IsOpen());
+}
+
+TEST_CASE("A range read fails when a filter makes no progress", "")
+{
+    ContainerPtr c = Container::OpenContainer(FONT_EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    REQUIRE(bool(item));
+    
+    FilterChain chain(FilterChain::FilterList{ StalledRangeFilter::New() });
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStreamRange(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    FilterChainByteStreamRange* rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+    REQUIRE(rangeStream != nullptr);
+    
+    char buf[64];
+    ByteRange range;
+    range.Location(0);
+    range.Length(sizeof(buf));
+    REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), range) == 0);
+}
+
+TEST_CASE("Fonts are de-obfuscated from any byte range", "")
+{
+    ContainerPtr c = Container::OpenContainer(FONT_EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    REQUIRE(bool(item));
+    
+    auto obfuscator = std::make_shared<FontObfuscator>(c, pkg);
+    REQUIRE(obfuscator->GetOperatingMode() == ContentFilter::OperatingMode::SupportsByteRanges);
+    
+    std::string expected;
+    auto rawStream = item->Reader();
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = rawStream->ReadBytes(buf, sizeof(buf))) > 0 )
+        expected.append(buf, numRead);
+    std::unique_ptr<FilterContext> ctx(obfuscator->MakeFilterContext(item));
+    size_t outLen = 0;
+    obfuscator->FilterData(ctx.get(), &expected[0], expected.size(), &outLen);
+    REQUIRE(expected.compare(0, 4, "OTTO") == 0);
+    
+    // the obfuscator reads each range itself, without touching the bytes before it
+    FilterChain chain(FilterChain::FilterList{ obfuscator });
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStreamRange(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    FilterChainByteStreamRange* rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+    REQUIRE(rangeStream != nullptr);
+    
+    const std::pair<uint32_t, uint32_t> ranges[] = { {0, 1040}, {5, 3}, {1030, 20}, {1040, 9}, {17, 4000}, {uint32_t(expected.size()) - 3, 3} };
+    for ( auto& r : ranges )
+    {
+        CAPTURE(r.first);
+        CAPTURE(r.second);
+        ByteRange range;
+        range.Location(r.first);
+        range.Length(r.second);
+        REQUIRE(rangeStream->ReadBytes(buf, sizeof(buf), range) == r.second);
+        REQUIRE(expected.compare(r.first, r.second, buf, r.second) == 0);
+    }
+    
+    // content read from the start still streams through the same filter
+    std::unique_ptr<ByteStream> whole = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    std::string output;
+    while ( (numRead = whole->ReadBytes(buf, 777)) > 0 )
+        output.append(buf, numRead);
+    REQUIRE(output == expected);
+}
+
+TEST_CASE("Adobe font keys come from urn:uuid identifiers", "")
+{
+    uint8_t key[16];
+    REQUIRE(FontObfuscator::AdobeKeyFromIdentifier("urn:uuid:01234567-89ab-CDEF-0123-456789abcdef", key));
+    const uint8_t expected[] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+    REQUIRE(memcmp(key, expected, sizeof(expected)) == 0);
+    
+    REQUIRE(FontObfuscator::AdobeKeyFromIdentifier("URN:UUID:0123456789abcdef0123456789abcdef", key));
+    REQUIRE(memcmp(key, expected, sizeof(expected)) == 0);
+    
+    REQUIRE_FALSE(FontObfuscator::AdobeKeyFromIdentifier("0123456789abcdef0123456789abcdef", key));
+    REQUIRE_FALSE(FontObfuscator::AdobeKeyFromIdentifier("urn:uuid:0123456789abcdef0123456789abcde", key));
+    REQUIRE_FALSE(FontObfuscator::AdobeKeyFromIdentifier("urn:uuid:0123456789abcdef0123456789abcdef00", key));
+    REQUIRE_FALSE(FontObfuscator::AdobeKeyFromIdentifier("urn:uuid:0123456789abcdef0123456789abcdeg", key));
+}
+
+TEST_CASE("Filtered content is cached per manifest item within a budget", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->ManifestItemAtRelativePath("xhtml/0-intro.xhtml");
+    REQUIRE(bool(item));
+    
+    auto rot13 = ROT13Filter::New();
+    rot13->SetTypeSniffer([](ConstManifestItemPtr){ return true; });
+    FilterChain chain(FilterChain::FilterList{ rot13 });
+    FilteredContentCache& cache = chain.FilteredContent();
+    
+    // disabled by default
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    size_t size = stream->BytesAvailable();
+    REQUIRE(size > 0);
+    REQUIRE(cache.Misses() == 0);
+    REQUIRE(cache.Size() == 0);
+    
+    std::string expected(size, '\0');
+    REQUIRE(stream->ReadBytes(&expected[0], size) == size);
+    
+    cache.SetBudget(size * 2);
+    std::unique_ptr<ByteStream> first = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    REQUIRE(cache.Misses() == 1);
+    REQUIRE(cache.Size() == size);
+    
+    // the second stream shares the first one's filtered bytes
+    std::unique_ptr<ByteStream> second = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    REQUIRE(cache.Hits() == 1);
+    REQUIRE(second->BytesAvailable() == size);
+    REQUIRE(second->ReadView(0, size).data() == first->ReadView(0, size).data());
+    
+    std::string output(size, '\0');
+    REQUIRE(second->ReadBytes(&output[0], size) == size);
+    REQUIRE(output == expected);
+    REQUIRE(second->AtEnd());
+    
+    // evicted content stays readable by the streams which hold it
+    cache.Purge();
+    REQUIRE(cache.Size() == 0);
+    std::fill(output.begin(), output.end(), '\0');
+    REQUIRE(first->ReadBytes(&output[0], size) == size);
+    REQUIRE(output == expected);
+    
+    // content larger than the budget isn't kept
+    cache.SetBudget(size - 1);
+    chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+    REQUIRE(cache.Misses() == 2);
+    REQUIRE(cache.Size() == 0);
+    
+    // a package applies its budget to its chain
+    pkg->SetFilteredContentCacheBudget(1024*1024);
+    REQUIRE(pkg->GetFilterChain()->FilteredContent().Budget() == 1024*1024);
+}
+
+TEST_CASE("Filter applicability is determined once per manifest item", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr xhtml = pkg->ManifestItemAtRelativePath("xhtml/0-intro.xhtml");
+    REQUIRE(bool(xhtml));
+    
+    size_t numSniffs = 0;
+    auto rot13 = ROT13Filter::New();
+    ContentFilter::TypeSnifferFn sniffer = rot13->TypeSniffer();
+    rot13->SetTypeSniffer([&](ConstManifestItemPtr item) { numSniffs++; return sniffer(item); });
+    auto blocks = BlockXORFilter::New();
+    FilterChain chain(FilterChain::FilterList{ rot13, blocks });
+    
+    // without precomputation, every request sniffs
+    REQUIRE(chain.GetFilterChainSize(xhtml) == 2);
+    REQUIRE(numSniffs == 1);
+    
+    chain.PrecomputeApplicability(pkg->Manifest());
+    REQUIRE(numSniffs == 1 + pkg->Manifest().size());
+    numSniffs = 0;
+    
+    for ( auto& pair : pkg->Manifest() )
+    {
+        bool isXHTML = (pair.second->MediaType() == "application/xhtml+xml");
+        REQUIRE(chain.GetFilterChainSize(pair.second) == (isXHTML ? 2 : 1));
+    }
+    REQUIRE(numSniffs == 0);
+    
+    // the precomputed filters are applied in chain order
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(xhtml, dynamic_cast<SeekableByteStream*>(xhtml->Reader().release()));
+    REQUIRE(numSniffs == 0);
+    std::string expected;
+    auto rawStream = xhtml->Reader();
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = rawStream->ReadBytes(buf, sizeof(buf))) > 0 )
+        expected.append(buf, numRead);
+    ROT13Filter().FilterData(nullptr, &expected[0], expected.size(), nullptr);
+    std::unique_ptr<FilterContext> ctx(blocks->MakeFilterContext(xhtml));
+    size_t outLen = 0;
+    blocks->FilterData(ctx.get(), &expected[0], expected.size(), &outLen);
+    
+    std::string output(expected.size(), '\0');
+    REQUIRE(stream->ReadBytes(&output[0], output.size()) == output.size());
+    REQUIRE(output == expected);
+    
+    // items from elsewhere are still sniffed
+    ContainerPtr other = Container::OpenContainer(FONT_EPUB_PATH);
+    ManifestItemPtr font = other->DefaultPackage()->ManifestItemWithID(FONT_MANIFEST_ID);
+    REQUIRE(chain.GetFilterChainSize(font) == 1);
+    REQUIRE(numSniffs == 1);
+}
+
+TEST_CASE("Pipelined filter chains produce the same content as streams", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    // ROT13 collects its input; the blocks are XORed a chunk at a time
+    FilterChain chain(FilterChain::FilterList{ ROT13Filter::New(), BlockXORFilter::New() });
+    
+    std::vector<std::string> expected;
+    std::vector<std::unique_ptr<ByteStream>> pipelines;
+    char buf[4096];
+    ByteStream::size_type numRead = 0;
+    for ( auto& pair : pkg->Manifest() )
+    {
+        ManifestItemPtr item = pair.second;
+        std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+        expected.emplace_back();
+        while ( (numRead = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+            expected.back().append(buf, numRead);
+        
+        pipelines.push_back(chain.GetFilterChainPipeline(item, dynamic_cast<SeekableByteStream*>(item->Reader().release())));
+        REQUIRE(dynamic_cast<FilterChainPipeline*>(pipelines.back().get()) != nullptr);
+    }
+    
+    // every item is filtered at once, while read in small pieces
+    std::vector<std::string> output(pipelines.size());
+    bool reading = true;
+    while ( reading )
+    {
+        reading = false;
+        for ( size_t i = 0; i < pipelines.size(); i++ )
+        {
+            if ( (numRead = pipelines[i]->ReadBytes(buf, 1000)) > 0 )
+            {
+                output[i].append(buf, numRead);
+                reading = true;
+            }
+        }
+    }
+    
+    for ( size_t i = 0; i < pipelines.size(); i++ )
+    {
+        CAPTURE(i);
+        REQUIRE(pipelines[i]->AtEnd());
+        REQUIRE(pipelines[i]->Error() == 0);
+        REQUIRE(output[i] == expected[i]);
+    }
+    
+    // fonts are de-obfuscated a chunk at a time
+    ContainerPtr fontContainer = Container::OpenContainer(FONT_EPUB_PATH);
+    PackagePtr fontPkg = fontContainer->DefaultPackage();
+    ManifestItemPtr font = fontPkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    FilterChain fontChain(FilterChain::FilterList{ std::make_shared<FontObfuscator>(fontContainer, fontPkg) });
+    
+    std::string fontExpected, fontOutput;
+    std::unique_ptr<ByteStream> stream = fontChain.GetFilterChainByteStream(font, dynamic_cast<SeekableByteStream*>(font->Reader().release()));
+    while ( (numRead = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        fontExpected.append(buf, numRead);
+    REQUIRE(fontExpected.size() > FilterChainPipeline::ChunkSize * FilterChainPipeline::MaxQueuedChunks);
+    
+    stream = fontChain.GetFilterChainPipeline(font, dynamic_cast<SeekableByteStream*>(font->Reader().release()));
+    while ( (numRead = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        fontOutput.append(buf, numRead);
+    REQUIRE(fontOutput == fontExpected);
+    REQUIRE(fontOutput.compare(0, 4, "OTTO") == 0);
+    
+    // decryption and inflation both collect their input
+    ContainerPtr compressedContainer = Container::OpenContainer(COMPRESSED_EPUB_PATH);
+    ManifestItemPtr video = compressedContainer->DefaultPackage()->ManifestItemWithID(COMPRESSED_MANIFEST_ID);
+    auto keyProvider = [](ConstManifestItemPtr item, EncryptionInfoPtr encInfo, uint8_t* key, size_t keyLength) {
+        for ( size_t i = 0; i < keyLength; i++ )
+            key[i] = uint8_t(i);
+        return true;
+    };
+    FilterChain compressedChain(FilterChain::FilterList{ std::make_shared<AESCBCDecryptor>(keyProvider), std::make_shared<ResourceInflater>() });
+    
+    std::string videoExpected, videoOutput;
+    stream = compressedChain.GetFilterChainByteStream(video, dynamic_cast<SeekableByteStream*>(video->Reader().release()));
+    while ( (numRead = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        videoExpected.append(buf, numRead);
+    REQUIRE(videoExpected.size() == 2500000);
+    
+    stream = compressedChain.GetFilterChainPipeline(video, dynamic_cast<SeekableByteStream*>(video->Reader().release()));
+    while ( (numRead = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        videoOutput.append(buf, numRead);
+    REQUIRE(videoOutput == videoExpected);
+    
+    // abandoning a pipeline part-way through is harmless
+    stream = fontChain.GetFilterChainPipeline(font, dynamic_cast<SeekableByteStream*>(font->Reader().release()));
+    REQUIRE(stream->ReadBytes(buf, 10) == 10);
+    stream.reset();
+}
+
 #ifdef SUPPORT_ASYNC
 /*
 TEST_CASE("Filters apply automatically", "")
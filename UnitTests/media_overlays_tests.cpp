@@ -0,0 +1,97 @@
+//
+//  media_overlays_tests.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/ePub/media-overlays_smil_model.h"
+#include "../ePub3/utilities/error_handler.h"
+#include "catch.hpp"
+#include <string>
+#include <vector>
+
+// Twelve chapters, chapter N narrated by a SMIL of N one-second clips.
+// c03.smil has version 2.0, c05.smil's metadata duration is wrong, and c07.smil has no version.
+#define EPUB_PATH "TestData/media-overlays.epub"
+#define SMIL_COUNT 12
+
+using namespace ePub3;
+
+// The SMIL files named by the Media Overlays errors raised while loading a package's overlays.
+static std::vector<std::string> SMILErrorsFromLoading(PackagePtr pkg)
+{
+    std::vector<std::string> smilErrors;
+    SetErrorHandler([&smilErrors](const error_details& err) {
+        if ( err.is_spec_error() && err.epub_spec() == EPUBSpec::MediaOverlays )
+        {
+            std::string msg(err.message());
+            auto pos = msg.find("smil/c");
+            if ( pos != std::string::npos )
+                smilErrors.push_back(msg.substr(pos, 13));
+        }
+        return true;
+    });
+
+    pkg->MediaOverlaysSmilModel();
+    SetErrorHandler(DefaultErrorHandler);
+    return smilErrors;
+}
+
+TEST_CASE("SMIL documents are parsed concurrently and merged in spine order", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+
+    std::vector<std::string> expectedErrors = { "smil/c03.smil", "smil/c05.smil", "smil/c07.smil" };
+    REQUIRE(SMILErrorsFromLoading(pkg) == expectedErrors);
+
+    auto model = pkg->MediaOverlaysSmilModel();
+    REQUIRE(model->GetSmilCount() == SMIL_COUNT);
+    REQUIRE(model->DurationMilliseconds_Calculated() == 78000);
+    for ( size_t i = 0; i < SMIL_COUNT; i++ )
+    {
+        CAPTURE(i);
+        auto smil = model->GetSmil(i);
+        REQUIRE(smil->XhtmlSpineItem() == pkg->SpineItemAt(i));
+        REQUIRE(smil->SmilManifestItem() == pkg->SpineItemAt(i)->ManifestItem()->MediaOverlay());
+        REQUIRE(smil->DurationMilliseconds_Calculated() == (i + 1) * 1000);
+    }
+
+    // the errors are reported the same way every time
+    for ( int i = 0; i < 10; i++ )
+    {
+        c = Container::OpenContainer(EPUB_PATH);
+        REQUIRE(SMILErrorsFromLoading(c->DefaultPackage()) == expectedErrors);
+    }
+}
+
+TEST_CASE("An error thrown for one SMIL document stops parsing at that document", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+
+    std::vector<EPUBError> raised;
+    SetErrorHandler([&raised](const error_details& err) {
+        if ( err.is_spec_error() && err.epub_spec() == EPUBSpec::MediaOverlays )
+            raised.push_back(err.epub_error_code());
+        return err.is_spec_error() && err.epub_error_code() != EPUBError::MediaOverlayInvalidVersion;
+    });
+
+    REQUIRE_THROWS_AS(pkg->MediaOverlaysSmilModel(), epub_spec_error);
+    SetErrorHandler(DefaultErrorHandler);
+
+    // nothing after c03.smil was reported
+    REQUIRE(raised.size() == 2);
+    REQUIRE(raised[1] == EPUBError::MediaOverlayInvalidVersion);
+}
@@ -16,6 +16,7 @@
 #include "../ePub3/ePub/object_preprocessor.h"
 #include "../ePub3/ePub/container.h"
 #include "../ePub3/ePub/package.h"
+#include <vector>
 #include "catch.hpp"
 
 #define EPUB_PATH "TestData/widget-figure-gallery-20121022.epub"
@@ -207,6 +208,39 @@ TEST_CASE("Object tags for bound media should be replaced by iframes and buttons
     REQUIRE(strncmp(gGalleryIFrame, output, outLen) == 0);
 }
 
+TEST_CASE("Object tags can be replaced into caller-provided spans", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    ObjectPreprocessor proc(pkg);
+    REQUIRE(proc.SupportsSpans());
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    
+    // drain the output through a small span
+    std::string result;
+    char output[100];
+    ContentFilter::FilterSpans spans(gGalleryObject, sizeof(gGalleryObject), output, sizeof(output));
+    ContentFilter::SpanStatus status = proc.FilterSpan(ctx.get(), spans);
+    REQUIRE(spans.inputConsumed == sizeof(gGalleryObject));
+    result.append(output, spans.outputProduced);
+    while ( status == ContentFilter::SpanStatus::NeedsOutputSpace )
+    {
+        spans = ContentFilter::FilterSpans(nullptr, 0, output, sizeof(output));
+        status = proc.FilterSpan(ctx.get(), spans);
+        REQUIRE(spans.outputProduced > 0);
+        result.append(output, spans.outputProduced);
+    }
+    REQUIRE(result == std::string(gGalleryIFrame, sizeof(gGalleryIFrame)));
+    
+    // documents without matching objects are copied through
+    std::vector<char> plain(sizeof(gGalleryIFrame));
+    spans = ContentFilter::FilterSpans(gGalleryIFrame, sizeof(gGalleryIFrame), plain.data(), plain.size());
+    REQUIRE(proc.FilterSpan(ctx.get(), spans) == ContentFilter::SpanStatus::Complete);
+    REQUIRE(spans.outputProduced == sizeof(gGalleryIFrame));
+    REQUIRE(memcmp(plain.data(), gGalleryIFrame, plain.size()) == 0);
+}
+
 TEST_CASE("The title of the 'Open Fullscreen' button may be replaced", "")
 {
     ContainerPtr c = Container::OpenContainer(EPUB_PATH);
@@ -223,3 +257,66 @@ TEST_CASE("The title of the 'Open Fullscreen' button may be replaced", "")
     REQUIRE(outLen == sizeof(gGalleryIFrameFrench));
     REQUIRE(strncmp(gGalleryIFrameFrench, output, outLen) == 0);
 }
+
+TEST_CASE("Empty object tags for bound media should be replaced", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    ObjectPreprocessor proc(pkg);
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    
+    size_t outLen = 0;
+    char* input = strdup(gShortGalleryObject);
+    char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), input, sizeof(gShortGalleryObject), &outLen));
+    
+    std::string result(output, outLen);
+    INFO("IFrame output:\n" << result);
+    REQUIRE(result.find("<object") == std::string::npos);
+    REQUIRE(result.find("<iframe src=\"epub3://code.google.com.epub-samples.widget-figure-gallery/EPUB/figure-gallery-widget/figure-gallery-impl.xhtml?src=moon-phases.xml&type=application%2Fx-epub-figure-gallery\"") != std::string::npos);
+    REQUIRE(result.find("id=\"moon-figures-button\">Open Fullscreen</button></form>\n        </section>") != std::string::npos);
+    
+    if ( output != input )
+        delete [] output;
+    free(input);
+}
+
+TEST_CASE("Object parameters and nested fallbacks are handled, and comments are left alone", "")
+{
+    static const char kInput[] = R"raw(<body>
+<!-- <object data="old.xml" type="application/x-epub-figure-gallery"></object> -->
+<object type='application/x-epub-figure-gallery' data='moon-phases.xml'>
+  <param name="speed" value="slow"/>
+  <object data="moon.png" type="image/png"><param name="ignored" value="yes"/></object>
+</object>
+<p>after</p>
+</body>)raw";
+    
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    ObjectPreprocessor proc(pkg);
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    
+    size_t outLen = 0;
+    char* input = strdup(kInput);
+    char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), input, sizeof(kInput)-1, &outLen));
+    
+    std::string result(output, outLen);
+    INFO("IFrame output:\n" << result);
+    
+    // the commented-out object remains
+    REQUIRE(result.find("<!-- <object data=\"old.xml\" type=\"application/x-epub-figure-gallery\"></object> -->\n<iframe ") != std::string::npos);
+    
+    // the whole outer object, including its fallback, was replaced
+    REQUIRE(result.find("moon.png") == std::string::npos);
+    REQUIRE(result.find("</form>\n<p>after</p>\n</body>") != std::string::npos);
+    
+    // only the outer object's parameters are passed on
+    REQUIRE(result.find("speed=slow") != std::string::npos);
+    REQUIRE(result.find("ignored") == std::string::npos);
+    
+    if ( output != input )
+        delete [] output;
+    free(input);
+}
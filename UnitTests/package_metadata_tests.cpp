@@ -0,0 +1,71 @@
+//
+//  package_metadata_tests.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/ePub/package_metadata.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+TEST_CASE("Metadata-only opens agree with the full package", "")
+{
+    for ( auto path : { "TestData/childrens-literature-20120722.epub", "TestData/dante-hell.epub", "TestData/page-blanche.epub", "TestData/widget-figure-gallery-20121022.epub" } )
+    {
+        CAPTURE(path);
+        PackageMetadataPtr metadata = PackageMetadata::Open(path);
+        REQUIRE(bool(metadata));
+        
+        ContainerPtr c = Container::OpenContainer(path);
+        PackagePtr pkg = c->DefaultPackage();
+        REQUIRE(metadata->Version() == pkg->Version());
+        REQUIRE(metadata->PackageID() == pkg->PackageID());
+        REQUIRE(metadata->Title() == pkg->Title(false));
+        REQUIRE(metadata->AuthorNames() == pkg->AuthorNames(false));
+        REQUIRE(metadata->Language() == pkg->Language());
+        REQUIRE(metadata->ModificationDate() == pkg->ModificationDate());
+        REQUIRE(bool(pkg->CoverManifestItem()));
+        REQUIRE(metadata->CoverPath() == pkg->CoverManifestItem()->AbsolutePath());
+    }
+}
+
+TEST_CASE("Metadata-only opens read rendition properties and the main title", "")
+{
+    PackageMetadataPtr metadata = PackageMetadata::Open("TestData/page-blanche.epub");
+    REQUIRE(metadata->PackagePath() == "EPUB/package.opf");
+    REQUIRE(metadata->RenditionProperties().size() == 3);
+    REQUIRE(metadata->RenditionProperties().at("layout") == "pre-paginated");
+    REQUIRE(metadata->RenditionProperties().at("spread") == "auto");
+    
+    // the subtitle's refinements don't make it the title
+    metadata = PackageMetadata::Open("TestData/childrens-literature-20120722.epub");
+    REQUIRE(metadata->Title() == "Children's Literature");
+    REQUIRE(metadata->Identifiers().size() == 1);
+    REQUIRE(metadata->CoverPath() == "EPUB/images/cover.png");
+    REQUIRE(metadata->RenditionProperties().empty());
+}
+
+TEST_CASE("Metadata-only opens upgrade to the full package on demand", "")
+{
+    PackageMetadataPtr metadata = PackageMetadata::Open("TestData/childrens-literature-20120722.epub");
+    PackagePtr pkg = metadata->FullPackage();
+    REQUIRE(bool(pkg));
+    REQUIRE(pkg->Title() == metadata->Title());
+    REQUIRE(bool(pkg->SpineItemAt(0)));
+    REQUIRE(metadata->FullPackage() == pkg);
+    
+    REQUIRE_THROWS(PackageMetadata::Open("TestData/no-such-file.epub"));
+}
@@ -16,10 +16,16 @@
 #include "../ePub3/ePub/container.h"
 #include "../ePub3/ePub/package.h"
 #include "../ePub3/ePub/content_handler.h"
+#include "../ePub3/ePub/xpath_wrangler.h"
+#include "../ePub3/ePub/content_module.h"
+#include "../ePub3/ePub/content_module_manager.h"
+#include "../ePub3/ePub/filter_manager.h"
 #include "../ePub3/utilities/error_handler.h"
 #include "catch.hpp"
 #include <cstdlib>
 #include "../ePub3/xml/tree/document.h"
+#include <atomic>
+#include <thread>
 
 #define EPUB_PATH "TestData/childrens-literature-20120722.epub"
 #define BINDINGS_EPUB_PATH "TestData/widget-figure-gallery-20121022.epub"
@@ -202,6 +208,30 @@ static const char* kInvalidUniqueIDRef = R"X(<?xml version="1.0" encoding="UTF-8
 </package>
 )X";
 
+static const char* kForeignElements = R"X(<?xml version="1.0" encoding="UTF-8"?>
+<package xmlns="http://www.idpf.org/2007/opf" xmlns:x="urn:x-example" version="3.0" unique-identifier="id">
+  <metadata xmlns:dc="http://purl.org/dc/elements/1.1/">
+    <dc:identifier id="id">http://www.gutenberg.org/ebooks/25545</dc:identifier>
+    <meta property="dcterms:modified">2010-02-17T04:39:13Z</meta>
+    <dc:title id="t1">Children's Literature</dc:title>
+    <dc:language>en</dc:language>
+  </metadata>
+  <manifest>
+    <!-- only OPF items belong to the manifest -->
+    <item href="cover.xhtml" id="cover" media-type="application/xhtml+xml"/>
+    <x:item href="s04.xhtml" id="foreign" media-type="application/xhtml+xml"/>
+    <item href="s04.xhtml" id="s04" media-type="application/xhtml+xml"/>
+    <item href="css/epub.css" id="css" media-type="text/css"/>
+  </manifest>
+  <spine>
+    <itemref idref="cover"/>
+    <x:itemref idref="foreign"/>
+    <itemref idref="s04"/>
+  </spine>
+  <x:collection role="ignored"/>
+</package>
+)X";
+
 static const char* kMissingModDate = R"X(<?xml version="1.0" encoding="UTF-8"?>
 <package xmlns="http://www.idpf.org/2007/opf" version="3.0" unique-identifier="id">
   <metadata xmlns:dc="http://purl.org/dc/elements/1.1/">
@@ -739,6 +769,63 @@ TEST_CASE("Packages with an invalid unique-id reference should raise a spec erro
     REQUIRE(int(triggeredError) == int(EPUBError::OPFPackageUniqueIDInvalid));
 }
 
+TEST_CASE("Only OPF elements are read from the package document", "")
+{
+    SetErrorHandler([](const error_details&){ return true; });
+    
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = Package::New(c, "application/oebps-package+xml");
+    
+    auto doc = ePub3::xml::Wrapped<ePub3::xml::Document>(xmlParseMemory(kForeignElements, (int)strlen(kForeignElements)));
+    REQUIRE(pkg->_OpenForTest(doc, "EPUB/"));
+    
+    SetErrorHandler(DefaultErrorHandler);
+    REQUIRE(pkg->Manifest().size() == 3);
+    REQUIRE_FALSE(bool(pkg->ManifestItemWithID("foreign")));
+    REQUIRE(pkg->SpineItemAt(1)->Idref() == "s04");
+    REQUIRE_FALSE(bool(pkg->SpineItemAt(2)));
+    REQUIRE(pkg->Collections().empty());
+    REQUIRE(pkg->PackageID() == "http://www.gutenberg.org/ebooks/25545");
+}
+
+TEST_CASE("Repeated XPath queries reuse compiled expressions and contexts", "")
+{
+    auto doc = ePub3::xml::Wrapped<ePub3::xml::Document>(xmlParseMemory(kForeignElements, (int)strlen(kForeignElements)));
+    
+    // the same prefix bound to a different namespace must not share compiled state
+    XPathWrangler opf(doc, {{"p", "http://www.idpf.org/2007/opf"}});
+    XPathWrangler foreign(doc, {{"p", "urn:x-example"}});
+    
+    for ( int i = 0; i < 3; i++ )
+    {
+        REQUIRE(opf.Nodes("/p:package/p:manifest/p:item").size() == 3);
+        REQUIRE(foreign.Nodes("/*/*/p:item").size() == 1);
+        REQUIRE(opf.Strings("/p:package/p:spine/p:itemref/@idref") == XPathWrangler::StringList({"cover", "s04"}));
+        REQUIRE(opf.Strings("string(/p:package/@version)") == XPathWrangler::StringList({"3.0"}));
+        REQUIRE(opf.Matches("//p:itemref[@idref='s04']"));
+        REQUIRE_FALSE(foreign.Matches("//p:itemref[@idref='s04']"));
+    }
+    
+    // contexts are handed out per query, so the document can be queried from several threads
+    // (node wrappers aren't thread-safe, so these queries don't return nodes)
+    std::vector<std::thread> threads;
+    std::atomic<int> matched(0);
+    for ( int t = 0; t < 4; t++ )
+    {
+        threads.emplace_back([&]() {
+            XPathWrangler xpath(doc, {{"p", "http://www.idpf.org/2007/opf"}});
+            for ( int i = 0; i < 100; i++ )
+            {
+                if ( xpath.Matches("/p:package/p:spine/p:itemref[@idref='s04']") && xpath.Strings("string(count(//p:item))") == XPathWrangler::StringList({"3"}) )
+                    matched++;
+            }
+        });
+    }
+    for ( auto& thread : threads )
+        thread.join();
+    REQUIRE(matched == 400);
+}
+
 TEST_CASE("'refines' should contain a valid IRI", "")
 {
     EPUBError triggeredError = EPUBError::NoError;
@@ -941,6 +1028,109 @@ TEST_CASE("Our test package should only have TOC and PageList navigation tables"
     REQUIRE(pkg->PageList() != nullptr);
 }
 
+TEST_CASE("Navigation tables, spine titles, and media overlays are loaded on first access", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    // a spine item's title brings in the TOC
+    auto item = pkg->FirstSpineItem();
+    while ( bool(item) && item->Title().empty() )
+        item = item->Next();
+    REQUIRE(bool(item));
+    REQUIRE(pkg->NavigationTables().size() == 2);
+    REQUIRE(pkg->MediaOverlaysSmilModel() != nullptr);
+    
+    // and with preloading, they're loaded on the shared pool while we wait on them
+    Package::SetPreloadsDeferredContent(true);
+    c = Container::OpenContainer(EPUB_PATH);
+    Package::SetPreloadsDeferredContent(false);
+    PackagePtr preloaded = c->DefaultPackage();
+    
+    REQUIRE(preloaded->MediaOverlaysSmilModel() != nullptr);
+    REQUIRE(preloaded->TableOfContents() != nullptr);
+    REQUIRE(preloaded->SpineItemWithIDRef(item->Idref())->Title() == item->Title());
+}
+
+// notes whether the navigation document was read through it
+class NavWatchingFilter : public ContentFilter
+{
+public:
+    static std::atomic<bool> sawNavigation;
+    
+    NavWatchingFilter() : ContentFilter([](ConstManifestItemPtr item){ return item->HasProperty(ItemProperties::Navigation); }) {}
+    virtual ~NavWatchingFilter() {}
+    
+    virtual bool PreservesLength() const OVERRIDE { return true; }
+    
+    virtual void* FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE
+    {
+        sawNavigation = true;
+        *outputLen = len;
+        return data;
+    }
+};
+std::atomic<bool> NavWatchingFilter::sawNavigation(false);
+
+// while armed, opens EPUB_PATH and then puts a NavWatchingFilter in place, like a DRM module would
+class NavWatchingModule : public ContentModule
+{
+public:
+    static std::atomic<bool> armed;
+    static std::atomic<bool> filterInPlace;
+    
+    virtual ContainerPtr ProcessFile(const string& path) OVERRIDE
+    {
+        if ( !armed || path != EPUB_PATH )
+            return nullptr;
+        
+        filterInPlace = false;
+        ContainerPtr container = Container::OpenContainerForContentModule(path);
+        
+        // a module may look through the package before handing it back
+        if ( bool(container) )
+            container->DefaultPackage()->TableOfContents();
+        return container;
+    }
+    
+    virtual void RegisterContentFilters() OVERRIDE
+    {
+        FilterManager::Instance()->RegisterFilter("NavWatchingFilter", ContentFilter::EPUBDecryption, [](ConstPackagePtr package) -> ContentFilterPtr {
+            if ( !armed || !filterInPlace )
+                return nullptr;
+            return std::make_shared<NavWatchingFilter>();
+        });
+        filterInPlace = true;
+    }
+    
+    virtual string GetModuleName() OVERRIDE { return "NavWatchingModule"; }
+};
+std::atomic<bool> NavWatchingModule::armed(false);
+std::atomic<bool> NavWatchingModule::filterInPlace(false);
+
+TEST_CASE("Packages opened by a content module preload through the module's filters", "")
+{
+    static std::once_flag registered;
+    std::call_once(registered, []() {
+        ContentModuleManager::Instance()->RegisterContentModule(new NavWatchingModule, "NavWatchingModule");
+    });
+    
+    NavWatchingModule::armed = true;
+    NavWatchingFilter::sawNavigation = false;
+    Package::SetPreloadsDeferredContent(true);
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    Package::SetPreloadsDeferredContent(false);
+    NavWatchingModule::armed = false;
+    REQUIRE(bool(c));
+    PackagePtr pkg = c->DefaultPackage();
+    
+    // the tables read before the module's filter was in the chain were read again through it
+    REQUIRE(pkg->TableOfContents() != nullptr);
+    REQUIRE(pkg->NavigationTables().size() == 2);
+    REQUIRE(NavWatchingFilter::sawNavigation);
+    REQUIRE(pkg->MediaOverlaysSmilModel() != nullptr);
+}
+
 TEST_CASE("Package should have multiple manifest items, and they should be indexable by identifier string", "")
 {
     ContainerPtr c = Container::OpenContainer(EPUB_PATH);
@@ -979,6 +1169,68 @@ TEST_CASE("Package should have multiple spine items", "")
     REQUIRE(pkg->SpineItemAt(idx) == (*pkg)[idx]);
 }
 
+TEST_CASE("Indexed spine lookups agree with the linked list", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    auto first = pkg->FirstSpineItem();
+    REQUIRE(first != nullptr);
+    
+    size_t count = first->Count();
+    size_t i = 0;
+    for ( auto item = first; item != nullptr; item = item->Next(), i++ )
+    {
+        CAPTURE(i);
+        REQUIRE(item->Index() == i);
+        REQUIRE(item->Count() == count - i);
+        REQUIRE(pkg->SpineItemAt(i) == item);
+        REQUIRE(first->at(i) == item);
+        REQUIRE(item->at(-ssize_t(i)) == first);
+        REQUIRE(pkg->SpineItemWithIDRef(item->Idref()) == item);
+        REQUIRE(pkg->IndexOfSpineItemWithIDRef(item->Idref()) == i);
+    }
+    REQUIRE(i == count);
+    
+    REQUIRE(pkg->SpineItemAt(count) == nullptr);
+    REQUIRE(pkg->IndexOfSpineItemWithIDRef("not-in-the-spine") == size_t(-1));
+    REQUIRE_THROWS_AS(first->at(count), std::out_of_range);
+    REQUIRE_THROWS_AS(first->at(-1), std::out_of_range);
+}
+
+TEST_CASE("Manifest items can be found by percent-escaped relative paths", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    for ( auto& pair : pkg->Manifest() )
+    {
+        ManifestItemPtr item = pair.second;
+        std::string href = item->Href().stl_str();
+        CAPTURE(href);
+        REQUIRE(pkg->ManifestItemAtRelativePath(href) == item);
+        
+        // escape every '.' in the path, alternating between upper- and lower-case hex digits
+        std::string escaped;
+        bool upper = true;
+        for ( char ch : href )
+        {
+            if ( ch == '.' )
+            {
+                escaped += (upper ? "%2E" : "%2e");
+                upper = !upper;
+            }
+            else
+            {
+                escaped += ch;
+            }
+        }
+        CAPTURE(escaped);
+        REQUIRE(pkg->ManifestItemAtRelativePath(escaped) == item);
+    }
+    
+    REQUIRE(pkg->ManifestItemAtRelativePath("not/in/the%20manifest.xhtml") == nullptr);
+}
+
 TEST_CASE("Package should be able to create and resolve basic CFIs", "")
 {
     ContainerPtr c = Container::OpenContainer(EPUB_PATH);
@@ -0,0 +1,165 @@
+//
+//  resource_inflater_tests.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/aes_cbc_decryptor.h"
+#include "../ePub3/ePub/resource_inflater.h"
+#include "../ePub3/ePub/filter_chain.h"
+#include "../ePub3/ePub/filter_chain_byte_stream_range.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/utilities/byte_stream.h"
+#include "catch.hpp"
+#include <string>
+
+// Raw-deflated with zlib, then encrypted as in aes-cbc-encrypted.epub.
+#define EPUB_PATH "TestData/compressed-encrypted.epub"
+#define CHAPTER_ID "chapter"            // aes128-cbc, OriginalLength 9512
+#define PLAIN_CHAPTER_ID "chapter-plain"
+#define VIDEO_ID "video"                // aes256-cbc, OriginalLength 2500000, many small deflate blocks
+#define AUDIO_ID "audio"                // aes128-cbc, no OriginalLength
+#define PLAIN_AUDIO_ID "audio-plain"
+
+using namespace ePub3;
+
+static std::string ReadAll(ByteStream& stream)
+{
+    ByteBuffer bytes = stream.ReadAllBytes();
+    return std::string(reinterpret_cast<const char*>(bytes.GetBytes()), bytes.GetBufferSize());
+}
+
+// The fixture's video: lines of eight words, rotated by a pseudo-random bit.
+static std::string VideoContent()
+{
+    static const char* const words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "elit", "sed", "magna" };
+    std::string result;
+    uint32_t seed = 1;
+    for ( size_t i = 0; result.size() < 2500000; i++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        for ( size_t k = 0; k < 8; k++ )
+        {
+            result += words[(i + k + ((seed >> 16) & 1)) % 8];
+            result += (k == 7 ? '\n' : ' ');
+        }
+    }
+    result.resize(2500000);
+    return result;
+}
+
+static FilterChain::FilterList TestFilters()
+{
+    // the fixture's keys are 00 01 02 ... for either length
+    auto keyProvider = [](ConstManifestItemPtr item, EncryptionInfoPtr encInfo, uint8_t* key, size_t keyLength) {
+        for ( size_t i = 0; i < keyLength; i++ )
+            key[i] = uint8_t(i);
+        return true;
+    };
+    return FilterChain::FilterList{ std::make_shared<AESCBCDecryptor>(keyProvider), std::make_shared<ResourceInflater>() };
+}
+
+TEST_CASE("Compression properties are read from the encryption data", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+
+    EncryptionInfoPtr encInfo = pkg->ManifestItemWithID(CHAPTER_ID)->GetEncryptionInfo();
+    REQUIRE(bool(encInfo));
+    REQUIRE(encInfo->IsCompressed());
+    REQUIRE(encInfo->OriginalLength() == 9512);
+
+    encInfo = pkg->ManifestItemWithID(AUDIO_ID)->GetEncryptionInfo();
+    REQUIRE(bool(encInfo));
+    REQUIRE(encInfo->IsCompressed());
+    REQUIRE(encInfo->OriginalLength() == 0);
+
+    REQUIRE_FALSE(ResourceInflater::CompressedTypeSniffer(pkg->ManifestItemWithID(PLAIN_CHAPTER_ID)));
+    REQUIRE(ResourceInflater::CompressedTypeSniffer(pkg->ManifestItemWithID(VIDEO_ID)));
+}
+
+TEST_CASE("Compressed resources are inflated after decryption", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    FilterChain chain(TestFilters());
+
+    for ( auto ids : { std::make_pair(CHAPTER_ID, PLAIN_CHAPTER_ID), std::make_pair(AUDIO_ID, PLAIN_AUDIO_ID) } )
+    {
+        CAPTURE(ids.first);
+        ManifestItemPtr item = pkg->ManifestItemWithID(ids.first);
+        std::string expected = ReadAll(*pkg->ManifestItemWithID(ids.second)->Reader());
+
+        std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(item, dynamic_cast<SeekableByteStream*>(item->Reader().release()));
+        REQUIRE(stream->BytesAvailable() == expected.size());
+        REQUIRE(ReadAll(*stream) == expected);
+    }
+
+    ManifestItemPtr video = pkg->ManifestItemWithID(VIDEO_ID);
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStream(video, dynamic_cast<SeekableByteStream*>(video->Reader().release()));
+    REQUIRE(ReadAll(*stream) == VideoContent());
+}
+
+TEST_CASE("Compressed resources serve byte ranges without inflating everything", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    FilterChain chain(TestFilters());
+
+    ManifestItemPtr video = pkg->ManifestItemWithID(VIDEO_ID);
+    std::string expected = VideoContent();
+
+    std::unique_ptr<ByteStream> stream = chain.GetFilterChainByteStreamRange(video, dynamic_cast<SeekableByteStream*>(video->Reader().release()));
+    FilterChainByteStreamRange* rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+    REQUIRE(rangeStream != nullptr);
+
+    // the declared length, without inflating anything
+    REQUIRE(rangeStream->BytesAvailable() == expected.size());
+
+    // forwards, back to the start, then past the checkpoints recorded along the way
+    uint32_t size = uint32_t(expected.size());
+    const std::pair<uint32_t, uint32_t> ranges[] = { {0, 100}, {2000000, 5000}, {10, 1}, {1500000, 65536}, {1048575, 3}, {size - 7, 7}, {5, 30000} };
+    std::vector<char> buf(65536);
+    for ( auto& r : ranges )
+    {
+        CAPTURE(r.first);
+        CAPTURE(r.second);
+        ByteRange range;
+        range.Location(r.first);
+        range.Length(r.second);
+        REQUIRE(rangeStream->ReadBytes(buf.data(), buf.size(), range) == r.second);
+        REQUIRE(expected.compare(r.first, r.second, buf.data(), r.second) == 0);
+    }
+
+    // a second stream for the same item resumes from the checkpoints of the first
+    std::unique_ptr<ByteStream> other = chain.GetFilterChainByteStreamRange(video, dynamic_cast<SeekableByteStream*>(video->Reader().release()));
+    ByteRange tail;
+    tail.Location(size - 1000);
+    tail.Length(2000);
+    REQUIRE(dynamic_cast<FilterChainByteStreamRange*>(other.get())->ReadBytes(buf.data(), buf.size(), tail) == 1000);
+    REQUIRE(expected.compare(size - 1000, 1000, buf.data(), 1000) == 0);
+
+    // with no declared length, the size is found by inflating
+    ManifestItemPtr audio = pkg->ManifestItemWithID(AUDIO_ID);
+    expected = ReadAll(*pkg->ManifestItemWithID(PLAIN_AUDIO_ID)->Reader());
+    stream = chain.GetFilterChainByteStreamRange(audio, dynamic_cast<SeekableByteStream*>(audio->Reader().release()));
+    rangeStream = dynamic_cast<FilterChainByteStreamRange*>(stream.get());
+    REQUIRE(rangeStream != nullptr);
+    REQUIRE(rangeStream->BytesAvailable() == expected.size());
+
+    ByteRange middle;
+    middle.Location(12345);
+    middle.Length(4321);
+    REQUIRE(rangeStream->ReadBytes(buf.data(), buf.size(), middle) == 4321);
+    REQUIRE(expected.compare(12345, 4321, buf.data(), 4321) == 0);
+}
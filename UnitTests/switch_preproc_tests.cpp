@@ -12,11 +12,15 @@
 //  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
 //
 
-THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include "../ePub3/ePub/switch_preprocessor.h"
 #include "catch.hpp"
+#include <chrono>
+#include <functional>
+#include <vector>
+#include REGEX_INCLUDE
 
 using namespace ePub3;
 
@@ -420,3 +424,221 @@ TEST_CASE("Processors should NOT uncomment switch constructs which have been com
     
     SwitchPreprocessor::SetSupportedNamespaces({});
 }
+
+static std::string FilterInChunks(SwitchPreprocessor& proc, const char* input, size_t len, size_t chunkSize)
+{
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    std::string result;
+    
+    for ( size_t pos = 0; pos < len; pos += chunkSize )
+    {
+        std::string chunk(input + pos, std::min(chunkSize, len - pos));
+        size_t outLen = 0;
+        char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), &chunk[0], chunk.size(), &outLen));
+        result.append(output, outLen);
+        if ( output != &chunk[0] )
+            delete [] output;
+    }
+    
+    // the end of the stream
+    size_t outLen = 0;
+    char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), nullptr, 0, &outLen));
+    result.append(output, outLen);
+    delete [] output;
+    
+    return result;
+}
+
+TEST_CASE("Processors should produce the same output however the input is chunked", "")
+{
+    SwitchPreprocessor proc;
+    const char* inputs[] = { gInput, gCommentedInput, gTotallyCommentedInput };
+    const SwitchPreprocessor::NamespaceList namespaceLists[] = {
+        {},
+        {"http://www.xml-cml.org/schema"},
+        {"http://www.xml-cml.org/schema", MathMLNamespaceURI},
+    };
+    
+    for ( auto& namespaces : namespaceLists )
+    {
+        SwitchPreprocessor::SetSupportedNamespaces(namespaces);
+        for ( const char* input : inputs )
+        {
+            size_t len = strlen(input);
+            std::string whole = FilterInChunks(proc, input, len, len);
+            
+            for ( size_t chunkSize : { 1, 2, 3, 7, 64, 333 } )
+            {
+                CAPTURE(chunkSize);
+                REQUIRE(FilterInChunks(proc, input, len, chunkSize) == whole);
+            }
+        }
+    }
+    
+    SwitchPreprocessor::SetSupportedNamespaces({});
+    REQUIRE(FilterInChunks(proc, gInput, strlen(gInput), 5) == gDefault);
+    REQUIRE(FilterInChunks(proc, gCommentedInput, strlen(gCommentedInput), 5) == gCommentedDefaultOutput);
+    REQUIRE(FilterInChunks(proc, gTotallyCommentedInput, strlen(gTotallyCommentedInput), 5) == gTotallyCommentedOutput);
+}
+
+TEST_CASE("Processors should output held markup once the stream ends", "")
+{
+    static const char input[] = "<p>unclosed</p><!-";
+    
+    SwitchPreprocessor proc;
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    
+    std::string data(input);
+    size_t outLen = 0;
+    char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), &data[0], data.size(), &outLen));
+    REQUIRE(std::string(output, outLen) == "<p>unclosed</p>");
+    
+    output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), nullptr, 0, &outLen));
+    REQUIRE(std::string(output, outLen) == "<!-");
+    delete [] output;
+}
+
+static std::string FilterSpansInChunks(SwitchPreprocessor& proc, const char* input, size_t len, size_t chunkSize, size_t outputSpace)
+{
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    std::string result;
+    std::vector<uint8_t> output(outputSpace);
+    
+    size_t pos = 0;
+    do
+    {
+        size_t chunkLen = std::min(chunkSize, len - pos);
+        ContentFilter::FilterSpans spans(input + pos, chunkLen, output.data(), output.size(), pos + chunkLen == len);
+        ContentFilter::SpanStatus status = proc.FilterSpan(ctx.get(), spans);
+        REQUIRE(spans.outputProduced <= output.size());
+        result.append(reinterpret_cast<const char*>(output.data()), spans.outputProduced);
+        pos += spans.inputConsumed;
+        if ( status == ContentFilter::SpanStatus::NeedsOutputSpace )
+            REQUIRE(spans.outputNeeded > 0);
+        else if ( pos == len )
+            break;
+    } while ( true );
+    
+    return result;
+}
+
+TEST_CASE("Processors can write into caller-provided spans of any size", "")
+{
+    SwitchPreprocessor proc;
+    REQUIRE(proc.SupportsSpans());
+    const char* inputs[] = { gInput, gCommentedInput, gTotallyCommentedInput };
+    
+    for ( const char* input : inputs )
+    {
+        size_t len = strlen(input);
+        std::string whole = FilterInChunks(proc, input, len, len);
+        
+        for ( size_t chunkSize : { 1, 7, 333, 100000 } )
+        {
+            for ( size_t outputSpace : { 1, 16, 4096 } )
+            {
+                CAPTURE(chunkSize);
+                CAPTURE(outputSpace);
+                REQUIRE(FilterSpansInChunks(proc, input, len, chunkSize, outputSpace) == whole);
+            }
+        }
+    }
+    
+    // without a context, everything is output at once or not at all
+    size_t len = strlen(gInput);
+    std::vector<uint8_t> output(len);
+    ContentFilter::FilterSpans small(gInput, len, output.data(), 10);
+    REQUIRE(proc.FilterSpan(nullptr, small) == ContentFilter::SpanStatus::NeedsOutputSpace);
+    REQUIRE(small.inputConsumed == 0);
+    REQUIRE(small.outputNeeded == strlen(gDefault));
+    ContentFilter::FilterSpans enough(gInput, len, output.data(), small.outputNeeded);
+    REQUIRE(proc.FilterSpan(nullptr, enough) == ContentFilter::SpanStatus::Complete);
+    REQUIRE(enough.inputConsumed == len);
+    REQUIRE(std::string(reinterpret_cast<const char*>(output.data()), enough.outputProduced) == gDefault);
+}
+
+TEST_CASE("Processors should pass through documents without switches unchanged", "")
+{
+    static const char input[] = "<?xml version=\"1.0\"?>\n<html><body><p>a &lt; b</p><!-- switch --><switchboard/><epub:switches/></body></html>\n";
+    
+    SwitchPreprocessor proc;
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    
+    std::string data(input);
+    size_t outLen = 0;
+    char* output = reinterpret_cast<char*>(proc.FilterData(ctx.get(), &data[0], data.size(), &outLen));
+    REQUIRE(output == &data[0]);
+    REQUIRE(std::string(output, outLen) == input);
+}
+
+// The regular expressions previously used by the SwitchPreprocessor, for comparison
+static std::string RegexSwitchFilter(const std::string& inputStr)
+{
+    static const REGEX_NS::regex_constants::syntax_option_type flags = REGEX_NS::regex::icase|REGEX_NS::regex::optimize|REGEX_NS::regex::ECMAScript;
+    static const REGEX_NS::regex commented("(?:<!--)(\\s*<(?:epub:)switch(?:.|\\n|\\r)*?<(?:epub:)default(?:.|\\n|\\r)*?>\\s*)(?:-->)((?:.|\\n|\\r)*?)(?:<!--)(\\s*</(?:epub:)default>(?:.|\\n|\\r)*?)(?:-->)", flags);
+    static const REGEX_NS::regex switchContent("<(?:epub:)?switch(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?switch(?:.|\\n|\\r)*?>", flags);
+    static const REGEX_NS::regex defaultContent("<(?:epub:)?default(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?default(?:.|\\n|\\r)*?>", flags);
+    
+    std::string str = REGEX_NS::regex_replace(inputStr, commented, std::string("$1$2$3"));
+    std::string output;
+    auto end = REGEX_NS::sregex_iterator();
+    for ( auto pos = REGEX_NS::sregex_iterator(str.begin(), str.end(), switchContent); pos != end; )
+    {
+        output += pos->prefix();
+        std::string switchContents = pos->str(1);
+        REGEX_NS::smatch match;
+        if ( REGEX_NS::regex_search(switchContents, match, defaultContent) )
+            output += match[1].str();
+        auto here = pos++;
+        if ( pos == end )
+            output += here->suffix();
+    }
+    return output;
+}
+
+static std::string LargeSwitchDocument(size_t approximateSize)
+{
+    static const char* kBlock = R"raw(
+    <p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore.</p>
+    <epub:switch id="s">
+      <epub:case required-namespace="http://www.w3.org/1998/Math/MathML">
+        <math xmlns="http://www.w3.org/1998/Math/MathML"><mrow><mn>2</mn><mo>&#x2061;</mo><mi>x</mi></mrow></math>
+      </epub:case>
+      <epub:default>
+        <p>2x</p>
+      </epub:default>
+    </epub:switch>)raw";
+    
+    std::string doc("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<html xmlns=\"http://www.w3.org/1999/xhtml\" xmlns:epub=\"http://www.idpf.org/2007/ops\">\n  <body>");
+    while ( doc.size() < approximateSize )
+        doc += kBlock;
+    doc += "\n  </body>\n</html>\n";
+    return doc;
+}
+
+TEST_CASE("Benchmark: epub:switch processing of large documents", "[.][benchmark]")
+{
+    SwitchPreprocessor proc;
+    SwitchPreprocessor::SetSupportedNamespaces({});
+    
+    auto time = [](std::function<std::string()> fn, std::string& result) {
+        auto start = std::chrono::steady_clock::now();
+        result = fn();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    
+    // the regex implementation is too slow (and too stack-hungry) for chapter-sized input
+    std::string small = LargeSwitchDocument(64*1024);
+    std::string regexOutput, output;
+    auto regexTime = time([&]() { return RegexSwitchFilter(small); }, regexOutput);
+    auto tokenizerTime = time([&]() { return FilterInChunks(proc, small.data(), small.size(), small.size()); }, output);
+    REQUIRE(output == regexOutput);
+    WARN("64KB document: regex " << regexTime << "ms, tokenizer " << tokenizerTime << "ms");
+    
+    std::string large = LargeSwitchDocument(5*1024*1024);
+    tokenizerTime = time([&]() { return FilterInChunks(proc, large.data(), large.size(), large.size()); }, output);
+    WARN("5MB document: tokenizer " << tokenizerTime << "ms");
+    auto chunkedTime = time([&]() { return FilterInChunks(proc, large.data(), large.size(), 16*1024); }, regexOutput);
+    REQUIRE(output == regexOutput);
+    WARN("5MB document in 16KB chunks: tokenizer " << chunkedTime << "ms");
+}
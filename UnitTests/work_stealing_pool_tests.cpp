@@ -0,0 +1,44 @@
+//
+//  work_stealing_pool_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/utilities/work_stealing_pool.h"
+#include "catch.hpp"
+#include <atomic>
+#include <functional>
+
+using namespace ePub3;
+
+TEST_CASE("Work-stealing pools run every task, including those added by tasks", "")
+{
+    std::atomic<size_t> numRun(0);
+    std::function<void(int)> task;
+    {
+        WorkStealingPool pool(4);
+        REQUIRE(pool.ThreadCount() == size_t(4));
+        REQUIRE_FALSE(pool.IsWorkerThread());
+        
+        // each task adds two more, to a depth of ten
+        task = [&](int depth) {
+            numRun++;
+            if ( depth == 0 )
+                return;
+            pool.Add([&task, depth]() { task(depth - 1); });
+            pool.Add([&task, depth]() { task(depth - 1); });
+        };
+        for ( int i = 0; i < 8; i++ )
+            pool.Add([&task]() { task(10); });
+        
+        // the pool finishes its queued tasks before it is destroyed
+    }
+    REQUIRE(numRun == size_t(8 * ((1 << 11) - 1)));
+}
@@ -0,0 +1,385 @@
+//
+//  zip_archive_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+//
+
+
+#include "../ePub3/ePub/zip_archive.h"
+#include "../ePub3/utilities/byte_stream.h"
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+#define EPUB_PATH "TestData/wasteland-otf-obf-20120118.epub"
+#define DEFLATED_SUBPATH "EPUB/OldStandard-Bold.obf.otf"
+#define STORED_SUBPATH "mimetype"
+
+using namespace ePub3;
+
+static std::vector<uint8_t> ReadEverything(ByteStream* stream)
+{
+    std::vector<uint8_t> result(stream->BytesAvailable());
+    size_t total = 0;
+    while ( total < result.size() )
+    {
+        size_t numRead = stream->ReadBytes(&result[total], result.size()-total);
+        if ( numRead == 0 )
+            break;
+        total += numRead;
+    }
+    result.resize(total);
+    return result;
+}
+
+// Hides the size of another stream, so readers can't allocate up front
+class UnsizedByteStream : public ByteStream
+{
+public:
+    UnsizedByteStream(std::unique_ptr<ByteStream>&& input) : ByteStream(), _input(std::move(input)) {}
+    virtual ~UnsizedByteStream() {}
+    
+    virtual size_type BytesAvailable() _NOEXCEPT OVERRIDE { return UnknownSize; }
+    virtual bool IsOpen() const _NOEXCEPT OVERRIDE { return _input->IsOpen(); }
+    virtual void Close() OVERRIDE { _input->Close(); }
+    virtual size_type ReadBytes(void* buf, size_type len) OVERRIDE { return _input->ReadBytes(buf, len); }
+    virtual size_type WriteBytes(const void* buf, size_type len) OVERRIDE { return 0; }
+    
+private:
+    std::unique_ptr<ByteStream> _input;
+};
+
+TEST_CASE("Seeking within a deflated item resumes from inflate checkpoints", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    std::unique_ptr<ByteStream> raw = archive.ByteStreamAtPath(DEFLATED_SUBPATH);
+    ZipFileByteStream* stream = dynamic_cast<ZipFileByteStream*>(raw.get());
+    REQUIRE(stream != nullptr);
+    REQUIRE(stream->IsOpen());
+    
+    // use a small span so this (sub-megabyte) font gets several checkpoints
+    auto index = std::make_shared<ZipInflateIndex>(16*1024);
+    stream->SetInflateIndex(index);
+    
+    // a straight read builds the index
+    std::vector<uint8_t> expected = ReadEverything(stream);
+    REQUIRE(expected.size() == archive.InfoAtPath(DEFLATED_SUBPATH).UncompressedSize());
+    REQUIRE(index->Count() > 0);
+    
+    size_t size = expected.size();
+    const size_t offsets[] = { size-100, 17, size/2, 16*1024+3, 0, size/3, size/3 + 10 };
+    for ( size_t offset : offsets )
+    {
+        CAPTURE(offset);
+        REQUIRE(stream->Seek(offset, std::ios::beg) == offset);
+        
+        uint8_t buf[100];
+        REQUIRE(stream->ReadBytes(buf, sizeof(buf)) == sizeof(buf));
+        REQUIRE(memcmp(buf, &expected[offset], sizeof(buf)) == 0);
+    }
+    
+    // a clone starts at the same place and shares the index
+    REQUIRE(stream->Seek(size/4, std::ios::beg) == size/4);
+    auto clone = std::dynamic_pointer_cast<ZipFileByteStream>(stream->Clone());
+    REQUIRE(bool(clone));
+    REQUIRE(clone->InflateIndex() == index);
+    REQUIRE(clone->Position() == size/4);
+    
+    uint8_t buf[100];
+    REQUIRE(clone->ReadBytes(buf, sizeof(buf)) == sizeof(buf));
+    REQUIRE(memcmp(buf, &expected[size/4], sizeof(buf)) == 0);
+}
+
+TEST_CASE("Reading a deflated item from the start after seeking verifies its CRC", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    std::unique_ptr<ByteStream> raw = archive.ByteStreamAtPath(DEFLATED_SUBPATH);
+    ZipFileByteStream* stream = dynamic_cast<ZipFileByteStream*>(raw.get());
+    REQUIRE(stream != nullptr);
+    
+    std::vector<uint8_t> first = ReadEverything(stream);
+    REQUIRE(stream->Seek(0, std::ios::beg) == 0);
+    std::vector<uint8_t> second = ReadEverything(stream);
+    
+    REQUIRE(first == second);
+    
+    // hitting the end triggers the CRC check, which would close the stream on failure
+    uint8_t extra;
+    REQUIRE(stream->ReadBytes(&extra, 1) == 0);
+    REQUIRE(stream->IsOpen());
+}
+
+TEST_CASE("Item name lookups agree with zip_name_locate", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    std::vector<std::string> names;
+    archive.EachItem([&](const ArchiveItemInfo& info) {
+        names.push_back(info.Path().stl_str());
+    });
+    REQUIRE(names.size() == 14);
+    
+    for ( auto& name : names )
+    {
+        CAPTURE(name);
+        REQUIRE(archive.ContainsItem(name));
+        REQUIRE(archive.IndexOfItem(name) >= 0);
+        REQUIRE(archive.InfoAtPath(name).Path() == name);
+        
+        std::unique_ptr<ByteStream> stream = archive.ByteStreamAtPath(name);
+        REQUIRE(stream->IsOpen());
+        REQUIRE(stream->BytesAvailable() == archive.InfoAtPath(name).UncompressedSize());
+    }
+    
+    REQUIRE_FALSE(archive.ContainsItem("EPUB/missing.xhtml"));
+    REQUIRE(archive.IndexOfItem("EPUB/missing.xhtml") == -1);
+    REQUIRE_FALSE(archive.ByteStreamAtPath("EPUB/missing.xhtml")->IsOpen());
+    REQUIRE(archive.ReaderAtPath("EPUB/missing.xhtml") == nullptr);
+    REQUIRE_THROWS(archive.InfoAtPath("EPUB/missing.xhtml"));
+}
+
+TEST_CASE("Item names may be looked up ignoring case or directories", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    int index = archive.IndexOfItem("EPUB/wasteland.opf");
+    REQUIRE(index >= 0);
+    
+    REQUIRE(archive.IndexOfItem("epub/WASTELAND.opf") == -1);
+    REQUIRE(archive.IndexOfItem("epub/WASTELAND.opf", ZIP_FL_NOCASE) == index);
+    REQUIRE(archive.IndexOfItem("wasteland.opf") == -1);
+    REQUIRE(archive.IndexOfItem("wasteland.opf", ZIP_FL_NODIR) == index);
+    REQUIRE(archive.IndexOfItem("Wasteland.OPF", ZIP_FL_NOCASE|ZIP_FL_NODIR) == index);
+    REQUIRE(archive.IndexOfItem("container.xml", ZIP_FL_NODIR) == archive.IndexOfItem("META-INF/container.xml"));
+    REQUIRE(archive.IndexOfItem("missing.opf", ZIP_FL_NODIR) == -1);
+}
+
+static uLong CRCOfStream(ByteStream* stream, size_t chunkSize)
+{
+    std::vector<uint8_t> buf(chunkSize);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    ByteStream::size_type numRead = 0;
+    while ( (numRead = stream->ReadBytes(buf.data(), buf.size())) > 0 )
+        crc = crc32(crc, buf.data(), static_cast<uInt>(numRead));
+    return crc;
+}
+
+TEST_CASE("Items may be read concurrently from many threads", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    std::vector<std::string> names;
+    archive.EachItem([&](const ArchiveItemInfo& info) {
+        names.push_back(info.Path().stl_str());
+    });
+    
+    std::vector<uLong> expected;
+    for ( auto& name : names )
+    {
+        auto stream = archive.ByteStreamAtPath(name);
+        expected.push_back(CRCOfStream(stream.get(), 4096));
+    }
+    
+    // Catch assertions aren't thread-safe, so just count the failures
+    std::atomic<int> failures(0);
+    std::atomic<int> reads(0);
+    std::vector<std::thread> threads;
+    for ( size_t t = 0; t < 16; t++ )
+    {
+        threads.emplace_back([&, t]() {
+            for ( int pass = 0; pass < 4; pass++ )
+            {
+                for ( size_t i = 0; i < names.size(); i++ )
+                {
+                    // each thread starts at a different item, with a different read size
+                    size_t item = (i + t) % names.size();
+                    std::unique_ptr<ByteStream> stream = archive.ByteStreamAtPath(names[item]);
+                    uLong crc = 0;
+                    if ( pass % 2 == 0 )
+                    {
+                        crc = CRCOfStream(stream.get(), 512 + 1000*t);
+                    }
+                    else
+                    {
+                        auto clone = dynamic_cast<SeekableByteStream*>(stream.get())->Clone();
+                        stream.reset();
+                        crc = CRCOfStream(clone.get(), 333 + 100*t);
+                    }
+                    
+                    if ( crc != expected[item] )
+                        failures++;
+                    reads++;
+                }
+            }
+        });
+    }
+    
+    for ( auto& thread : threads )
+        thread.join();
+    
+    REQUIRE(reads == int(16 * 4 * names.size()));
+    REQUIRE(failures == 0);
+}
+
+TEST_CASE("Archives opened by path are memory-mapped", "")
+{
+    std::unique_ptr<Archive> opened = Archive::Open(EPUB_PATH);
+    MappedZipArchive* mapped = dynamic_cast<MappedZipArchive*>(opened.get());
+    REQUIRE(mapped != nullptr);
+    REQUIRE(mapped->IsMapped());
+    
+    std::unique_ptr<ByteStream> stream = mapped->ByteStreamAtPath(DEFLATED_SUBPATH);
+    REQUIRE(dynamic_cast<MappedZipFileByteStream*>(stream.get()) != nullptr);
+    REQUIRE_FALSE(mapped->ByteStreamAtPath("EPUB/missing.xhtml")->IsOpen());
+}
+
+TEST_CASE("Mapped items read the same as items read through libzip", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    MappedZipArchive mapped(EPUB_PATH);
+    
+    archive.EachItem([&](const ArchiveItemInfo& info) {
+        CAPTURE(info.Path());
+        std::unique_ptr<ByteStream> zipStream = archive.ByteStreamAtPath(info.Path());
+        std::unique_ptr<ByteStream> mappedStream = mapped.ByteStreamAtPath(info.Path());
+        REQUIRE(dynamic_cast<MappedZipFileByteStream*>(mappedStream.get()) != nullptr);
+        REQUIRE(mappedStream->BytesAvailable() == info.UncompressedSize());
+        
+        std::vector<uint8_t> expected = ReadEverything(zipStream.get());
+        REQUIRE(ReadEverything(mappedStream.get()) == expected);
+        
+        // reading to the end verifies the checksum, leaving the stream open
+        uint8_t extra;
+        REQUIRE(mappedStream->ReadBytes(&extra, 1) == 0);
+        REQUIRE(mappedStream->IsOpen());
+    });
+}
+
+TEST_CASE("Seeking within a mapped deflated item", "")
+{
+    MappedZipArchive archive(EPUB_PATH);
+    std::unique_ptr<ByteStream> raw = archive.ByteStreamAtPath(DEFLATED_SUBPATH);
+    MappedZipFileByteStream* stream = dynamic_cast<MappedZipFileByteStream*>(raw.get());
+    REQUIRE(stream != nullptr);
+    
+    auto index = std::make_shared<ZipInflateIndex>(16*1024);
+    stream->SetInflateIndex(index);
+    
+    std::vector<uint8_t> expected = ReadEverything(stream);
+    REQUIRE(index->Count() > 0);
+    
+    size_t size = expected.size();
+    const size_t offsets[] = { size-100, 17, size/2, 16*1024+3, 0, size/3, size/3 + 10 };
+    for ( size_t offset : offsets )
+    {
+        CAPTURE(offset);
+        REQUIRE(stream->Seek(offset, std::ios::beg) == offset);
+        
+        uint8_t buf[100];
+        REQUIRE(stream->ReadBytes(buf, sizeof(buf)) == sizeof(buf));
+        REQUIRE(memcmp(buf, &expected[offset], sizeof(buf)) == 0);
+    }
+    
+    REQUIRE(stream->Seek(size/4, std::ios::beg) == size/4);
+    auto clone = std::dynamic_pointer_cast<MappedZipFileByteStream>(stream->Clone());
+    REQUIRE(bool(clone));
+    REQUIRE(clone->InflateIndex() == index);
+    REQUIRE(clone->Position() == size/4);
+    
+    // the clone keeps the mapping alive on its own
+    raw.reset();
+    uint8_t buf[100];
+    REQUIRE(clone->ReadBytes(buf, sizeof(buf)) == sizeof(buf));
+    REQUIRE(memcmp(buf, &expected[size/4], sizeof(buf)) == 0);
+}
+
+TEST_CASE("Mapped stored items can be viewed in place", "")
+{
+    MappedZipArchive archive(EPUB_PATH);
+    std::unique_ptr<ByteStream> stream = archive.ByteStreamAtPath(STORED_SUBPATH);
+    REQUIRE(dynamic_cast<MappedZipFileByteStream*>(stream.get()) != nullptr);
+    
+    ByteView view = stream->ReadView(0, 1024);
+    REQUIRE(view.size() == 20);
+    REQUIRE(string(reinterpret_cast<const char*>(view.data()), view.size()) == "application/epub+zip");
+    
+    ByteView sub = stream->ReadView(12, 3);
+    REQUIRE(sub.size() == 3);
+    REQUIRE(sub.data() == view.data() + 12);
+    REQUIRE(stream->ReadView(20, 1).empty());
+    
+    // the view doesn't affect the stream's position
+    std::vector<uint8_t> bytes = ReadEverything(stream.get());
+    REQUIRE(std::equal(bytes.begin(), bytes.end(), view.begin()));
+    
+    // deflated data has no in-place representation
+    REQUIRE(archive.ByteStreamAtPath(DEFLATED_SUBPATH)->ReadView(0, 100).empty());
+}
+
+TEST_CASE("Whole items can be read with or without a size hint", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    archive.EachItem([&](const ArchiveItemInfo& info) {
+        CAPTURE(info.Path());
+        std::vector<uint8_t> expected = ReadEverything(archive.ByteStreamAtPath(info.Path()).get());
+        
+        ByteBuffer sized = archive.ByteStreamAtPath(info.Path())->ReadAllBytes();
+        REQUIRE(sized.GetBufferSize() == info.UncompressedSize());
+        REQUIRE(std::equal(expected.begin(), expected.end(), sized.GetBytes()));
+        
+        UnsizedByteStream unsized(archive.ByteStreamAtPath(info.Path()));
+        ByteBuffer grown = unsized.ReadAllBytes();
+        REQUIRE(grown == sized);
+        
+        void* raw = nullptr;
+        size_t rawLen = archive.ByteStreamAtPath(info.Path())->ReadAllBytes(&raw);
+        REQUIRE(rawLen == sized.GetBufferSize());
+        if ( rawLen != 0 )
+            REQUIRE(memcmp(raw, sized.GetBytes(), rawLen) == 0);
+        free(raw);
+    });
+}
+
+TEST_CASE("Benchmark: reading a 50MB item in one go", "[.][benchmark]")
+{
+    static const char* kPath = "readall-benchmark.zip";
+    static const size_t kSize = 50*1024*1024;
+    
+    // somewhat compressible content, so it gets deflated
+    std::vector<uint8_t> content(kSize);
+    for ( size_t i = 0; i < kSize; i++ )
+        content[i] = uint8_t((i * 2654435761u) >> ((i & 7) + 13));
+    
+    std::remove(kPath);
+    int zerr = 0;
+    struct zip* z = zip_open(kPath, ZIP_CREATE, &zerr);
+    REQUIRE(z != nullptr);
+    struct zip_source* src = zip_source_buffer(z, content.data(), content.size(), 0);
+    REQUIRE(src != nullptr);
+    REQUIRE(zip_add(z, "large.bin", src) >= 0);
+    REQUIRE(zip_close(z) == 0);
+    
+    auto time = [&](const char* label, std::function<ByteBuffer()> fn) {
+        auto start = std::chrono::steady_clock::now();
+        ByteBuffer result = fn();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        REQUIRE(result.GetBufferSize() == kSize);
+        REQUIRE(memcmp(result.GetBytes(), content.data(), kSize) == 0);
+        WARN(label << ": " << elapsed.count() << "ms");
+    };
+    
+    ZipArchive archive(kPath);
+    MappedZipArchive mapped(kPath);
+    time("libzip, sized", [&]() { return archive.ByteStreamAtPath("large.bin")->ReadAllBytes(); });
+    time("mapped, sized", [&]() { return mapped.ByteStreamAtPath("large.bin")->ReadAllBytes(); });
+    time("libzip, unsized", [&]() { return UnsizedByteStream(archive.ByteStreamAtPath("large.bin")).ReadAllBytes(); });
+    
+    std::remove(kPath);
+}
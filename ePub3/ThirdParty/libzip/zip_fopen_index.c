@@ -36,6 +36,13 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(_MSC_VER)
+# include <windows.h>
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
 
 #include "zipint.h"
 
@@ -47,6 +54,7 @@
 #endif
 
 static struct zip_file *_zip_file_new(struct zip *za);
+static ssize_t _zip_pread(FILE *fp, void *buf, size_t len, off_t offset);
 
 
 
@@ -108,6 +116,7 @@ zip_fopen_index(struct zip *za, int fileno, int flags)
 	zip_fclose(zf);
 	return NULL;
     }
+    zf->data_fpos = zf->fpos;
     
     if ((zf->flags & ZIP_ZF_DECOMP) == 0)
 	zf->bytes_left = zf->cbytes_left;
@@ -171,16 +180,14 @@ _zip_file_fillbuf(void *buf, size_t buflen, struct zip_file *zf)
     if ((zf->flags & ZIP_ZF_EOF) || zf->cbytes_left <= 0 || buflen <= 0)
 	return 0;
     
-    if (fseeko(zf->za->zp, zf->fpos, SEEK_SET) < 0) {
-	_zip_error_set(&zf->error, ZIP_ER_SEEK, errno);
-	return -1;
-    }
     if (buflen < zf->cbytes_left)
 	i = (ssize_t)buflen;
     else
 	i = zf->cbytes_left;
 
-    j = (ssize_t)fread(buf, 1, i, zf->za->zp);
+    /* read using positional I/O, leaving the shared file position
+       alone, so files within the same archive can be read concurrently */
+    j = _zip_pread(zf->za->zp, buf, (size_t)i, zf->fpos);
     if (j == 0) {
 	_zip_error_set(&zf->error, ZIP_ER_EOF, 0);
 	j = -1;
@@ -231,8 +238,46 @@ _zip_file_new(struct zip *za)
     zf->method = -1;
     zf->bytes_left = zf->cbytes_left = 0;
     zf->fpos = 0;
+    zf->data_fpos = 0;
     zf->buffer = NULL;
     zf->zstr = NULL;
 
     return zf;
 }
+
+
+
+/* pread() on the archive's descriptor, or the Windows equivalent */
+static ssize_t
+_zip_pread(FILE *fp, void *buf, size_t len, off_t offset)
+{
+#if defined(_MSC_VER)
+    HANDLE h;
+    OVERLAPPED ov;
+    DWORD n;
+
+    h = (HANDLE)_get_osfhandle(fileno(fp));
+    if (h == INVALID_HANDLE_VALUE) {
+	errno = EBADF;
+	return -1;
+    }
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+    if (!ReadFile(h, buf, (DWORD)len, &n, &ov)) {
+	if (GetLastError() == ERROR_HANDLE_EOF)
+	    return 0;
+	errno = EIO;
+	return -1;
+    }
+    return (ssize_t)n;
+#else
+    ssize_t n;
+
+    do {
+	n = pread(fileno(fp), buf, len, offset);
+    } while (n < 0 && errno == EINTR);
+    return n;
+#endif
+}
@@ -114,8 +114,7 @@ int _zip_fseek_bytes(struct zip_file* zf, off_t abspos, off_t flen)
         /* added by DRM inside, C.H. Yu on 2015-04-13 */
         // Without following added codes, uncompressed EPUB media content would not be properly random accessed,
         // such as bad index access error
-        zf->fpos = _zip_file_get_offset_safe(zf->za, zf->file_index);
-        zf->fpos += flen;
+        zf->fpos = zf->data_fpos + flen;
         zf->cbytes_left = 0;
         /* adding end */
     }
@@ -173,7 +172,7 @@ int _zip_fseek_to_start(struct zip_file* zf)
     zf->file_fpos = 0;
     zf->bytes_left = zf->za->cdir->entry[zf->file_index].uncomp_size;
     zf->cbytes_left = zf->za->cdir->entry[zf->file_index].comp_size;
-    zf->fpos = _zip_file_get_offset_safe(zf->za, zf->file_index);
+    zf->fpos = zf->data_fpos;
     
     len = _zip_file_fillbuf(zf->buffer, BUFSIZE, zf);
     
@@ -150,6 +150,7 @@ struct zip_file {
     off_t file_fpos;    /* position within this file itself -- relative to data type being returned */
                         /* i.e. if ZIP_FL_COMPRESSED, this is offset into compressed bytes, */
                         /* otherwise offset is into decompressed bytes */
+    off_t data_fpos;    /* position of this file's data within the zip file */
 };
 
 /* zip archive directory entry (central or local) */
@@ -65,6 +65,7 @@ _EPUB_DECLARE_CLASS(RunLoop);
 _EPUB_DECLARE_CLASS(MediaSupportInfo);
 _EPUB_DECLARE_CLASS(Collection);
 _EPUB_DECLARE_CLASS(Link);
+_EPUB_DECLARE_CLASS(PackageMetadata);
 
 EPUB3_END_NAMESPACE
 
@@ -136,6 +136,60 @@ void *PassThroughFilter::FilterData(FilterContext *context, void *data, size_t l
     return buffer;
 }
 
+ContentFilter::SpanStatus PassThroughFilter::FilterSpan(FilterContext *context, FilterSpans &spans)
+{
+    PassThroughContext *ptContext = dynamic_cast<PassThroughContext *>(context);
+    SeekableByteStream *byteStream = (ptContext == nullptr ? nullptr : ptContext->GetSeekableByteStream());
+    if (byteStream == nullptr)
+    {
+        // One filter in a chain of filters: the input bytes are passed along as they are.
+        size_t len = std::min(spans.inputLength, spans.outputCapacity);
+        if (spans.output != spans.input && len > 0)
+        {
+            ::memcpy(spans.output, spans.input, len);
+        }
+        spans.inputConsumed = spans.outputProduced = len;
+        spans.outputNeeded = spans.inputLength - len;
+        return (len == spans.inputLength ? SpanStatus::Complete : SpanStatus::NeedsOutputSpace);
+    }
+
+    if (!byteStream->IsOpen())
+    {
+        return SpanStatus::Complete;
+    }
+
+    // Acting alone: read the requested bytes straight into the output span, with no
+    // temporary buffer.
+    ByteStream::size_type bytesToRead = 0;
+    if (!ptContext->GetByteRange().IsFullRange()) // range requests only
+    {
+        bytesToRead = (ByteStream::size_type)(ptContext->GetByteRange().Length());
+        byteStream->Seek(ptContext->GetByteRange().Location(), std::ios::beg);
+    }
+    else // whole file  only
+    {
+        byteStream->Seek(0, std::ios::beg);
+        bytesToRead = byteStream->BytesAvailable();
+    }
+
+    if (bytesToRead > spans.outputCapacity)
+    {
+        spans.outputNeeded = bytesToRead;
+        return SpanStatus::NeedsOutputSpace;
+    }
+
+    ByteStream::size_type total = 0;
+    while (total < bytesToRead)
+    {
+        ByteStream::size_type numRead = byteStream->ReadBytes(spans.output + total, bytesToRead - total);
+        if (numRead == 0)
+            break;
+        total += numRead;
+    }
+    spans.outputProduced = total;
+    return SpanStatus::Complete;
+}
+
 void PassThroughFilter::Register()
 {
     // The PassThroughFilter is put as the very first filter in the filter chain.
@@ -47,6 +47,8 @@ public:
     PassThroughFilter(PassThroughFilter &&o) : ContentFilter(std::move(o)) { }
 
     virtual void *FilterData(FilterContext *context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus FilterSpan(FilterContext *context, FilterSpans &spans) OVERRIDE;
     virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::SupportsByteRanges; }
 
     virtual ByteStream::size_type BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const OVERRIDE;
@@ -0,0 +1,606 @@
+//
+//  aes_cbc_decryptor.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <ePub3/base.h>
+
+#include "aes_cbc_decryptor.h"
+#include "container.h"
+#include "package.h"
+#include "filter_manager.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#if (EPUB_CPU(X86) || EPUB_CPU(X86_64)) && (EPUB_COMPILER(GCC) || EPUB_COMPILER(MSVC))
+# define AES_X86 1
+# include <wmmintrin.h>
+# if EPUB_COMPILER(MSVC)
+#  include <intrin.h>
+#  define AES_X86_TARGET
+# else
+#  include <cpuid.h>
+#  define AES_X86_TARGET __attribute__((target("aes,sse2")))
+# endif
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+# define AES_ARMV8 1
+# include <arm_neon.h>
+#endif
+
+EPUB3_BEGIN_NAMESPACE
+
+namespace
+{
+
+const int kMaxRounds = 14;
+
+/// The S-box inverse, and the inverse round tables for the table-based implementation.
+struct AESTables
+{
+    uint8_t     sbox[256];
+    uint8_t     invSbox[256];
+    uint32_t    td[4][256];
+};
+
+inline uint8_t Rotl8(uint8_t x, int shift)
+{
+    return uint8_t((x << shift) | (x >> (8 - shift)));
+}
+
+inline uint8_t GFMul(uint8_t a, uint8_t b)
+{
+    uint8_t result = 0;
+    while ( b != 0 )
+    {
+        if ( b & 1 )
+            result ^= a;
+        a = uint8_t((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+        b >>= 1;
+    }
+    return result;
+}
+
+inline uint32_t Ror32(uint32_t x, int shift)
+{
+    return (x >> shift) | (x << (32 - shift));
+}
+
+inline uint32_t LoadBE32(const uint8_t* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void StoreBE32(uint8_t* p, uint32_t v)
+{
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+const AESTables& Tables()
+{
+    static AESTables tables;
+    static std::once_flag built;
+    std::call_once(built, []{
+        // walk the multiplicative group using generator 3, pairing each element with its inverse
+        uint8_t p = 1, q = 1;
+        do
+        {
+            p = uint8_t(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+            q ^= uint8_t(q << 1);
+            q ^= uint8_t(q << 2);
+            q ^= uint8_t(q << 4);
+            if ( q & 0x80 )
+                q ^= 0x09;
+            tables.sbox[p] = uint8_t(q ^ Rotl8(q, 1) ^ Rotl8(q, 2) ^ Rotl8(q, 3) ^ Rotl8(q, 4) ^ 0x63);
+        } while ( p != 1 );
+        tables.sbox[0] = 0x63;
+
+        for ( int i = 0; i < 256; i++ )
+            tables.invSbox[tables.sbox[i]] = uint8_t(i);
+
+        for ( int i = 0; i < 256; i++ )
+        {
+            uint8_t s = tables.invSbox[i];
+            uint32_t word = (uint32_t(GFMul(s, 14)) << 24) | (uint32_t(GFMul(s, 9)) << 16) | (uint32_t(GFMul(s, 13)) << 8) | uint32_t(GFMul(s, 11));
+            tables.td[0][i] = word;
+            tables.td[1][i] = Ror32(word, 8);
+            tables.td[2][i] = Ror32(word, 16);
+            tables.td[3][i] = Ror32(word, 24);
+        }
+    });
+    return tables;
+}
+
+/// InvMixColumns applied to a single column.
+uint32_t InvMixColumn(uint32_t word)
+{
+    uint8_t a0 = uint8_t(word >> 24), a1 = uint8_t(word >> 16), a2 = uint8_t(word >> 8), a3 = uint8_t(word);
+    uint8_t b0 = GFMul(a0, 14) ^ GFMul(a1, 11) ^ GFMul(a2, 13) ^ GFMul(a3, 9);
+    uint8_t b1 = GFMul(a0, 9) ^ GFMul(a1, 14) ^ GFMul(a2, 11) ^ GFMul(a3, 13);
+    uint8_t b2 = GFMul(a0, 13) ^ GFMul(a1, 9) ^ GFMul(a2, 14) ^ GFMul(a3, 11);
+    uint8_t b3 = GFMul(a0, 11) ^ GFMul(a1, 13) ^ GFMul(a2, 9) ^ GFMul(a3, 14);
+    return (uint32_t(b0) << 24) | (uint32_t(b1) << 16) | (uint32_t(b2) << 8) | uint32_t(b3);
+}
+
+void DecryptBlockPortable(const AESTables& t, const uint32_t* rk, int rounds, const uint8_t* in, uint8_t* out)
+{
+    uint32_t s0 = LoadBE32(in) ^ rk[0];
+    uint32_t s1 = LoadBE32(in + 4) ^ rk[1];
+    uint32_t s2 = LoadBE32(in + 8) ^ rk[2];
+    uint32_t s3 = LoadBE32(in + 12) ^ rk[3];
+
+    for ( int r = 1; r < rounds; r++ )
+    {
+        rk += 4;
+        uint32_t t0 = t.td[0][s0 >> 24] ^ t.td[1][(s3 >> 16) & 0xff] ^ t.td[2][(s2 >> 8) & 0xff] ^ t.td[3][s1 & 0xff] ^ rk[0];
+        uint32_t t1 = t.td[0][s1 >> 24] ^ t.td[1][(s0 >> 16) & 0xff] ^ t.td[2][(s3 >> 8) & 0xff] ^ t.td[3][s2 & 0xff] ^ rk[1];
+        uint32_t t2 = t.td[0][s2 >> 24] ^ t.td[1][(s1 >> 16) & 0xff] ^ t.td[2][(s0 >> 8) & 0xff] ^ t.td[3][s3 & 0xff] ^ rk[2];
+        uint32_t t3 = t.td[0][s3 >> 24] ^ t.td[1][(s2 >> 16) & 0xff] ^ t.td[2][(s1 >> 8) & 0xff] ^ t.td[3][s0 & 0xff] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += 4;
+    const uint8_t* si = t.invSbox;
+    StoreBE32(out,      ((uint32_t(si[s0 >> 24]) << 24) | (uint32_t(si[(s3 >> 16) & 0xff]) << 16) | (uint32_t(si[(s2 >> 8) & 0xff]) << 8) | uint32_t(si[s1 & 0xff])) ^ rk[0]);
+    StoreBE32(out + 4,  ((uint32_t(si[s1 >> 24]) << 24) | (uint32_t(si[(s0 >> 16) & 0xff]) << 16) | (uint32_t(si[(s3 >> 8) & 0xff]) << 8) | uint32_t(si[s2 & 0xff])) ^ rk[1]);
+    StoreBE32(out + 8,  ((uint32_t(si[s2 >> 24]) << 24) | (uint32_t(si[(s1 >> 16) & 0xff]) << 16) | (uint32_t(si[(s0 >> 8) & 0xff]) << 8) | uint32_t(si[s3 & 0xff])) ^ rk[2]);
+    StoreBE32(out + 12, ((uint32_t(si[s3 >> 24]) << 24) | (uint32_t(si[(s2 >> 16) & 0xff]) << 16) | (uint32_t(si[(s1 >> 8) & 0xff]) << 8) | uint32_t(si[s0 & 0xff])) ^ rk[3]);
+}
+
+void DecryptCBCPortable(const uint32_t* rk, int rounds, const uint8_t* iv, uint8_t* blocks, size_t numBlocks)
+{
+    const AESTables& tables = Tables();
+    uint8_t prev[AESCBCDecryptor::BlockSize], cipher[AESCBCDecryptor::BlockSize];
+    std::memcpy(prev, iv, AESCBCDecryptor::BlockSize);
+    for ( size_t i = 0; i < numBlocks; i++ )
+    {
+        uint8_t* block = blocks + i * AESCBCDecryptor::BlockSize;
+        std::memcpy(cipher, block, AESCBCDecryptor::BlockSize);
+        DecryptBlockPortable(tables, rk, rounds, cipher, block);
+        for ( size_t j = 0; j < AESCBCDecryptor::BlockSize; j++ )
+            block[j] ^= prev[j];
+        std::memcpy(prev, cipher, AESCBCDecryptor::BlockSize);
+    }
+}
+
+#if AES_X86
+
+bool DetectHardwareAES()
+{
+#if EPUB_COMPILER(MSVC)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 25)) != 0;
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+        return false;
+    return (ecx & (1u << 25)) != 0;
+#endif
+}
+
+AES_X86_TARGET
+void DecryptCBCHardware(const uint8_t* roundKeys, int rounds, const uint8_t* iv, uint8_t* blocks, size_t numBlocks)
+{
+    __m128i rk[kMaxRounds + 1];
+    for ( int r = 0; r <= rounds; r++ )
+        rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys + r * AESCBCDecryptor::BlockSize));
+
+    __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    __m128i* p = reinterpret_cast<__m128i*>(blocks);
+    size_t i = 0;
+
+    // blocks are independent once the ciphertext is known, so keep four in flight
+    for ( ; i + 4 <= numBlocks; i += 4 )
+    {
+        __m128i c0 = _mm_loadu_si128(p + i), c1 = _mm_loadu_si128(p + i + 1), c2 = _mm_loadu_si128(p + i + 2), c3 = _mm_loadu_si128(p + i + 3);
+        __m128i s0 = _mm_xor_si128(c0, rk[0]), s1 = _mm_xor_si128(c1, rk[0]), s2 = _mm_xor_si128(c2, rk[0]), s3 = _mm_xor_si128(c3, rk[0]);
+        for ( int r = 1; r < rounds; r++ )
+        {
+            s0 = _mm_aesdec_si128(s0, rk[r]);
+            s1 = _mm_aesdec_si128(s1, rk[r]);
+            s2 = _mm_aesdec_si128(s2, rk[r]);
+            s3 = _mm_aesdec_si128(s3, rk[r]);
+        }
+        s0 = _mm_aesdeclast_si128(s0, rk[rounds]);
+        s1 = _mm_aesdeclast_si128(s1, rk[rounds]);
+        s2 = _mm_aesdeclast_si128(s2, rk[rounds]);
+        s3 = _mm_aesdeclast_si128(s3, rk[rounds]);
+        _mm_storeu_si128(p + i, _mm_xor_si128(s0, prev));
+        _mm_storeu_si128(p + i + 1, _mm_xor_si128(s1, c0));
+        _mm_storeu_si128(p + i + 2, _mm_xor_si128(s2, c1));
+        _mm_storeu_si128(p + i + 3, _mm_xor_si128(s3, c2));
+        prev = c3;
+    }
+    for ( ; i < numBlocks; i++ )
+    {
+        __m128i c = _mm_loadu_si128(p + i);
+        __m128i s = _mm_xor_si128(c, rk[0]);
+        for ( int r = 1; r < rounds; r++ )
+            s = _mm_aesdec_si128(s, rk[r]);
+        s = _mm_aesdeclast_si128(s, rk[rounds]);
+        _mm_storeu_si128(p + i, _mm_xor_si128(s, prev));
+        prev = c;
+    }
+}
+
+#elif AES_ARMV8
+
+bool DetectHardwareAES()
+{
+    // the compiler was told the extension is present
+    return true;
+}
+
+void DecryptCBCHardware(const uint8_t* roundKeys, int rounds, const uint8_t* iv, uint8_t* blocks, size_t numBlocks)
+{
+    uint8x16_t rk[kMaxRounds + 1];
+    for ( int r = 0; r <= rounds; r++ )
+        rk[r] = vld1q_u8(roundKeys + r * AESCBCDecryptor::BlockSize);
+
+    uint8x16_t prev = vld1q_u8(iv);
+    for ( size_t i = 0; i < numBlocks; i++ )
+    {
+        uint8_t* block = blocks + i * AESCBCDecryptor::BlockSize;
+        uint8x16_t c = vld1q_u8(block);
+        uint8x16_t s = c;
+        // AESD adds the round key first, so the rounds are shifted by one relative to AES-NI
+        for ( int r = 0; r < rounds - 1; r++ )
+            s = vaesimcq_u8(vaesdq_u8(s, rk[r]));
+        s = veorq_u8(vaesdq_u8(s, rk[rounds - 1]), rk[rounds]);
+        vst1q_u8(block, veorq_u8(s, prev));
+        prev = c;
+    }
+}
+
+#else
+
+bool DetectHardwareAES()
+{
+    return false;
+}
+
+void DecryptCBCHardware(const uint8_t*, int, const uint8_t*, uint8_t*, size_t)
+{
+}
+
+#endif
+
+bool HardwareAES()
+{
+    static const bool available = DetectHardwareAES();
+    return available;
+}
+
+ByteStream::size_type ReadFully(SeekableByteStream* byteStream, uint8_t* buf, ByteStream::size_type len)
+{
+    ByteStream::size_type total = 0;
+    while ( total < len )
+    {
+        ByteStream::size_type numRead = byteStream->ReadBytes(buf + total, len - total);
+        if ( numRead == 0 )
+            break;
+        total += numRead;
+    }
+    return total;
+}
+
+/// Validates the padding of a decrypted final block, returning its length or zero.
+size_t PaddingLength(const uint8_t* lastBlock)
+{
+    size_t pad = lastBlock[AESCBCDecryptor::BlockSize - 1];
+    if ( pad == 0 || pad > AESCBCDecryptor::BlockSize )
+        return 0;
+    return pad;
+}
+
+}
+
+AESCBCDecryptor::AESCBCContext::~AESCBCContext()
+{
+    // don't leave key material lying around
+    volatile uint8_t* keys = _roundKeys;
+    for ( size_t i = 0; i < sizeof(_roundKeys); i++ )
+        keys[i] = 0;
+    volatile uint32_t* words = _roundWords;
+    for ( size_t i = 0; i < sizeof(_roundWords) / sizeof(uint32_t); i++ )
+        words[i] = 0;
+}
+void AESCBCDecryptor::AESCBCContext::SetKey(const uint8_t* key, size_t keyLength)
+{
+    const AESTables& tables = Tables();
+    int nk = int(keyLength / 4);
+    int rounds = nk + 6;
+    int total = (rounds + 1) * 4;
+
+    // the standard (encryption) key schedule
+    uint32_t w[(MaxRounds+1)*4];
+    for ( int i = 0; i < nk; i++ )
+        w[i] = LoadBE32(key + i * 4);
+    uint8_t rcon = 1;
+    for ( int i = nk; i < total; i++ )
+    {
+        uint32_t temp = w[i-1];
+        if ( i % nk == 0 )
+        {
+            temp = (temp << 8) | (temp >> 24);
+            temp = (uint32_t(tables.sbox[temp >> 24]) << 24) | (uint32_t(tables.sbox[(temp >> 16) & 0xff]) << 16) | (uint32_t(tables.sbox[(temp >> 8) & 0xff]) << 8) | uint32_t(tables.sbox[temp & 0xff]);
+            temp ^= uint32_t(rcon) << 24;
+            rcon = GFMul(rcon, 2);
+        }
+        else if ( nk > 6 && i % nk == 4 )
+        {
+            temp = (uint32_t(tables.sbox[temp >> 24]) << 24) | (uint32_t(tables.sbox[(temp >> 16) & 0xff]) << 16) | (uint32_t(tables.sbox[(temp >> 8) & 0xff]) << 8) | uint32_t(tables.sbox[temp & 0xff]);
+        }
+        w[i] = w[i-nk] ^ temp;
+    }
+
+    // the equivalent inverse cipher uses the round keys in reverse, with
+    // InvMixColumns applied to all but the first and last
+    for ( int r = 0; r <= rounds; r++ )
+    {
+        for ( int c = 0; c < 4; c++ )
+        {
+            uint32_t word = w[(rounds - r) * 4 + c];
+            if ( r != 0 && r != rounds )
+                word = InvMixColumn(word);
+            _roundWords[r * 4 + c] = word;
+            StoreBE32(_roundKeys + r * BlockSize + c * 4, word);
+        }
+    }
+    _rounds = rounds;
+
+    volatile uint32_t* scrub = w;
+    for ( int i = 0; i < total; i++ )
+        scrub[i] = 0;
+}
+void AESCBCDecryptor::AESCBCContext::Decrypt(const uint8_t* iv, uint8_t* blocks, size_t numBlocks) const
+{
+    if ( HardwareAES() )
+        DecryptCBCHardware(_roundKeys, _rounds, iv, blocks, numBlocks);
+    else
+        DecryptCBCPortable(_roundWords, _rounds, iv, blocks, numBlocks);
+}
+
+size_t AESCBCDecryptor::KeyLengthForAlgorithm(const string& algorithm)
+{
+    if ( algorithm == "http://www.w3.org/2001/04/xmlenc#aes128-cbc" )
+        return 16;
+    if ( algorithm == "http://www.w3.org/2001/04/xmlenc#aes192-cbc" )
+        return 24;
+    if ( algorithm == "http://www.w3.org/2001/04/xmlenc#aes256-cbc" )
+        return 32;
+    return 0;
+}
+bool AESCBCDecryptor::UsesHardwareAES()
+{
+    return HardwareAES();
+}
+
+FilterContext* AESCBCDecryptor::InnerMakeFilterContext(ConstManifestItemPtr item) const
+{
+    AESCBCContext* context = new AESCBCContext;
+    EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
+    size_t keyLength = (encInfo == nullptr ? 0 : KeyLengthForAlgorithm(encInfo->Algorithm()));
+    if ( keyLength == 0 || !_keyProvider )
+        return context;
+
+    uint8_t key[MaxKeySize] = {0};
+    if ( _keyProvider(item, encInfo, key, keyLength) )
+        context->SetKey(key, keyLength);
+
+    volatile uint8_t* scrub = key;
+    for ( size_t i = 0; i < MaxKeySize; i++ )
+        scrub[i] = 0;
+    return context;
+}
+
+ByteStream::size_type AESCBCDecryptor::BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const
+{
+    AESCBCContext* p = dynamic_cast<AESCBCContext*>(context);
+    if ( p == nullptr || !p->HasKey() || byteStream == nullptr || !byteStream->IsOpen() )
+        return 0;
+    if ( p->PlainSizeKnown() )
+        return p->PlainSize();
+
+    byteStream->Seek(0, std::ios::beg);
+    ByteStream::size_type rawSize = byteStream->BytesAvailable();
+
+    // an IV and at least one block, with nothing left over
+    ByteStream::size_type plainSize = 0;
+    if ( rawSize >= 2 * BlockSize && rawSize % BlockSize == 0 )
+    {
+        // only the final block need be decrypted to find the padding
+        uint8_t tail[2 * BlockSize];
+        byteStream->Seek(rawSize - 2 * BlockSize, std::ios::beg);
+        if ( ReadFully(byteStream, tail, sizeof(tail)) == sizeof(tail) )
+        {
+            p->Decrypt(tail, tail + BlockSize, 1);
+            size_t pad = PaddingLength(tail + BlockSize);
+            if ( pad != 0 )
+                plainSize = rawSize - BlockSize - pad;
+        }
+    }
+
+    p->SetPlainSize(plainSize);
+    return plainSize;
+}
+
+bool AESCBCDecryptor::ClipRange(AESCBCContext* context, SeekableByteStream* byteStream, ByteStream::size_type* offset, ByteStream::size_type* length) const
+{
+    ByteStream::size_type plainSize = BytesAvailable(context, byteStream);
+    ByteRange& range = context->GetByteRange();
+    if ( range.IsFullRange() )
+    {
+        *offset = 0;
+        *length = plainSize;
+    }
+    else
+    {
+        *offset = range.Location();
+        *length = range.Length();
+    }
+
+    if ( *offset >= plainSize || *length == 0 )
+        return false;
+    *length = std::min(*length, plainSize - *offset);
+    return true;
+}
+ByteStream::size_type AESCBCDecryptor::CipherLengthForRange(ByteStream::size_type offset, ByteStream::size_type length)
+{
+    ByteStream::size_type firstBlock = offset / BlockSize;
+    ByteStream::size_type lastBlock = (offset + length - 1) / BlockSize;
+    return (lastBlock - firstBlock + 2) * BlockSize;
+}
+ByteStream::size_type AESCBCDecryptor::DecryptRange(AESCBCContext* context, SeekableByteStream* byteStream, ByteStream::size_type offset, ByteStream::size_type length, uint8_t* work) const
+{
+    // plaintext block N is ciphertext block N+1 in the resource, since the IV comes first;
+    // reading from block N gets us the block which acts as its IV, too
+    ByteStream::size_type firstBlock = offset / BlockSize;
+    ByteStream::size_type cipherLength = CipherLengthForRange(offset, length);
+    byteStream->Seek(firstBlock * BlockSize, std::ios::beg);
+    if ( ReadFully(byteStream, work, cipherLength) != cipherLength )
+        return 0;
+
+    context->Decrypt(work, work + BlockSize, cipherLength / BlockSize - 1);
+    std::memmove(work, work + BlockSize + (offset % BlockSize), length);
+    return length;
+}
+size_t AESCBCDecryptor::DecryptAll(AESCBCContext* context, uint8_t* data, size_t len) const
+{
+    if ( len < 2 * BlockSize || len % BlockSize != 0 )
+        return 0;
+
+    context->Decrypt(data, data + BlockSize, len / BlockSize - 1);
+    size_t pad = PaddingLength(data + len - BlockSize);
+    if ( pad == 0 )
+        return 0;
+
+    size_t plainLength = len - BlockSize - pad;
+    std::memmove(data, data + BlockSize, plainLength);
+    return plainLength;
+}
+
+void * AESCBCDecryptor::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
+{
+    *outputLen = 0;
+
+    AESCBCContext* p = dynamic_cast<AESCBCContext*>(context);
+    if ( p == nullptr || !p->HasKey() )
+        return nullptr;
+
+    SeekableByteStream* byteStream = p->GetSeekableByteStream();
+    if ( byteStream == nullptr )
+    {
+        // we've been handed the complete resource
+        *outputLen = DecryptAll(p, reinterpret_cast<uint8_t*>(data), len);
+        return (*outputLen == 0 ? nullptr : data);
+    }
+
+    ByteStream::size_type offset = 0, length = 0;
+    if ( !byteStream->IsOpen() || !ClipRange(p, byteStream, &offset, &length) )
+        return nullptr;
+
+    uint8_t* buf = p->GetAllocateTemporaryByteBuffer(CipherLengthForRange(offset, length));
+    *outputLen = DecryptRange(p, byteStream, offset, length, buf);
+    return buf;
+}
+ContentFilter::SpanStatus AESCBCDecryptor::FilterSpan(FilterContext* context, FilterSpans& spans)
+{
+    AESCBCContext* p = dynamic_cast<AESCBCContext*>(context);
+    if ( p == nullptr || !p->HasKey() )
+        return SpanStatus::Complete;
+
+    SeekableByteStream* byteStream = p->GetSeekableByteStream();
+    if ( byteStream == nullptr )
+    {
+        // the complete resource: the plaintext is at most the input less its IV
+        size_t maxPlain = (spans.inputLength > BlockSize ? spans.inputLength - BlockSize : 0);
+        if ( spans.outputCapacity < maxPlain )
+        {
+            spans.outputNeeded = maxPlain;
+            return SpanStatus::NeedsOutputSpace;
+        }
+
+        size_t plainLength = 0;
+        if ( spans.inputLength >= 2 * BlockSize && spans.inputLength % BlockSize == 0 )
+        {
+            std::vector<uint8_t> cipher(spans.input, spans.input + spans.inputLength);
+            plainLength = DecryptAll(p, cipher.data(), cipher.size());
+            std::memcpy(spans.output, cipher.data(), plainLength);
+            std::fill(cipher.begin(), cipher.end(), 0);
+        }
+        spans.inputConsumed = spans.inputLength;
+        spans.outputProduced = plainLength;
+        return SpanStatus::Complete;
+    }
+
+    ByteStream::size_type offset = 0, length = 0;
+    if ( !byteStream->IsOpen() || !ClipRange(p, byteStream, &offset, &length) )
+        return SpanStatus::Complete;
+
+    if ( length > spans.outputCapacity )
+    {
+        spans.outputNeeded = length;
+        return SpanStatus::NeedsOutputSpace;
+    }
+
+    // decrypt in the caller's storage when the extra blocks fit there too
+    ByteStream::size_type cipherLength = CipherLengthForRange(offset, length);
+    if ( cipherLength <= spans.outputCapacity )
+    {
+        spans.outputProduced = DecryptRange(p, byteStream, offset, length, spans.output);
+    }
+    else
+    {
+        uint8_t* buf = p->GetAllocateTemporaryByteBuffer(cipherLength);
+        spans.outputProduced = DecryptRange(p, byteStream, offset, length, buf);
+        std::memcpy(spans.output, buf, spans.outputProduced);
+    }
+    return SpanStatus::Complete;
+}
+
+void AESCBCDecryptor::Register(KeyProviderFn keyProvider)
+{
+    FilterManager::Instance()->RegisterFilter("AESCBCDecryptor", EPUBDecryption, [keyProvider](ConstPackagePtr package) -> ContentFilterPtr {
+        ConstContainerPtr container = package->GetContainer();
+        for ( auto& encInfo : container->EncryptionData() )
+        {
+            if ( KeyLengthForAlgorithm(encInfo->Algorithm()) != 0 )
+                return std::make_shared<AESCBCDecryptor>(keyProvider);
+        }
+
+        // opted out, nothing for us to do here
+        return nullptr;
+    });
+}
+
+EPUB3_END_NAMESPACE
@@ -0,0 +1,178 @@
+//
+//  aes_cbc_decryptor.h
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__aes_cbc_decryptor__
+#define __ePub3__aes_cbc_decryptor__
+
+#include <ePub3/filter.h>
+#include <ePub3/encryption.h>
+#include <ePub3/manifest.h>
+#include <ePub3/utilities/byte_stream.h>
+#include <functional>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ The AESCBCDecryptor class decrypts resources encrypted using the XML Encryption
+ AES-CBC block ciphers (`aes128-cbc`, `aes192-cbc` and `aes256-cbc`).
+
+ Each encrypted resource starts with a 16-byte initialization vector, followed by
+ the ciphertext, padded to a whole number of blocks. The last byte of the plaintext
+ gives the length of the padding, so the exact size of a resource can be found by
+ decrypting its final block alone.
+
+ Since each block is decrypted using only the ciphertext block preceding it, any
+ byte range can be served by reading and decrypting just the blocks which cover it.
+
+ The keys are not known to the SDK: they are obtained through a KeyProviderFn
+ supplied by the application. This filter is not registered by default; call
+ Register() to enable it.
+
+ Where the CPU provides AES instructions (AES-NI on x86, the ARMv8 cryptography
+ extension), those are used; otherwise a portable table-based implementation is.
+ @see http://www.w3.org/TR/xmlenc-core1/#sec-AES
+ */
+class AESCBCDecryptor : public ContentFilter, public PointerType<AESCBCDecryptor>
+{
+public:
+    static const size_t         BlockSize = 16;
+    static const size_t         MaxKeySize = 32;
+
+    /**
+     Supplies the key for an encrypted item.
+     @param item The manifest item being decrypted.
+     @param encInfo The item's encryption information, which identifies the
+     algorithm and the key retrieval method.
+     @param key Storage for the key.
+     @param keyLength The length of key the algorithm requires: 16, 24 or 32 bytes.
+     @result Return `true` if `key` was filled in, `false` if the key isn't available.
+     */
+    typedef std::function<bool(ConstManifestItemPtr item, EncryptionInfoPtr encInfo, uint8_t* key, size_t keyLength)> KeyProviderFn;
+
+    ///
+    /// The key length for an XML Encryption algorithm URI, or zero if it isn't an AES-CBC algorithm.
+    static EPUB3_EXPORT size_t KeyLengthForAlgorithm(const string& algorithm);
+
+    /**
+     The type-sniffer for AES-CBC applicability: the item's encryption information
+     must specify one of the AES-CBC algorithms.
+     */
+    static bool CBCTypeSniffer(ConstManifestItemPtr item) {
+        EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
+        return (encInfo != nullptr && KeyLengthForAlgorithm(encInfo->Algorithm()) != 0);
+    }
+
+private:
+    class AESCBCContext : public RangeFilterContext
+    {
+    public:
+        static const size_t     MaxRounds = 14;
+
+        AESCBCContext() : RangeFilterContext(), _rounds(0), _plainSize(0), _plainSizeKnown(false) {}
+        virtual ~AESCBCContext();
+
+        ///
+        /// Expands a key into the decryption round keys.
+        void                    SetKey(const uint8_t* key, size_t keyLength);
+        bool                    HasKey()                const   { return _rounds != 0; }
+
+        ///
+        /// Decrypts whole blocks in place; `iv` is the ciphertext block preceding them.
+        void                    Decrypt(const uint8_t* iv, uint8_t* blocks, size_t numBlocks) const;
+
+        bool                    PlainSizeKnown()        const   { return _plainSizeKnown; }
+        ByteStream::size_type   PlainSize()             const   { return _plainSize; }
+        void                    SetPlainSize(ByteStream::size_type size) { _plainSize = size; _plainSizeKnown = true; }
+
+    private:
+        int                     _rounds;
+        uint8_t                 _roundKeys[(MaxRounds+1)*BlockSize];    ///< Decryption order, as bytes for the AES instructions.
+        uint32_t                _roundWords[(MaxRounds+1)*4];           ///< The same keys, as big-endian column words.
+        ByteStream::size_type   _plainSize;
+        bool                    _plainSizeKnown;
+
+    };
+
+public:
+    /**
+     Create an AES-CBC decryption filter.
+     @param keyProvider The function used to obtain each item's key.
+     */
+    AESCBCDecryptor(KeyProviderFn keyProvider) : ContentFilter(CBCTypeSniffer), _keyProvider(keyProvider) {}
+    AESCBCDecryptor(const AESCBCDecryptor& o) : ContentFilter(o), _keyProvider(o._keyProvider) {}
+    AESCBCDecryptor(AESCBCDecryptor&& o) : ContentFilter(std::move(o)), _keyProvider(std::move(o._keyProvider)) {}
+    virtual ~AESCBCDecryptor() {}
+
+    virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE;
+    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::SupportsByteRanges; }
+
+    ///
+    /// The exact size of the decrypted resource, found from its padding.
+    virtual ByteStream::size_type BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const OVERRIDE;
+
+    ///
+    /// Whether the AES instructions of the CPU are used.
+    static EPUB3_EXPORT bool UsesHardwareAES();
+
+    /**
+     Registers the filter with the FilterManager.
+     @param keyProvider The function used to obtain each item's key.
+     */
+    static void Register(KeyProviderFn keyProvider);
+
+protected:
+    virtual FilterContext *InnerMakeFilterContext(ConstManifestItemPtr item) const OVERRIDE;
+
+private:
+    KeyProviderFn           _keyProvider;
+
+    ///
+    /// There is no default constructor.
+    AESCBCDecryptor() _DELETED_;
+
+    ///
+    /// Clips a requested range to the plaintext; returns `false` if nothing is left.
+    bool                    ClipRange(AESCBCContext* context, SeekableByteStream* byteStream, ByteStream::size_type* offset, ByteStream::size_type* length) const;
+    ///
+    /// The bytes of ciphertext (including the preceding block) needed to decrypt a range.
+    static ByteStream::size_type CipherLengthForRange(ByteStream::size_type offset, ByteStream::size_type length);
+    ///
+    /// Decrypts a clipped range into `work`, which holds CipherLengthForRange() bytes; the plaintext is left at its start.
+    ByteStream::size_type   DecryptRange(AESCBCContext* context, SeekableByteStream* byteStream, ByteStream::size_type offset, ByteStream::size_type length, uint8_t* work) const;
+    ///
+    /// Decrypts a complete resource in place, returning the length of its plaintext.
+    size_t                  DecryptAll(AESCBCContext* context, uint8_t* data, size_t len) const;
+
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__aes_cbc_decryptor__) */
@@ -41,9 +41,10 @@ void Archive::RegisterArchive(CreatorFn creator, SnifferFn sniffer)
 }
 void Archive::Initialize()
 {
-    RegisterArchive([](const string& path) { return std::unique_ptr<ZipArchive>(new ZipArchive(path)); },
+    // MappedZipArchive falls back to stdio if the file can't be mapped
+    RegisterArchive([](const string& path) { return std::unique_ptr<ZipArchive>(new MappedZipArchive(path)); },
                     [](const string& path) { return path.rfind(".zip") == path.size()-4; });
-    RegisterArchive([](const string& path) { return std::unique_ptr<ZipArchive>(new ZipArchive(path)); },
+    RegisterArchive([](const string& path) { return std::unique_ptr<ZipArchive>(new MappedZipArchive(path)); },
                     [](const string& path) { return path.rfind(".epub") == path.size()-5; });
 }
 std::unique_ptr<Archive> Archive::Open(const string& path)
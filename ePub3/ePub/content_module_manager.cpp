@@ -69,6 +69,24 @@ ContentModuleManager* ContentModuleManager::Instance() _NOEXCEPT
 //    return ptr;
 }
 
+class ContentModuleManager::ProcessingScope
+{
+public:
+    ProcessingScope(ContentModuleManager* manager) : _manager(manager)
+    {
+        std::lock_guard<std::mutex> _(_manager->_processingLock);
+        _manager->_processingThreads.insert(std::this_thread::get_id());
+    }
+    ~ProcessingScope()
+    {
+        std::lock_guard<std::mutex> _(_manager->_processingLock);
+        _manager->_processingThreads.erase(_manager->_processingThreads.find(std::this_thread::get_id()));
+    }
+    
+private:
+    ContentModuleManager*   _manager;
+};
+
 void ContentModuleManager::RegisterContentModule(ContentModule* module,
                                                  const ePub3::string& name) _NOEXCEPT
 {
@@ -78,6 +96,12 @@ void ContentModuleManager::RegisterContentModule(ContentModule* module,
     _known_modules[name] = std::shared_ptr<ContentModule>(module);
 }
 
+bool ContentModuleManager::IsProcessingFileOnCurrentThread() const _NOEXCEPT
+{
+    std::lock_guard<std::mutex> _(_processingLock);
+    return _processingThreads.count(std::this_thread::get_id()) != 0;
+}
+
 #if FUTURE_ENABLED
 
 void ContentModuleManager::DisplayMessage(const string& title, const string& message) _NOEXCEPT
@@ -112,6 +136,7 @@ ContentModuleManager::LoadContentAtPath(const string& path, launch policy)
     }
     
     future<ContainerPtr> result;
+    ProcessingScope processing(this);
 
     for (auto& item : _known_modules)
     {
@@ -159,6 +184,9 @@ ContentModuleManager::LoadContentAtPath(const string& path, launch policy)
             return nullptr;
         }
 
+        // the packages the modules open can't preload until Unpack_Finally(true), below
+        ProcessingScope processing(this);
+
         for (auto& item : _known_modules)
         {
             std::shared_ptr<ContentModule> modulePtr = item.second;
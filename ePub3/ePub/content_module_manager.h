@@ -36,6 +36,9 @@
 #include <ePub3/utilities/utfstring.h>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #if FUTURE_ENABLED
 #include <mutex>
@@ -69,6 +72,12 @@ public:
     void
     RegisterContentModule(ContentModule* module,
                           const ePub3::string& name) _NOEXCEPT;
+    
+    ///
+    /// Whether a Content Module is opening a file on the calling thread; the filters
+    /// it registers aren't in place yet, so its package's filter chain isn't final.
+    bool
+    IsProcessingFileOnCurrentThread() const _NOEXCEPT;
 
     ////////////////////////////////////////////////////
     // Services for DRM implementations
@@ -92,6 +101,12 @@ std::mutex                                          _mutex;
 
     std::map<string, std::shared_ptr<ContentModule>>    _known_modules;
     
+    mutable std::mutex                                  _processingLock;
+    std::multiset<std::thread::id>                      _processingThreads;
+    
+    /// Marks the calling thread as processing a file for as long as it exists.
+    class ProcessingScope;
+    
     friend class Container;
 
 #if FUTURE_ENABLED
@@ -29,6 +29,7 @@
 
 #include "encryption.h"
 #include "xpath_wrangler.h"
+#include <cstdlib>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -84,6 +85,7 @@ bool EncryptionInfo::ParseXML(shared_ptr<xml::Node> node)
                 return false;
         
         _uncompressed_size = strings[0];
+        _original_length = std::strtoull(strings[0].c_str(), nullptr, 10);
     }
 
     return true;
@@ -64,13 +64,13 @@ public:
 public:
     ///
     /// Creates a new EncryptionInfo with no details filled in.
-    EncryptionInfo(ContainerPtr owner) : OwnedBy(owner), _algorithm(), _path(), _compression_method(), _uncompressed_size(), _keyRetrievalMethodType() {}
+    EncryptionInfo(ContainerPtr owner) : OwnedBy(owner), _algorithm(), _path(), _compression_method(), _uncompressed_size(), _keyRetrievalMethodType(), _original_length(0) {}
     ///
     /// Copy constructor.
-    EncryptionInfo(const EncryptionInfo& o) : OwnedBy(o), _algorithm(o._algorithm), _path(o._path), _compression_method(o._compression_method), _uncompressed_size(o._uncompressed_size), _keyRetrievalMethodType(o._keyRetrievalMethodType) {}
+    EncryptionInfo(const EncryptionInfo& o) : OwnedBy(o), _algorithm(o._algorithm), _path(o._path), _compression_method(o._compression_method), _uncompressed_size(o._uncompressed_size), _keyRetrievalMethodType(o._keyRetrievalMethodType), _original_length(o._original_length) {}
     ///
     /// Move constructor.
-    EncryptionInfo(EncryptionInfo&& o) : OwnedBy(std::move(o)), _algorithm(std::move(o._algorithm)), _path(std::move(o._path)),  _compression_method(std::move(o._compression_method)), _uncompressed_size(std::move(o._uncompressed_size)), _keyRetrievalMethodType(std::move(o._keyRetrievalMethodType)) {}
+    EncryptionInfo(EncryptionInfo&& o) : OwnedBy(std::move(o)), _algorithm(std::move(o._algorithm)), _path(std::move(o._path)),  _compression_method(std::move(o._compression_method)), _uncompressed_size(std::move(o._uncompressed_size)), _keyRetrievalMethodType(std::move(o._keyRetrievalMethodType)), _original_length(o._original_length) {}
     virtual ~EncryptionInfo() {}
     
     
@@ -115,6 +115,14 @@ public:
     // Return additional information for the compressed and encrypted contents
     virtual const string&           CompressionMethod()                     const   { return _compression_method; }
     virtual const string&           UnCompressedSize()                      const   { return _uncompressed_size;}
+    
+    ///
+    /// Whether the resource was deflated before it was encrypted (a Compression method of `8`).
+    /// @see http://www.idpf.org/epub/301/spec/epub-ocf.html#app-schema-encryption
+    virtual bool                    IsCompressed()                          const   { return _compression_method == "8"; }
+    ///
+    /// The declared length of the resource before it was compressed, or zero if none was given.
+    virtual uint64_t                OriginalLength()                        const   { return _original_length; }
 
 
 protected:
@@ -126,6 +134,7 @@ protected:
     // To get additional information for the compressed and encrypted contents
     string          _compression_method;  //  Compression method : 0(no compression), 8(deflated)
     string          _uncompressed_size;   //  Uncompressed size of the content
+    uint64_t        _original_length;     ///< The uncompressed size, as a number.
 
 };
 
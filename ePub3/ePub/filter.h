@@ -35,8 +35,10 @@
 #include <ePub3/manifest.h>
 #include <ePub3/encryption.h>
 #include <string>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <stdexcept>
 #include <ePub3/utilities/byte_stream.h>
 
 EPUB3_BEGIN_NAMESPACE
@@ -254,6 +256,10 @@ public:
     /// This is the priority at which XML-ENC and XML-DSig filters take place.
     static const FilterPriority EPUBDecryption          = 750;
     
+    ///
+    /// This is the priority at which resources which were compressed before being encrypted are inflated.
+    static const FilterPriority EPUBDecompression       = 700;
+    
     ///
     /// This is the priority at which HTML content is modified to process `<switch>` elements and similar.
     static const FilterPriority SwitchStaticHandling    = 500;
@@ -291,6 +297,40 @@ public:
         SupportsByteRanges     /** < This ContentFilter can operate on specific byte ranges. */
     };
     
+    /**
+     The outcome of a call to FilterSpan().
+     */
+    enum class SpanStatus
+    {
+        Complete,               ///< All the consumed input has been filtered, and its output written.
+        NeedsOutputSpace        ///< The output span is too small; call again with at least `outputNeeded` bytes of space.
+    };
+    
+    /**
+     The input and output of a call to FilterSpan(), along with the progress made.
+     
+     The caller fills in the input and output spans; the filter fills in the rest.
+     Input which hasn't been consumed must be passed again on the next call, after
+     any output has been taken.
+     */
+    struct FilterSpans
+    {
+        const uint8_t*  input;              ///< The bytes to filter; `nullptr` when a range filter reads its own input.
+        size_t          inputLength;        ///< The number of bytes at `input`.
+        bool            inputIsFinal;       ///< Whether the end of the resource's data is within this input.
+        uint8_t*        output;             ///< Where the filtered bytes are written.
+        size_t          outputCapacity;     ///< The number of bytes which may be written to `output`.
+        size_t          inputConsumed;      ///< On return, the number of input bytes used.
+        size_t          outputProduced;     ///< On return, the number of bytes written to `output`.
+        size_t          outputNeeded;       ///< On return, with SpanStatus::NeedsOutputSpace, the space needed to make progress.
+        
+        FilterSpans(const void* in, size_t inLen, void* out, size_t outCapacity, bool final=true)
+            : input(reinterpret_cast<const uint8_t*>(in)), inputLength(inLen), inputIsFinal(final),
+              output(reinterpret_cast<uint8_t*>(out)), outputCapacity(outCapacity),
+              inputConsumed(0), outputProduced(0), outputNeeded(0)
+            {}
+    };
+    
 private:
     ///
     /// No default constructor.
@@ -343,6 +383,53 @@ public:
     virtual OperatingMode GetOperatingMode() const { return OperatingMode::Standard; }
 
     virtual ByteStream::size_type BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const { return byteStream->BytesAvailable(); };
+    
+    /**
+     Whether this filter's output is always exactly as long as its input.
+     
+     Subclasses which operate in OperatingMode::Standard, keep any positional state
+     in their FilterContext, and never change the length of the data should override
+     this to return `true`. When every filter applied to a resource does so, the
+     resource is filtered incrementally as it is read, using a bounded amount of
+     memory, rather than being filtered and cached in its entirety up front.
+     */
+    virtual bool PreservesLength() const { return false; }
+    
+    /**
+     Prepares this filter to produce one range of its output, when byte ranges are
+     served through a stack of filters (see FilterChainByteStreamRange).
+     
+     The filter reports the range of its input from which the requested output can be
+     produced. It may widen that range as needed: a block cipher, for example, would
+     align it to block boundaries. Any positional state held in `context` should be
+     reset so that the next call to FilterData() is treated as starting at
+     `*inputLocation`.
+     
+     The output produced from the input range must be the same length as that range.
+     Its first `*outputSkip` bytes will be discarded, as will anything beyond
+     `length` bytes after that.
+     
+     The default implementation supports stateless length-preserving filters in
+     OperatingMode::Standard, mapping each range onto itself.
+     @param context The filter's context for the resource being read.
+     @param location The offset of the first byte of output required.
+     @param length The number of bytes of output required.
+     @param inputLocation On return, the offset of the first byte of input needed.
+     @param inputLength On return, the number of bytes of input needed.
+     @param outputSkip On return, the number of leading output bytes to discard.
+     @result `false` if this filter can't produce arbitrary ranges of its output.
+     */
+    virtual bool PrepareForRange(FilterContext* context, ByteStream::size_type location, ByteStream::size_type length,
+                                 ByteStream::size_type* inputLocation, ByteStream::size_type* inputLength,
+                                 ByteStream::size_type* outputSkip) const
+    {
+        if ( GetOperatingMode() != OperatingMode::Standard || !PreservesLength() )
+            return false;
+        *inputLocation = location;
+        *inputLength = length;
+        *outputSkip = 0;
+        return true;
+    }
 
     ///
     /// Obtains the type-sniffer for this filter.
@@ -373,6 +460,73 @@ public:
      */
     virtual void *FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) = 0;
     
+    ///
+    /// Whether this filter implements FilterSpan(). Filters which do should override this to return `true`.
+    virtual bool SupportsSpans() const { return false; }
+    
+    /**
+     The allocation-free processing function, writing into caller-provided storage.
+     
+     The filter reads from the input span and writes to the output span, reporting
+     how much of each it used. If the output span can't hold what the filter has to
+     write, it writes what it can and returns SpanStatus::NeedsOutputSpace, setting
+     `outputNeeded`; any output it has produced but not written is kept in its
+     context until the next call.
+     
+     The spans must not overlap, except that a length-preserving filter (see
+     PreservesLength()) may be given the same storage for both.
+     
+     Range filters (in OperatingMode::SupportsByteRanges) are given no input, and read
+     the range set in their RangeFilterContext directly into the output span. They
+     write the whole range or nothing: if it doesn't fit, `outputNeeded` is set to its
+     full size.
+     
+     Only filters which return `true` from SupportsSpans() implement this; the default
+     throws std::logic_error.
+     @param context The filter's context for the resource being read.
+     @param spans The input and output spans, which also receive the results.
+     @result Whether the call completed, or needs more output space.
+     */
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans)
+    {
+        throw std::logic_error("ContentFilter: this filter does not support spans");
+    }
+    
+    /**
+     Filters data in place, through FilterSpan() if possible, or FilterData().
+     
+     This may be used only with length-preserving filters, or others whose output is
+     never longer than their input, and not with range filters, which read their own
+     input.
+     @param context The filter's context for the resource being read.
+     @param data The data to filter, which is replaced by the output.
+     @param len The number of bytes in `data`.
+     @result The number of filtered bytes now in `data`.
+     */
+    size_t FilterInPlace(FilterContext* context, void* data, size_t len)
+    {
+        if ( SupportsSpans() )
+        {
+            FilterSpans spans(data, len, data, len, false);
+            if ( FilterSpan(context, spans) != SpanStatus::Complete || spans.inputConsumed != len )
+                throw std::logic_error("ContentFilter: filter output does not fit in place");
+            return spans.outputProduced;
+        }
+        
+        size_t filteredLen = 0;
+        void* filteredData = FilterData(context, data, len, &filteredLen);
+        if ( filteredData != data && filteredData != nullptr )
+        {
+            bool fits = (filteredLen <= len);
+            if ( fits )
+                ::memcpy(data, filteredData, filteredLen);
+            delete[] reinterpret_cast<uint8_t*>(filteredData);
+            if ( !fits )
+                throw std::logic_error("ContentFilter: filter output does not fit in place");
+        }
+        return (filteredData == nullptr ? 0 : filteredLen);
+    }
+    
 protected:
     TypeSnifferFn       _sniffer;
     
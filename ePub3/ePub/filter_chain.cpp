@@ -30,6 +30,7 @@
 #include "filter_chain.h"
 #include "filter_chain_byte_stream.h"
 #include "filter_chain_byte_stream_range.h"
+#include "filter_chain_pipeline.h"
 #include "../ePub/manifest.h"
 #include "filter.h"
 #include "byte_buffer.h"
@@ -45,66 +46,71 @@
 EPUB3_BEGIN_NAMESPACE
 
 #ifdef SUPPORT_ASYNC
-std::unique_ptr<thread_pool> FilterChain::_filterThreadPool(nullptr);
-
 std::shared_ptr<AsyncByteStream> FilterChain::GetFilteredOutputStreamForManifestItem(ConstManifestItemPtr item) const
 {
-    std::unique_ptr<AsyncByteStream> rawInput = item->AsyncReader();
+    unique_ptr<SeekableByteStream> rawInput(dynamic_cast<SeekableByteStream *>(item->Reader().release()));
+    if (!rawInput || !rawInput->IsOpen())
+        return nullptr;
     
-    // transfer ownership to a new shared_ptr
-    ChainLink input = ChainLink(rawInput.release());
-    shared_vector<ChainLinkProcessor> thisChain;
+    std::vector<ContentFilterPtr> thisChain = FiltersForItem(item);
+    std::shared_ptr<FilterChainPipeline> pipeline = std::make_shared<FilterChainPipeline>(std::move(rawInput), thisChain, item, WorkStealingPool::Shared());
     
-    AsyncPipe::Pair linkPipe;
+    AsyncPipe::Pair linkPipe = AsyncPipe::LinkedPair();
+    std::shared_ptr<AsyncByteStream> output = linkPipe.first;
     
-    for ( ContentFilterPtr filter : _filters )
-    {
-        if ( filter->TypeSniffer()(item) )
+    // moves as much as both sides allow; called by the pipeline as bytes are filtered, and by the pipe as the client reads
+    auto lock = std::make_shared<std::mutex>();
+    auto pump = [lock](FilterChainPipeline* source, AsyncByteStream* sink) {
+        std::lock_guard<std::mutex> _(*lock);
+        uint8_t buf[ASYNC_BUF_SIZE];
+        size_t bytesToMove = 0;
+        while ( sink->IsOpen() && (bytesToMove = std::min(std::min(source->BytesAvailable(), sink->SpaceAvailable()), size_t(ASYNC_BUF_SIZE))) > 0 )
         {
-            if ( !thisChain.empty() )
-                thisChain.back()->SetOutputLink(linkPipe.first);
-            
-            thisChain.push_back(ChainLinkProcessor::New(filter, input, item));
-            linkPipe = AsyncPipe::LinkedPair();
-            input = linkPipe.second;
+            bytesToMove = source->ReadBytes(buf, bytesToMove);
+            sink->WriteBytes(buf, bytesToMove);
         }
-    }
-    
-    // if no filters apply, read raw bytes
-    if ( thisChain.empty() )
-        return input;
-    
-    // otherwise, attach the output pipe
-    thisChain.back()->SetOutputLink(linkPipe.first);
-
-    static std::once_flag __once;
-    std::call_once(__once, [](){
-        _filterThreadPool.reset(new thread_pool(thread_pool::Automatic));
-    });
-    
-    // set it to run on a runloop somewhere...
-    _filterThreadPool->add([thisChain]() mutable {
-        RunLoopPtr myRunLoop = RunLoop::CurrentRunLoop();
         
-        auto pos = thisChain.rbegin();
-        auto end = thisChain.rend();
-        while ( pos != end )
+        if ( source->AtEnd() && sink->IsOpen() )
         {
-            (*pos)->ScheduleProcessor(myRunLoop);
-            ++pos;
+            source->SetOutputHandler(nullptr);
+            sink->Close();
         }
+    };
+    
+    // the pipe only refers weakly to the pipeline, which owns the pipe's writing end through its handler
+    std::weak_ptr<FilterChainPipeline> weakPipeline(pipeline);
+    output->SetEventHandler([weakPipeline, pump](AsyncEvent evt, AsyncByteStream* stream) {
+        auto source = weakPipeline.lock();
+        if ( !bool(source) )
+            return;
         
-        // as a file/zip-based async stream, the raw input stream will automatically
-        // read bytes from the underlying resource on a shared background thread,
-        // thus feeding the chain that follows
-        
-        // Note that the input stream is returned to us already opened.
-        
-        // run until all sources have been removed
-        myRunLoop->Run();
+        switch ( evt )
+        {
+            case AsyncEvent::HasSpaceAvailable:
+                pump(source.get(), stream);
+                break;
+                
+            case AsyncEvent::ErrorOccurred:
+                std::cerr << "FilterChain output stream error: " << stream->Error() << std::endl;
+                // fall through
+            case AsyncEvent::EndEncountered:
+                source->SetOutputHandler(nullptr);
+                source->Close();
+                break;
+                
+            default:
+                break;
+        }
+    });
+    output->SetTargetRunLoop(RunLoop::CurrentRunLoop());
+    
+    FilterChainPipeline* source = pipeline.get();
+    pipeline->SetOutputHandler([pipeline, output, pump]() {
+        pump(pipeline.get(), output.get());
     });
+    pump(source, output.get());
     
-    // return the output pipe
+    // return the reading end of the pipe
     return linkPipe.second;
 }
 #endif /* SUPPORT_ASYNC */
@@ -122,15 +128,23 @@ std::shared_ptr<ByteStream> FilterChain::GetFilterChainByteStream(ConstManifestI
 
 std::unique_ptr<ByteStream> FilterChain::GetFilterChainByteStream(ConstManifestItemPtr item, SeekableByteStream *rawInput) const
 {
-    std::vector<ContentFilterPtr> thisChain;
-    for (ContentFilterPtr filter : _filters)
-    {
-        if (filter->TypeSniffer()(item))
-            thisChain.push_back(filter);
-    }
+    std::vector<ContentFilterPtr> thisChain = FiltersForItem(item);
     
     unique_ptr<SeekableByteStream> rawInputPtr(rawInput);
-    return unique_ptr<FilterChainByteStream>(new FilterChainByteStream(std::move(rawInputPtr), thisChain, item));
+    if (thisChain.empty() || _cache->Budget() == 0)
+        return unique_ptr<FilterChainByteStream>(new FilterChainByteStream(std::move(rawInputPtr), thisChain, item));
+    
+    // the cache belongs to this chain, so the item alone identifies its filtered content
+    std::string key = item->AbsolutePath().stl_str();
+    FilteredContentCache::Entry content = _cache->Find(key);
+    if (content)
+        return unique_ptr<FilterChainByteStream>(new FilterChainByteStream(std::move(rawInputPtr), content));
+    
+    unique_ptr<FilterChainByteStream> result(new FilterChainByteStream(std::move(rawInputPtr), thisChain, item));
+    content = result->ShareFilteredContent();
+    if (content)
+        _cache->Insert(key, content);
+    return std::move(result);
 }
 
 std::shared_ptr<ByteStream> FilterChain::GetFilterChainByteStreamRange(ConstManifestItemPtr item) const
@@ -141,222 +155,227 @@ std::shared_ptr<ByteStream> FilterChain::GetFilterChainByteStreamRange(ConstMani
         return nullptr;
     }
     
-    return shared_ptr<ByteStream>(GetFilterChainByteStreamRange(item, byteStream.release()).release());
+    // on failure, we still own the raw stream
+    unique_ptr<ByteStream> result = GetFilterChainByteStreamRange(item, byteStream.get());
+    if (result)
+        byteStream.release();
+    return shared_ptr<ByteStream>(result.release());
 }
 
 std::unique_ptr<ByteStream> FilterChain::GetFilterChainByteStreamRange(ConstManifestItemPtr item, SeekableByteStream *rawInput) const
 {
-    unique_ptr<ByteStream> resultStream;
-    uint nFilters = 0;
-    for (ContentFilterPtr filter : _filters)
+    // A range-capable filter (which reads the raw bytes itself) may come first; any filters
+    // after it must be able to map each range of their output onto their input. Range-capable
+    // filters which preserve length can do that too, so they may also be stacked. Any other
+    // range-capable filter starts a new stage, reading the output of the stages before it.
+    struct Stage
     {
-        if (filter->TypeSniffer()(item))
+        ContentFilterPtr                rangeFilter;
+        std::vector<ContentFilterPtr>   stackedFilters;
+    };
+    std::vector<Stage> stages(1);
+    for (ContentFilterPtr filter : FiltersForItem(item))
+    {
+        Stage& stage = stages.back();
+        ContentFilter::OperatingMode mode = filter->GetOperatingMode();
+        if (mode == ContentFilter::OperatingMode::SupportsByteRanges && !stage.rangeFilter && stage.stackedFilters.empty())
         {
-            nFilters++;
-            if (nFilters > 1)
-            {
-                continue;
-            }
-            
-            if (filter->GetOperatingMode() == ContentFilter::OperatingMode::SupportsByteRanges)
-            {
-                unique_ptr<SeekableByteStream> rawInputPtr(rawInput);
-                resultStream.reset(new FilterChainByteStreamRange(std::move(rawInputPtr), filter, item));
-            }
+            stage.rangeFilter = filter;
         }
+        else if (mode != ContentFilter::OperatingMode::RequiresCompleteData && filter->PreservesLength())
+        {
+            stage.stackedFilters.push_back(filter);
+        }
+        else if (mode == ContentFilter::OperatingMode::SupportsByteRanges)
+        {
+            stages.emplace_back();
+            stages.back().rangeFilter = filter;
+        }
+        else
+        {
+            // this filter needs to see more than the requested range...abort!
+            return nullptr;
+        }
+    }
+    
+    // With no filters at all, this will simply put out raw bytes.
+    unique_ptr<SeekableByteStream> input(rawInput);
+    unique_ptr<FilterChainByteStreamRange> result;
+    for (Stage& stage : stages)
+    {
+        if (result)
+            input.reset(new SeekableFilterChainByteStreamRange(std::move(result)));
+        
+        if (stage.stackedFilters.empty())
+            result.reset(new FilterChainByteStreamRange(std::move(input), stage.rangeFilter, item));
+        else
+            result.reset(new FilterChainByteStreamRange(std::move(input), stage.rangeFilter, std::move(stage.stackedFilters), item));
     }
     
-    if (nFilters > 1)
+    return std::move(result);
+}
+
+std::shared_ptr<ByteStream> FilterChain::GetFilterChainPipeline(ConstManifestItemPtr item) const
+{
+    unique_ptr<SeekableByteStream> byteStream(dynamic_cast<SeekableByteStream *>(item->Reader().release()));
+    if (!byteStream || !byteStream->IsOpen())
     {
-        // more than one filter...abort!
         return nullptr;
     }
+
+    return shared_ptr<ByteStream>(GetFilterChainPipeline(item, byteStream.release()).release());
+}
+
+std::unique_ptr<ByteStream> FilterChain::GetFilterChainPipeline(ConstManifestItemPtr item, SeekableByteStream *rawInput) const
+{
+    std::vector<ContentFilterPtr> thisChain = FiltersForItem(item);
     
-    // There are no ContentFilter classes that curretly apply.
-    // In this case, return an empty FilterChainByteStreamRange, that will simply put out raw bytes.
-    if (!resultStream)
+    unique_ptr<SeekableByteStream> rawInputPtr(rawInput);
+    if (!thisChain.empty() && _cache->Budget() != 0)
     {
-        unique_ptr<SeekableByteStream> rawInputPtr(rawInput);
-        resultStream.reset(new FilterChainByteStreamRange(std::move(rawInputPtr), nullptr, nullptr));
+        FilteredContentCache::Entry content = _cache->Find(item->AbsolutePath().stl_str());
+        if (content)
+            return unique_ptr<FilterChainByteStream>(new FilterChainByteStream(std::move(rawInputPtr), content));
     }
     
-    return resultStream;
+    return unique_ptr<FilterChainPipeline>(new FilterChainPipeline(std::move(rawInputPtr), thisChain, item, WorkStealingPool::Shared()));
 }
 
 size_t FilterChain::GetFilterChainSize(ConstManifestItemPtr item) const
 {
-    size_t numFilters = 0;
+    return FiltersForItem(item).size();
+}
+
+void FilterChain::PrecomputeApplicability(const ManifestTable& manifest)
+{
+    _applicability.clear();
     
-    for (ContentFilterPtr filter : _filters)
+    // too many filters for a mask: keep sniffing on each request
+    if (_filters.size() > sizeof(ApplicabilityMask) * 8)
+        return;
+    
+    _applicability.reserve(manifest.size());
+    for (auto& pair : manifest)
     {
-        if (filter->TypeSniffer()(item))
+        ApplicabilityMask mask = 0;
+        for (size_t i = 0; i < _filters.size(); i++)
         {
-            numFilters++;
+            if (_filters[i]->TypeSniffer()(pair.second))
+                mask |= ApplicabilityMask(1) << i;
         }
+        _applicability[pair.second.get()] = mask;
     }
-
-    return numFilters;
 }
 
-#ifdef SUPPORT_ASYNC
-FilterChain::ChainLinkProcessor::ChainLinkProcessor(ContentFilterPtr filter, ChainLink input, ConstManifestItemPtr item)
-  : _filter(filter),
-    _context(filter->MakeFilterContext(item)),
-    _input(input),
-    _output(nullptr),
-    _collectionBuffer()
+std::vector<ContentFilterPtr> FilterChain::FiltersForItem(ConstManifestItemPtr item) const
 {
+    std::vector<ContentFilterPtr> result;
+    
+    auto found = _applicability.find(item.get());
+    if (found != _applicability.end())
+    {
+        size_t i = 0;
+        for (ApplicabilityMask mask = found->second; mask != 0; mask >>= 1, i++)
+        {
+            if (mask & 1)
+                result.push_back(_filters[i]);
+        }
+        return result;
+    }
+    
+    for (ContentFilterPtr filter : _filters)
+    {
+        if (filter->TypeSniffer()(item))
+            result.push_back(filter);
+    }
+    return result;
 }
 
-FilterChain::ChainLinkProcessor::~ChainLinkProcessor()
+FilteredContentCache::Entry FilteredContentCache::Find(const std::string& key)
 {
+    std::lock_guard<std::mutex> _(_lock);
+    auto found = _index.find(key);
+    if (found == _index.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+    
+    _hits++;
+    _entries.splice(_entries.begin(), _entries, found->second);
+    return found->second->second;
 }
 
-void FilterChain::ChainLinkProcessor::ScheduleProcessor(RunLoopPtr runLoop)
+void FilteredContentCache::Insert(const std::string& key, Entry content)
 {
-    if ( _filter->RequiresCompleteData() )
-        _collectionBuffer.SetUsesSecureErasure();
+    if (!content)
+        return;
     
-    std::weak_ptr<ChainLinkProcessor> weakSelf(Ptr());
-    _input->SetEventHandler([this, weakSelf](AsyncEvent evt, AsyncByteStream* stream) {
-        // we use this variable ONLY to ensure that the 'this' ptr is still valid
-        auto strongSelf = weakSelf.lock();
-        if ( !bool(strongSelf) )
-            return;
-        
-        switch ( evt )
-        {
-            case AsyncEvent::HasBytesAvailable:
-            {
-                // we *know* that all links on a given chain fire events serially on
-                // the same thread, so we don't need to dick about with locks here
-                
-                // there are bytes available to read -- pump as many through as we can
-                ssize_t numMoved = FunnelBytes();
-                if ( numMoved == 0 && !_output->IsOpen() )
-                    stream->Close();
-                
-                break;
-            }
-                
-            case AsyncEvent::ErrorOccurred:
-                std::cerr << "ChainLinkProcessor input stream error: " << stream->Error() << std::endl;
-                _output->Close();
-                break;
-                
-            case AsyncEvent::EndEncountered:
-            {
-                if ( _filter->RequiresCompleteData() )
-                {
-                    size_t filteredLen = 0;
-                    void* filteredData = _filter->FilterData(_context.get(), _collectionBuffer.GetBytes(), _collectionBuffer.GetBufferSize(), &filteredLen);
-                    if ( filteredData == nullptr || filteredLen == 0 ) {
-                        if (filteredData != nullptr && filteredData != _collectionBuffer.GetBytes())
-                            delete[] reinterpret_cast<uint8_t*>(filteredData);
-                        throw std::logic_error("ChainLinkProcessor: ContentFilter::FilterData() returned no data!");
-                    }
+    std::lock_guard<std::mutex> _(_lock);
+    size_t size = content->GetBufferSize();
+    if (size > _budget)
+        return;
+    
+    auto found = _index.find(key);
+    if (found != _index.end())
+    {
+        _size -= found->second->second->GetBufferSize();
+        _entries.erase(found->second);
+        _index.erase(found);
+    }
+    
+    EvictToFit(_budget - size);
+    _entries.emplace_front(key, content);
+    _index[key] = _entries.begin();
+    _size += size;
+}
 
-                    // forward the data
-                    uint8_t *outputData = reinterpret_cast<uint8_t*>(filteredData);
-                    size_t offset = 0;
-                    
-                    while ( offset < filteredLen )
-                    {
-                        offset += _output->WriteBytes(&outputData[offset], filteredLen-offset);
-                        if ( offset < filteredLen )
-                            std::this_thread::yield();
-                    }
+void FilteredContentCache::SetBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _budget = bytes;
+    EvictToFit(_budget);
+}
 
-                    if (filteredData != _collectionBuffer.GetBytes())
-                        delete[] reinterpret_cast<uint8_t*>(filteredData);
+size_t FilteredContentCache::Budget() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _budget;
+}
 
-                    // (securely) remove all bytes from the buffer
-                    _collectionBuffer.RemoveBytes(_collectionBuffer.GetBufferSize());
-                }
-                
-                _output->Close();
-                break;
-            }
-            default:
-                break;
-        }
-    });
-    
-    // if this is the last link in the chain, this will ultimately be replaced by the
-    // SDK client. If it's only an intermediary link, however, we need to ensure that
-    // notification of read-space-available messages is passed back down the chain to
-    // the actual resource stream, otherwise the whole process may stall...
-    _output->SetEventHandler([this](AsyncEvent evt, AsyncByteStream* stream) {
-        switch ( evt )
-        {
-            case AsyncEvent::HasSpaceAvailable:
-            {
-                // pull more data through into the output stream
-                if ( FunnelBytes() <= 0 && (_input->AtEnd() || !_input->IsOpen()) )
-                {
-                    stream->Close();
-                    return;
-                }
-                
-                break;
-            }
-                
-            case AsyncEvent::ErrorOccurred:
-                std::cerr << "ChainLinkProcessor input stream error: " << stream->Error() << std::endl;
-                stream->Close();
-                if (bool(_input))
-                    _input->Close();
-                break;
-                
-            case AsyncEvent::EndEncountered:
-                if (bool(_input))
-                    _input->Close();
-                break;
-                
-            default:
-                break;
-        }
-    });
-    
-    _input->SetTargetRunLoop(runLoop);
-    _output->SetTargetRunLoop(runLoop);
+size_t FilteredContentCache::Size() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _size;
 }
 
-ssize_t FilterChain::ChainLinkProcessor::FunnelBytes()
+size_t FilteredContentCache::Hits() const
 {
-    uint8_t buf[ASYNC_BUF_SIZE];
-    size_t bytesToMove = std::min(_input->BytesAvailable(), _output->SpaceAvailable());
-    
-    while ( bytesToMove > 0 )
-    {
-        size_t thisChunk = std::min(size_t(ASYNC_BUF_SIZE), bytesToMove);
-        thisChunk = _input->ReadBytes(buf, thisChunk);      // consumes read bytes from the buffer
-        
-        if ( _filter->RequiresCompleteData() )
-        {
-            _collectionBuffer.AddBytes(buf, thisChunk);
-        }
-        else
-        {
-            size_t filteredLen = 0;
-            void* filteredData = _filter->FilterData(_context.get(), buf, thisChunk, &filteredLen);
-            if ( filteredData == nullptr || filteredLen == 0 ) {
-                if (filteredData != nullptr && filteredData != buf)
-                    delete[] reinterpret_cast<uint8_t*>(filteredData);
-                throw std::logic_error("ChainLinkProcessor: ContentFilter::FilterData() returned no data!");
-            }
+    std::lock_guard<std::mutex> _(_lock);
+    return _hits;
+}
+
+size_t FilteredContentCache::Misses() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _misses;
+}
 
-            _output->WriteBytes(filteredData, filteredLen);
+void FilteredContentCache::Purge()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    EvictToFit(0);
+}
 
-            if (filteredData != buf)
-                delete[] reinterpret_cast<uint8_t*>(filteredData);
-        }
-        
-        bytesToMove -= thisChunk;
+void FilteredContentCache::EvictToFit(size_t budget)
+{
+    // the buffers free (and securely erase) themselves once no stream is reading them
+    while (_size > budget && !_entries.empty())
+    {
+        _size -= _entries.back().second->GetBufferSize();
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
     }
-    
-    return (ssize_t)bytesToMove;
 }
-#endif /* SUPPORT_ASYNC */
 
 EPUB3_END_NAMESPACE
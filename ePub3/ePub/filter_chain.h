@@ -36,6 +36,10 @@
 #include <memory>
 #include <algorithm>
 #include <utility>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #if FUTURE_ENABLED
 #include <thread>
@@ -53,6 +57,56 @@ EPUB3_BEGIN_NAMESPACE
 class FilterContext;
 class ByteRange;
 
+/**
+ A memory-budgeted, least-recently-used cache of filtered content.
+ 
+ Entries are shared with the streams reading them, so an entry which is evicted
+ while being read stays alive until its last reader is destroyed. The content is
+ typically decrypted, so its buffers use secure erasure. All methods are
+ thread-safe.
+ */
+class FilteredContentCache
+{
+public:
+    typedef std::shared_ptr<const ByteBuffer>   Entry;
+    
+public:
+    FilteredContentCache() : _budget(0), _size(0), _hits(0), _misses(0) {}
+    ~FilteredContentCache() {}
+    
+    /// Looks up an entry, making it the most recently used one.
+    Entry               Find(const std::string& key);
+    /// Adds an entry, evicting others as needed; content larger than the budget is not kept.
+    void                Insert(const std::string& key, Entry content);
+    
+    /// Sets the maximum number of bytes to keep; zero disables the cache.
+    void                SetBudget(size_t bytes);
+    size_t              Budget()            const;
+    /// The number of bytes currently held.
+    size_t              Size()              const;
+    /// The number of lookups which found an entry.
+    size_t              Hits()              const;
+    /// The number of lookups which found nothing.
+    size_t              Misses()            const;
+    /// Discards all entries; the counters are left untouched.
+    void                Purge();
+    
+private:
+    typedef std::list<std::pair<std::string, Entry>>    EntryList;
+    
+    void                EvictToFit(size_t budget);
+    
+    mutable std::mutex                                      _lock;
+    EntryList                                               _entries;   ///< Most recently used first.
+    std::unordered_map<std::string, EntryList::iterator>    _index;
+    size_t                                                  _budget;
+    size_t                                                  _size;
+    size_t                                                  _hits;
+    size_t                                                  _misses;
+    
+    FilteredContentCache(const FilteredContentCache&)               _DELETED_;
+    FilteredContentCache&   operator=(const FilteredContentCache&)  _DELETED_;
+};
 
 class FilterChain : public PointerType<FilterChain>
 #if EPUB_PLATFORM(WINRT)
@@ -63,68 +117,94 @@ public:
     typedef shared_vector<ContentFilter>    FilterList;
     
 public:
-    FilterChain(FilterList filters) : _filters(filters) {}
+    FilterChain(FilterList filters) : _filters(filters), _applicability(), _cache(new FilteredContentCache) {}
 #if EPUB_COMPILER_SUPPORTS(CXX_DEFAULTED_FUNCTIONS)
-    FilterChain(FilterChain&& o) : _filters(std::move(o._filters)) {}
+    FilterChain(FilterChain&& o) : _filters(std::move(o._filters)), _applicability(std::move(o._applicability)), _cache(std::move(o._cache)) {}
     virtual ~FilterChain()                  = default;
     FilterChain& operator=(FilterChain&& o) {
         _filters = std::move(o._filters);
+        _applicability = std::move(o._applicability);
+        _cache = std::move(o._cache);
         return *this;
     }
 #else
-    FilterChain(FilterChain&& o) : _filters(std::move(o._filters)) {}
+    FilterChain(FilterChain&& o) : _filters(std::move(o._filters)), _applicability(std::move(o._applicability)), _cache(std::move(o._cache)) {}
     virtual ~FilterChain() {}
     FilterChain& operator=(FilterChain&& o) { swap(std::move(o)); return *this; }
 #endif
     
-    void swap(FilterChain&& __o) { _filters.swap(__o._filters); }
+    void swap(FilterChain&& __o) { _filters.swap(__o._filters); _applicability.swap(__o._applicability); _cache.swap(__o._cache); }
+    
+    /**
+     Determines once which filters apply to each item of a manifest.
+     
+     Each filter's type sniffer is run for every item, and the results are kept so
+     that setting up streams for those items runs no sniffers at all. Items not seen
+     here are still sniffed on every request. Call this again if the manifest or a
+     sniffer changes, and before the chain is shared between threads.
+     @param manifest The manifest of the package which owns this chain.
+     */
+    void PrecomputeApplicability(const ManifestTable& manifest);
     
     // obtains a stream which can be used to read filtered bytes from the chain
 
 #ifdef SUPPORT_ASYNC
+    /**
+     Creates an asynchronous stream of an item's filtered content.
+     
+     The content is filtered by a FilterChainPipeline on the shared WorkStealingPool,
+     and moved into the returned pipe as the client makes room in it; no thread
+     waits on either. The pipe's events are delivered on the calling thread's run loop.
+     */
     std::shared_ptr<AsyncByteStream> GetFilteredOutputStreamForManifestItem(ConstManifestItemPtr item) const;
 #endif /* SUPPORT_ASYNC */
 
     std::shared_ptr<ByteStream> GetFilterChainByteStream(ConstManifestItemPtr item) const;
     std::unique_ptr<ByteStream> GetFilterChainByteStream(ConstManifestItemPtr item, SeekableByteStream *rawInput) const;
     std::shared_ptr<ByteStream> GetFilterChainByteStreamRange(ConstManifestItemPtr item) const;
+    /**
+     Creates a stream which can serve byte ranges of an item's filtered content.
+     
+     Ranges can be served when the item's filters consist of at most one filter which
+     supports byte ranges, followed by any number of length-preserving filters. A
+     further filter which supports byte ranges reads the output of those before it
+     (see SeekableFilterChainByteStreamRange), and may be followed by length-preserving
+     filters in turn. Otherwise this returns `nullptr`, and the caller keeps ownership
+     of `rawInput`.
+     */
     std::unique_ptr<ByteStream> GetFilterChainByteStreamRange(ConstManifestItemPtr item, SeekableByteStream *rawInput) const;
+    std::shared_ptr<ByteStream> GetFilterChainPipeline(ConstManifestItemPtr item) const;
+    /**
+     Creates a stream which filters an item's content in chunks on the shared WorkStealingPool.
+     
+     Filtering starts at once and runs ahead of the reader by a few chunks, so many
+     items can be filtered in parallel (see FilterChainPipeline). Content already in
+     the cache is served from there instead.
+     */
+    std::unique_ptr<ByteStream> GetFilterChainPipeline(ConstManifestItemPtr item, SeekableByteStream *rawInput) const;
     size_t GetFilterChainSize(ConstManifestItemPtr item) const;
     
-protected:
-
-#ifdef SUPPORT_ASYNC
-    typedef std::shared_ptr<AsyncByteStream>    ChainLink;
-
-    class ChainLinkProcessor : public PointerType<ChainLinkProcessor>
-    {
-    public:
-        ChainLinkProcessor(ContentFilterPtr filter, ChainLink input, ConstManifestItemPtr manifestItem);
-        ChainLinkProcessor(const ChainLinkProcessor& o) : _filter(o._filter), _context(o._context), _input(o._input), _output(o._output), _collectionBuffer(o._collectionBuffer) {}
-        ChainLinkProcessor(ChainLinkProcessor&& o) : _filter(std::move(o._filter)), _context(o._context), _input(std::move(o._input)), _output(std::move(o._output)) {}
-        virtual ~ChainLinkProcessor();
-        
-        virtual void SetOutputLink(ChainLink output) { _output = output; }
-        
-        virtual void ScheduleProcessor(RunLoopPtr runLoop);
-        
-    protected:
-        ContentFilterPtr                _filter;
-        std::shared_ptr<FilterContext>  _context;
-        ChainLink                       _input;
-        ChainLink                       _output;
-        ByteBuffer                      _collectionBuffer;
-        
-        ssize_t FunnelBytes();
-        
-    };
-
-    static
-    std::unique_ptr<thread_pool>        _filterThreadPool;
-#endif /* SUPPORT_ASYNC */
-
+    /**
+     Obtains the cache of this chain's filtered content.
+     
+     Content which must be filtered in its entirety before it can be read is kept
+     after its first use, keyed by manifest item, so that further streams for the
+     same item skip the filters. Content filtered as it is read, and byte ranges,
+     bypass the cache. The cache is disabled until given a budget.
+     */
+    FilteredContentCache& FilteredContent() const { return *_cache; }
+    
     private:
+    /// One bit per filter in `_filters`, set for those which apply to an item.
+    typedef uint64_t                                                ApplicabilityMask;
+    typedef std::unordered_map<const ManifestItem*, ApplicabilityMask>  ApplicabilityTable;
+    
+    /// Returns the filters which apply to an item, in chain order.
+    std::vector<ContentFilterPtr>   FiltersForItem(ConstManifestItemPtr item) const;
+    
     FilterList              _filters;
+    ApplicabilityTable      _applicability;     ///< Precomputed masks, keyed by the manifest items of the owning package.
+    std::unique_ptr<FilteredContentCache>   _cache; ///< Belongs to this chain, as its entries depend on the filters it applies.
 
 };
 
@@ -62,7 +62,7 @@ FilterChainByteStream::~FilterChainByteStream()
 //}
 
 FilterChainByteStream::FilterChainByteStream(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem)
-: _input(std::move(input)), m_filters(), m_filterContexts(), _needs_cache(false), _cache(), _read_cache(), _cacheHasBeenFilledUp(false)
+: _input(std::move(input)), m_filters(), m_filterContexts(), _needs_cache(false), _cache(), _read_cache(), _cachePos(0), _cacheHasBeenFilledUp(false)
 {
     _cache.SetUsesSecureErasure();
     _read_cache.SetUsesSecureErasure();
@@ -72,12 +72,25 @@ FilterChainByteStream::FilterChainByteStream(std::unique_ptr<SeekableByteStream>
         m_filters.push_back(filter);
         m_filterContexts.push_back(std::unique_ptr<FilterContext>(filter->MakeFilterContext(manifestItem)));
     }
-	
-	// We are currently hardcoding _needs_cache to true, because we realized that this is the only way to realiably compute
-	// the content length of any resource being read by FilterChainByteStream. Only by processing the raw conten of a given
-	// resource through all the filters in the chaing, and storing the result in the cache, that we can reliably stablish the
-	// size of the resource after being processed.
-	_needs_cache = true;
+
+	// Processing the raw content of a resource through all the filters in the chain, and storing the result in the cache,
+	// is the only way to reliably establish the size of the resource after being processed. The exception is a chain made
+	// up entirely of length-preserving filters: the filtered size is then the raw size, so the content can be filtered
+	// chunk by chunk as it is read.
+    for (ContentFilterPtr filter : m_filters)
+    {
+        if (filter->GetOperatingMode() == ContentFilter::OperatingMode::RequiresCompleteData || !filter->PreservesLength())
+        {
+            _needs_cache = true;
+            break;
+        }
+    }
+}
+
+FilterChainByteStream::FilterChainByteStream(std::unique_ptr<SeekableByteStream>&& input, std::shared_ptr<const ByteBuffer> filteredContent)
+: _input(std::move(input)), m_filters(), m_filterContexts(), _needs_cache(true), _cache(), _read_cache(), _cachePos(0), _sharedCache(filteredContent), _cacheHasBeenFilledUp(true)
+{
+    _read_cache.SetUsesSecureErasure();
 }
 
 ByteStream::size_type FilterChainByteStream::ReadBytes(void* bytes, size_type len)
@@ -92,40 +105,48 @@ ByteStream::size_type FilterChainByteStream::ReadBytes(void* bytes, size_type le
         return ReadBytesFromCache(bytes, len);
     }
 
-    if (_read_cache.GetBufferSize() > 0)
+    if (!_input->IsOpen())
     {
-        size_type toMove = std::min(len, _read_cache.GetBufferSize());
-        ::memcpy_s(bytes, len, _read_cache.GetBytes(), toMove);
-        _read_cache.RemoveBytes(toMove);
-        return toMove;
+        return 0;
     }
-    else 
+
+    size_type result = _input->ReadBytes(bytes, len);
+    if (result == 0)
     {
-        if (!_input->IsOpen())
-        {
-            return 0;
-        }
+        return 0;
+    }
 
-        size_type result = _input->ReadBytes(bytes, len);
-        if (result == 0)
-        {
-            return 0;
-        }
+    return FilterBytesInPlace(bytes, result);
+}
 
-        result = FilterBytes(bytes, result);
-        if (result == 0)
-        {
-            return 0;
-        }
+ByteView FilterChainByteStream::ReadView(size_type offset, size_type len)
+{
+    if (!_needs_cache)
+        return ByteView();
 
-        size_type toMove = std::min(len, _read_cache.GetBufferSize());
-        if (toMove > 0)
-        {
-            ::memcpy_s(bytes, len, _read_cache.GetBytes(), toMove);
-            _read_cache.RemoveBytes(toMove);
-        }
-        return toMove;
-    }
+    if (_cache.GetBufferSize() == 0 && !_cacheHasBeenFilledUp)
+        CacheBytes();
+
+    const ByteBuffer& content = FilteredContent();
+    return ByteView(content.GetBytes(), content.GetBufferSize()).subview(offset, len);
+}
+
+std::shared_ptr<const ByteBuffer> FilterChainByteStream::ShareFilteredContent()
+{
+    if (!_needs_cache)
+        return nullptr;
+
+    if (_cache.GetBufferSize() == 0 && !_cacheHasBeenFilledUp)
+        CacheBytes();
+
+    if (!_cacheHasBeenFilledUp)
+        return nullptr;
+
+    // moving the buffer keeps its storage in place, so existing views stay valid
+    if (!_sharedCache)
+        _sharedCache = std::make_shared<ByteBuffer>(std::move(_cache));
+
+    return _sharedCache;
 }
 
 ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type len)
@@ -135,6 +156,8 @@ ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type
     size_type result = len;
     ByteBuffer buf(reinterpret_cast<uint8_t*>(bytes), len);
     buf.SetUsesSecureErasure();
+    ByteBuffer spare;       // output for filters which write into caller-provided storage
+    spare.SetUsesSecureErasure();
 
     for (int i = 0; i < m_filters.size(); i++)
     {
@@ -143,11 +166,11 @@ ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type
 
         size_type streamPos = 0;
 
-        // A filter may support ranges, but may be invoked in a non-HTTP-byte-range scenario
-        RangeFilterContext *filterContextRange = dynamic_cast<RangeFilterContext *>(filterContext);
+        // A filter may support ranges, but may be invoked in a non-HTTP-byte-range scenario.
+        // Only the first filter can read the raw bytes itself; later ones filter what they are given.
+        RangeFilterContext *filterContextRange = (i == 0 ? dynamic_cast<RangeFilterContext *>(filterContext) : nullptr);
         if (filterContextRange != nullptr)
         {
-            // ASSERT i == 0 ? (decryption filter always first, can access raw byte stream directly)
 
             ByteRange byteRange;
             if (!_needs_cache)
@@ -171,7 +194,22 @@ ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type
         size_type filteredLen = 0;
         void *filteredData = nullptr;
 
-        if (filterContextRange != nullptr)
+        if (filter->SupportsSpans())
+        {
+            if (filterContextRange == nullptr && filter->PreservesLength())
+            {
+                filteredLen = filter->FilterInPlace(filterContext, buf.GetBytes(), buf.GetBufferSize());
+            }
+            else if (filterContextRange != nullptr)
+            {
+                filteredLen = FilterSpansInto(filter.get(), filterContext, nullptr, 0, spare);
+            }
+            else
+            {
+                filteredLen = FilterSpansInto(filter.get(), filterContext, buf.GetBytes(), buf.GetBufferSize(), spare);
+            }
+        }
+        else if (filterContextRange != nullptr)
         {
             filteredData = filter->FilterData(filterContext, nullptr, 0, &filteredLen);
         }
@@ -194,6 +232,17 @@ ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type
             }
         }
 
+        if (filter->SupportsSpans())
+        {
+            if (filteredLen == 0)
+                return 0;
+
+            if (filterContextRange != nullptr || !filter->PreservesLength())
+                std::swap(buf, spare);
+            result = filteredLen;
+            continue;
+        }
+
         if (filteredData == nullptr || filteredLen == 0)
         {
             if (filteredData != nullptr && filteredData != buf.GetBytes())
@@ -241,13 +290,53 @@ ByteStream::size_type FilterChainByteStream::FilterBytes(void* bytes, size_type
     return result;
 }
 
+ByteStream::size_type FilterChainByteStream::FilterBytesInPlace(void* bytes, size_type len)
+{
+    // every filter preserves length, so each one's output can simply replace its input
+    for (size_t i = 0; i < m_filters.size(); i++)
+    {
+        if (m_filters[i]->FilterInPlace(m_filterContexts[i].get(), bytes, len) != len)
+            throw std::logic_error("FilterChainByteStream: a length-preserving filter changed the length of its data");
+    }
+
+    return len;
+}
+
+ByteStream::size_type FilterChainByteStream::FilterSpansInto(ContentFilter* filter, FilterContext* context, const uint8_t* input, size_type len, ByteBuffer& output)
+{
+    // start with room for as much output as input, growing as the filter asks
+    output.Resize(std::max(len, size_type(1)));
+    size_type consumed = 0;
+    size_type produced = 0;
+    for (;;)
+    {
+        ContentFilter::FilterSpans spans(input == nullptr ? nullptr : input + consumed, len - consumed,
+                                         output.GetBytes() + produced, output.GetBufferSize() - produced);
+        ContentFilter::SpanStatus status = filter->FilterSpan(context, spans);
+        consumed += spans.inputConsumed;
+        produced += spans.outputProduced;
+        if (status == ContentFilter::SpanStatus::Complete)
+            break;
+
+        output.Resize(produced + std::max(spans.outputNeeded, size_type(1)));
+    }
+
+    output.Resize(produced);
+    return produced;
+}
+
 ByteStream::size_type FilterChainByteStream::ReadBytesFromCache(void* bytes, size_type len)
 {
     if (len == 0) return 0;
 
-    size_type numToRead = std::min(len, size_type(_cache.GetBufferSize()));
-    ::memcpy_s(bytes, len, _cache.GetBytes(), numToRead);
-    _cache.RemoveBytes(numToRead);
+    // the cache is left intact so that views returned by ReadView() remain valid
+    const ByteBuffer& content = FilteredContent();
+    if (_cachePos >= content.GetBufferSize())
+        return 0;
+
+    size_type numToRead = std::min(len, size_type(content.GetBufferSize() - _cachePos));
+    ::memcpy_s(bytes, len, content.GetBytes() + _cachePos, numToRead);
+    _cachePos += numToRead;
     return numToRead;
 }
 
@@ -62,6 +62,8 @@ private:
     bool                            _needs_cache;
     ByteBuffer                        _cache;
     ByteBuffer                        _read_cache;
+    size_type                       _cachePos;      ///< Read position within `_cache`; its bytes stay in place until destruction.
+    std::shared_ptr<const ByteBuffer> _sharedCache; ///< Filtered content shared with a FilteredContentCache; replaces `_cache` when set.
 
 private:
     FilterChainByteStream(const FilterChainByteStream& o)             _DELETED_;
@@ -70,9 +72,15 @@ private:
     FilterChainByteStream&         operator=(FilterChainByteStream&&)                         _DELETED_;
 
 public:
-    FilterChainByteStream() : ByteStream(), _cacheHasBeenFilledUp(false) {}
+    FilterChainByteStream() : ByteStream(), _cachePos(0), _cacheHasBeenFilledUp(false) {}
     //EPUB3_EXPORT FilterChainByteStream(std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr &manifestItem);
     EPUB3_EXPORT FilterChainByteStream(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem);
+    /**
+     Creates a stream which serves content that has already been filtered.
+     @param input The raw input stream; it is not read.
+     @param filteredContent The filtered content, as returned by ShareFilteredContent().
+     */
+    EPUB3_EXPORT FilterChainByteStream(std::unique_ptr<SeekableByteStream>&& input, std::shared_ptr<const ByteBuffer> filteredContent);
     virtual ~FilterChainByteStream();
     
     virtual size_type BytesAvailable() _NOEXCEPT OVERRIDE
@@ -83,7 +91,7 @@ public:
 			{
 				CacheBytes();
 			}
-            return _cache.GetBufferSize();
+            return FilteredContent().GetBufferSize() - _cachePos;
         } else {
             return _input->BytesAvailable();
         }
@@ -101,7 +109,30 @@ public:
         _input->Close();
     }
     virtual size_type ReadBytes(void* bytes, size_type len) OVERRIDE;
+    
+    /**
+     Obtain direct access to the filtered content.
+     
+     The content is filtered and cached in its entirety on first use, and the view
+     refers to that cache. It remains valid until this stream is destroyed.
+     
+     When every filter preserves length, the content is filtered incrementally as it
+     is read instead; no cache exists, and an empty view is returned.
+     @see ByteStream::ReadView()
+     */
+    virtual ByteView ReadView(size_type offset, size_type len) OVERRIDE;
     //virtual size_type ReadBytes(void* bytes, size_type len, ByteRange &byteRange);
+    
+    /**
+     Obtain shared ownership of the filtered content.
+     
+     The content is filtered and cached in its entirety if that has not happened yet.
+     Any views returned by ReadView() remain valid.
+     @result The filtered content, or `nullptr` if the content is filtered as it is
+     read, or if there is none.
+     */
+    std::shared_ptr<const ByteBuffer> ShareFilteredContent();
+    
     virtual size_type WriteBytes(const void* bytes, size_type len) OVERRIDE
     {
         throw std::system_error(std::make_error_code(std::errc::operation_not_supported));
@@ -109,8 +140,8 @@ public:
     
     virtual bool AtEnd() const _NOEXCEPT OVERRIDE
     {
-        if (_needs_cache && _input->AtEnd()) {
-            return _cache.IsEmpty();
+        if (_needs_cache && (_cacheHasBeenFilledUp || _input->AtEnd())) {
+            return _cachePos >= FilteredContent().GetBufferSize();
         } else {
             return _input->AtEnd();
         }
@@ -120,10 +151,19 @@ public:
         return _input->Error();
     }
     
+    /**
+     Runs a filter's FilterSpan() over some input, growing the output as it asks.
+     @param input The data to filter, or `nullptr` if the filter reads its own input.
+     @result The number of bytes in `output`.
+     */
+    static size_type FilterSpansInto(ContentFilter* filter, FilterContext* context, const uint8_t* input, size_type len, ByteBuffer& output);
+    
 private:
+    const ByteBuffer& FilteredContent() const { return _sharedCache ? *_sharedCache : _cache; }
     size_type ReadBytesFromCache(void* bytes, size_type len);
     void CacheBytes();
     size_type FilterBytes(void* bytes, size_type len);
+    size_type FilterBytesInPlace(void* bytes, size_type len);
     //size_type FilterBytes(void* bytes, ByteRange &byteRange);
     
     bool _cacheHasBeenFilledUp;
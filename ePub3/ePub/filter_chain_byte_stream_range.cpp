@@ -45,10 +45,22 @@ FilterChainByteStreamRange::~FilterChainByteStreamRange()
 }
 
 FilterChainByteStreamRange::FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input, ContentFilterPtr filter, ConstManifestItemPtr manifestItem)
-: m_input(std::move(input)), m_filter(filter), m_filterContext(filter != nullptr ? std::unique_ptr<FilterContext>(filter->MakeFilterContext(manifestItem)) : nullptr)
+: m_input(std::move(input)), m_filter(filter), m_filterContext(filter != nullptr ? std::unique_ptr<FilterContext>(filter->MakeFilterContext(manifestItem)) : nullptr), m_totalSize(UnknownSize)
 {
 }
 
+FilterChainByteStreamRange::FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input, ContentFilterPtr filter, std::vector<ContentFilterPtr> rangeFilters, ConstManifestItemPtr manifestItem)
+: m_input(std::move(input)), m_filter(filter), m_filterContext(filter != nullptr ? std::unique_ptr<FilterContext>(filter->MakeFilterContext(manifestItem)) : nullptr), m_rangeFilters(std::move(rangeFilters)), m_totalSize(UnknownSize)
+{
+    for (ContentFilterPtr rangeFilter : m_rangeFilters)
+    {
+        m_rangeFilterContexts.push_back(std::unique_ptr<FilterContext>(rangeFilter->MakeFilterContext(manifestItem)));
+    }
+
+    // filtered data passes through the read cache
+    m_readCache.SetUsesSecureErasure();
+}
+
 //FilterChainByteStreamRange::FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input) : m_input(std::move(input))
 //{
 //}
@@ -89,6 +101,11 @@ ByteStream::size_type FilterChainByteStreamRange::ReadBytes(void *bytes, size_ty
         return 0;
     }
     
+    if (!m_rangeFilters.empty())
+    {
+        return ReadStackedRange(bytes, len, byteRange);
+    }
+
     if (!m_filter)
     {
         // There are no ContentFilters that applied. In this case, the caller is just interested
@@ -103,6 +120,21 @@ ByteStream::size_type FilterChainByteStreamRange::ReadBytes(void *bytes, size_ty
         filterContext->SetSeekableByteStream(m_input.get());
     }
 
+    if (filterContext != nullptr && m_filter->SupportsSpans())
+    {
+        // the filter reads its range straight into the caller's buffer
+        ContentFilter::FilterSpans spans(nullptr, 0, bytes, len);
+        ContentFilter::SpanStatus status = m_filter->FilterSpan(m_filterContext.get(), spans);
+
+        filterContext->GetByteRange().Reset();
+        filterContext->ResetSeekableByteStream();
+
+        // too small buffer
+        if (status != ContentFilter::SpanStatus::Complete)
+            return 0;
+        return spans.outputProduced;
+    }
+
     size_type filteredLen = 0;
     void *filteredData = nullptr;
 
@@ -184,4 +216,216 @@ ByteStream::size_type FilterChainByteStreamRange::ReadRawBytes(void *bytes, size
     return m_input->ReadBytes(bytes, bytesToRead);
 }
 
+ByteStream::size_type FilterChainByteStreamRange::TotalSize()
+{
+    if (m_totalSize == UnknownSize)
+    {
+        m_input->Seek(0, std::ios::beg);
+        m_totalSize = BytesAvailable();
+    }
+    return m_totalSize;
+}
+
+ByteStream::size_type FilterChainByteStreamRange::ReadStackedRange(void *bytes, size_type len, ByteRange &byteRange)
+{
+    size_type total = TotalSize();
+    size_type location = 0;
+    size_type length = total;
+    if (!byteRange.IsFullRange())
+    {
+        location = byteRange.Location();
+        length = byteRange.Length();
+    }
+    else if (total > len)
+    {
+        return 0; // Buffer is not big enough to take the entire file.
+    }
+
+    if (location >= total) return 0;
+    length = std::min(length, total - location);
+
+    // Work backwards from the requested output, asking each link which input it needs.
+    struct Span
+    {
+        size_type   skip;       // leading bytes of the link's output which precede the range it was asked for
+        size_type   length;     // the length of the range it was asked for
+    };
+    std::vector<Span> spans(m_rangeFilters.size());
+    for (size_t i = m_rangeFilters.size(); i-- > 0; )
+    {
+        size_type inputLocation = 0, inputLength = 0, outputSkip = 0;
+        if (!m_rangeFilters[i]->PrepareForRange(m_rangeFilterContexts[i].get(), location, length, &inputLocation, &inputLength, &outputSkip))
+        {
+            throw std::logic_error("FilterChainByteStreamRange: filter cannot produce byte ranges");
+        }
+
+        if (inputLocation >= total) return 0;
+        spans[i].skip = outputSkip;
+        spans[i].length = length;
+        location = inputLocation;
+        length = std::min(inputLength, total - inputLocation);
+    }
+
+    if (ReadSourceRange(location, length) == 0) return 0;
+
+    // Now filter forwards through the stack, trimming each link's output to the range it was asked for.
+    for (size_t i = 0; i < m_rangeFilters.size(); i++)
+    {
+        size_t filteredLen = m_rangeFilters[i]->FilterInPlace(m_rangeFilterContexts[i].get(), m_readCache.GetBytes(), m_readCache.GetBufferSize());
+        if (filteredLen == 0)
+        {
+            m_readCache.RemoveBytes(m_readCache.GetBufferSize());
+            return 0;
+        }
+
+        if (filteredLen < m_readCache.GetBufferSize())
+        {
+            m_readCache.Resize(filteredLen);
+        }
+
+        m_readCache.RemoveBytes(spans[i].skip);
+        if (m_readCache.GetBufferSize() > spans[i].length)
+            m_readCache.Resize(spans[i].length);
+    }
+
+    size_type result = std::min(len, size_type(m_readCache.GetBufferSize()));
+    ::memcpy_s(bytes, len, m_readCache.GetBytes(), result);
+    m_readCache.RemoveBytes(m_readCache.GetBufferSize());
+    return result;
+}
+
+ByteStream::size_type FilterChainByteStreamRange::ReadSourceRange(size_type location, size_type length)
+{
+    m_readCache.RemoveBytes(m_readCache.GetBufferSize());
+    if (length == 0) return 0;
+
+    RangeFilterContext *filterContext = dynamic_cast<RangeFilterContext *>(m_filterContext.get());
+    if (m_filter && filterContext != nullptr)
+    {
+        // the range-capable filter reads (and pads) its own input
+        filterContext->GetByteRange().Location((uint32_t)location);
+        filterContext->GetByteRange().Length((uint32_t)length);
+        filterContext->SetSeekableByteStream(m_input.get());
+
+        if (m_filter->SupportsSpans())
+        {
+            // read straight into the cache, making room if the filter needs more (to pad a block, say)
+            m_readCache.Resize(length);
+            ContentFilter::FilterSpans spans(nullptr, 0, m_readCache.GetBytes(), m_readCache.GetBufferSize());
+            bool failed = false;
+            while (m_filter->FilterSpan(m_filterContext.get(), spans) == ContentFilter::SpanStatus::NeedsOutputSpace)
+            {
+                // a filter which doesn't ask for more room than it already had would never finish
+                if (spans.outputNeeded <= m_readCache.GetBufferSize())
+                {
+                    failed = true;
+                    break;
+                }
+                m_readCache.Resize(spans.outputNeeded);
+                spans = ContentFilter::FilterSpans(nullptr, 0, m_readCache.GetBytes(), m_readCache.GetBufferSize());
+            }
+
+            filterContext->GetByteRange().Reset();
+            filterContext->ResetSeekableByteStream();
+
+            if (failed)
+            {
+                m_readCache.RemoveBytes(m_readCache.GetBufferSize());
+                return 0;
+            }
+
+            m_readCache.Resize(std::min(size_type(spans.outputProduced), length));
+            return m_readCache.GetBufferSize();
+        }
+
+        size_type filteredLen = 0;
+        void *filteredData = m_filter->FilterData(m_filterContext.get(), nullptr, 0, &filteredLen);
+
+        filterContext->GetByteRange().Reset();
+        filterContext->ResetSeekableByteStream();
+
+        if (filteredData == nullptr)
+            return 0;
+
+        m_readCache.AddBytes(reinterpret_cast<uint8_t *>(filteredData), std::min(filteredLen, length));
+        if (reinterpret_cast<uint8_t *>(filteredData) != filterContext->GetCurrentTemporaryByteBuffer())
+        {
+            delete[] reinterpret_cast<uint8_t *>(filteredData);
+        }
+        return m_readCache.GetBufferSize();
+    }
+
+    m_readCache.Resize(length);
+    m_input->Seek(location, std::ios::beg);
+
+    size_type total = 0;
+    while (total < length)
+    {
+        size_type numRead = m_input->ReadBytes(m_readCache.GetBytes() + total, length - total);
+        if (numRead == 0)
+            break;
+        total += numRead;
+    }
+
+    m_readCache.Resize(total);
+    return total;
+}
+
+SeekableFilterChainByteStreamRange::SeekableFilterChainByteStreamRange(std::unique_ptr<FilterChainByteStreamRange> &&input)
+: m_input(std::move(input)), m_position(0), m_totalSize(UnknownSize)
+{
+}
+
+ByteStream::size_type SeekableFilterChainByteStreamRange::TotalSize()
+{
+    if (m_totalSize == UnknownSize)
+        m_totalSize = m_input->BytesAvailable();
+    return m_totalSize;
+}
+
+ByteStream::size_type SeekableFilterChainByteStreamRange::BytesAvailable() _NOEXCEPT
+{
+    size_type total = TotalSize();
+    return (m_position < total ? total - m_position : 0);
+}
+
+ByteStream::size_type SeekableFilterChainByteStreamRange::ReadBytes(void *bytes, size_type len)
+{
+    size_type toRead = std::min(len, BytesAvailable());
+    if (toRead == 0) return 0;
+    
+    ByteRange range;
+    range.Location((uint32_t)m_position);
+    range.Length((uint32_t)toRead);
+    size_type numRead = m_input->ReadBytes(bytes, toRead, range);
+    m_position += numRead;
+    return numRead;
+}
+
+ByteStream::size_type SeekableFilterChainByteStreamRange::WriteBytes(const void *bytes, size_type len)
+{
+    throw std::system_error(std::make_error_code(std::errc::operation_not_supported));
+}
+
+ByteStream::size_type SeekableFilterChainByteStreamRange::Seek(size_type by, std::ios::seekdir dir)
+{
+    switch (dir)
+    {
+        case std::ios::beg:
+            m_position = by;
+            break;
+        case std::ios::cur:
+            m_position += by;
+            break;
+        case std::ios::end:
+            m_position = TotalSize() + by;
+            break;
+        default:
+            break;
+    }
+    
+    m_position = std::min(m_position, TotalSize());
+    return m_position;
+}
+
 EPUB3_END_NAMESPACE
@@ -36,6 +36,7 @@
 #include <memory>
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #if FUTURE_ENABLED
 #include <thread>
@@ -61,8 +62,23 @@ private:
     FilterChainByteStreamRange&         operator=(FilterChainByteStreamRange&&)                         _DELETED_;
 
 public:
-    FilterChainByteStreamRange() : ByteStream() {}
+    FilterChainByteStreamRange() : ByteStream(), m_totalSize(UnknownSize) {}
     EPUB3_EXPORT FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input, ContentFilterPtr filter, ConstManifestItemPtr manifestItem);
+    
+    /**
+     Creates a stream which serves byte ranges through a stack of filters.
+     
+     Each range is produced by asking each of `rangeFilters`, last to first, which range
+     of its input it needs (see ContentFilter::PrepareForRange()), reading only that
+     much from `input`, and filtering it forwards through the stack.
+     @param input The raw resource data.
+     @param filter An optional filter in ContentFilter::OperatingMode::SupportsByteRanges
+     mode, which reads directly from `input`.
+     @param rangeFilters Length-preserving filters applied, in order, to the output of
+     `filter` (or to the raw data).
+     @param manifestItem The item being read.
+     */
+    EPUB3_EXPORT FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input, ContentFilterPtr filter, std::vector<ContentFilterPtr> rangeFilters, ConstManifestItemPtr manifestItem);
     //EPUB3_EXPORT FilterChainByteStreamRange(std::unique_ptr<SeekableByteStream> &&input);
     virtual ~FilterChainByteStreamRange();
     
@@ -78,15 +94,64 @@ public:
     
 private:
     size_type ReadRawBytes(void *bytes, size_type len, ByteRange &byteRange);
+    size_type ReadStackedRange(void *bytes, size_type len, ByteRange &byteRange);
+    size_type ReadSourceRange(size_type location, size_type length);
+    size_type TotalSize();
     
     unique_ptr<SeekableByteStream> m_input;
 
     ContentFilterPtr m_filter;
     std::unique_ptr<FilterContext> m_filterContext;
 
+    std::vector<ContentFilterPtr> m_rangeFilters;
+    std::vector<std::unique_ptr<FilterContext>> m_rangeFilterContexts;
+    size_type m_totalSize;
+
     ByteBuffer m_readCache;
 };
 
+/**
+ Presents the filtered output of a FilterChainByteStreamRange as a seekable stream.
+ 
+ Each read is served as a byte range of the underlying stream, so a filter which
+ reads its own input (see ContentFilter::OperatingMode::SupportsByteRanges) can be
+ stacked on the output of others: inflating decrypted data, for example.
+ */
+class SeekableFilterChainByteStreamRange : public SeekableByteStream
+{
+private:
+    SeekableFilterChainByteStreamRange(const SeekableFilterChainByteStreamRange& o)         _DELETED_;
+    SeekableFilterChainByteStreamRange(SeekableFilterChainByteStreamRange&& o)              _DELETED_;
+    SeekableFilterChainByteStreamRange& operator=(SeekableFilterChainByteStreamRange&)      _DELETED_;
+    SeekableFilterChainByteStreamRange& operator=(SeekableFilterChainByteStreamRange&&)     _DELETED_;
+    
+public:
+    EPUB3_EXPORT SeekableFilterChainByteStreamRange(std::unique_ptr<FilterChainByteStreamRange> &&input);
+    virtual ~SeekableFilterChainByteStreamRange() {}
+    
+    virtual size_type BytesAvailable() _NOEXCEPT OVERRIDE;
+    virtual size_type SpaceAvailable() const _NOEXCEPT OVERRIDE { return 0; }
+    virtual bool IsOpen() const _NOEXCEPT OVERRIDE { return m_input->IsOpen(); }
+    virtual void Close() OVERRIDE { m_input->Close(); }
+    virtual size_type ReadBytes(void *bytes, size_type len) OVERRIDE;
+    virtual size_type WriteBytes(const void *bytes, size_type len) OVERRIDE;
+    virtual bool AtEnd() const _NOEXCEPT OVERRIDE { return m_totalSize != UnknownSize && m_position >= m_totalSize; }
+    virtual int Error() const _NOEXCEPT OVERRIDE { return m_input->Error(); }
+    virtual size_type Seek(size_type by, std::ios::seekdir dir) OVERRIDE;
+    virtual size_type Position() const OVERRIDE { return m_position; }
+    
+    ///
+    /// The filter state can't be shared, so this returns `nullptr`.
+    virtual std::shared_ptr<SeekableByteStream> Clone() const OVERRIDE { return nullptr; }
+    
+private:
+    size_type TotalSize();
+    
+    std::unique_ptr<FilterChainByteStreamRange> m_input;
+    size_type m_position;
+    size_type m_totalSize;
+};
+
 EPUB3_END_NAMESPACE
 
 #endif /* defined(__ePub3__filter_chain_byte_stream_range__) */
@@ -0,0 +1,377 @@
+//
+//  filter_chain_pipeline.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, 
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this 
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, 
+//  this list of conditions and the following disclaimer in the documentation and/or 
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be 
+//  used to endorse or promote products derived from this software without specific 
+//  prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "filter_chain_pipeline.h"
+#include "filter_chain_byte_stream.h"
+#include "../ePub/manifest.h"
+#include "filter.h"
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ The pipeline proper, shared by the stream and its queued tasks.
+ 
+ Stage zero reads the raw data, and stage `i + 1` runs link `i`; each stage writes
+ into the queue of the same index, so the last queue holds the output. All members
+ but the links' filter contexts and the input are guarded by `_lock`; those are only
+ touched by the single task running their stage.
+ */
+class FilterChainPipeline::State : public std::enable_shared_from_this<State>
+{
+public:
+    State(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem, WorkStealingPool& pool);
+    ~State() {}
+    
+    void            Start();
+    void            Abandon();
+    
+    size_type       Read(void* bytes, size_type len);
+    size_type       BytesAvailable();
+    bool            IsOpen();
+    bool            AtEnd();
+    int             Error();
+    void            SetOutputHandler(OutputHandler handler);
+    
+private:
+    struct Link
+    {
+        ContentFilterPtr                filter;
+        std::unique_ptr<FilterContext>  context;
+        bool                            collects;   ///< Whether the filter needs all its input at once.
+        ByteBuffer                      collected;
+    };
+    
+    WorkStealingPool&                   _pool;
+    std::unique_ptr<SeekableByteStream> _input;
+    std::vector<std::unique_ptr<Link>>  _links;
+    
+    std::mutex                          _lock;
+    std::condition_variable             _outputReady;
+    std::vector<std::deque<ByteBuffer>> _queues;
+    std::vector<bool>                   _scheduled;     ///< Whether a task is queued or running for each stage.
+    std::vector<bool>                   _done;          ///< Whether each stage has produced all its output.
+    bool                                _abandoned;
+    int                                 _error;
+    OutputHandler                       _handler;
+    
+    size_t          OutputStage()   const   { return _links.size(); }
+    
+    /// Queues a task for a stage which has input and room for its output. Call with `_lock` held.
+    void            ScheduleIfReady(size_t stage);
+    void            RunStage(size_t stage);
+    
+    /// Reads the next raw chunk; returns `true` at the end of the input.
+    bool            ReadChunk(ByteBuffer& output);
+    /// Passes a chunk through a link; returns `true` once the link has produced all its output.
+    bool            FilterChunk(Link& link, ByteBuffer& chunk, bool inputEnded, ByteBuffer& output);
+    /// Filters all of a collecting link's input at once.
+    void            FilterCollected(Link& link, ByteBuffer& output);
+    
+};
+
+FilterChainPipeline::State::State(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem, WorkStealingPool& pool)
+: _pool(pool), _input(std::move(input)), _links(), _lock(), _outputReady(), _queues(), _scheduled(), _done(), _abandoned(false), _error(0), _handler()
+{
+    for ( ContentFilterPtr filter : filters )
+    {
+        std::unique_ptr<Link> link(new Link);
+        link->filter = filter;
+        link->context.reset(filter->MakeFilterContext(manifestItem));
+        link->collects = (filter->GetOperatingMode() == ContentFilter::OperatingMode::RequiresCompleteData || !filter->PreservesLength());
+        link->collected.SetUsesSecureErasure();
+        _links.push_back(std::move(link));
+    }
+    
+    _queues.resize(_links.size() + 1);
+    _scheduled.resize(_links.size() + 1, false);
+    _done.resize(_links.size() + 1, false);
+}
+void FilterChainPipeline::State::Start()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    ScheduleIfReady(0);
+}
+void FilterChainPipeline::State::Abandon()
+{
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        _abandoned = true;
+        for ( auto& queue : _queues )
+            queue.clear();
+        _handler = nullptr;
+    }
+    _outputReady.notify_all();
+}
+ByteStream::size_type FilterChainPipeline::State::Read(void* bytes, size_type len)
+{
+    if ( len == 0 )
+        return 0;
+    
+    std::unique_lock<std::mutex> lock(_lock);
+    std::deque<ByteBuffer>& output = _queues[OutputStage()];
+    _outputReady.wait(lock, [&]{ return _abandoned || !output.empty() || _done[OutputStage()]; });
+    
+    uint8_t* dst = reinterpret_cast<uint8_t*>(bytes);
+    size_type numRead = 0;
+    while ( numRead < len && !output.empty() )
+    {
+        numRead += output.front().MoveTo(dst + numRead, len - numRead);
+        if ( output.front().IsEmpty() )
+            output.pop_front();
+    }
+    
+    ScheduleIfReady(OutputStage());
+    return numRead;
+}
+ByteStream::size_type FilterChainPipeline::State::BytesAvailable()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    size_type result = 0;
+    for ( auto& chunk : _queues[OutputStage()] )
+        result += chunk.GetBufferSize();
+    return result;
+}
+bool FilterChainPipeline::State::IsOpen()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return !_abandoned;
+}
+bool FilterChainPipeline::State::AtEnd()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _abandoned || (_done[OutputStage()] && _queues[OutputStage()].empty());
+}
+int FilterChainPipeline::State::Error()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _error;
+}
+void FilterChainPipeline::State::SetOutputHandler(OutputHandler handler)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _handler = handler;
+}
+void FilterChainPipeline::State::ScheduleIfReady(size_t stage)
+{
+    if ( _abandoned || _scheduled[stage] || _done[stage] || _queues[stage].size() >= MaxQueuedChunks )
+        return;
+    if ( stage > 0 && _queues[stage-1].empty() && !_done[stage-1] )
+        return;
+    
+    _scheduled[stage] = true;
+    std::shared_ptr<State> self = shared_from_this();
+    _pool.Add([self, stage]() { self->RunStage(stage); });
+}
+void FilterChainPipeline::State::RunStage(size_t stage)
+{
+    ByteBuffer chunk;
+    chunk.SetUsesSecureErasure();
+    bool inputEnded = false;
+    
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        if ( _abandoned )
+        {
+            _scheduled[stage] = false;
+            return;
+        }
+        
+        if ( stage > 0 )
+        {
+            std::deque<ByteBuffer>& input = _queues[stage-1];
+            if ( !input.empty() )
+            {
+                chunk = std::move(input.front());
+                input.pop_front();
+                ScheduleIfReady(stage-1);
+            }
+            inputEnded = (input.empty() && _done[stage-1]);
+        }
+    }
+    
+    ByteBuffer output;
+    output.SetUsesSecureErasure();
+    bool finished = false, failed = false;
+    try
+    {
+        if ( stage == 0 )
+            finished = ReadChunk(output);
+        else
+            finished = FilterChunk(*_links[stage-1], chunk, inputEnded, output);
+    }
+    catch (...)
+    {
+        failed = true;
+    }
+    
+    OutputHandler handler;
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        _scheduled[stage] = false;
+        if ( _abandoned )
+            return;
+        
+        if ( failed )
+        {
+            // end the output with whatever has been filtered so far
+            _error = EIO;
+            for ( size_t i = 0; i < OutputStage(); i++ )
+                _queues[i].clear();
+            _done.assign(_done.size(), true);
+        }
+        else
+        {
+            if ( !output.IsEmpty() )
+                _queues[stage].push_back(std::move(output));
+            if ( finished )
+                _done[stage] = true;
+            
+            ScheduleIfReady(stage);
+            if ( stage < OutputStage() )
+                ScheduleIfReady(stage+1);
+        }
+        
+        if ( stage == OutputStage() || failed )
+        {
+            _outputReady.notify_all();
+            handler = _handler;
+        }
+    }
+    
+    if ( handler )
+        handler();
+}
+bool FilterChainPipeline::State::ReadChunk(ByteBuffer& output)
+{
+    if ( !_input->IsOpen() )
+        return true;
+    
+    output.Resize(ChunkSize);
+    size_type numRead = _input->ReadBytes(output.GetBytes(), ChunkSize);
+    output.Resize(numRead);
+    return (numRead == 0 || _input->AtEnd());
+}
+bool FilterChainPipeline::State::FilterChunk(Link& link, ByteBuffer& chunk, bool inputEnded, ByteBuffer& output)
+{
+    if ( !link.collects )
+    {
+        if ( !chunk.IsEmpty() )
+        {
+            if ( link.filter->FilterInPlace(link.context.get(), chunk.GetBytes(), chunk.GetBufferSize()) != chunk.GetBufferSize() )
+                throw std::logic_error("FilterChainPipeline: a length-preserving filter changed the length of its data");
+            output = std::move(chunk);
+        }
+        return inputEnded;
+    }
+    
+    if ( !chunk.IsEmpty() )
+        link.collected.AddBytes(chunk.GetBytes(), chunk.GetBufferSize());
+    if ( !inputEnded )
+        return false;
+    
+    if ( !link.collected.IsEmpty() )
+        FilterCollected(link, output);
+    return true;
+}
+void FilterChainPipeline::State::FilterCollected(Link& link, ByteBuffer& output)
+{
+    ContentFilter* filter = link.filter.get();
+    FilterContext* context = link.context.get();
+    ByteBuffer& data = link.collected;
+    
+    if ( filter->SupportsSpans() )
+    {
+        FilterChainByteStream::FilterSpansInto(filter, context, data.GetBytes(), data.GetBufferSize(), output);
+        data.RemoveBytes(data.GetBufferSize());
+        return;
+    }
+    
+    // the filter has the complete resource, so it reads nothing itself
+    size_t filteredLen = 0;
+    void* filteredData = filter->FilterData(context, data.GetBytes(), data.GetBufferSize(), &filteredLen);
+    if ( filteredData == data.GetBytes() )
+    {
+        data.RemoveBytes(data.GetBufferSize() - std::min(filteredLen, data.GetBufferSize()), filteredLen);
+        output = std::move(data);
+        return;
+    }
+    
+    if ( filteredData != nullptr )
+    {
+        output = ByteBuffer(reinterpret_cast<uint8_t*>(filteredData), filteredLen);
+        
+        RangeFilterContext* rangeContext = dynamic_cast<RangeFilterContext*>(context);
+        if ( rangeContext == nullptr || reinterpret_cast<uint8_t*>(filteredData) != rangeContext->GetCurrentTemporaryByteBuffer() )
+            delete[] reinterpret_cast<uint8_t*>(filteredData);
+    }
+    data.RemoveBytes(data.GetBufferSize());
+}
+
+FilterChainPipeline::FilterChainPipeline(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem, WorkStealingPool& pool)
+: ByteStream(), _state(std::make_shared<State>(std::move(input), filters, manifestItem, pool))
+{
+    _state->Start();
+}
+FilterChainPipeline::~FilterChainPipeline()
+{
+    _state->Abandon();
+}
+ByteStream::size_type FilterChainPipeline::BytesAvailable() _NOEXCEPT
+{
+    return _state->BytesAvailable();
+}
+bool FilterChainPipeline::IsOpen() const _NOEXCEPT
+{
+    return _state->IsOpen();
+}
+void FilterChainPipeline::Close()
+{
+    _state->Abandon();
+}
+ByteStream::size_type FilterChainPipeline::ReadBytes(void* bytes, size_type len)
+{
+    return _state->Read(bytes, len);
+}
+bool FilterChainPipeline::AtEnd() const _NOEXCEPT
+{
+    return _state->AtEnd();
+}
+int FilterChainPipeline::Error() const _NOEXCEPT
+{
+    return _state->Error();
+}
+void FilterChainPipeline::SetOutputHandler(OutputHandler handler)
+{
+    _state->SetOutputHandler(handler);
+}
+
+EPUB3_END_NAMESPACE
@@ -0,0 +1,132 @@
+//
+//  filter_chain_pipeline.h
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, 
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this 
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, 
+//  this list of conditions and the following disclaimer in the documentation and/or 
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be 
+//  used to endorse or promote products derived from this software without specific 
+//  prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__filter_chain_pipeline__
+#define __ePub3__filter_chain_pipeline__
+
+#include <ePub3/epub3.h>
+#include <ePub3/utilities/byte_stream.h>
+#include <ePub3/utilities/byte_buffer.h>
+#include <ePub3/utilities/work_stealing_pool.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <ePub3/filter.h>
+
+EPUB3_BEGIN_NAMESPACE
+
+class FilterContext;
+
+/**
+ Filters a resource in chunks, as a pipeline of tasks on a WorkStealingPool.
+ 
+ The raw data is read in chunks of ChunkSize bytes, and each filter of the chain
+ is a link of the pipeline: whenever a chunk is waiting at its input and there is
+ room at its output, a task is queued to pass it through. Each link runs at most one
+ task at a time, so its chunks stay in order, but different links, and different
+ pipelines, run in parallel on any of the pool's workers. The queues between links
+ hold at most MaxQueuedChunks chunks, so a pipeline whose reader falls behind stops
+ using the pool until it catches up, rather than filtering the whole resource into
+ memory.
+ 
+ As with FilterChainByteStream, a filter which requires complete data, or which
+ changes the length of its data, collects all of its input and filters it once; the
+ links after it then resume working chunk by chunk.
+ 
+ Reads block until the next filtered bytes are ready; BytesAvailable() reports how
+ many can be read without blocking. If a filter throws, the pipeline ends, and
+ Error() returns `EIO`.
+ */
+class FilterChainPipeline : public ByteStream
+{
+public:
+    ///
+    /// The size of each chunk of raw data.
+    static const size_type      ChunkSize = 16*1024;
+    ///
+    /// The number of chunks which may wait between two links.
+    static const size_t         MaxQueuedChunks = 4;
+    
+    ///
+    /// Called on a pool thread when filtered bytes become available, or the output ends.
+    typedef std::function<void()>   OutputHandler;
+    
+private:
+    FilterChainPipeline(const FilterChainPipeline& o)             _DELETED_;
+    FilterChainPipeline(FilterChainPipeline&& o)                  _DELETED_;
+    FilterChainPipeline&         operator=(FilterChainPipeline&)      _DELETED_;
+    FilterChainPipeline&         operator=(FilterChainPipeline&&)     _DELETED_;
+    
+public:
+    /**
+     Creates a pipeline and starts reading.
+     @param input The raw resource data.
+     @param filters The filters which apply to the item, in chain order.
+     @param manifestItem The item being read.
+     @param pool The pool on which to run the pipeline's tasks.
+     */
+    EPUB3_EXPORT FilterChainPipeline(std::unique_ptr<SeekableByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem, WorkStealingPool& pool);
+    /**
+     Abandons any work still in progress.
+     */
+    virtual ~FilterChainPipeline();
+    
+    virtual size_type BytesAvailable() _NOEXCEPT OVERRIDE;
+    virtual size_type SpaceAvailable() const _NOEXCEPT OVERRIDE { return 0; }
+    virtual bool IsOpen() const _NOEXCEPT OVERRIDE;
+    virtual void Close() OVERRIDE;
+    virtual size_type ReadBytes(void* bytes, size_type len) OVERRIDE;
+    virtual size_type WriteBytes(const void* bytes, size_type len) OVERRIDE
+    {
+        throw std::system_error(std::make_error_code(std::errc::operation_not_supported));
+    }
+    virtual bool AtEnd() const _NOEXCEPT OVERRIDE;
+    virtual int Error() const _NOEXCEPT OVERRIDE;
+    
+    /**
+     Sets a function to be called when filtered bytes become available.
+     
+     The handler is called from the pool, so it must not block; it is also called at
+     the end of the output. Pass `nullptr` to remove it.
+     */
+    void SetOutputHandler(OutputHandler handler);
+    
+private:
+    class State;
+    
+    std::shared_ptr<State>      _state;     ///< Shared with queued tasks, which may outlive the stream.
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__filter_chain_pipeline__) */
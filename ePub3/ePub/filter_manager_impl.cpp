@@ -29,6 +29,7 @@
 
 #include "filter_manager_impl.h"
 #include "filter_chain.h"
+#include "package.h"
 #include <vector>
 
 EPUB3_BEGIN_NAMESPACE
@@ -58,7 +59,12 @@ FilterChainPtr FilterManagerImpl::BuildFilterChainForPackage(ConstPackagePtr pac
             filters.push_back(filter);
     }
     
-    return std::make_shared<FilterChain>(filters); //FilterChain::New(filters);
+    FilterChainPtr chain = std::make_shared<FilterChain>(filters); //FilterChain::New(filters);
+    
+    // before the package is unpacked its manifest is empty; Package::Unpack() fills this in later
+    if ( package )
+        chain->PrecomputeApplicability(package->Manifest());
+    return chain;
 }
 
 EPUB3_END_NAMESPACE
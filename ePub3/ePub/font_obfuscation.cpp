@@ -51,32 +51,164 @@ using namespace ::Windows::Security::Cryptography::Core;
 #include "container.h"
 #include "package.h"
 #include "filter_manager.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 
 EPUB3_BEGIN_NAMESPACE
 
 #if !EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) || EPUB_COMPILER(MSVC)
 const char * const FontObfuscator::FontObfuscationAlgorithmID = "http://www.idpf.org/2008/embedding";
+const char * const FontObfuscator::AdobeFontObfuscationAlgorithmID = "http://ns.adobe.com/pdf/enc#RC";
 #endif
 
 const REGEX_NS::regex FontObfuscator::TypeCheck("(?:font/.*|application/(?:x-font-.*|font-.*|vnd.ms-(?:opentype|fontobject)))");
 
+/// XORs `len` bytes of `src` with `mask` into `dst`, a machine word at a time where possible.
+static inline void XORBytes(uint8_t* dst, const uint8_t* src, const uint8_t* mask, size_t len)
+{
+    size_t i = 0;
+    for ( ; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t) )
+    {
+        // memcpy makes no alignment assumptions, and compiles to plain (vectorizable) loads and stores
+        uint64_t word, maskWord;
+        std::memcpy(&word, src + i, sizeof(word));
+        std::memcpy(&maskWord, mask + i, sizeof(maskWord));
+        word ^= maskWord;
+        std::memcpy(dst + i, &word, sizeof(word));
+    }
+    for ( ; i < len; i++ )
+        dst[i] = src[i] ^ mask[i];
+}
+
 void * FontObfuscator::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
 {
     FontObfuscationContext* p = dynamic_cast<FontObfuscationContext*>(context);
-    size_t bytesFiltered = p->ProcessedCount();
-    
-    uint8_t *buf = static_cast<uint8_t*>(data);
-    for ( size_t i = 0; i < len && (i + bytesFiltered) < 1040; i++)
+    if ( p->GetSeekableByteStream() != nullptr )
     {
-        // XOR each of the first 1040 bytes of the font with the key, circling around the keybuf
-        buf[i] ^= _key[(i+bytesFiltered)%20];
+        // read the requested range ourselves, into the context's buffer
+        *outputLen = 0;
+        ByteStream::size_type rangeLen = SeekToRange(p);
+        if ( rangeLen == 0 )
+            return nullptr;
+        
+        uint8_t* buf = p->GetAllocateTemporaryByteBuffer(rangeLen);
+        *outputLen = ReadRange(p, buf, rangeLen);
+        return buf;
     }
     
-    bytesFiltered += len;
-    p->SetProcessedCount(bytesFiltered);
+    uint8_t *buf = static_cast<uint8_t*>(data);
+    Obfuscate(p, buf, buf, len);
     *outputLen = len;
     return buf;
 }
+ContentFilter::SpanStatus FontObfuscator::FilterSpan(FilterContext* context, FilterSpans& spans)
+{
+    FontObfuscationContext* p = dynamic_cast<FontObfuscationContext*>(context);
+    if ( p->GetSeekableByteStream() != nullptr )
+    {
+        // read the requested range straight into the output span
+        ByteStream::size_type rangeLen = SeekToRange(p);
+        if ( rangeLen > spans.outputCapacity )
+        {
+            spans.outputNeeded = rangeLen;
+            return SpanStatus::NeedsOutputSpace;
+        }
+        
+        spans.outputProduced = ReadRange(p, spans.output, rangeLen);
+        return SpanStatus::Complete;
+    }
+    
+    size_t len = std::min(spans.inputLength, spans.outputCapacity);
+    Obfuscate(p, spans.input, spans.output, len);
+    
+    spans.inputConsumed = spans.outputProduced = len;
+    spans.outputNeeded = spans.inputLength - len;
+    return (len == spans.inputLength ? SpanStatus::Complete : SpanStatus::NeedsOutputSpace);
+}
+void FontObfuscator::Obfuscate(FontObfuscationContext* context, const uint8_t* src, uint8_t* dst, size_t len) const
+{
+    size_t position = context->ProcessedCount();
+    size_t masked = 0;
+    if ( position < context->MaskLength() )
+    {
+        masked = std::min(len, context->MaskLength() - position);
+        XORBytes(dst, src, context->Mask() + position, masked);
+    }
+    
+    // anything past the obfuscated bytes is plain
+    if ( src != dst && masked < len )
+        std::memcpy(dst + masked, src + masked, len - masked);
+    
+    context->SetProcessedCount(position + len);
+}
+ByteStream::size_type FontObfuscator::SeekToRange(FontObfuscationContext* context) const
+{
+    SeekableByteStream* byteStream = context->GetSeekableByteStream();
+    if ( !byteStream->IsOpen() )
+        return 0;
+    
+    ByteRange& range = context->GetByteRange();
+    if ( range.IsFullRange() )
+    {
+        byteStream->Seek(0, std::ios::beg);
+        context->SetProcessedCount(0);
+        return byteStream->BytesAvailable();
+    }
+    
+    byteStream->Seek(range.Location(), std::ios::beg);
+    context->SetProcessedCount(range.Location());
+    return range.Length();
+}
+ByteStream::size_type FontObfuscator::ReadRange(FontObfuscationContext* context, uint8_t* output, ByteStream::size_type len) const
+{
+    SeekableByteStream* byteStream = context->GetSeekableByteStream();
+    ByteStream::size_type total = 0;
+    while ( total < len )
+    {
+        ByteStream::size_type numRead = byteStream->ReadBytes(output + total, len - total);
+        if ( numRead == 0 )
+            break;
+        total += numRead;
+    }
+    
+    Obfuscate(context, output, output, total);
+    return total;
+}
+FilterContext* FontObfuscator::InnerMakeFilterContext(ConstManifestItemPtr item) const
+{
+    EncryptionInfoPtr encInfo = (item == nullptr ? nullptr : item->GetEncryptionInfo());
+    if ( encInfo != nullptr && encInfo->Algorithm() == AdobeFontObfuscationAlgorithmID )
+        return new FontObfuscationContext(_adobeMask, (_hasAdobeKey ? AdobeObfuscatedLength : 0));
+    return new FontObfuscationContext(_mask, ObfuscatedLength);
+}
+void FontObfuscator::BuildMasks()
+{
+    for ( size_t i = 0; i < ObfuscatedLength; i++ )
+        _mask[i] = _key[i % KeySize];
+    
+    // without a key, the Adobe mask is never used
+    std::memset(_adobeMask, 0, AdobeObfuscatedLength);
+    if ( _hasAdobeKey )
+    {
+        for ( size_t i = 0; i < AdobeObfuscatedLength; i++ )
+            _adobeMask[i] = _adobeKey[i % AdobeKeySize];
+    }
+}
+bool FontObfuscator::PrepareForRange(FilterContext* context, ByteStream::size_type location, ByteStream::size_type length,
+                                     ByteStream::size_type* inputLocation, ByteStream::size_type* inputLength,
+                                     ByteStream::size_type* outputSkip) const
+{
+    FontObfuscationContext* p = dynamic_cast<FontObfuscationContext*>(context);
+    if ( p == nullptr )
+        return false;
+    
+    p->SetProcessedCount(location);
+    *inputLocation = location;
+    *inputLength = length;
+    *outputSkip = 0;
+    return true;
+}
 bool FontObfuscator::BuildKey(ConstContainerPtr container, ConstPackagePtr pkg)
 {
     REGEX_NS::regex re("\\s+");
@@ -156,12 +288,78 @@ bool FontObfuscator::BuildKey(ConstContainerPtr container, ConstPackagePtr pkg)
     return true;
 }
 
+static int HexDigitValue(char ch)
+{
+    if ( ch >= '0' && ch <= '9' )
+        return ch - '0';
+    if ( ch >= 'a' && ch <= 'f' )
+        return ch - 'a' + 10;
+    if ( ch >= 'A' && ch <= 'F' )
+        return ch - 'A' + 10;
+    return -1;
+}
+bool FontObfuscator::AdobeKeyFromIdentifier(const string& identifier, uint8_t key[AdobeKeySize])
+{
+    static const char kPrefix[] = "urn:uuid:";
+    static const size_t kPrefixLen = sizeof(kPrefix) - 1;
+    
+    const std::string& str = identifier.stl_str();
+    if ( str.size() < kPrefixLen )
+        return false;
+    for ( size_t i = 0; i < kPrefixLen; i++ )
+    {
+        if ( std::tolower(static_cast<unsigned char>(str[i])) != kPrefix[i] )
+            return false;
+    }
+    
+    // 32 hex digits, in groups separated by hyphens
+    uint8_t result[AdobeKeySize];
+    size_t numDigits = 0;
+    for ( size_t i = kPrefixLen; i < str.size(); i++ )
+    {
+        if ( str[i] == '-' )
+            continue;
+        int value = HexDigitValue(str[i]);
+        if ( value < 0 || numDigits == AdobeKeySize * 2 )
+            return false;
+        if ( numDigits % 2 == 0 )
+            result[numDigits / 2] = uint8_t(value << 4);
+        else
+            result[numDigits / 2] |= uint8_t(value);
+        numDigits++;
+    }
+    if ( numDigits != AdobeKeySize * 2 )
+        return false;
+    
+    std::memcpy(key, result, AdobeKeySize);
+    return true;
+}
+bool FontObfuscator::BuildAdobeKey(ConstPackagePtr pkg)
+{
+    _hasAdobeKey = AdobeKeyFromIdentifier(pkg->PackageID(), _adobeKey);
+    if ( !_hasAdobeKey )
+    {
+        for ( auto& identifier : pkg->PropertiesMatching(DCType::Identifier) )
+        {
+            if ( AdobeKeyFromIdentifier(identifier->Value(), _adobeKey) )
+            {
+                _hasAdobeKey = true;
+                break;
+            }
+        }
+    }
+    
+    if ( !_hasAdobeKey )
+        std::memset(_adobeKey, 0, AdobeKeySize);
+    return _hasAdobeKey;
+}
+
 ContentFilterPtr FontObfuscator::FontObfuscatorFactory(ConstPackagePtr package)
 {
     ConstContainerPtr container = package->GetContainer();
     for ( auto& encInfo : container->EncryptionData() )
     {
-        if ( encInfo->Algorithm() == FontObfuscationAlgorithmID )
+        if ( IsFontObfuscationAlgorithm(encInfo->Algorithm()) )
         {
             return std::make_shared<FontObfuscator>(container, package); //New(container, package);
         }
@@ -39,36 +39,54 @@ EPUB3_BEGIN_NAMESPACE
 
 /**
  The FontObfuscator class implements font obfuscation algorithm as defined in
- Open Container Format 3.0 ??4.
+ Open Container Format 3.0 ??4, along with the older Adobe font mangling algorithm.
  
  The underlying algorithm is bidirectional, so this filter can actually be used both
  to obfuscate and de-obfuscate resources; as such, this filter may be applied when
  loading or when storing content.
+ 
+ Each algorithm XORs the start of the font with a mask repeating its key, which is
+ built once for the package. Any byte range of a font can therefore be served
+ directly from the container, without reading what precedes it.
  @see http://www.idpf.org/epub/30/spec/epub30-ocf.html#font-obfuscation
  */
 class FontObfuscator : public ContentFilter, public PointerType<FontObfuscator>
 {
 protected:
     static const size_t         KeySize = 20;       // SHA-1 key size = 20 bytes
+    static const size_t         ObfuscatedLength = 1040;
+    static const size_t         AdobeKeySize = 16;  // the bytes of a UUID
+    static const size_t         AdobeObfuscatedLength = 1024;
     static const REGEX_NS::regex     TypeCheck;
     CONSTEXPR static EPUB3_EXPORT const char * const	FontObfuscationAlgorithmID
 #if EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) && !EPUB_COMPILER(MSVC)
             = "http://www.idpf.org/2008/embedding"
+#endif
+              ;
+    CONSTEXPR static EPUB3_EXPORT const char * const	AdobeFontObfuscationAlgorithmID
+#if EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) && !EPUB_COMPILER(MSVC)
+            = "http://ns.adobe.com/pdf/enc#RC"
 #endif
               ;
     
+    ///
+    /// Whether an encryption algorithm URI identifies one of the font obfuscation algorithms.
+    static bool IsFontObfuscationAlgorithm(const string& algorithm) {
+        return algorithm == FontObfuscationAlgorithmID || algorithm == AdobeFontObfuscationAlgorithmID;
+    }
+    
     /**
      The type-sniffer for font obfuscation applicability.
      
      The sniffer looks at two things:
      
-     1. The encryption information for the item must specify the font
+     1. The encryption information for the item must specify a font
      obfuscation algorithm.
      2. The item must be a font resource.
      */
     static bool FontTypeSniffer(ConstManifestItemPtr item) {
         EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
-        if ( encInfo == nullptr || encInfo->Algorithm() != FontObfuscationAlgorithmID )
+        if ( encInfo == nullptr || !IsFontObfuscationAlgorithm(encInfo->Algorithm()) )
             return false;
 
         auto mediaType = item->MediaType();
@@ -84,45 +102,68 @@ private:
     FontObfuscator() _DELETED_;
     
 private:
-    class FontObfuscationContext : public FilterContext
+    class FontObfuscationContext : public RangeFilterContext
     {
     private:
         size_t          _count;
+        const uint8_t*  _mask;
+        size_t          _maskLength;
         
     public:
-        FontObfuscationContext() : FilterContext(), _count(0) {}
+        FontObfuscationContext(const uint8_t* mask, size_t maskLength) : RangeFilterContext(), _count(0), _mask(mask), _maskLength(maskLength) {}
         virtual ~FontObfuscationContext() {}
         
         size_t  ProcessedCount() const      { return _count; }
         void SetProcessedCount(size_t val)  { _count = val; }
         
+        ///
+        /// The mask for the item's algorithm, XORed with the first MaskLength() bytes.
+        const uint8_t*  Mask() const        { return _mask; }
+        size_t          MaskLength() const  { return _maskLength; }
+        
     };
 
 public:
     /**
      Create a font obfuscation filter.
      
-     The obfuscation key is built using data from every manifestation within an EPUB
-     container, so the Container instance is passed in for that purpose. This is
-     only used during construction.
-     @see BuildKey(const Container*)
+     The obfuscation keys are built using the package's identifiers, so the Container
+     and Package instances are passed in for that purpose. They are only used during
+     construction.
+     @see BuildKey(ConstContainerPtr, ConstPackagePtr)
+     @see BuildAdobeKey(ConstPackagePtr)
      */
     FontObfuscator(ConstContainerPtr container, ConstPackagePtr package) : ContentFilter(FontTypeSniffer) {
         BuildKey(container, package);
+        BuildAdobeKey(package);
+        BuildMasks();
     }
     ///
     /// Copy constructor.
-    FontObfuscator(const FontObfuscator& o) : ContentFilter(o) {
+    FontObfuscator(const FontObfuscator& o) : ContentFilter(o), _hasAdobeKey(o._hasAdobeKey) {
         std::memcpy(_key, o._key, KeySize);
+        std::memcpy(_adobeKey, o._adobeKey, AdobeKeySize);
+        BuildMasks();
     }
     ///
     /// Move constructor.
-    FontObfuscator(FontObfuscator&& o) : ContentFilter(std::move(o)) {
+    FontObfuscator(FontObfuscator&& o) : ContentFilter(std::move(o)), _hasAdobeKey(o._hasAdobeKey) {
         std::memcpy(_key, o._key, KeySize);
+        std::memcpy(_adobeKey, o._adobeKey, AdobeKeySize);
+        BuildMasks();
     }
     
+    /**
+     Fonts are read directly from the container when a byte range is requested;
+     otherwise the data passed in is (de-)obfuscated in place, a chunk at a time.
+     */
+    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::SupportsByteRanges; }
+    
     /**
      Applies the font obfuscation algorithm to the resource data.
+     
+     If the context has been given a stream, the range it specifies is read from that
+     stream instead, and `data` is ignored.
      @see http://www.idpf.org/epub/30/spec/epub30-ocf.html#font-obfuscation
      @param data The data to process.
      @param len The number of bytes in `data`.
@@ -131,10 +172,38 @@ public:
      */
     virtual void * FilterData(FilterContext* context, void * data, size_t len, size_t *outputLen) OVERRIDE;
     
+    ///
+    /// The obfuscation is applied in place, a chunk at a time.
+    virtual bool PreservesLength() const OVERRIDE { return true; }
+    
+    ///
+    /// Applies the algorithm while copying from the input span to the output span, which may be the same.
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE;
+    
+    ///
+    /// Ranges map onto themselves; the context is rewound to the start of the range.
+    virtual bool PrepareForRange(FilterContext* context, ByteStream::size_type location, ByteStream::size_type length,
+                                 ByteStream::size_type* inputLocation, ByteStream::size_type* inputLength,
+                                 ByteStream::size_type* outputSkip) const OVERRIDE;
+    
     static void Register();
     
+    /**
+     Obtains the Adobe obfuscation key from a package identifier.
+     @param identifier An identifier of the form `urn:uuid:` followed by a UUID.
+     @param key Storage for the 16 bytes of the UUID.
+     @result `false` if the identifier isn't a UUID URN.
+     */
+    EPUB3_EXPORT
+    static bool AdobeKeyFromIdentifier(const string& identifier, uint8_t key[AdobeKeySize]);
+    
 protected:
     uint8_t             _key[KeySize];
+    uint8_t             _adobeKey[AdobeKeySize];
+    bool                _hasAdobeKey;
+    uint8_t             _mask[ObfuscatedLength];            ///< `_key` repeated over the obfuscated length.
+    uint8_t             _adobeMask[AdobeObfuscatedLength];  ///< `_adobeKey` repeated, or zeroes if there's no key.
     
     /**
      Builds the obfuscaton key using data from the container.
@@ -146,7 +215,29 @@ protected:
     EPUB3_EXPORT
     bool BuildKey(ConstContainerPtr container, ConstPackagePtr package);
     
-    virtual FilterContext *InnerMakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new FontObfuscationContext; }
+    /**
+     Builds the Adobe obfuscation key from the package's first `urn:uuid:` identifier,
+     preferring its unique identifier.
+     @result `false` if the package has no such identifier.
+     */
+    EPUB3_EXPORT
+    bool BuildAdobeKey(ConstPackagePtr package);
+    
+    virtual FilterContext *InnerMakeFilterContext(ConstManifestItemPtr item) const OVERRIDE;
+    
+private:
+    ///
+    /// Fills in each mask from its key.
+    void                BuildMasks();
+    ///
+    /// (De-)obfuscates `len` bytes from `src` into `dst`, which may be the same, advancing the context.
+    void                Obfuscate(FontObfuscationContext* context, const uint8_t* src, uint8_t* dst, size_t len) const;
+    ///
+    /// Seeks the context's stream to the start of its range, returning the range's length.
+    ByteStream::size_type   SeekToRange(FontObfuscationContext* context) const;
+    ///
+    /// Reads `len` bytes of the context's range into `output` and de-obfuscates them, returning the count read.
+    ByteStream::size_type   ReadRange(FontObfuscationContext* context, uint8_t* output, ByteStream::size_type len) const;
 };
 
 EPUB3_END_NAMESPACE
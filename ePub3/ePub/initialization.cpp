@@ -37,6 +37,7 @@
 #include <ePub3/switch_preprocessor.h>
 #include <ePub3/object_preprocessor.h>
 #include <ePub3/PassThroughFilter.h>
+#include <ePub3/resource_inflater.h>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -59,6 +60,9 @@ void PopulateFilterManager()
 		// to see if the class is enabling itself.
 		//
         // PassThroughFilter::Register();
+        // The AESCBCDecryptor needs the application to supply keys, so it is not registered
+        // here; call AESCBCDecryptor::Register() with a key provider to enable it.
+        ResourceInflater::Register();
         SwitchPreprocessor::Register();
         ObjectPreprocessor::Register();
     });
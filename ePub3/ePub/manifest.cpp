@@ -268,8 +268,7 @@ shared_ptr<xml::Document> ManifestItem::ReferencedDocument() const
     if (!byteStream)
         return nullptr;
 	
-	void *docBuf = nullptr;
-	std::size_t resbuflen = byteStream->ReadAllBytes(&docBuf);
+	ByteBuffer docBuf = byteStream->ReadAllBytes();
 	
     // In some EPUBs, UTF-8 XML/HTML files have a superfluous (erroneous?) BOM, so we either:
     // pass "utf-8" and expect InputBuffer::read_cb (in io.cpp) to skip the 3 erroneous bytes
@@ -278,18 +277,15 @@ shared_ptr<xml::Document> ManifestItem::ReferencedDocument() const
     const char * encoding = nullptr;
     //const char * encoding = "utf-8";
 
-//    std::string fileContents ((char*)docBuf, resbuflen);
+//    std::string fileContents ((char*)docBuf.GetBytes(), docBuf.GetBufferSize());
 
 	xmlDocPtr raw;
     if ( _mediaType == "text/html" ) {
-        raw = htmlReadMemory((const char*)docBuf, resbuflen, path.c_str(), encoding, ArchiveXmlReader::DEFAULT_OPTIONS);
+        raw = htmlReadMemory((const char*)docBuf.GetBytes(), (int)docBuf.GetBufferSize(), path.c_str(), encoding, ArchiveXmlReader::DEFAULT_OPTIONS);
     } else {
-        raw = xmlReadMemory((const char*)docBuf, resbuflen, path.c_str(), encoding, ArchiveXmlReader::DEFAULT_OPTIONS);
+        raw = xmlReadMemory((const char*)docBuf.GetBytes(), (int)docBuf.GetBufferSize(), path.c_str(), encoding, ArchiveXmlReader::DEFAULT_OPTIONS);
     }
 
-    if (docBuf)
-        free(docBuf);
-
     if (!bool(raw) || (raw->type != XML_HTML_DOCUMENT_NODE && raw->type != XML_DOCUMENT_NODE) || !bool(raw->children)) {
         if (bool(raw)) {
             xmlFreeDoc(raw);
@@ -0,0 +1,66 @@
+//
+//  markup_lexing.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, 
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this 
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, 
+//  this list of conditions and the following disclaimer in the documentation and/or 
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be 
+//  used to endorse or promote products derived from this software without specific 
+//  prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__markup_lexing__
+#define __ePub3__markup_lexing__
+
+#include <ePub3/base.h>
+#include <cstddef>
+
+EPUB3_BEGIN_NAMESPACE
+
+// Character-level helpers shared by the content preprocessors' markup scanners.
+
+static inline bool IsXMLSpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+static inline bool IsNameChar(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == ':' || ch == '-' || ch == '_' || ch == '.';
+}
+///
+/// Compares `len` characters of `name`, ignoring ASCII case, with a lowercase name.
+static inline bool NameEquals(const char* name, size_t len, const char* lowercaseName)
+{
+    for ( size_t i = 0; i < len; i++, lowercaseName++ )
+    {
+        if ( *lowercaseName == '\0' )
+            return false;
+        char ch = name[i];
+        if ( ch >= 'A' && ch <= 'Z' )
+            ch += 'a' - 'A';
+        if ( ch != *lowercaseName )
+            return false;
+    }
+    return *lowercaseName == '\0';
+}
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__markup_lexing__) */
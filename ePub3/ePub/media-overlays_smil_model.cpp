@@ -33,10 +33,19 @@
 #include <ePub3/media-overlays_smil_data.h>
 #include "error_handler.h"
 #include "xpath_wrangler.h"
+#include <ePub3/utilities/work_stealing_pool.h>
+#include <ePub3/xml/document.h>
 
+#if EPUB_USE(LIBXML2)
+#include "archive_xml.h"
+#include "byte_stream.h"
+#include <libxml/parser.h>
+#endif
 
 //#include <iostream>
 #include <chrono>
+#include <condition_variable>
+#include <exception>
 
 
 //#include "make_unique.h"
@@ -375,6 +384,147 @@ public:
             }
         }
 
+#if EPUB_USE(LIBXML2)
+        /**
+         Reads a SMIL document through the package's filter chain, as
+         ManifestItem::ReferencedDocument() does, but using the caller's parser context.
+         The parse options, not the calling thread's libxml2 defaults, decide entity
+         substitution and DTD loading, so every thread parses a document the same way.
+         */
+        static shared_ptr<xml::Document> ReadSMILDocument(const PackagePtr & package, const ManifestItemPtr & item, xmlParserCtxtPtr ctxt)
+        {
+            shared_ptr<ByteStream> byteStream = package->GetFilterChainByteStream(item);
+            if (!byteStream)
+            {
+                return nullptr;
+            }
+
+            ByteBuffer docBuf = byteStream->ReadAllBytes();
+            string path(item->BaseHref());
+
+            xmlDocPtr raw;
+            if (ctxt != nullptr)
+            {
+                raw = xmlCtxtReadMemory(ctxt, (const char*)docBuf.GetBytes(), (int)docBuf.GetBufferSize(), path.c_str(), nullptr, ArchiveXmlReader::DEFAULT_OPTIONS);
+            }
+            else
+            {
+                raw = xmlReadMemory((const char*)docBuf.GetBytes(), (int)docBuf.GetBufferSize(), path.c_str(), nullptr, ArchiveXmlReader::DEFAULT_OPTIONS);
+            }
+
+            if (!bool(raw) || raw->type != XML_DOCUMENT_NODE || !bool(raw->children))
+            {
+                if (bool(raw))
+                {
+                    xmlFreeDoc(raw);
+                }
+                return nullptr;
+            }
+
+            return xml::Wrapped<xml::Document>(raw);
+        }
+
+        /**
+         The SMIL documents of a package, read and parsed concurrently.
+
+         Each thread taking part claims documents in turn and parses them with its own
+         libxml2 parser context. The thread that asked for the documents takes part too,
+         so it only ever waits on documents already being parsed, never on queued tasks.
+
+         Nothing is reported to the error handler here: anything thrown while reading a
+         document is kept, to be rethrown when the caller reaches that document.
+         */
+        class SMILDocumentBatch : public std::enable_shared_from_this<SMILDocumentBatch>
+        {
+        public:
+            SMILDocumentBatch(const PackagePtr & package, const std::vector<ManifestItemPtr> & items)
+                : _package(package), _items(items), _documents(items.size()), _errors(items.size()), _next(0), _finished(0)
+            {}
+
+            /**
+             Parses every document, using the shared pool as well as the calling thread.
+             */
+            void ReadAll()
+            {
+                if (_items.size() > 1)
+                {
+                    WorkStealingPool & pool = WorkStealingPool::Shared();
+                    size_t helpers = std::min(pool.ThreadCount(), _items.size() - 1);
+
+                    // a helper which starts late finds nothing left to claim, and only keeps the batch alive
+                    auto self = shared_from_this();
+                    for (size_t i = 0; i < helpers; i++)
+                    {
+                        pool.Add([self]() { self->ReadClaimed(); });
+                    }
+                }
+
+                ReadClaimed();
+
+                std::unique_lock<std::mutex> lock(_lock);
+                _allFinished.wait(lock, [this]() { return _finished == _items.size(); });
+            }
+
+            /**
+             Returns the document at a given index, releasing the batch's reference to it.
+
+             Rethrows anything thrown while reading it.
+             */
+            shared_ptr<xml::Document> TakeDocument(size_t index)
+            {
+                if (_errors[index])
+                {
+                    std::rethrow_exception(_errors[index]);
+                }
+                return std::move(_documents[index]);
+            }
+
+        private:
+            PackagePtr                              _package;
+            std::vector<ManifestItemPtr>            _items;
+            std::vector<shared_ptr<xml::Document>>  _documents;
+            std::vector<std::exception_ptr>         _errors;
+            std::atomic<size_t>                     _next;
+            size_t                                  _finished;      ///< Guarded by `_lock`.
+            std::mutex                              _lock;
+            std::condition_variable                 _allFinished;
+
+            void ReadClaimed()
+            {
+                xmlParserCtxtPtr ctxt = nullptr;
+
+                size_t index;
+                while ((index = _next++) < _items.size())
+                {
+                    if (ctxt == nullptr)
+                    {
+                        ctxt = xmlNewParserCtxt();
+                    }
+
+                    try
+                    {
+                        _documents[index] = ReadSMILDocument(_package, _items[index], ctxt);
+                    }
+                    catch (...)
+                    {
+                        _errors[index] = std::current_exception();
+                    }
+
+                    std::lock_guard<std::mutex> _(_lock);
+                    if (++_finished == _items.size())
+                    {
+                        _allFinished.notify_all();
+                    }
+                }
+
+                if (ctxt != nullptr)
+                {
+                    xmlFreeParserCtxt(ctxt);
+                }
+            }
+        };
+#endif
+
         uint32_t MediaOverlaysSmilModel::parseSMILs()
         {       
             std::shared_ptr<Package> package = Owner(); // internally: std::weak_ptr<Package>.lock()
@@ -390,9 +540,11 @@ public:
 
             uint32_t accumulatedDurationMilliseconds = 0;
 
+            // the spine items with media overlays, and their SMIL manifest items, in spine order
+            std::vector<shared_ptr<SpineItem>> smilSpineItems;
+            std::vector<ManifestItemPtr> smilItems;
 
-            shared_ptr<SpineItem> spineItem = package->FirstSpineItem();
-            while (spineItem != nullptr)
+            for (shared_ptr<SpineItem> spineItem = package->FirstSpineItem(); spineItem != nullptr; spineItem = spineItem->Next())
             {
                 ManifestItemPtr item = spineItem->ManifestItem();
 
@@ -405,10 +557,25 @@ public:
                 item = item->MediaOverlay();
                 if (item == nullptr)
                 {
-                    spineItem = spineItem->Next();
                     continue;
                 }
 
+                smilSpineItems.push_back(spineItem);
+                smilItems.push_back(item);
+            }
+
+#if EPUB_USE(LIBXML2)
+            // the SMIL documents are independent, so they're parsed concurrently; everything
+            // else below happens in spine order, so errors are reported as they always were
+            auto smilDocuments = std::make_shared<SMILDocumentBatch>(package, smilItems);
+            smilDocuments->ReadAll();
+#endif
+
+            for (size_t smilIndex = 0; smilIndex < smilItems.size(); smilIndex++)
+            {
+                shared_ptr<SpineItem> spineItem = smilSpineItems[smilIndex];
+                ManifestItemPtr item = smilItems[smilIndex];
+
 //                counter++;
 //                if (counter > 10)
 //                {
@@ -418,7 +585,11 @@ public:
                 //printf("Media Overlays SMIL PARSING: %s\n", item->Href().c_str());
 
                 //unique_ptr<ArchiveXmlReader> xmlReader = package->XmlReaderForRelativePath(item->Href());
+#if EPUB_USE(LIBXML2)
+                shared_ptr<xml::Document> doc = smilDocuments->TakeDocument(smilIndex);
+#else
                 shared_ptr<xml::Document> doc = item->ReferencedDocument();
+#endif
                 if (!bool(doc))
                 {
                     HandleError(EPUBError::MediaOverlayCannotParseSMILXML, _Str("Cannot parse XML: ", item->Href().c_str()));
@@ -553,8 +724,6 @@ public:
                 }
 
                 accumulatedDurationMilliseconds += smilDur;
-
-                spineItem = spineItem->Next();
             }
 
             return accumulatedDurationMilliseconds;
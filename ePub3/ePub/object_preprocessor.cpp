@@ -28,17 +28,129 @@
 //  OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "object_preprocessor.h"
+#include "markup_lexing.h"
 #include "package.h"
 #include "filter_manager.h"
-
-static const REGEX_NS::regex::flag_type regexFlags(REGEX_NS::regex::ECMAScript|REGEX_NS::regex::optimize);
-static const REGEX_NS::regex reEscaper("\\\\\\.\\(\\)\\[\\]\\$\\^\\*\\+\\?\\:\\=\\|", regexFlags);
+#include <cstring>
 
 EPUB3_BEGIN_NAMESPACE
 
-static REGEX_NS::regex ParamMatcher("<param[^>]+(name|value)=\"([^\"]*)\"[^>]*?(value|name)=\"([^\"]*)\"(.|\\n|\\r)*?>", regexFlags);
-static REGEX_NS::regex SourceFinder("data=\\\"([^\\\"]*)\\\"", regexFlags);
-static REGEX_NS::regex IDFinder("id=\\\"([^\\\"]*)\\\"", regexFlags);
+/**
+ Determines whether `p`, which points to a `<` character, begins a tag for the
+ named element: a start tag, or an end tag if `closing` is `true`.
+ */
+static bool IsTagNamed(const char* p, const char* end, const char* lowercaseName, bool closing)
+{
+    const char* name = p + 1;
+    if ( closing )
+    {
+        if ( name == end || *name != '/' )
+            return false;
+        name++;
+    }
+    
+    const char* nameEnd = name;
+    while ( nameEnd != end && IsNameChar(*nameEnd) )
+        ++nameEnd;
+    if ( nameEnd == end || !NameEquals(name, size_t(nameEnd - name), lowercaseName) )
+        return false;
+    return IsXMLSpace(*nameEnd) || *nameEnd == '>' || *nameEnd == '/';
+}
+
+/// Returns a pointer just past the `>` ending the tag at `p`, or `nullptr`.
+static const char* FindTagEnd(const char* p, const char* end)
+{
+    char quote = '\0';
+    for ( ; p != end; ++p )
+    {
+        if ( quote != '\0' )
+        {
+            if ( *p == quote )
+                quote = '\0';
+        }
+        else if ( *p == '"' || *p == '\'' )
+        {
+            quote = *p;
+        }
+        else if ( *p == '>' )
+        {
+            return p + 1;
+        }
+    }
+    return nullptr;
+}
+
+/// Returns a pointer just past the `-->` closing a comment which starts at `p`, or `nullptr`.
+static const char* SkipComment(const char* p, const char* end)
+{
+    for ( p += 4; end - p >= 3; ++p )
+    {
+        p = reinterpret_cast<const char*>(::memchr(p, '-', size_t(end - p)));
+        if ( p == nullptr || end - p < 3 )
+            return nullptr;
+        if ( p[1] == '-' && p[2] == '>' )
+            return p + 3;
+    }
+    return nullptr;
+}
+static inline bool IsCommentStart(const char* p, const char* end)
+{
+    return end - p >= 4 && p[1] == '!' && p[2] == '-' && p[3] == '-';
+}
+
+/**
+ Calls `fn(name, nameLen, value, valueLen)` for each attribute of the start tag
+ spanning [tag, tagEnd).
+ */
+template <class _Fn>
+static void ForEachAttribute(const char* tag, const char* tagEnd, _Fn fn)
+{
+    const char* p = tag + 1;
+    while ( p != tagEnd && IsNameChar(*p) )
+        ++p;
+    
+    while ( p != tagEnd )
+    {
+        while ( p != tagEnd && (IsXMLSpace(*p) || *p == '/' || *p == '>') )
+            ++p;
+        const char* name = p;
+        while ( p != tagEnd && IsNameChar(*p) )
+            ++p;
+        if ( p == name )
+            break;
+        const char* nameEnd = p;
+        
+        while ( p != tagEnd && IsXMLSpace(*p) )
+            ++p;
+        if ( p == tagEnd || *p != '=' )
+            continue;
+        ++p;
+        while ( p != tagEnd && IsXMLSpace(*p) )
+            ++p;
+        if ( p == tagEnd )
+            break;
+        
+        const char* value = p;
+        const char* valueEnd = nullptr;
+        if ( *p == '"' || *p == '\'' )
+        {
+            value = p + 1;
+            valueEnd = std::find(value, tagEnd, *p);
+            p = (valueEnd == tagEnd ? tagEnd : valueEnd + 1);
+        }
+        else
+        {
+            while ( p != tagEnd && !IsXMLSpace(*p) && *p != '>' && *p != '/' )
+                ++p;
+            valueEnd = p;
+        }
+        
+        fn(name, size_t(nameEnd - name), value, size_t(valueEnd - value));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// ObjectPreprocessor
 
 bool ObjectPreprocessor::ShouldApply(ConstManifestItemPtr item)
 {
@@ -64,60 +176,139 @@ ObjectPreprocessor::ObjectPreprocessor(ConstPackagePtr pkg, const string& button
         return;
     }
     
-    std::stringstream ss;
-    ss << "<object\\s+?([^>]*?(?:media-)?type=\"(";
-    
-    auto pos = mediaTypes.begin();
-    auto end = mediaTypes.end();
-    
-    while ( pos != end )
-    {
-        auto here = pos++;
-        std::string regstr("$`\\\\$&$'");
-        std::string str = REGEX_NS::regex_replace(here->stl_str(), reEscaper, regstr);    // yes, double-backslash, so it doesn't escape whatever '$&' is (i.e. the character which needs to be escaped)
-        if ( pos == end )
-            ss << str;
-        else
-            ss << str << "|";
-    }
-    
-    ss << ")\"[^>]*?)>((?:.|\\n|\\r)*?)</object>";
-    std::string reStr = ss.str();
-    _objectMatcher = REGEX_NS::regex(reStr, regexFlags);
-    
-    for ( auto mediaType : mediaTypes )
+    _handlers.reserve(mediaTypes.size());
+    for ( auto& mediaType : mediaTypes )
     {
 #if EPUB_HAVE(CXX_MAP_EMPLACE)
-        _handlers.emplace(mediaType, *(pkg->OPFHandlerForMediaType(mediaType)));
+        _handlers.emplace(mediaType.stl_str(), *(pkg->OPFHandlerForMediaType(mediaType)));
 #else
-        _handlers.insert({mediaType, *(pkg->OPFHandlerForMediaType(mediaType))});
+        _handlers.insert({mediaType.stl_str(), *(pkg->OPFHandlerForMediaType(mediaType))});
 #endif
     }
 }
 void* ObjectPreprocessor::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
 {
-    char* input = reinterpret_cast<char*>(data);
-    // find each `object` tag
-    REGEX_NS::cregex_iterator pos(input, input+len, _objectMatcher);
-    REGEX_NS::cregex_iterator end;
-    if ( pos == end )
+    std::string output;
+    if ( !Rewrite(reinterpret_cast<const char*>(data), len, output) )
     {
         *outputLen = len;
         return data;        // no match == no change
     }
     
-    std::string output;
-    while ( pos != end )
+    *outputLen = output.size();
+    if ( output.size() <= len )
     {
-        // output any leading non-matched characters
-        output += pos->prefix();
+        // use the incoming buffer directly
+        output.copy(reinterpret_cast<char*>(data), output.size());
+        return data;
+    }
+    
+    // allocate an output buffer
+    char* result = new char[output.size()];
+    output.copy(result, output.size());
+    return result;
+}
+ContentFilter::SpanStatus ObjectPreprocessor::FilterSpan(FilterContext* context, FilterSpans& spans)
+{
+    ObjectContext localContext;
+    ObjectContext* objectContext = dynamic_cast<ObjectContext*>(context);
+    if ( objectContext == nullptr )
+        objectContext = &localContext;
+    
+    std::string& output = objectContext->output;
+    spans.inputConsumed = spans.outputProduced = spans.outputNeeded = 0;
+    
+    // output held back from the last call goes out before any more input is read
+    if ( objectContext->written == output.size() )
+    {
+        output.clear();     // keeps its storage for the next document
+        objectContext->written = 0;
+        
+        if ( !Rewrite(reinterpret_cast<const char*>(spans.input), spans.inputLength, output) )
+        {
+            // no match == no change
+            if ( spans.inputLength > spans.outputCapacity )
+            {
+                spans.outputNeeded = spans.inputLength;
+                return SpanStatus::NeedsOutputSpace;
+            }
+            if ( spans.output != spans.input && spans.inputLength != 0 )
+                ::memcpy(spans.output, spans.input, spans.inputLength);
+            spans.inputConsumed = spans.outputProduced = spans.inputLength;
+            return SpanStatus::Complete;
+        }
+        
+        // without a context there's nowhere to hold the output, so it goes all at once or not at all
+        if ( objectContext == &localContext && output.size() > spans.outputCapacity )
+        {
+            spans.outputNeeded = output.size();
+            return SpanStatus::NeedsOutputSpace;
+        }
+        spans.inputConsumed = spans.inputLength;
+    }
+    
+    size_t len = std::min(output.size() - objectContext->written, spans.outputCapacity);
+    output.copy(reinterpret_cast<char*>(spans.output), len, objectContext->written);
+    objectContext->written += len;
+    spans.outputProduced = len;
+    spans.outputNeeded = output.size() - objectContext->written;
+    return (spans.outputNeeded == 0 ? SpanStatus::Complete : SpanStatus::NeedsOutputSpace);
+}
+bool ObjectPreprocessor::Rewrite(const char* input, size_t len, std::string& output) const
+{
+    const char* end = input + len;
+    const char* copied = input;     // everything before this has been written to `output`
+    const char* p = input;
+    
+    std::string type;
+    
+    while ( p != end && (p = reinterpret_cast<const char*>(::memchr(p, '<', size_t(end - p)))) != nullptr )
+    {
+        if ( IsCommentStart(p, end) )
+        {
+            p = SkipComment(p, end);
+            if ( p == nullptr )
+                break;
+            continue;
+        }
+        if ( !IsTagNamed(p, end, "object", false) )
+        {
+            ++p;
+            continue;
+        }
+        
+        const char* tagEnd = FindTagEnd(p, end);
+        if ( tagEnd == nullptr )
+            break;
         
-        std::string type(pos->str(2));
-        // we have matched an <object> element: find the appropriate media handler
+        // we have an <object> tag: find its type, source, and id
+        const char* src = nullptr;
+        size_t srcLen = 0;
+        const char* objectID = nullptr;
+        size_t objectIDLen = 0;
+        type.clear();
+        ForEachAttribute(p, tagEnd, [&](const char* name, size_t nameLen, const char* value, size_t valueLen) {
+            if ( NameEquals(name, nameLen, "type") || NameEquals(name, nameLen, "media-type") )
+            {
+                type.assign(value, valueLen);
+            }
+            else if ( NameEquals(name, nameLen, "data") )
+            {
+                src = value;
+                srcLen = valueLen;
+            }
+            else if ( NameEquals(name, nameLen, "id") )
+            {
+                objectID = value;
+                objectIDLen = valueLen;
+            }
+        });
+        
+        // find the appropriate media handler
         auto found = _handlers.find(type);
         if ( found == _handlers.end() )
         {
-            output += pos->str();
+            p = tagEnd;
             continue;
         }
         
@@ -125,87 +316,112 @@ void* ObjectPreprocessor::FilterData(FilterContext* context, void *data, size_t
         ContentHandler::ParameterList params;
         params["type"] = type;
         
-        // find the data source
-        REGEX_NS::smatch m;
-        std::string attrs(pos->str(1));
-        REGEX_NS::regex_search(attrs.cbegin(), attrs.cend(), m, SourceFinder);
-        string src(m[1].str());
-        
-        // find any parameters to the object tag
-        std::string content(pos->str(3));
-        REGEX_NS::sregex_iterator cpos(content.begin(), content.end(), ParamMatcher);
-        REGEX_NS::sregex_iterator cend;
-        
-        while ( cpos != cend )
+        // find the end of the element, collecting any parameters on the way
+        const char* elementEnd = nullptr;
+        if ( tagEnd[-2] == '/' )
         {
-            if ( cpos->length() >= 4 )
+            elementEnd = tagEnd;
+        }
+        else
+        {
+            int depth = 1;
+            const char* q = tagEnd;
+            while ( q != end && (q = reinterpret_cast<const char*>(::memchr(q, '<', size_t(end - q)))) != nullptr )
             {
-                string name, value;
-                if ( cpos->str(1) == "name" )
-                    name = cpos->str(2);
-                else
-                    value = cpos->str(2);
-                
-                if ( cpos->str(3) == "value" )
-                    value = cpos->str(4);
+                const char* next = nullptr;
+                if ( IsCommentStart(q, end) )
+                {
+                    next = SkipComment(q, end);
+                }
+                else if ( IsTagNamed(q, end, "object", true) )
+                {
+                    next = FindTagEnd(q, end);
+                    if ( next != nullptr && --depth == 0 )
+                    {
+                        elementEnd = next;
+                        break;
+                    }
+                }
+                else if ( IsTagNamed(q, end, "object", false) )
+                {
+                    // nested fallback objects
+                    next = FindTagEnd(q, end);
+                    if ( next != nullptr && next[-2] != '/' )
+                        depth++;
+                }
+                else if ( depth == 1 && IsTagNamed(q, end, "param", false) )
+                {
+                    next = FindTagEnd(q, end);
+                    if ( next != nullptr )
+                    {
+                        string name, value;
+                        ForEachAttribute(q, next, [&](const char* attrName, size_t attrNameLen, const char* attrValue, size_t attrValueLen) {
+                            if ( NameEquals(attrName, attrNameLen, "name") )
+                                name = string(attrValue, attrValueLen);
+                            else if ( NameEquals(attrName, attrNameLen, "value") )
+                                value = string(attrValue, attrValueLen);
+                        });
+                        if ( !name.empty() )
+                            params[name] = value;
+                    }
+                }
                 else
-                    name = cpos->str(4);
+                {
+                    next = q + 1;
+                }
                 
-                params[name] = value;
+                if ( next == nullptr )
+                    break;
+                q = next;
             }
-            
-            ++cpos;
         }
         
+        // an unterminated element is left as-is
+        if ( elementEnd == nullptr )
+            break;
+        
         // now determine the target-- this is an absolute URL
-        IRI target = handler.Target(src, params);
+        IRI target = handler.Target(string(src == nullptr ? std::string() : std::string(src, srcLen)), params);
+        std::string url = target.URIString().stl_str();
         
-        // find out if the object tag had an id attribute
-        std::string objectID;
-        if ( REGEX_NS::regex_search(attrs.cbegin(), attrs.cend(), m, IDFinder) )
-            objectID = m[1].str();
+        // the replacement is usually larger than the element, so size for the whole document up front;
+        // any further replacements will grow the buffer geometrically
+        static const size_t kReplacementMarkupLength = 220;
+        if ( copied == input )
+            output.reserve(len + kReplacementMarkupLength + (url.size() * 3) + (objectIDLen * 3) + _button.stl_str().size());
+        
+        // output any leading non-matched characters
+        output.append(copied, p);
         
         // now construct the `iframe` tag
-        std::string url = target.URIString().stl_str();
-        output += "<iframe src=\"" + url + "\" srcdoc=\"" + url + "\"";
+        output.append("<iframe src=\"").append(url).append("\" srcdoc=\"").append(url).append("\"");
         
         // replicate any id attribute from the `object` tag
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "\"";
+        if ( objectIDLen != 0 )
+            output.append(" id=\"").append(objectID, objectIDLen).append("\"");
         
         // enable sandbox and allow some stuff, and use seamless presentation
-        output += " sandbox=\"allow-forms allow-scripts allow-same-origin\" seamless=\"seamless\"></iframe>";
+        output.append(" sandbox=\"allow-forms allow-scripts allow-same-origin\" seamless=\"seamless\"></iframe>");
         
         // now add the form & button
-        output += "<form action=\"" + url + "\" method=\"get\"";
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "-form\"";
-        output += "><button type=\"submit\"";
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "-button\"";
-        output += ">" + _button.stl_str() + "</button></form>";
+        output.append("<form action=\"").append(url).append("\" method=\"get\"");
+        if ( objectIDLen != 0 )
+            output.append(" id=\"").append(objectID, objectIDLen).append("-form\"");
+        output.append("><button type=\"submit\"");
+        if ( objectIDLen != 0 )
+            output.append(" id=\"").append(objectID, objectIDLen).append("-button\"");
+        output.append(">").append(_button.stl_str()).append("</button></form>");
         
         // that's it-- we've replaced the whole lot!
-        
-        // step forward, and if we get the end let's output the current suffix
-        // this ensures that we don't lose everything following the last match
-        auto here = pos++;
-        if ( pos == end )
-            output += here->suffix();
+        copied = p = elementEnd;
     }
     
-    *outputLen = output.size();
-    if ( output.size() < len )
-    {
-        // use the incoming buffer directly
-        output.copy(input, output.size());
-        return input;
-    }
+    if ( copied == input )
+        return false;
     
-    // allocate an output buffer
-    char* result = new char[output.size()];
-    output.copy(result, output.size());
-    return result;
+    // output everything following the last match
+    output.append(copied, end);
+    return true;
 }
 
 EPUB3_END_NAMESPACE
@@ -34,7 +34,7 @@
 #include <ePub3/filter.h>
 #include <ePub3/utilities/iri.h>
 #include <ePub3/content_handler.h>
-#include REGEX_INCLUDE
+#include <unordered_map>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -71,11 +71,11 @@ public:
     
     ///
     /// Standard copy constructor.
-    ObjectPreprocessor(const ObjectPreprocessor& o) : ContentFilter(o), _objectMatcher(o._objectMatcher), _handlers(o._handlers) {}
+    ObjectPreprocessor(const ObjectPreprocessor& o) : ContentFilter(o), _button(o._button), _handlers(o._handlers) {}
     
     ///
     /// C++11 'move' constructor.
-    ObjectPreprocessor(ObjectPreprocessor&& o) : ContentFilter(std::move(o)), _objectMatcher(std::move(o._objectMatcher)), _handlers(std::move(o._handlers)) {}
+    ObjectPreprocessor(ObjectPreprocessor&& o) : ContentFilter(std::move(o)), _button(o._button), _handlers(std::move(o._handlers)) {}
     
     ///
     /// Destructor.
@@ -107,47 +107,54 @@ public:
      and `-button` and applied to the `form` and `button` elements respectively.  It
      is our intention that these rules will make it possible for content authors to
      anticipate these substitutions and build CSS or JavaScript rules directly.
+     
+     The document is scanned once, lexing tags and attributes directly. Documents
+     containing no matching `object` elements are returned untouched, without any
+     allocation.
      */
     virtual void*   FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE;
     
-    // register with the filter manager
-    static void Register();
-    
-protected:
     /**
-     This regex is used to locate only those `object` tags for which handlers exist.
-     
-     Its text is:
-     
-         <object\s+?([^>]*?media-type="(...|...|...)"[^>]*?)>(.*?)</object>
-     
-     The three ellipses in the middle represent media types. For example, with
-     handlers for 'application/x-slideshow+xml' and 'image/x-slideshow', the regex
-     would read:
-     
-         <object\s+?([^>]*?type="(application/x-slideshow\.xml|image/x-slideshow)"[^>]*?)>(.*?)</object>
-     
-     Note that any and all regex special characters will be replaced automatically
-     during insertion.
-     
-     #### Matches
+     Performs the same replacement as FilterData(), writing into the output span.
      
-     There are a few things captured by the expression:
-     
-     - *0:* The entire `<object...>...</object>` construct.
-     - *1:* The complete string containing all the attribute definitions of the `<object>` tag.
-     - *2:* The value of the `object` element's `type` attribute.
-     - *3:* The `innerHTML` content of the `object` element.
+     The input must be the entire content document. Output which doesn't fit is held
+     in the filter context until the next call, and the context's storage is reused
+     from one document to the next.
      */
-    REGEX_NS::regex                         _objectMatcher;
+    virtual bool            SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus      FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE;
+    
+    // register with the filter manager
+    static void Register();
     
+protected:
     ///
     /// The (hopefully localized!) title of the generated HTML5 `<button>`.
     const string                            _button;
     
     ///
     /// The object keeps its own list of handlers, used to create target URIs.
-    std::map<string, MediaHandler>          _handlers;
+    /// Keyed by media-type, so each `object` tag's `type` is matched with one hash lookup.
+    std::unordered_map<std::string, MediaHandler>   _handlers;
+    
+    virtual FilterContext*  InnerMakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new ObjectContext; }
+    
+private:
+    ///
+    /// Holds a document's rewritten markup until it has all been written to the caller's spans.
+    class ObjectContext : public FilterContext
+    {
+    public:
+        ObjectContext() : FilterContext(), output(), written(0) {}
+        virtual ~ObjectContext() {}
+        
+        std::string     output;             ///< The rewritten document.
+        size_t          written;            ///< The number of bytes of `output` written so far.
+    };
+    
+    ///
+    /// Appends the rewritten document to `output`, returning `false` (with `output` untouched) if nothing was replaced.
+    bool                    Rewrite(const char* input, size_t len, std::string& output) const;
     
 };
 
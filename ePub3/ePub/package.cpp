@@ -39,8 +39,10 @@
 #include "byte_stream.h"
 #include "filter_chain.h"
 #include "filter_manager.h"
+#include "content_module_manager.h"
 #include "media-overlays_smil_model.h"
 #include <ePub3/utilities/error_handler.h>
+#include <ePub3/utilities/work_stealing_pool.h>
 #include <sstream>
 #include <list>
 #include REGEX_INCLUDE
@@ -92,14 +94,78 @@ static const xmlChar * DCNamespace = (const xmlChar*)"http://purl.org/dc/element
 static const xmlChar * MediaTypeElementName = (const xmlChar*)"mediaType";
 #endif
 
+/**
+ The sections of a package document, gathered in a single walk over the children of
+ its root element instead of with an XPath query for each one.
+ 
+ As with the queries they replace, only elements in the OPF namespace are collected,
+ and only when the root is an OPF `package` element.
+ */
+struct PackageSections
+{
+    xml::NodeSet    manifestItems;      ///< `/opf:package/opf:manifest/opf:item`
+    xml::NodeSet    spineItems;         ///< `/opf:package/opf:spine/opf:itemref`
+    xml::NodeSet    collections;        ///< `/opf:package/opf:collection`
+    xml::NodeSet    metadata;           ///< `/opf:package/opf:metadata/*`
+    xml::NodeSet    bindings;           ///< `/opf:package/opf:bindings/*`
+};
+
+static bool IsOPFElement(const std::shared_ptr<xml::Node>& node, const xml::string& name)
+{
+    static const xml::string kOPFNamespace(OPFNamespace);
+    if ( node->Name() != name )
+        return false;
+    
+    auto ns = node->Namespace();
+    return bool(ns) && ns->URI() == kOPFNamespace;
+}
+
+/// Appends the element children of `node` to `nodes`, optionally only those with a given OPF name.
+static void CollectOPFChildren(const std::shared_ptr<xml::Node>& node, xml::NodeSet& nodes, const xml::string* name = nullptr)
+{
+    for ( auto child = node->FirstElementChild(); bool(child); child = child->NextElementSibling() )
+    {
+        if ( name == nullptr || IsOPFElement(child, *name) )
+            nodes.push_back(child);
+    }
+}
+
+/// Returns the first OPF `spine` element among the children of the root.
+static std::shared_ptr<xml::Node> OPFSpineElement(const std::shared_ptr<xml::Node>& root)
+{
+    static const xml::string kSpineName((const char*)"spine");
+    for ( auto child = root->FirstElementChild(); bool(child); child = child->NextElementSibling() )
+    {
+        if ( IsOPFElement(child, kSpineName) )
+            return child;
+    }
+    return nullptr;
+}
+
+/// Returns the first element, in document order, whose `id` attribute matches `ident`.
+static std::shared_ptr<xml::Node> ElementWithID(const std::shared_ptr<xml::Node>& node, const string& ident)
+{
+    if ( _getProp(node, "id") == ident )
+        return node;
+    
+    for ( auto child = node->FirstElementChild(); bool(child); child = child->NextElementSibling() )
+    {
+        auto found = ElementWithID(child, ident);
+        if ( bool(found) )
+            return found;
+    }
+    return nullptr;
+}
+
 bool Package::gValidateSchema = true;
+bool Package::gPreloadDeferredContent = false;
 
-PackageBase::PackageBase(const shared_ptr<Container>& owner, const string& type) : _archive(owner->GetArchive()), _opf(nullptr), _type(type)
+PackageBase::PackageBase(const shared_ptr<Container>& owner, const string& type) : _archive(owner->GetArchive()), _opf(nullptr), _type(type), _deferredContentReady(false), _navigationLoaded(false), _mediaOverlaysLoaded(false)
 {
     if ( !_archive )
         throw std::invalid_argument("Owner doesn't have an archive!");
 }
-PackageBase::PackageBase(PackageBase&& o) : _archive(o._archive), _opf(std::move(o._opf)), _pathBase(std::move(o._pathBase)), _type(std::move(o._type)), _manifestByID(std::move(o._manifestByID)), _manifestByAbsolutePath(std::move(o._manifestByAbsolutePath)), _spine(std::move(o._spine))
+PackageBase::PackageBase(PackageBase&& o) : _archive(o._archive), _opf(std::move(o._opf)), _pathBase(std::move(o._pathBase)), _type(std::move(o._type)), _manifestByID(std::move(o._manifestByID)), _manifestByAbsolutePath(std::move(o._manifestByAbsolutePath)), _manifestByDecodedPath(std::move(o._manifestByDecodedPath)), _spine(std::move(o._spine)), _deferredContentReady(false), _navigationLoaded(false), _mediaOverlaysLoaded(false)
 {
     o._archive = nullptr;
 }
@@ -146,23 +212,15 @@ bool PackageBase::Open(const string& path, bool skipLoadingPotentiallyEncryptedC
 }
 shared_ptr<SpineItem> PackageBase::SpineItemAt(size_t idx) const
 {
-    shared_ptr<SpineItem> item = _spine;
-    for ( size_t i = 0; i < idx && item != nullptr; i++ )
-    {
-        item = item->Next();
-    }
-    return item;
+    if ( !bool(_spine) || !bool(_spine->_spineIndex) )
+        return nullptr;
+    return _spine->_spineIndex->ItemAt(idx);
 }
 size_t PackageBase::IndexOfSpineItemWithIDRef(const string &idref) const
 {
-    shared_ptr<SpineItem> item = FirstSpineItem();
-    for ( size_t i = 0; item != nullptr; i++, item = item->Next() )
-    {
-        if ( item->Idref() == idref )
-            return i;
-    }
-    
-    return size_t(-1);
+    if ( !bool(_spine) || !bool(_spine->_spineIndex) )
+        return size_t(-1);
+    return _spine->_spineIndex->IndexOfIDRef(idref);
 }
 shared_ptr<ManifestItem> PackageBase::ManifestItemWithID(const string &ident) const
 {
@@ -190,6 +248,34 @@ const shared_vector<ManifestItem> PackageBase::ManifestItemsWithProperties(Prope
     }
     return result;
 }
+/// Removes all percent-escapes from a path, yielding the form used by `_manifestByDecodedPath`.
+static string DecodedPath(const string& path)
+{
+    url_canon::RawCanonOutputW<256> output;
+    
+    // note that std::string .size() is the same as
+    // ePub3:string .utf8_size() defined in utfstring.h (equivalent to strlen(str.c_str()) ),
+    // but not the same as ePub3:string .size() !!
+    // WATCH OUT!
+    url_util::DecodeURLEscapeSequences(path.c_str(), static_cast<int>(path.utf8_size()), &output);
+    
+    return string(output.data(), output.length());
+}
+void PackageBase::BuildDecodedPathIndex()
+{
+    _manifestByDecodedPath.clear();
+    _manifestByDecodedPath.reserve(_manifestByID.size());
+    
+    // when two items decode to the same path, the first in identifier order wins
+    for ( auto& item : _manifestByID )
+    {
+#if EPUB_HAVE(CXX_MAP_EMPLACE)
+        _manifestByDecodedPath.emplace(DecodedPath(item.second->AbsolutePath()).stl_str(), item.second);
+#else
+        _manifestByDecodedPath.insert({DecodedPath(item.second->AbsolutePath()).stl_str(), item.second});
+#endif
+    }
+}
 shared_ptr<ManifestItem> PackageBase::ManifestItemAtRelativePath(const string& path) const
 {
 	string absPath = _pathBase + (path[0] == '/' ? path.substr(1) : path);
@@ -205,46 +291,12 @@ shared_ptr<ManifestItem> PackageBase::ManifestItemAtRelativePath(const string& p
 
     //if ( path.find("%") != std::string::npos ) SOMETIMES OPF MANIFEST ITEM HREF IS PERCENT-ESCAPED, BUT NOT HTML SRC !!
 
-    url_canon::RawCanonOutputW<256> output;
-
-    // SEE BELOW FOR A DEBUGGING BREAKPOINT / CHECK
-    // note that std::string .size() is the same as
-    // ePub3:string .utf8_size() defined in utfstring.h (equivalent to strlen(str.c_str()) ),
-    // but not the same as ePub3:string .size() !!
-    // WATCH OUT!
-    url_util::DecodeURLEscapeSequences(path.c_str(), static_cast<int>(path.utf8_size()), &output);
-
-    string path_(output.data(), output.length());
-
+    string path_ = DecodedPath(path);
     string absPath_ = _pathBase + (path_[0] == '/' ? path_.substr(1) : path_);
-    for (auto& item : _manifestByID)
-    {
-        string absolute = item.second->AbsolutePath();
-
-        url_canon::RawCanonOutputW<256> output_;
-
-//        THIS IS FOR DEBUGGING, SEE COMMENT BELOW ...
-        const char * absChars = absolute.c_str();
-        int absLength_STRLEN = (int)strlen(absChars);
-        int absLength_SIZE = static_cast<int>(absolute.size());
-        int absLength_UTF8SIZE = static_cast<int>(absolute.utf8_size());
-        if (absLength_STRLEN != absLength_SIZE || absLength_STRLEN != absLength_UTF8SIZE || absLength_SIZE != absLength_UTF8SIZE)
-        {
-            // Place breakpoint here
-            //printf("String length DIFF absLength_STRLEN:%d - absLength_SIZE:%d - absLength_UTF8SIZE:%d\n", absLength_STRLEN, absLength_SIZE, absLength_UTF8SIZE);
-        }
-
-        // note that std::string .size() is the same as
-        // ePub3:string .utf8_size() defined in utfstring.h (equivalent to strlen(str.c_str()) ),
-        // but not the same as ePub3:string .size() !!
-        // WATCH OUT!
-        url_util::DecodeURLEscapeSequences(absolute.c_str(), static_cast<int>(absolute.utf8_size()), &output_);
-
-        string absolute_(output_.data(), output_.length());
-
-        if (absolute_ == absPath_)
-            return item.second;
-    }
+    
+    auto decodedFound = _manifestByDecodedPath.find(absPath_.stl_str());
+    if ( decodedFound != _manifestByDecodedPath.end() )
+        return decodedFound->second;
 
     // DEBUG
     //printf("MISSING ManifestItemAtRelativePath %s (%s)\n", path.c_str(), absPath.c_str());
@@ -253,6 +305,7 @@ shared_ptr<ManifestItem> PackageBase::ManifestItemAtRelativePath(const string& p
 }
 shared_ptr<NavigationTable> PackageBase::NavigationTable(const string &title) const
 {
+    LoadNavigationTablesOnce();
     auto found = _navigation.find(title);
     if ( found == _navigation.end() )
         return nullptr;
@@ -265,6 +318,40 @@ shared_ptr<Collection> PackageBase::CollectionWithRole(string_view role) const
         return nullptr;
     return found->second;
 }
+void PackageBase::LoadNavigationTablesOnce() const
+{
+    if ( !_deferredContentReady )
+        return;
+    
+    // if this throws the tables are left unloaded, so the next caller tries again;
+    // any tables added before the failure are dropped so that retry starts afresh
+    std::lock_guard<std::mutex> _(_navigationLock);
+    if ( _navigationLoaded )
+        return;
+    
+    try
+    {
+        const_cast<PackageBase*>(this)->LoadNavigationTables();
+    }
+    catch (...)
+    {
+        const_cast<PackageBase*>(this)->_navigation.clear();
+        throw;
+    }
+    _navigationLoaded = true;
+}
+void PackageBase::LoadMediaOverlaysOnce() const
+{
+    if ( !_deferredContentReady )
+        return;
+    
+    std::lock_guard<std::mutex> _(_mediaOverlaysLock);
+    if ( _mediaOverlaysLoaded )
+        return;
+    
+    const_cast<PackageBase*>(this)->LoadMediaOverlays();
+    _mediaOverlaysLoaded = true;
+}
 unique_ptr<ByteStream> PackageBase::ReadStreamForItemAtPath(const string &path) const
 {
     return _archive->ByteStreamAtPath(path.stl_str());
@@ -274,19 +361,13 @@ shared_ptr<SpineItem> PackageBase::ConfirmOrCorrectSpineItemQualifier(shared_ptr
     if ( pComponent->HasQualifier() && pItem->Idref() != pComponent->qualifier )
     {
         // find the item with the qualifier
-        pItem = _spine;
-        uint32_t idx = 2;
+        size_t idx = IndexOfSpineItemWithIDRef(pComponent->qualifier);
+        pItem = SpineItemAt(idx);
         
-        while ( pItem != nullptr )
+        if ( pItem != nullptr )
         {
-            if ( pItem->Idref() == pComponent->qualifier )
-            {
-                // found it-- correct the CFI
-                pComponent->nodeIndex = idx;
-                break;
-            }
-            
-            pItem = pItem->Next();
+            // found it-- correct the CFI
+            pComponent->nodeIndex = uint32_t((idx+1)*2);
         }
     }
     else if ( pComponent->HasQualifier() == false )
@@ -405,7 +486,7 @@ NavigationList PackageBase::_LoadNCXNavTablesFromManifestItem(PackagePtr sharedP
 #pragma mark - Package High-Level API
 #endif
 
-Package::Package(const shared_ptr<Container>& owner, const string& type) : PropertyHolder(), OwnedBy(owner), PackageBase(owner, type)
+Package::Package(const shared_ptr<Container>& owner, const string& type) : PropertyHolder(), OwnedBy(owner), PackageBase(owner, type), _filteredContentCacheBudget(0), _spineTitlesCompiled(false)
 {
 }
 
@@ -499,15 +580,74 @@ void Package::Unpack_Finally(bool resetContentFilterChain)
     if (resetContentFilterChain) {
         auto fm = FilterManager::Instance();
         auto fc = fm->BuildFilterChainForPackage(shared_from_this());
+        
+        // anything already loaded came through the old chain, so is loaded again through
+        // the new one; taking the locks waits out any load which is under way
+        std::lock(_spineTitlesLock, _navigationLock, _mediaOverlaysLock);
+        std::lock_guard<std::mutex> titlesGuard(_spineTitlesLock, std::adopt_lock);
+        std::lock_guard<std::mutex> navigationGuard(_navigationLock, std::adopt_lock);
+        std::lock_guard<std::mutex> mediaOverlaysGuard(_mediaOverlaysLock, std::adopt_lock);
+        
         SetFilterChain(fc);
+        _navigation.clear();
+        _navigationLoaded = false;
+        _mediaOverlays.reset();
+        _mediaOverlaysLoaded = false;
+        _spineTitlesCompiled = false;
     }
 
-    this->LoadNavigationTables();
+    // the navigation tables, spine item titles and media overlays are loaded on first access
+    _deferredContentReady = true;
+    
+    // a content module registers its filters after opening the package, then calls this
+    // again to build the final chain; preloading before then would use the wrong filters
+    if ( gPreloadDeferredContent && (resetContentFilterChain || !ContentModuleManager::Instance()->IsProcessingFileOnCurrentThread()) )
+        PreloadDeferredContent();
+}
 
+void Package::LoadDeferredContent()
+{
+    LoadNavigationTablesOnce();
+    
     // go through the TOC and copy titles to the relevant spine items for easy access
-    this->CompileSpineItemTitles();
+    CompileSpineItemTitlesOnce();
+    
+    LoadMediaOverlaysOnce();
+}
 
-    this->LoadMediaOverlays();
+void Package::PreloadDeferredContent()
+{
+    if ( !_deferredContentReady )
+        return;
+    
+    std::weak_ptr<Package> weakSelf = shared_from_this();
+    WorkStealingPool::Shared().Add([weakSelf]() {
+        PackagePtr self = weakSelf.lock();
+        if ( !bool(self) )
+            return;
+        
+        try
+        {
+            self->LoadDeferredContent();
+        }
+        catch (...)
+        {
+            // anything left unloaded is tried again, and reported, on first access
+        }
+    });
+}
+
+void Package::CompileSpineItemTitlesOnce() const
+{
+    if ( !_deferredContentReady )
+        return;
+    
+    std::lock_guard<std::mutex> _(_spineTitlesLock);
+    if ( _spineTitlesCompiled )
+        return;
+    
+    const_cast<Package*>(this)->CompileSpineItemTitles();
+    _spineTitlesCompiled = true;
 }
 
 void Package::LoadMediaOverlays() {
@@ -584,14 +724,10 @@ void Package::LoadNavigationTables()
     if (_navigation.empty() || _navigation["toc"]->Children().empty())
     {
         // look for EPUB2 NCX file
-#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
-        XPathWrangler xpath(_opf, { { "opf", OPFNamespace } });
-#else
-        XPathWrangler::NamespaceList __m;
-		__m["opf"] = OPFNamespace;
-		XPathWrangler xpath(_opf, __m);
-#endif
-        auto tocNames = xpath.Strings("/opf:package/opf:spine/@toc");
+        std::vector<string> tocNames;
+        auto spineNode = OPFSpineElement(root);
+        if ( bool(spineNode) && !_getProp(spineNode, "toc").empty() )
+            tocNames.push_back(_getProp(spineNode, "toc"));
 
         if (tocNames.empty() && _navigation.empty())
         {
@@ -680,10 +816,19 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
     auto val = _getProp(root, "prefix", ePub3NamespaceURI);
     InstallPrefixesFromAttributeValue(val);
     
-    // go through children to determine the CFI index of the <spine> tag
+    // go through children to determine the CFI index of the <spine> tag, and gather
+    // the contents of each section as we go
+    static xml::string kPackageName((const char*)"package");
     static xml::string kSpineName((const char*)"spine");
     static xml::string kManifestName((const char*)"manifest");
     static xml::string kMetadataName((const char*)"metadata");
+    static xml::string kCollectionName((const char*)"collection");
+    static xml::string kBindingsName((const char*)"bindings");
+    static xml::string kItemName((const char*)"item");
+    static xml::string kItemrefName((const char*)"itemref");
+
+    PackageSections sections;
+    bool isOPFPackage = IsOPFElement(root, kPackageName);
 
     _spineCFIIndex = 0;
     uint32_t idx = 0;
@@ -706,6 +851,20 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
             HandleError(EPUBError::OPFMetadataOutOfOrder);
         }
         
+        if ( isOPFPackage )
+        {
+            if ( IsOPFElement(child, kManifestName) )
+                CollectOPFChildren(child, sections.manifestItems, &kItemName);
+            else if ( IsOPFElement(child, kSpineName) )
+                CollectOPFChildren(child, sections.spineItems, &kItemrefName);
+            else if ( IsOPFElement(child, kMetadataName) )
+                CollectOPFChildren(child, sections.metadata);
+            else if ( IsOPFElement(child, kCollectionName) )
+                sections.collections.push_back(child);
+            else if ( IsOPFElement(child, kBindingsName) )
+                CollectOPFChildren(child, sections.bindings);
+        }
+        
 		child = child->NextElementSibling();
     }
     
@@ -715,23 +874,14 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
         return false;       // spineless!
     }
     
-#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
-    XPathWrangler xpath(_opf, {{"opf", OPFNamespace}, {"dc", DCNamespace}});
-#else
-    XPathWrangler::NamespaceList __m;
-    __m["opf"] = OPFNamespace;
-    __m["dc"] = DCNamespace;
-    XPathWrangler xpath(_opf, __m);
-#endif
-    
     // simple things: manifest and spine items
     xml::NodeSet manifestNodes;
     xml::NodeSet spineNodes;
     
     try
     {
-        manifestNodes = xpath.Nodes("/opf:package/opf:manifest/opf:item");
-        spineNodes = xpath.Nodes("/opf:package/opf:spine/opf:itemref");
+        manifestNodes = std::move(sections.manifestItems);
+        spineNodes = std::move(sections.spineItems);
         
         if ( manifestNodes.empty() )
         {
@@ -763,6 +913,12 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
             }
         }
         
+        BuildDecodedPathIndex();
+        
+        // now that the manifest is complete, settle which filters apply to each item
+        if ( _filterChain )
+            _filterChain->PrecomputeApplicability(_manifestByID);
+        
         // check fallback chains
         typedef std::map<string, bool> IdentSet;
         IdentSet idents;
@@ -831,6 +987,7 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
             else
             {
                 _spine = next;
+                _spine->BeginSpine();
             }
             
             cur = next;
@@ -857,7 +1014,7 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
     try
     {
         PropertyHolderPtr holderPtr = CastPtr<PropertyHolder>();
-        collectionNodes = xpath.Nodes("/opf:package/opf:collection");
+        collectionNodes = std::move(sections.collections);
         
         for (auto& node : collectionNodes)
         {
@@ -890,7 +1047,7 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
     try
     {
         PropertyHolderPtr holderPtr = CastPtr<PropertyHolder>();
-        metadataNodes = xpath.Nodes("/opf:package/opf:metadata/*");
+        metadataNodes = std::move(sections.metadata);
         if ( metadataNodes.empty() )
             HandleError(EPUBError::OPFNoMetadata);
         
@@ -1085,7 +1242,7 @@ bool Package::Unpack(bool skipLoadingPotentiallyEncryptedContent)
     
     try
     {
-        bindingNodes = xpath.Nodes("/opf:package/opf:bindings/*");
+        bindingNodes = std::move(sections.bindings);
         if ( !bindingNodes.empty() )
         {
 			xml::string mediaTypeElementName(MediaTypeElementName);
@@ -1250,18 +1407,26 @@ string Package::URLSafeUniqueID() const
 }
 string Package::PackageID() const
 {
-#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
-    XPathWrangler xpath(_opf, {{"opf", OPFNamespace}, {"dc", DCNamespace}});
-#else
-    XPathWrangler::NamespaceList __m;
-    __m["opf"] = OPFNamespace;
-    __m["dc"] = DCNamespace;
-    XPathWrangler xpath(_opf, __m);
-#endif
-    XPathWrangler::StringList strings = xpath.Strings("//*[@id=/opf:package/@unique-identifier]/text()");
-    if ( strings.empty() )
+    // the first text of the element named by /opf:package/@unique-identifier
+    static const xml::string kPackageName((const char*)"package");
+    auto root = _opf->Root();
+    if ( !bool(root) || !IsOPFElement(root, kPackageName) )
+        return string::EmptyString;
+    
+    string uniqueIDRef = _getProp(root, "unique-identifier");
+    if ( uniqueIDRef.empty() )
         return string::EmptyString;
-    return strings[0];
+    
+    auto identifier = ElementWithID(root, uniqueIDRef);
+    if ( !bool(identifier) )
+        return string::EmptyString;
+    
+    for ( auto child = identifier->FirstChild(); bool(child); child = child->NextSibling() )
+    {
+        if ( child->IsTextNode() )
+            return child->Content();
+    }
+    return string::EmptyString;
 }
 string Package::Version() const
 {
@@ -1287,13 +1452,7 @@ void Package::FireLoadEvent(const IRI &url) const
 }
 shared_ptr<SpineItem> Package::SpineItemWithIDRef(const string &idref) const
 {
-    for ( auto item = FirstSpineItem(); item != nullptr; item = item->Next() )
-    {
-        if ( item->Idref() == idref )
-            return item;
-    }
-    
-    return nullptr;
+    return SpineItemAt(IndexOfSpineItemWithIDRef(idref));
 }
 const CFI Package::CFIForManifestItem(shared_ptr<ManifestItem> item) const
 {
@@ -1400,11 +1559,30 @@ unique_ptr<ByteStream> Package::GetFilterChainByteStreamRange(ManifestItemPtr ma
     return _filterChain->GetFilterChainByteStreamRange(manifestItem, rawInput);
 }
 
+shared_ptr<ByteStream> Package::GetFilterChainPipeline(ManifestItemPtr manifestItem) const
+{
+    return _filterChain->GetFilterChainPipeline(manifestItem);
+}
+
 size_t Package::GetFilterChainSize(ManifestItemPtr manifestItem) const
 {
     return _filterChain->GetFilterChainSize(manifestItem);
 }
 
+void Package::SetFilterChain(FilterChainPtr chain) _NOEXCEPT
+{
+    _filterChain = chain;
+    if (_filterChain)
+        _filterChain->FilteredContent().SetBudget(_filteredContentCacheBudget);
+}
+
+void Package::SetFilteredContentCacheBudget(size_t bytes)
+{
+    _filteredContentCacheBudget = bytes;
+    if (_filterChain)
+        _filterChain->FilteredContent().SetBudget(bytes);
+}
+
 const string& Package::Title(bool localized) const
 {
     IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
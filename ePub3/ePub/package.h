@@ -34,7 +34,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <list>
+#include <mutex>
 #include <ePub3/xml/node.h>
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/encryption.h>
@@ -96,6 +98,9 @@ public:
     ///
     /// An XML-ID lookup table for relevant types
     typedef std::map<string, shared_ptr<XMLIdentifiable>>   XMLIDLookup;
+    ///
+    /// A hashed lookup table of manifest items, indexed by percent-decoded path.
+    typedef std::unordered_map<std::string, shared_ptr<ManifestItem>>   ManifestPathIndex;
     
 private:
     /** There is no default constructor for PackageBase. */
@@ -145,8 +150,8 @@ public:
     /// Returns an immutable reference to the manifest table.
     const ManifestTable&    Manifest()              const       { return _manifestByID; }
     ///
-    /// Returns an immutable reference to the map of navigation tables.
-    const NavigationMap&    NavigationTables()      const       { return _navigation; }
+    /// Returns an immutable reference to the map of navigation tables, loading them on first use.
+    const NavigationMap&    NavigationTables()      const       { LoadNavigationTablesOnce(); return _navigation; }
 
     /// @}
     
@@ -264,8 +269,19 @@ public:
     void            Unpack_Finally(bool resetContentFilterChain);
 
 protected:
-    void            LoadMediaOverlays();
-    void            LoadNavigationTables();
+    virtual void    LoadMediaOverlays()         = 0;
+    virtual void    LoadNavigationTables()      = 0;
+    
+    ///
+    /// Loads the navigation tables on first use, once Unpack_Finally() has run.
+    void            LoadNavigationTablesOnce()  const;
+    ///
+    /// Loads the media overlays on first use, once Unpack_Finally() has run.
+    void            LoadMediaOverlaysOnce()     const;
+    
+    ///
+    /// Rebuilds `_manifestByDecodedPath` from the manifest; called once the manifest is parsed.
+    void            BuildDecodedPathIndex();
 
     shared_ptr<Archive>       _archive;                ///< The archive from which the package was loaded.
     shared_ptr<xml::Document> _opf;                    ///< The XML document representing the package.
@@ -273,11 +289,18 @@ protected:
     string                    _type;                   ///< The MIME type of the package document.
     ManifestTable             _manifestByID;           ///< All manifest items, indexed by unique identifier.
     ManifestTable             _manifestByAbsolutePath; ///< All manifest items, indexed by absolute path.
+    ManifestPathIndex         _manifestByDecodedPath;  ///< All manifest items, indexed by percent-decoded absolute path.
     NavigationMap             _navigation;             ///< All navigation tables, indexed by type.
     ContentHandlerMap         _contentHandlers;        ///< All installed content handlers, indexed by media-type.
     shared_ptr<SpineItem>     _spine;                  ///< The first item in the spine (SpineItems are a linked list).
     XMLIDLookup               _xmlIDLookup;            ///< Lookup table for all items with XML ID values.
     CollectionList            _collections;            ///< List of all parsed <collection> elements.
+    
+    bool                      _deferredContentReady;   ///< Set by Unpack_Finally(): the navigation and media overlays may now be loaded.
+    mutable std::mutex        _navigationLock;         ///< Held while the navigation tables are loaded or reset.
+    mutable bool              _navigationLoaded;       ///< Whether `_navigation` holds the tables read through the current filter chain.
+    mutable std::mutex        _mediaOverlaysLock;      ///< Held while the media overlays are loaded or reset.
+    mutable bool              _mediaOverlaysLoaded;    ///< Whether `_mediaOverlays` was read through the current filter chain.
 
 protected:
     // used to verify/correct CFIs
@@ -329,8 +352,8 @@ protected:
 protected:
     std::shared_ptr<MediaOverlaysSmilModel> _mediaOverlays;      ///< The Media Overlays SMIL model
 public:
-    // returns a copy of the smart shared pointer (reference count++)
-    std::shared_ptr<MediaOverlaysSmilModel>    MediaOverlaysSmilModel()      const       { return _mediaOverlays; }
+    // returns a copy of the smart shared pointer (reference count++), loading the model on first use
+    std::shared_ptr<MediaOverlaysSmilModel>    MediaOverlaysSmilModel()      const       { LoadMediaOverlaysOnce(); return _mediaOverlays; }
 
     shared_ptr<Archive> Archive() const { return _archive; }
 };
@@ -383,7 +406,7 @@ private:
 
 public:
     EPUB3_EXPORT            Package(const shared_ptr<Container>& owner, const string& type);
-                            Package(Package&& o) : OwnedBy(std::move(o)), PackageBase(std::move(o)) {}
+                            Package(Package&& o) : OwnedBy(std::move(o)), PackageBase(std::move(o)), _filteredContentCacheBudget(o._filteredContentCacheBudget) {}
     virtual                 ~Package() {}
     
     ContainerPtr            GetContainer()          const       { return Owner(); }
@@ -557,6 +580,13 @@ public:
     
     EPUB3_EXPORT
     unique_ptr<ByteStream>          GetFilterChainByteStreamRange(ManifestItemPtr manifestItem, SeekableByteStream *rawInput) const;
+
+    /**
+     Obtains a stream which filters an item's content in chunks on a shared pool of
+     threads, ahead of its reads (see FilterChain::GetFilterChainPipeline()).
+     */
+    EPUB3_EXPORT
+    shared_ptr<ByteStream>          GetFilterChainPipeline(ManifestItemPtr manifestItem)  const;
     
     EPUB3_EXPORT
     size_t GetFilterChainSize(ManifestItemPtr manifestItem) const;
@@ -933,19 +963,63 @@ public:
      built-in chain creation is not enough.
      @param chain The filter chain for the receiving Package instance.
      */
-    virtual void            SetFilterChain(FilterChainPtr chain) _NOEXCEPT {
-        _filterChain = chain;
-    }
+    virtual void            SetFilterChain(FilterChainPtr chain) _NOEXCEPT;
+    
+    ///
+    /// Returns the filter chain for this package.
+    FilterChainPtr          GetFilterChain()                    const   { return _filterChain; }
+    
+    /**
+     Sets the memory budget for caching this package's filtered content.
+     
+     The budget applies to the current filter chain and to any chain assigned later.
+     Hit and miss counts are available from the chain's cache.
+     @param bytes The maximum number of bytes to keep; zero, the default, disables
+     the cache.
+     @see FilterChain::FilteredContent()
+     */
+    EPUB3_EXPORT
+    void                    SetFilteredContentCacheBudget(size_t bytes);
 
 public:
+    /**
+     Completes opening the package once its filter chain is in place.
+     
+     The navigation tables, the spine items' titles and the media overlays are not
+     loaded here: each is loaded on first access, unless background preloading is
+     enabled (see SetPreloadsDeferredContent()).
+     @param resetContentFilterChain Pass `true` to build a new filter chain for the
+     package first; anything already loaded is then loaded again through it.
+     */
     EPUB3_EXPORT
     void            Unpack_Finally(bool resetContentFilterChain);
+    
+    /**
+     Loads the navigation tables, spine item titles and media overlays now, rather
+     than on first access.
+     */
+    EPUB3_EXPORT
+    void            LoadDeferredContent();
+    
+    /**
+     Loads the navigation tables, spine item titles and media overlays on the shared
+     WorkStealingPool.
+     
+     Accessors called in the meantime wait for the item they need. Any error reported
+     while preloading is reported on a pool thread, and again on first access.
+     */
+    EPUB3_EXPORT
+    void            PreloadDeferredContent();
+    
+    ///
+    /// Assigns the TOC's titles to the spine items on first use; called by SpineItem::Title().
+    void            CompileSpineItemTitlesOnce()    const;
 
     /// @}
     
 protected:
-    void            LoadMediaOverlays();
-    void            LoadNavigationTables();
+    virtual void    LoadMediaOverlays()             OVERRIDE;
+    virtual void    LoadNavigationTables()          OVERRIDE;
 
     ///
     /// Extracts information from the OPF XML document.
@@ -964,6 +1038,10 @@ protected:
     EPUB3_EXPORT
     static bool             gValidateSchema;
     
+    // default is `false`
+    EPUB3_EXPORT
+    static bool             gPreloadDeferredContent;
+    
 public:
     ///
     /// Whether the XML parser will validate an OPF file against its schema (default is `true`).
@@ -971,6 +1049,12 @@ public:
     ///
     /// Enable or disable OPF schema validation.
     static void             SetValidatesSchema(bool validate)   { gValidateSchema = validate; }
+    ///
+    /// Whether packages call PreloadDeferredContent() as they finish opening (default is `false`).
+    static bool             PreloadsDeferredContent()           { return gPreloadDeferredContent; }
+    ///
+    /// Enable or disable background preloading of each package's navigation and media overlays.
+    static void             SetPreloadsDeferredContent(bool preload)    { gPreloadDeferredContent = preload; }
     
 protected:
     LoadEventHandler        _loadEventHandler;      ///< The current handler for load events.
@@ -980,6 +1064,9 @@ protected:
     void                    InitMediaSupport();
     
     FilterChainPtr          _filterChain;           ///< The filter chain for this package.
+    size_t                  _filteredContentCacheBudget;    ///< The budget given to each filter chain's cache.
+    mutable std::mutex      _spineTitlesLock;       ///< Held while the spine items' titles are compiled or reset.
+    mutable bool            _spineTitlesCompiled;   ///< Whether the spine items' titles came from the current TOC.
 };
 
 EPUB3_END_NAMESPACE
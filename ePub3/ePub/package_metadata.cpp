@@ -0,0 +1,296 @@
+//
+//  package_metadata.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "package_metadata.h"
+
+#if EPUB_USE(LIBXML2)
+
+#include "archive.h"
+#include "archive_xml.h"
+#include "container.h"
+#include <libxml/xmlreader.h>
+#include <sstream>
+
+EPUB3_BEGIN_NAMESPACE
+
+static const char * gContainerFilePath = "META-INF/container.xml";
+static const xmlChar * OCFNamespace = BAD_CAST OCFNamespaceURI;
+static const xmlChar * OPFNamespace = BAD_CAST "http://www.idpf.org/2007/opf";
+static const xmlChar * DCNamespace = BAD_CAST "http://purl.org/dc/elements/1.1/";
+
+typedef std::unique_ptr<xmlTextReader, void(*)(xmlTextReaderPtr)> TextReaderPtr;
+
+static int ReadArchiveItem(void * context, char * buffer, int len)
+{
+    ssize_t r = reinterpret_cast<ArchiveReader*>(context)->read(buffer, len);
+    return (r < 0 ? -1 : static_cast<int>(r));
+}
+static int CloseArchiveItem(void * context)
+{
+    return 0;
+}
+static TextReaderPtr OpenTextReader(ArchiveReader* reader, const string& path)
+{
+    return TextReaderPtr(xmlReaderForIO(ReadArchiveItem, CloseArchiveItem, reader, path.c_str(), nullptr, ArchiveXmlReader::DEFAULT_OPTIONS), xmlFreeTextReader);
+}
+static bool IsElement(xmlTextReaderPtr reader, const xmlChar * nsURI, const char * name)
+{
+    return (xmlStrEqual(xmlTextReaderConstNamespaceUri(reader), nsURI) == 1 &&
+            xmlStrEqual(xmlTextReaderConstLocalName(reader), BAD_CAST name) == 1);
+}
+static string Attribute(xmlTextReaderPtr reader, const char * name)
+{
+    xmlChar * ch = xmlTextReaderGetAttribute(reader, BAD_CAST name);
+    if ( ch == nullptr )
+        return string::EmptyString;
+    
+    string result(ch);
+    xmlFree(ch);
+    return result;
+}
+static string TextContent(xmlTextReaderPtr reader)
+{
+    xmlChar * ch = xmlTextReaderReadString(reader);
+    if ( ch == nullptr )
+        return string::EmptyString;
+    
+    string result(ch);
+    xmlFree(ch);
+    return result;
+}
+static bool HasToken(const string& list, const string& token)
+{
+    std::istringstream stream(list.stl_str());
+    std::string item;
+    while ( stream >> item )
+    {
+        if ( item == token.stl_str() )
+            return true;
+    }
+    return false;
+}
+
+PackageMetadataPtr PackageMetadata::Open(const string& path)
+{
+    ArchivePtr archive(Archive::Open(path.stl_str()));
+    if ( !bool(archive) )
+        throw std::invalid_argument(_Str("Path does not point to a recognised archive file: '", path, "'"));
+    
+    unique_ptr<ArchiveReader> ocf = archive->ReaderAtPath(gContainerFilePath);
+    if ( !bool(ocf) )
+        throw std::invalid_argument(_Str("ZIP Path not recognised: '", gContainerFilePath, "'"));
+    
+    // the first rootfile is the default package
+    string packagePath;
+    TextReaderPtr reader = OpenTextReader(ocf.get(), gContainerFilePath);
+    while ( bool(reader) && packagePath.empty() && xmlTextReaderRead(reader.get()) == 1 )
+    {
+        if ( xmlTextReaderNodeType(reader.get()) == XML_READER_TYPE_ELEMENT && IsElement(reader.get(), OCFNamespace, "rootfile") )
+            packagePath = Attribute(reader.get(), "full-path");
+    }
+    reader.reset();
+    
+    if ( packagePath.empty() )
+        return nullptr;
+    
+    auto result = std::make_shared<PackageMetadata>();
+    result->_path = path;
+    result->_packagePath = packagePath;
+    if ( !result->ReadPackageDocument(archive.get()) )
+        return nullptr;
+    
+    return result;
+}
+bool PackageMetadata::ReadPackageDocument(Archive* archive)
+{
+    unique_ptr<ArchiveReader> opf = archive->ReaderAtPath(_packagePath.stl_str());
+    if ( !bool(opf) )
+        return false;
+    
+    TextReaderPtr owner = OpenTextReader(opf.get(), _packagePath);
+    xmlTextReaderPtr reader = owner.get();
+    if ( reader == nullptr )
+        return false;
+    
+    // manifest hrefs are relative to the package document, as in PackageBase::Open()
+    string basePath("/");
+    size_t loc = _packagePath.rfind("/");
+    if ( loc != string::npos )
+        basePath = _packagePath.substr(0, loc+1);
+    
+    string uniqueIdentifier, mainTitleID, epub2CoverID, epub2CoverPath;
+    std::vector<std::pair<string, string>> titles;
+    bool sawPackage = false, sawMetadata = false, inMetadata = false, inManifest = false, done = false;
+    
+    while ( !done && xmlTextReaderRead(reader) == 1 )
+    {
+        int type = xmlTextReaderNodeType(reader);
+        if ( type == XML_READER_TYPE_END_ELEMENT )
+        {
+            if ( xmlTextReaderDepth(reader) != 1 )
+                continue;
+            
+            if ( inMetadata )
+                sawMetadata = true;
+            else if ( inManifest && sawMetadata )
+                done = true;
+            inMetadata = inManifest = false;
+            continue;
+        }
+        if ( type != XML_READER_TYPE_ELEMENT )
+            continue;
+        
+        int depth = xmlTextReaderDepth(reader);
+        if ( depth == 0 )
+        {
+            if ( !IsElement(reader, OPFNamespace, "package") )
+                return false;
+            
+            sawPackage = true;
+            _version = Attribute(reader, "version");
+            uniqueIdentifier = Attribute(reader, "unique-identifier");
+            continue;
+        }
+        
+        if ( depth == 1 )
+        {
+            inMetadata = IsElement(reader, OPFNamespace, "metadata");
+            inManifest = IsElement(reader, OPFNamespace, "manifest");
+            
+            // the spine follows the manifest: there's no cover to be found beyond it
+            if ( sawMetadata && IsElement(reader, OPFNamespace, "spine") )
+                done = true;
+            if ( xmlTextReaderIsEmptyElement(reader) == 1 )
+            {
+                sawMetadata = (sawMetadata || inMetadata);
+                inMetadata = inManifest = false;
+            }
+            continue;
+        }
+        
+        if ( inMetadata )
+        {
+            // OEBPS 1.2 packages nest the metadata inside <dc-metadata> and <x-metadata>
+            if ( IsElement(reader, DCNamespace, "title") )
+            {
+                titles.emplace_back(Attribute(reader, "id"), TextContent(reader));
+            }
+            else if ( IsElement(reader, DCNamespace, "creator") )
+            {
+                _authors.push_back(TextContent(reader));
+            }
+            else if ( IsElement(reader, DCNamespace, "identifier") )
+            {
+                _identifiers.push_back(TextContent(reader));
+                if ( !uniqueIdentifier.empty() && Attribute(reader, "id") == uniqueIdentifier )
+                    _packageID = _identifiers.back();
+            }
+            else if ( IsElement(reader, DCNamespace, "language") )
+            {
+                _languages.push_back(TextContent(reader));
+            }
+            else if ( IsElement(reader, OPFNamespace, "meta") )
+            {
+                string property = Attribute(reader, "property");
+                string refines = Attribute(reader, "refines");
+                if ( property.empty() )
+                {
+                    if ( Attribute(reader, "name") == "cover" )
+                        epub2CoverID = Attribute(reader, "content");
+                }
+                else if ( !refines.empty() )
+                {
+                    if ( property == "title-type" && refines.at(0) == '#' && mainTitleID.empty() && TextContent(reader) == "main" )
+                        mainTitleID = refines.substr(1);
+                }
+                else if ( property == "dcterms:modified" )
+                {
+                    _modificationDate = TextContent(reader);
+                }
+                else if ( property.find("rendition:") == 0 )
+                {
+                    _rendition[property.substr(10)] = TextContent(reader);
+                }
+            }
+        }
+        else if ( inManifest && depth == 2 && IsElement(reader, OPFNamespace, "item") )
+        {
+            string ident = Attribute(reader, "id");
+            bool coverImage = HasToken(Attribute(reader, "properties"), "cover-image");
+            if ( !coverImage && (epub2CoverID.empty() || ident != epub2CoverID || !epub2CoverPath.empty()) )
+                continue;
+            
+            string href = Attribute(reader, "href");
+            size_t s = href.find_first_of("#?");
+            if ( s != string::npos )
+                href = href.substr(0, s);
+            
+            if ( coverImage )
+            {
+                _coverPath = _Str(basePath, href);
+                done = true;
+            }
+            else
+            {
+                // an EPUB 3 package may still name another item with the cover-image property
+                epub2CoverPath = _Str(basePath, href);
+                if ( !_version.empty() && _version.at(0) < '3' )
+                    done = true;
+            }
+        }
+    }
+    
+    if ( !sawPackage )
+        return false;
+    
+    if ( _coverPath.empty() )
+        _coverPath = epub2CoverPath;
+    
+    for ( auto& title : titles )
+    {
+        if ( !mainTitleID.empty() && title.first == mainTitleID )
+            _title = title.second;
+    }
+    if ( _title.empty() && !titles.empty() )
+        _title = titles[0].second;
+    
+    return true;
+}
+PackagePtr PackageMetadata::FullPackage()
+{
+    std::lock_guard<std::mutex> _(_fullLock);
+    if ( !bool(_container) )
+        _container = Container::OpenContainer(_path);
+    
+    return (bool(_container) ? _container->DefaultPackage() : nullptr);
+}
+
+EPUB3_END_NAMESPACE
+
+#endif /* EPUB_USE(LIBXML2) */
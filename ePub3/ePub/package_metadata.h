@@ -0,0 +1,169 @@
+//
+//  package_metadata.h
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__package_metadata__
+#define __ePub3__package_metadata__
+
+#include <ePub3/epub3.h>
+#include <ePub3/utilities/utfstring.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if EPUB_USE(LIBXML2)
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ The PackageMetadata class holds the descriptive metadata of an EPUB's default
+ package, read without opening the publication.
+ 
+ Open() reads `META-INF/container.xml` and the package document with a streaming
+ xmlTextReader pass, stopping once the `<metadata>` element and the cover image's
+ manifest entry have been read. No DOM is built for the package document, and the
+ rest of the manifest, the spine, navigation documents and media overlays are never
+ touched, which makes it suitable for indexing large libraries.
+ 
+ The full Package is opened on demand by FullPackage().
+ 
+ @ingroup epub-model
+ */
+class PackageMetadata : public PointerType<PackageMetadata>
+{
+public:
+    typedef std::vector<string>             StringList;
+    ///
+    /// Rendition properties, by name without the `rendition:` prefix, e.g. `layout`.
+    typedef std::map<string, string>        PropertyMap;
+    
+private:
+                        PackageMetadata(const PackageMetadata&)     _DELETED_;
+                        PackageMetadata(PackageMetadata&&)          _DELETED_;
+    
+public:
+                        PackageMetadata() : _path(), _packagePath(), _version(), _packageID(), _identifiers(), _title(), _authors(),
+                            _languages(), _modificationDate(), _coverPath(), _rendition(), _fullLock(), _container(nullptr) {}
+    virtual             ~PackageMetadata() {}
+    
+    /**
+     Reads the metadata of the default package from an EPUB file.
+     @param path The path to the EPUB file.
+     @result The publication's metadata, or `nullptr` if the file has no package
+     document.
+     @throws std::invalid_argument if `path` isn't an archive, as with
+     Container::OpenContainer().
+     */
+    EPUB3_EXPORT
+    static PackageMetadataPtr   Open(const string& path);
+    
+    ///
+    /// The path of the EPUB file.
+    const string&       Path()                  const   { return _path; }
+    ///
+    /// The container-relative path of the package document.
+    const string&       PackagePath()           const   { return _packagePath; }
+    ///
+    /// The package document's version attribute.
+    const string&       Version()               const   { return _version; }
+    
+    ///
+    /// The identifier selected by the package's `unique-identifier` attribute.
+    /// @see Package::PackageID()
+    const string&       PackageID()             const   { return _packageID; }
+    ///
+    /// Every `dc:identifier`, in document order.
+    const StringList&   Identifiers()           const   { return _identifiers; }
+    
+    ///
+    /// The title refined as the `main` title, otherwise the first `dc:title`.
+    /// @see Package::Title()
+    const string&       Title()                 const   { return _title; }
+    ///
+    /// Every `dc:creator`, in document order.
+    /// @see Package::AuthorNames()
+    const StringList&   AuthorNames()           const   { return _authors; }
+    ///
+    /// The first `dc:language`, if any.
+    const string&       Language()              const   { return (_languages.empty() ? string::EmptyString : _languages[0]); }
+    ///
+    /// Every `dc:language`, in document order.
+    const StringList&   Languages()             const   { return _languages; }
+    ///
+    /// The `dcterms:modified` date, if any.
+    const string&       ModificationDate()      const   { return _modificationDate; }
+    
+    /**
+     The container-relative path of the cover image: the manifest item with the
+     `cover-image` property, or else the one named by an EPUB 2 `cover` meta element.
+     @result The same path as `CoverManifestItem()->AbsolutePath()` on the full
+     Package, or an empty string if there's no cover.
+     */
+    const string&       CoverPath()             const   { return _coverPath; }
+    
+    ///
+    /// The package-wide `rendition:` properties declared in the metadata.
+    const PropertyMap&  RenditionProperties()   const   { return _rendition; }
+    
+    /**
+     Opens the publication in full, as Container::OpenContainer() does.
+     
+     The container is opened on the first call and kept for subsequent ones.
+     @result The default package of the publication, or `nullptr` if it couldn't
+     be opened.
+     */
+    EPUB3_EXPORT
+    PackagePtr          FullPackage();
+    
+protected:
+    string              _path;
+    string              _packagePath;
+    string              _version;
+    string              _packageID;
+    StringList          _identifiers;
+    string              _title;
+    StringList          _authors;
+    StringList          _languages;
+    string              _modificationDate;
+    string              _coverPath;
+    PropertyMap         _rendition;
+    
+    std::mutex          _fullLock;
+    ContainerPtr        _container;     ///< The fully-opened container, once FullPackage() is called.
+    
+    ///
+    /// Reads the package document, returning `false` if it isn't one.
+    bool                ReadPackageDocument(Archive* archive);
+    
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* EPUB_USE(LIBXML2) */
+
+#endif /* defined(__ePub3__package_metadata__) */
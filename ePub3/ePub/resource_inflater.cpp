@@ -0,0 +1,372 @@
+//
+//  resource_inflater.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <ePub3/base.h>
+
+#include "resource_inflater.h"
+#include "container.h"
+#include "package.h"
+#include "filter_manager.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+EPUB3_BEGIN_NAMESPACE
+
+ResourceInflater::InflateContext::~InflateContext()
+{
+    if ( _zstr != nullptr )
+    {
+        inflateEnd(_zstr);
+        delete _zstr;
+    }
+}
+z_stream* ResourceInflater::InflateContext::Inflater()
+{
+    if ( _zstr == nullptr )
+    {
+        _zstr = new z_stream;
+        ::memset(_zstr, 0, sizeof(z_stream));
+
+        // negative value to tell zlib that there is no header
+        if ( inflateInit2(_zstr, -MAX_WBITS) != Z_OK )
+        {
+            delete _zstr;
+            _zstr = nullptr;
+        }
+    }
+    return _zstr;
+}
+
+FilterContext* ResourceInflater::InnerMakeFilterContext(ConstManifestItemPtr item) const
+{
+    EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
+    ByteStream::size_type originalLength = (encInfo == nullptr ? 0 : ByteStream::size_type(encInfo->OriginalLength()));
+
+    std::shared_ptr<ZipInflateIndex> index;
+    {
+        std::lock_guard<std::mutex> _(_indexLock);
+        std::shared_ptr<ZipInflateIndex>& found = _indexes[item->AbsolutePath().stl_str()];
+        if ( !found )
+            found = std::make_shared<ZipInflateIndex>();
+        index = found;
+    }
+
+    return new InflateContext(index, originalLength);
+}
+
+ByteStream::size_type ResourceInflater::BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const
+{
+    InflateContext* p = dynamic_cast<InflateContext*>(context);
+    if ( p == nullptr )
+        return 0;
+    if ( p->OriginalLength() != 0 )
+        return p->OriginalLength();
+    if ( byteStream == nullptr || !byteStream->IsOpen() )
+        return 0;
+
+    // nothing was declared: inflate everything (from the last checkpoint) to find out
+    SeekInflated(p, byteStream, ByteStream::size_type(-1));
+    if ( p->Finished() )
+        p->SetOriginalLength(p->InflatedOffset());
+    return p->OriginalLength();
+}
+
+bool ResourceInflater::ClipRange(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type* offset, ByteStream::size_type* length) const
+{
+    ByteStream::size_type inflatedSize = BytesAvailable(context, byteStream);
+    ByteRange& range = context->GetByteRange();
+    if ( range.IsFullRange() )
+    {
+        *offset = 0;
+        *length = inflatedSize;
+    }
+    else
+    {
+        *offset = range.Location();
+        *length = range.Length();
+    }
+
+    if ( *offset >= inflatedSize || *length == 0 )
+        return false;
+    *length = std::min(*length, inflatedSize - *offset);
+    return true;
+}
+
+bool ResourceInflater::SeekInflated(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type pos) const
+{
+    z_stream* zstr = context->Inflater();
+    if ( zstr == nullptr )
+        return false;
+
+    ZipInflateIndex::CheckpointPtr checkpoint = context->Index()->CheckpointBefore(pos);
+
+    // only go back if we must, or if a checkpoint would let us skip ahead
+    bool restart = (context->Source() != byteStream || pos < context->InflatedOffset() ||
+                    (bool(checkpoint) && checkpoint->uncompressedOffset > context->InflatedOffset()));
+    if ( restart )
+    {
+        if ( ZipInflateIndex::ResumeInflater(zstr, checkpoint.get()) != Z_OK )
+            return false;
+
+        if ( context->Source() != byteStream )
+        {
+            byteStream->Seek(0, std::ios::beg);
+            context->SetCompressedSize(byteStream->BytesAvailable());
+            context->SetSource(byteStream);
+        }
+
+        // the byte holding any bits primed from the checkpoint goes before the input
+        uint8_t* input = context->InputBuffer();
+        input[-1] = (bool(checkpoint) ? checkpoint->partialByte : 0);
+        zstr->next_in = input;
+        zstr->avail_in = 0;
+        context->SetInputOffset(bool(checkpoint) ? checkpoint->archiveOffset : 0);
+        context->SetInflatedOffset(bool(checkpoint) ? checkpoint->uncompressedOffset : 0);
+        context->SetFinished(false);
+    }
+
+    uint8_t scratch[16*1024];
+    while ( context->InflatedOffset() < pos )
+    {
+        ByteStream::size_type toSkip = std::min(ByteStream::size_type(sizeof(scratch)), pos - context->InflatedOffset());
+        if ( InflateBytes(context, byteStream, scratch, toSkip) <= 0 )
+            return false;
+    }
+
+    return true;
+}
+
+ssize_t ResourceInflater::InflateBytes(InflateContext* context, SeekableByteStream* byteStream, uint8_t* buf, ByteStream::size_type len) const
+{
+    if ( context->Finished() )
+        return 0;
+
+    z_stream* zstr = context->Inflater();
+    zstr->next_out = reinterpret_cast<Bytef*>(buf);
+    zstr->avail_out = static_cast<uInt>(std::min(len, ByteStream::size_type(UINT_MAX)));
+    uInt requested = zstr->avail_out;
+
+    while ( zstr->avail_out > 0 )
+    {
+        if ( zstr->avail_in == 0 )
+        {
+            // keep the last byte read, as a checkpoint may need its unused bits
+            uint8_t* input = context->InputBuffer();
+            input[-1] = zstr->next_in[-1];
+
+            if ( byteStream->Position() != context->InputOffset() )
+                byteStream->Seek(context->InputOffset(), std::ios::beg);
+            ByteStream::size_type numRead = byteStream->ReadBytes(input, InputBufferSize);
+            if ( numRead != 0 )
+            {
+                zstr->next_in = input;
+                zstr->avail_in = static_cast<uInt>(numRead);
+                context->SetInputOffset(context->InputOffset() + numRead);
+            }
+
+            // with no more input, zlib may still hold the bits of the final block
+        }
+
+        int ret = inflate(zstr, Z_BLOCK);
+        if ( ret == Z_STREAM_END )
+        {
+            context->SetFinished(true);
+            break;
+        }
+        if ( ret == Z_BUF_ERROR && zstr->avail_in == 0 )
+            break;      // the data is truncated
+        if ( ret != Z_OK )
+            return -1;
+
+        // bit 7 set: stopped at the end of a block; bit 6 set: that was the last block
+        if ( (zstr->data_type & 128) != 0 && (zstr->data_type & 64) == 0 )
+        {
+            ByteStream::size_type inputOffset = context->InputOffset() - zstr->avail_in;
+            context->Index()->RecordCheckpoint(zstr, context->InflatedOffset() + (requested - zstr->avail_out), inputOffset,
+                                               context->CompressedSize() - inputOffset);
+        }
+    }
+
+    ByteStream::size_type numInflated = requested - zstr->avail_out;
+    context->SetInflatedOffset(context->InflatedOffset() + numInflated);
+    if ( numInflated == 0 && !context->Finished() )
+        return -1;
+    return static_cast<ssize_t>(numInflated);
+}
+
+ByteStream::size_type ResourceInflater::InflateRange(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type offset, ByteStream::size_type length, uint8_t* buf) const
+{
+    if ( !SeekInflated(context, byteStream, offset) )
+        return 0;
+
+    ByteStream::size_type total = 0;
+    while ( total < length )
+    {
+        ssize_t numInflated = InflateBytes(context, byteStream, buf + total, length - total);
+        if ( numInflated <= 0 )
+            break;
+        total += ByteStream::size_type(numInflated);
+    }
+    return total;
+}
+
+ContentFilter::SpanStatus ResourceInflater::InflateSpans(InflateContext* context, FilterSpans& spans) const
+{
+    z_stream* zstr = context->Inflater();
+    if ( zstr == nullptr )
+        return SpanStatus::Complete;
+
+    // start afresh after serving ranges, or after a previous pass
+    if ( context->Source() != nullptr || context->Finished() )
+    {
+        inflateReset(zstr);
+        context->SetSource(nullptr);
+        context->SetInflatedOffset(0);
+        context->SetFinished(false);
+    }
+
+    zstr->next_in = const_cast<Bytef*>(spans.input);
+    zstr->avail_in = static_cast<uInt>(spans.inputLength);
+    zstr->next_out = spans.output;
+    zstr->avail_out = static_cast<uInt>(spans.outputCapacity);
+
+    while ( zstr->avail_out > 0 && !context->Finished() )
+    {
+        int ret = inflate(zstr, Z_NO_FLUSH);
+        if ( ret == Z_STREAM_END )
+            context->SetFinished(true);
+        else if ( ret != Z_OK )
+            break;      // no further progress possible (Z_BUF_ERROR), or bad data
+    }
+
+    spans.inputConsumed = spans.inputLength - zstr->avail_in;
+    spans.outputProduced = spans.outputCapacity - zstr->avail_out;
+    context->SetInflatedOffset(context->InflatedOffset() + spans.outputProduced);
+
+    // anything after the end of the deflate stream is ignored
+    if ( context->Finished() )
+        spans.inputConsumed = spans.inputLength;
+
+    if ( zstr->avail_out == 0 && !context->Finished() )
+    {
+        // there may be more output pending within zlib
+        ByteStream::size_type expected = context->OriginalLength();
+        spans.outputNeeded = (expected > context->InflatedOffset() ? size_t(expected - context->InflatedOffset()) : InputBufferSize);
+        return SpanStatus::NeedsOutputSpace;
+    }
+
+    spans.inputConsumed = spans.inputLength;
+    return SpanStatus::Complete;
+}
+
+void * ResourceInflater::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
+{
+    *outputLen = 0;
+
+    InflateContext* p = dynamic_cast<InflateContext*>(context);
+    if ( p == nullptr )
+        return nullptr;
+
+    SeekableByteStream* byteStream = p->GetSeekableByteStream();
+    if ( byteStream != nullptr )
+    {
+        ByteStream::size_type offset = 0, length = 0;
+        if ( !byteStream->IsOpen() || !ClipRange(p, byteStream, &offset, &length) )
+            return nullptr;
+
+        uint8_t* buf = p->GetAllocateTemporaryByteBuffer(length);
+        *outputLen = InflateRange(p, byteStream, offset, length, buf);
+        return buf;
+    }
+
+    // we've been handed the complete compressed resource
+    std::vector<uint8_t> output(std::max(size_t(p->OriginalLength()), std::max(len, size_t(1))));
+    size_t consumed = 0, produced = 0;
+    for ( ;; )
+    {
+        FilterSpans spans(reinterpret_cast<uint8_t*>(data) + consumed, len - consumed, output.data() + produced, output.size() - produced);
+        SpanStatus status = InflateSpans(p, spans);
+        consumed += spans.inputConsumed;
+        produced += spans.outputProduced;
+        if ( status == SpanStatus::Complete )
+            break;
+        output.resize(produced + std::max(spans.outputNeeded, output.size()));
+    }
+
+    if ( produced == 0 )
+        return nullptr;
+
+    uint8_t* buf = p->GetAllocateTemporaryByteBuffer(produced);
+    std::memcpy(buf, output.data(), produced);
+    std::fill(output.begin(), output.end(), 0);
+    *outputLen = produced;
+    return buf;
+}
+ContentFilter::SpanStatus ResourceInflater::FilterSpan(FilterContext* context, FilterSpans& spans)
+{
+    InflateContext* p = dynamic_cast<InflateContext*>(context);
+    if ( p == nullptr )
+        return SpanStatus::Complete;
+
+    SeekableByteStream* byteStream = p->GetSeekableByteStream();
+    if ( byteStream == nullptr )
+        return InflateSpans(p, spans);
+
+    ByteStream::size_type offset = 0, length = 0;
+    if ( !byteStream->IsOpen() || !ClipRange(p, byteStream, &offset, &length) )
+        return SpanStatus::Complete;
+
+    if ( length > spans.outputCapacity )
+    {
+        spans.outputNeeded = length;
+        return SpanStatus::NeedsOutputSpace;
+    }
+
+    spans.outputProduced = InflateRange(p, byteStream, offset, length, spans.output);
+    return SpanStatus::Complete;
+}
+
+void ResourceInflater::Register()
+{
+    FilterManager::Instance()->RegisterFilter("ResourceInflater", EPUBDecompression, [](ConstPackagePtr package) -> ContentFilterPtr {
+        ConstContainerPtr container = package->GetContainer();
+        for ( auto& encInfo : container->EncryptionData() )
+        {
+            if ( encInfo->IsCompressed() )
+                return std::make_shared<ResourceInflater>();
+        }
+
+        // nothing was compressed, nothing for us to do here
+        return nullptr;
+    });
+}
+
+EPUB3_END_NAMESPACE
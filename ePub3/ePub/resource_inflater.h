@@ -0,0 +1,178 @@
+//
+//  resource_inflater.h
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification,
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//  this list of conditions and the following disclaimer in the documentation and/or
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be
+//  used to endorse or promote products derived from this software without specific
+//  prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__resource_inflater__
+#define __ePub3__resource_inflater__
+
+#include <ePub3/filter.h>
+#include <ePub3/encryption.h>
+#include <ePub3/manifest.h>
+#include <ePub3/utilities/byte_stream.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ The ResourceInflater class inflates resources which were deflated before being
+ encrypted, as declared by a `Compression` encryption property with a method of `8`.
+
+ It runs after decryption (at the ContentFilter::EPUBDecompression priority), and
+ reports the declared `OriginalLength` as the size of the resource.
+
+ Byte ranges are served by reading the decrypted data through the filters before
+ it, inflating from the nearest checkpoint preceding the range. As with a
+ ZipFileByteStream, a checkpoint is recorded roughly every megabyte of output, and
+ the index of checkpoints is shared by every stream reading the same item, so large
+ media never needs to be inflated in its entirety.
+
+ Decryption filters must therefore leave the inflation of such resources to this
+ filter.
+ @see http://www.idpf.org/epub/301/spec/epub-ocf.html#app-schema-encryption
+ */
+class ResourceInflater : public ContentFilter, public PointerType<ResourceInflater>
+{
+public:
+    ///
+    /// The size of each read from the compressed data.
+    static const size_t         InputBufferSize = 16*1024;
+
+    /**
+     The type-sniffer for inflation: the item's encryption information must declare
+     that it was deflated.
+     */
+    static bool CompressedTypeSniffer(ConstManifestItemPtr item) {
+        EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
+        return (encInfo != nullptr && encInfo->IsCompressed());
+    }
+
+private:
+    class InflateContext : public RangeFilterContext
+    {
+    public:
+        InflateContext(std::shared_ptr<ZipInflateIndex> index, ByteStream::size_type originalLength)
+            : RangeFilterContext(), _index(index), _zstr(nullptr), _source(nullptr), _inflatedOffset(0), _inputOffset(0),
+              _compressedSize(0), _finished(false), _originalLength(originalLength) {}
+        virtual ~InflateContext();
+
+        ///
+        /// The inflater, created on first use; `nullptr` if zlib couldn't create one.
+        z_stream*               Inflater();
+        ZipInflateIndex*        Index()                 const   { return _index.get(); }
+
+        ///
+        /// The stream being inflated, or `nullptr` when inflating data handed to the filter.
+        SeekableByteStream*     Source()                const   { return _source; }
+        void                    SetSource(SeekableByteStream* source) { _source = source; }
+
+        ///
+        /// The offset of the next byte the inflater will produce.
+        ByteStream::size_type   InflatedOffset()        const   { return _inflatedOffset; }
+        void                    SetInflatedOffset(ByteStream::size_type offset) { _inflatedOffset = offset; }
+        ///
+        /// The offset within the compressed data of the next byte to be read into the input buffer.
+        ByteStream::size_type   InputOffset()           const   { return _inputOffset; }
+        void                    SetInputOffset(ByteStream::size_type offset) { _inputOffset = offset; }
+        ByteStream::size_type   CompressedSize()        const   { return _compressedSize; }
+        void                    SetCompressedSize(ByteStream::size_type size) { _compressedSize = size; }
+        bool                    Finished()              const   { return _finished; }
+        void                    SetFinished(bool finished)      { _finished = finished; }
+
+        ///
+        /// The declared size of the inflated data, or zero if it isn't known yet.
+        ByteStream::size_type   OriginalLength()        const   { return _originalLength; }
+        void                    SetOriginalLength(ByteStream::size_type length) { _originalLength = length; }
+
+        ///
+        /// The input buffer; the byte before it holds the last byte of the previous read.
+        uint8_t*                InputBuffer()                   { return _input + 1; }
+
+    private:
+        std::shared_ptr<ZipInflateIndex>    _index;
+        z_stream*               _zstr;
+        SeekableByteStream*     _source;
+        ByteStream::size_type   _inflatedOffset;
+        ByteStream::size_type   _inputOffset;
+        ByteStream::size_type   _compressedSize;
+        bool                    _finished;
+        ByteStream::size_type   _originalLength;
+        uint8_t                 _input[InputBufferSize + 1];
+
+    };
+
+public:
+    ResourceInflater() : ContentFilter(CompressedTypeSniffer), _indexLock(), _indexes() {}
+    ResourceInflater(const ResourceInflater& o) : ContentFilter(o), _indexLock(), _indexes() {}
+    ResourceInflater(ResourceInflater&& o) : ContentFilter(std::move(o)), _indexLock(), _indexes() {}
+    virtual ~ResourceInflater() {}
+
+    virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE;
+    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::SupportsByteRanges; }
+
+    ///
+    /// The declared `OriginalLength` of the resource; if there is none, the data is inflated to find it.
+    virtual ByteStream::size_type BytesAvailable(FilterContext *context, SeekableByteStream *byteStream) const OVERRIDE;
+
+    ///
+    /// Registers the filter with the FilterManager.
+    static void Register();
+
+protected:
+    virtual FilterContext *InnerMakeFilterContext(ConstManifestItemPtr item) const OVERRIDE;
+
+private:
+    typedef std::unordered_map<std::string, std::shared_ptr<ZipInflateIndex>>  IndexTable;
+
+    mutable std::mutex      _indexLock;
+    mutable IndexTable      _indexes;       ///< The checkpoints for each item, by path.
+
+    ///
+    /// Clips a requested range to the inflated data; returns `false` if nothing is left.
+    bool                    ClipRange(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type* offset, ByteStream::size_type* length) const;
+    ///
+    /// Positions the inflater at an offset within the inflated data, resuming from a checkpoint if one helps.
+    bool                    SeekInflated(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type pos) const;
+    ///
+    /// Inflates the next bytes from the stream, returning the number produced, or -1 on error.
+    ssize_t                 InflateBytes(InflateContext* context, SeekableByteStream* byteStream, uint8_t* buf, ByteStream::size_type len) const;
+    ///
+    /// Inflates a clipped range into `buf`.
+    ByteStream::size_type   InflateRange(InflateContext* context, SeekableByteStream* byteStream, ByteStream::size_type offset, ByteStream::size_type length, uint8_t* buf) const;
+    ///
+    /// Inflates data handed to the filter, continuing where the previous call left off.
+    SpanStatus              InflateSpans(InflateContext* context, FilterSpans& spans) const;
+
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__resource_inflater__) */
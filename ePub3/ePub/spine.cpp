@@ -36,10 +36,46 @@ EPUB3_BEGIN_NAMESPACE
 const IRI SpineItem::PageSpreadRightPropertyIRI("http://idpf.org/epub/vocab/package/#page-spread-right");
 const IRI SpineItem::PageSpreadLeftPropertyIRI("http://idpf.org/epub/vocab/package/#page-spread-left");
 
-SpineItem::SpineItem(const shared_ptr<Package>& owner) : OwnedBy(owner), PropertyHolder(owner), _idref(), _linear(true), _next(), _prev()
+shared_ptr<SpineItem> SpineIndex::ItemAt(size_t idx) const
 {
+    if ( idx >= _items.size() )
+        return nullptr;
+    return _items[idx].lock();
 }
-SpineItem::SpineItem(SpineItem&& o) : OwnedBy(std::move(o)), PropertyHolder(std::move(o)), XMLIdentifiable(std::move(o)), _idref(std::move(o._idref)), _linear(o._linear), _prev(std::move(o._prev)), _next(std::move(o._next))
+size_t SpineIndex::IndexOfIDRef(const string& idref) const
+{
+    auto found = _byIDRef.find(idref.stl_str());
+    if ( found == _byIDRef.end() )
+        return size_t(-1);
+    return found->second;
+}
+void SpineIndex::Insert(size_t idx, const shared_ptr<SpineItem>& item)
+{
+    _items.emplace(_items.begin() + idx, item);
+    item->_position = idx;
+    
+    if ( idx + 1 == _items.size() )
+    {
+        // appending (the usual case) can't change the position of any earlier idref
+        _byIDRef.emplace(item->Idref().stl_str(), idx);
+        return;
+    }
+    
+    _byIDRef.clear();
+    for ( size_t i = 0; i < _items.size(); i++ )
+    {
+        auto other = _items[i].lock();
+        if ( !other )
+            continue;
+        other->_position = i;
+        _byIDRef.emplace(other->Idref().stl_str(), i);
+    }
+}
+
+SpineItem::SpineItem(const shared_ptr<Package>& owner) : OwnedBy(owner), PropertyHolder(owner), _idref(), _linear(true), _next(), _prev(), _spineIndex(), _position(0)
+{
+}
+SpineItem::SpineItem(SpineItem&& o) : OwnedBy(std::move(o)), PropertyHolder(std::move(o)), XMLIdentifiable(std::move(o)), _idref(std::move(o._idref)), _linear(o._linear), _prev(std::move(o._prev)), _next(std::move(o._next)), _spineIndex(std::move(o._spineIndex)), _position(o._position)
 {
 }
 SpineItem::~SpineItem()
@@ -73,6 +109,13 @@ shared_ptr<ManifestItem> SpineItem::ManifestItem() const
         return nullptr;
     return package->ManifestItemWithID(Idref());
 }
+const string& SpineItem::Title() const
+{
+    auto package = this->Owner();
+    if ( bool(package) )
+        package->CompileSpineItemTitlesOnce();
+    return _toc_title;
+}
 PageSpread SpineItem::Spread() const
 {
     if ( NumberOfProperties() == 0 )
@@ -114,38 +157,37 @@ shared_ptr<SpineItem> SpineItem::PriorStep() const
 }
 shared_ptr<SpineItem> SpineItem::at(ssize_t idx) const
 {
-    SpineItemPtr result = std::const_pointer_cast<SpineItem>(Ptr());
+    if ( idx == 0 )
+        return std::const_pointer_cast<SpineItem>(Ptr());
     
-    ssize_t i = idx;
-    
-    if ( i > 0 )
-    {
-        while ( result != nullptr && i > 0 )
-        {
-            result = result->Next();
-            i--;
-        }
-    }
-    else if ( idx < 0 )
-    {
-        while ( result != nullptr && i < 0 )
-        {
-            result = result->Previous();
-            i++;
-        }
-    }
+    SpineItemPtr result;
+    if ( bool(_spineIndex) && (idx > 0 || size_t(-idx) <= _position) )
+        result = _spineIndex->ItemAt(_position + idx);
     
     // Q: maybe just return nullptr?
     if ( result == nullptr )
-        throw std::out_of_range(_Str("Index ", i, " is out of range"));
+        throw std::out_of_range(_Str("Index ", idx, " is out of range"));
     
     return result;
 }
+void SpineItem::BeginSpine()
+{
+    _spineIndex = std::make_shared<SpineIndex>();
+    _spineIndex->Insert(0, enable_shared_from_this<SpineItem>::shared_from_this());
+}
 void SpineItem::SetNextItem(const shared_ptr<SpineItem>& next)
 {
+    if ( !bool(_spineIndex) )
+        BeginSpine();
+    
     next->_next = _next;
+    if ( bool(_next) )
+        _next->_prev = next;
     next->_prev = enable_shared_from_this<SpineItem>::shared_from_this();
     _next = next;
+    
+    next->_spineIndex = _spineIndex;
+    _spineIndex->Insert(_position + 1, next);
 }
 
 EPUB3_END_NAMESPACE
@@ -34,11 +34,53 @@
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/utilities/xml_identifiable.h>
 #include <ePub3/property_holder.h>
+#include <unordered_map>
 #include <vector>
 #include <ePub3/xml/node.h>
 
 EPUB3_BEGIN_NAMESPACE
 
+class SpineItem;
+
+/**
+ A random-access table of the items in a spine.
+ 
+ The spine is a linked list of SpineItems, but positional and `idref` lookups are
+ frequent (every CFI is resolved through the spine), so each spine also keeps one
+ of these alongside the list. It is maintained by SpineItem::SetNextItem(), and
+ holds only non-owning references to its items.
+ @ingroup epub-model
+ */
+class SpineIndex
+{
+public:
+                            SpineIndex()                                    : _items(), _byIDRef() {}
+                            ~SpineIndex()                                   {}
+    
+    ///
+    /// The number of items in the spine.
+    size_t                  Count()                                 const   { return _items.size(); }
+    ///
+    /// Returns the item at the given position, or `nullptr` if out of bounds.
+    EPUB3_EXPORT
+    shared_ptr<SpineItem>   ItemAt(size_t idx)                      const;
+    ///
+    /// Returns the position of the first item with the given `idref`, or `size_t(-1)`.
+    EPUB3_EXPORT
+    size_t                  IndexOfIDRef(const string& idref)       const;
+    
+protected:
+    std::vector<weak_ptr<SpineItem>>            _items;         ///< The items, in spine order.
+    std::unordered_map<std::string, size_t>     _byIDRef;       ///< Position of the first item for each `idref`.
+    
+    friend class SpineItem;
+    
+    ///
+    /// Inserts an item into the table, updating the positions of any following items.
+    void                    Insert(size_t idx, const shared_ptr<SpineItem>& item);
+    
+};
+
 /**
  The SpineItem class provides access to the spine of a publication.
  
@@ -73,6 +115,9 @@ EPUB3_BEGIN_NAMESPACE
  spine items, however, the NextStep() and PriorStep() methods can be used to
  implicitly skip any non-linear items.
  
+ Each spine also maintains a SpineIndex, so that indexed access and lookups by
+ `idref` take constant time.
+ 
  @remarks As a linked-list structure, each SpineItem holds an *owning reference* to the
  following item, and a *non-owning reference* to the preceding item. When a
  SpineItem is destroyed, it will delete the next SpineItem in the chain, and will
@@ -124,11 +169,11 @@ public:
     /// @name Metadata
     
     ///
-    /// Returns an O(n) count of items in the spine (starting with this item).
-    inline size_t       Count()             const       { return (_next == nullptr ? 1 : 1 + _next->Count()); }
+    /// Returns a count of items in the spine (starting with this item).
+    inline size_t       Count()             const       { return (bool(_spineIndex) ? _spineIndex->Count() - _position : 1); }
     ///
-    /// Returns the index of the current item in the overall spine. O(n).
-    inline size_t       Index()             const       { return (_prev.expired() ? 0 : _prev.lock()->Index() + 1); }
+    /// Returns the index of the current item in the overall spine.
+    inline size_t       Index()             const       { return _position; }
     
     ///
     /// Returns this item's identifier (if any).
@@ -149,9 +194,9 @@ public:
     PageSpread          Spread()            const;
 
 	///
-	/// The title for this spine item, as defined in the TOC.
+	/// The title for this spine item, as defined in the TOC; the TOC is loaded on first use.
 	EPUB3_EXPORT
-	const string&		Title()				const		{ return _toc_title; }
+	const string&		Title()				const;
 	void				SetTitle(const string& str)		{ _toc_title = str; }
     
     /// @}
@@ -216,7 +261,17 @@ protected:
     weak_ptr<SpineItem>     _prev;              ///< The SpineItem preceding this one in the spine.
     shared_ptr<SpineItem>   _next;              ///< The SpineItem following this one in the spine.
     
+    shared_ptr<SpineIndex>  _spineIndex;        ///< The random-access table for the whole spine.
+    size_t                  _position;          ///< This item's position in the spine.
+    
+    friend class PackageBase;
     friend class Package;
+    friend class SpineIndex;
+    
+    ///
+    /// Makes this item the first in a new spine, with its own SpineIndex.
+    EPUB3_EXPORT
+    void BeginSpine();
     
     EPUB3_EXPORT
     void SetNextItem(const shared_ptr<SpineItem>& next);
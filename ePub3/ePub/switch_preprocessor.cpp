@@ -28,20 +28,15 @@
 //  OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "switch_preprocessor.h"
+#include "markup_lexing.h"
 #include "package.h"
 #include "container.h"
 #include "filter_manager.h"
-#include REGEX_INCLUDE
+#include <algorithm>
+#include <cstring>
 
 EPUB3_BEGIN_NAMESPACE
 
-static const REGEX_NS::regex_constants::syntax_option_type SwitchRegexFlags = REGEX_NS::regex::icase|REGEX_NS::regex::optimize|REGEX_NS::regex::ECMAScript;
-
-REGEX_NS::regex SwitchPreprocessor::CommentedSwitchIdentifier("(?:<!--)(\\s*<(?:epub:)switch(?:.|\\n|\\r)*?<(?:epub:)default(?:.|\\n|\\r)*?>\\s*)(?:-->)((?:.|\\n|\\r)*?)(?:<!--)(\\s*</(?:epub:)default>(?:.|\\n|\\r)*?)(?:-->)", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::SwitchContentExtractor("<(?:epub:)?switch(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?switch(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::CaseContentExtractor("<(?:epub:)?case\\s+required-namespace=\"(.*?)\">((?:.|\\n|\\r)*?)</(?:epub:)?case(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::DefaultContentExtractor("<(?:epub:)?default(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?default(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-
 #if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
 SwitchPreprocessor::NamespaceList SwitchPreprocessor::_supportedNamespaces{};
 #else
@@ -68,79 +63,511 @@ void SwitchPreprocessor::Register()
 }
 void * SwitchPreprocessor::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
 {
-    char* input = reinterpret_cast<char*>(data);
+    SwitchContext localContext;
+    SwitchContext* switchContext = dynamic_cast<SwitchContext*>(context);
+    if ( switchContext == nullptr )
+        switchContext = &localContext;
     
-    // handle partially-commented switch statements
-    std::string inputStr(reinterpret_cast<const char*>(data));
-    std::string replacement("$1$2$3");
-    std::string str = REGEX_NS::regex_replace(inputStr, CommentedSwitchIdentifier, replacement);
+    std::string output;
+    output.reserve(len);
+    if ( len > 0 )
+        switchContext->Process(reinterpret_cast<const char*>(data), len, output);
     
-    // str now contains a non-commented value (or the input if no switch statements were commented out)
-    auto pos = REGEX_NS::sregex_iterator(str.begin(), str.end(), SwitchContentExtractor);
-    auto end = REGEX_NS::sregex_iterator();
+    // without a context, there's no way for any more data to arrive; with one, an empty call marks the end
+    if ( switchContext == &localContext || len == 0 )
+        switchContext->Flush(output);
     
-    std::string output;
-    while ( pos != end )
+    *outputLen = output.size();
+    if ( output.size() <= len )
+    {
+        output.copy(reinterpret_cast<char*>(data), output.size());
+        return data;
+    }
+    
+    char* result = new char[output.size()];
+    output.copy(result, output.size());
+    return result;
+}
+
+ContentFilter::SpanStatus SwitchPreprocessor::FilterSpan(FilterContext* context, FilterSpans& spans)
+{
+    SwitchContext* switchContext = dynamic_cast<SwitchContext*>(context);
+    if ( switchContext != nullptr )
+        return switchContext->FilterSpan(spans);
+    
+    // without a context, the data is complete and there's nowhere to hold output: it goes all at once or not at all
+    SwitchContext localContext;
+    FilterSpans localSpans(spans.input, spans.inputLength, spans.output, spans.outputCapacity, true);
+    SpanStatus status = localContext.FilterSpan(localSpans);
+    if ( status == SpanStatus::NeedsOutputSpace )
+    {
+        spans.inputConsumed = spans.outputProduced = 0;
+        spans.outputNeeded = localSpans.outputProduced + localSpans.outputNeeded;
+        return status;
+    }
+    
+    spans.inputConsumed = localSpans.inputConsumed;
+    spans.outputProduced = localSpans.outputProduced;
+    spans.outputNeeded = 0;
+    return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// The epub:switch tokenizer
+
+/// The kinds of markup which the tokenizer distinguishes.
+enum class SwitchMarkup
+{
+    NeedMoreData,       ///< The markup continues past the end of the available data.
+    Other,              ///< Anything we don't care about.
+    CommentStart,       ///< `<!--`
+    SwitchStart,
+    SwitchEnd,
+    CaseStart,
+    CaseEnd,
+    DefaultStart,
+    DefaultEnd,
+};
+
+/**
+ Identifies the markup starting at `p`, which must point to a `<` character.
+ Element names are matched case-insensitively, with an optional `epub:` prefix.
+ */
+static SwitchMarkup ClassifyMarkup(const char* p, const char* end)
+{
+    static const char kCommentStart[] = "<!--";
+    size_t avail = size_t(end - p);
+    
+    if ( avail < 2 )
+        return SwitchMarkup::NeedMoreData;
+    if ( p[1] == '!' )
+    {
+        size_t n = std::min(avail, sizeof(kCommentStart)-1);
+        if ( ::memcmp(p, kCommentStart, n) != 0 )
+            return SwitchMarkup::Other;
+        return (n == sizeof(kCommentStart)-1 ? SwitchMarkup::CommentStart : SwitchMarkup::NeedMoreData);
+    }
+    
+    const char* name = p + 1;
+    bool closing = (*name == '/');
+    if ( closing )
+        name++;
+    
+    const char* nameEnd = name;
+    while ( nameEnd != end && IsNameChar(*nameEnd) )
+        ++nameEnd;
+    if ( nameEnd == end )
+        return SwitchMarkup::NeedMoreData;
+    
+    size_t nameLen = size_t(nameEnd - name);
+    if ( nameLen > 5 && NameEquals(name, 5, "epub:") )
+    {
+        name += 5;
+        nameLen -= 5;
+    }
+    
+    if ( NameEquals(name, nameLen, "switch") )
+        return (closing ? SwitchMarkup::SwitchEnd : SwitchMarkup::SwitchStart);
+    if ( NameEquals(name, nameLen, "case") )
+        return (closing ? SwitchMarkup::CaseEnd : SwitchMarkup::CaseStart);
+    if ( NameEquals(name, nameLen, "default") )
+        return (closing ? SwitchMarkup::DefaultEnd : SwitchMarkup::DefaultStart);
+    return SwitchMarkup::Other;
+}
+
+/// Returns a pointer just past the `>` ending the tag at `p`, or `nullptr`.
+static const char* FindTagEnd(const char* p, const char* end)
+{
+    char quote = '\0';
+    for ( ; p != end; ++p )
+    {
+        if ( quote != '\0' )
+        {
+            if ( *p == quote )
+                quote = '\0';
+        }
+        else if ( *p == '"' || *p == '\'' )
+        {
+            quote = *p;
+        }
+        else if ( *p == '>' )
+        {
+            return p + 1;
+        }
+    }
+    return nullptr;
+}
+
+static inline bool IsEmptyElementTag(const char* tagEnd)
+{
+    // tagEnd points just past the '>'
+    return tagEnd[-2] == '/';
+}
+
+/// Returns the value of an attribute of the start tag spanning [tag, tagEnd).
+static std::string AttributeValue(const char* tag, const char* tagEnd, const char* lowercaseName)
+{
+    const char* p = tag + 1;
+    while ( p != tagEnd && IsNameChar(*p) )
+        ++p;
+    
+    while ( p != tagEnd )
+    {
+        while ( p != tagEnd && (IsXMLSpace(*p) || *p == '/') )
+            ++p;
+        const char* name = p;
+        while ( p != tagEnd && IsNameChar(*p) )
+            ++p;
+        if ( p == name )
+            break;
+        const char* nameEnd = p;
+        
+        while ( p != tagEnd && IsXMLSpace(*p) )
+            ++p;
+        if ( p == tagEnd || *p != '=' )
+            continue;
+        ++p;
+        while ( p != tagEnd && IsXMLSpace(*p) )
+            ++p;
+        if ( p == tagEnd )
+            break;
+        
+        const char* value = p;
+        const char* valueEnd = nullptr;
+        if ( *p == '"' || *p == '\'' )
+        {
+            value = p + 1;
+            valueEnd = std::find(value, tagEnd, *p);
+            p = (valueEnd == tagEnd ? tagEnd : valueEnd + 1);
+        }
+        else
+        {
+            while ( p != tagEnd && !IsXMLSpace(*p) && *p != '>' )
+                ++p;
+            valueEnd = p;
+        }
+        
+        if ( NameEquals(name, size_t(nameEnd - name), lowercaseName) )
+            return std::string(value, valueEnd);
+    }
+    
+    return std::string();
+}
+
+/// Locates the first `-->` in [p, end).
+static const char* FindCommentEnd(const char* p, const char* end)
+{
+    while ( end - p >= 3 )
+    {
+        const char* dash = reinterpret_cast<const char*>(::memchr(p, '-', size_t(end - p - 2)));
+        if ( dash == nullptr )
+            return nullptr;
+        if ( dash[1] == '-' && dash[2] == '>' )
+            return dash;
+        p = dash + 1;
+    }
+    return nullptr;
+}
+
+/// The number of bytes at the end of [p, end) which could begin a `-->`.
+static size_t PartialCommentEndLength(const char* p, const char* end)
+{
+    if ( end - p >= 2 && end[-2] == '-' && end[-1] == '-' )
+        return 2;
+    if ( end - p >= 1 && end[-1] == '-' )
+        return 1;
+    return 0;
+}
+
+SwitchPreprocessor::SwitchContext::SwitchContext()
+  : FilterContext(),
+    _pending(),
+    _inSwitch(false),
+    _matched(false),
+    _sawDefault(false),
+    _uncommented(false),
+    _capture(Capture::Discard),
+    _commentState(CommentState::None),
+    _heldPrefix(),
+    _caseContent(),
+    _defaultContent(),
+    _output(),
+    _written(0)
+{
+}
+void SwitchPreprocessor::SwitchContext::Process(const char* data, size_t len, std::string& output)
+{
+    if ( _pending.empty() )
+    {
+        const char* rest = Scan(data, data + len, output);
+        _pending.assign(rest, data + len);
+        return;
+    }
+    
+    // prepend the unfinished markup from the last chunk
+    std::string input(std::move(_pending));
+    input.append(data, len);
+    const char* rest = Scan(input.data(), input.data() + input.size(), output);
+    _pending.assign(rest, input.data() + input.size());
+}
+void SwitchPreprocessor::SwitchContext::Flush(std::string& output)
+{
+    if ( _inSwitch )
+        EndSwitch(output);
+    
+    output.append(_heldPrefix);
+    output.append(_pending);
+    _heldPrefix.clear();
+    _pending.clear();
+    _commentState = CommentState::None;
+}
+ContentFilter::SpanStatus SwitchPreprocessor::SwitchContext::FilterSpan(FilterSpans& spans)
+{
+    spans.inputConsumed = spans.outputProduced = spans.outputNeeded = 0;
+    
+    // output held back from the last call goes out before any more input is read
+    if ( _written == _output.size() )
+    {
+        _output.clear();    // keeps its storage
+        _written = 0;
+        Process(reinterpret_cast<const char*>(spans.input), spans.inputLength, _output);
+        if ( spans.inputIsFinal )
+            Flush(_output);
+        spans.inputConsumed = spans.inputLength;
+    }
+    
+    size_t len = std::min(_output.size() - _written, spans.outputCapacity);
+    _output.copy(reinterpret_cast<char*>(spans.output), len, _written);
+    _written += len;
+    spans.outputProduced = len;
+    spans.outputNeeded = _output.size() - _written;
+    return (spans.outputNeeded == 0 ? SpanStatus::Complete : SpanStatus::NeedsOutputSpace);
+}
+void SwitchPreprocessor::SwitchContext::EndSwitch(std::string& output)
+{
+    // drop the comment opener if we un-commented this switch
+    if ( _uncommented && _heldPrefix.size() >= 4 )
+        output.append(_heldPrefix, 4, std::string::npos);
+    else
+        output.append(_heldPrefix);
+    
+    output.append(_matched ? _caseContent : _defaultContent);
+    
+    _inSwitch = _matched = _sawDefault = _uncommented = false;
+    _capture = Capture::Discard;
+    _heldPrefix.clear();
+    _caseContent.clear();
+    _defaultContent.clear();
+    
+    if ( _commentState != CommentState::DropClose )
+        _commentState = CommentState::None;
+}
+const char* SwitchPreprocessor::SwitchContext::Scan(const char* p, const char* end, std::string& output)
+{
+    while ( p != end )
     {
-        // output any non-matched characters
-        output += pos->prefix();
+        std::string* sink = &output;
+        if ( _inSwitch )
+        {
+            switch ( _capture )
+            {
+                case Capture::Case:
+                    sink = &_caseContent;
+                    break;
+                case Capture::Default:
+                    sink = &_defaultContent;
+                    break;
+                default:
+                    sink = nullptr;
+                    break;
+            }
+        }
         
-        std::string switchContents = pos->str(1);
+        if ( _commentState == CommentState::ExpectClose )
+        {
+            // whitespace here belongs to the default content; a commented-out switch
+            // then closes its comment
+            const char* text = p;
+            while ( p != end && IsXMLSpace(*p) )
+                ++p;
+            if ( sink != nullptr )
+                sink->append(text, p);
+            if ( p == end || (end - p < 3 && ::memcmp(p, "-->", size_t(end - p)) == 0) )
+                break;
+            
+            if ( ::memcmp(p, "-->", 3) == 0 )
+            {
+                p += 3;
+                _uncommented = true;
+                _commentState = CommentState::Uncommented;
+            }
+            else
+            {
+                _commentState = CommentState::None;
+            }
+            continue;
+        }
         
-        bool matched = false;
+        const char* next = reinterpret_cast<const char*>(::memchr(p, '<', size_t(end - p)));
         
-        // now scan the contents for any epub:case statements
-        if ( _supportedNamespaces.size() != 0 )
+        if ( _commentState == CommentState::DropClose )
         {
-            auto cpos = REGEX_NS::sregex_iterator(switchContents.begin(), switchContents.end(), CaseContentExtractor);
-            while ( cpos != end )
+            const char* closer = FindCommentEnd(p, (next == nullptr ? end : next));
+            if ( closer != nullptr )
             {
-                for ( auto ns : _supportedNamespaces )
+                if ( sink != nullptr )
+                    sink->append(p, closer);
+                p = closer + 3;
+                _commentState = CommentState::None;
+                continue;
+            }
+        }
+        
+        if ( next == nullptr )
+        {
+            // keep anything which might be the start of a comment terminator we want
+            size_t keep = (_commentState == CommentState::DropClose ? PartialCommentEndLength(p, end) : 0);
+            if ( sink != nullptr )
+                sink->append(p, end - keep);
+            return end - keep;
+        }
+        
+        if ( sink != nullptr )
+            sink->append(p, next);
+        p = next;
+        
+        SwitchMarkup markup = ClassifyMarkup(p, end);
+        if ( markup == SwitchMarkup::NeedMoreData )
+            return p;
+        
+        // outside a switch, only its start tag (and the comments around it) matter
+        if ( !_inSwitch && markup != SwitchMarkup::SwitchStart && markup != SwitchMarkup::CommentStart )
+            markup = SwitchMarkup::Other;
+        
+        const char* tagEnd = nullptr;
+        if ( markup != SwitchMarkup::Other && markup != SwitchMarkup::CommentStart )
+        {
+            tagEnd = FindTagEnd(p, end);
+            if ( tagEnd == nullptr )
+                return p;
+        }
+        
+        switch ( markup )
+        {
+            case SwitchMarkup::CommentStart:
+            {
+                // look for a switch, or the end of default content, inside this comment
+                bool atSwitch = (!_inSwitch && _commentState == CommentState::None);
+                bool atDefaultEnd = (_inSwitch && _commentState == CommentState::Uncommented);
+                if ( atSwitch || atDefaultEnd )
                 {
-                    if ( ns == cpos->str(1) )
+                    const char* q = p + 4;
+                    while ( q != end && IsXMLSpace(*q) )
+                        ++q;
+                    if ( q == end )
+                        return p;
+                    
+                    SwitchMarkup inner = (*q == '<' ? ClassifyMarkup(q, end) : SwitchMarkup::Other);
+                    if ( inner == SwitchMarkup::NeedMoreData )
+                        return p;
+                    
+                    if ( atSwitch && inner == SwitchMarkup::SwitchStart )
                     {
-                        // this case uses a supported namespace
-                        matched = true;
-                        break;
+                        // we won't know whether to drop the comment opener until we see the epub:default
+                        _heldPrefix.assign(p, q);
+                        _commentState = CommentState::Pending;
+                        p = q;
+                        continue;
+                    }
+                    if ( atDefaultEnd && inner == SwitchMarkup::DefaultEnd )
+                    {
+                        // drop the comment opener, keep the whitespace
+                        p += 4;
+                        continue;
                     }
                 }
                 
-                if ( matched )
+                if ( sink != nullptr )
+                    sink->append(p, 4);
+                p += 4;
+                break;
+            }
+                
+            case SwitchMarkup::SwitchStart:
+                if ( _inSwitch )
                 {
-                    // we matched the case, so append its contents and skip the remainder
-                    output += cpos->str(2);
+                    // switch elements don't nest: the first end tag closes the switch
+                    if ( sink != nullptr )
+                        sink->append(p, tagEnd);
+                    p = tagEnd;
                     break;
                 }
                 
-                ++cpos;
-            }
-        }
-        
-        if ( !matched )
-        {
-            // no matching case statements, so find the epub:default
-            REGEX_NS::smatch defaultCase;
-            if ( REGEX_NS::regex_search(switchContents, defaultCase, DefaultContentExtractor) )
-                output += defaultCase[1].str();
+                _inSwitch = true;
+                _capture = Capture::Discard;
+                p = tagEnd;
+                if ( IsEmptyElementTag(tagEnd) )
+                    EndSwitch(output);
+                break;
+                
+            case SwitchMarkup::SwitchEnd:
+                p = tagEnd;
+                EndSwitch(output);
+                break;
+                
+            case SwitchMarkup::CaseStart:
+                _capture = Capture::Discard;
+                if ( !_matched && !IsEmptyElementTag(tagEnd) )
+                {
+                    std::string ns = AttributeValue(p, tagEnd, "required-namespace");
+                    for ( auto& supported : _supportedNamespaces )
+                    {
+                        if ( supported == ns )
+                        {
+                            _matched = true;
+                            _capture = Capture::Case;
+                            break;
+                        }
+                    }
+                }
+                p = tagEnd;
+                break;
+                
+            case SwitchMarkup::DefaultStart:
+                _capture = Capture::Discard;
+                if ( !_sawDefault )
+                {
+                    _sawDefault = true;
+                    if ( !IsEmptyElementTag(tagEnd) )
+                        _capture = Capture::Default;
+                    if ( _commentState == CommentState::Pending )
+                        _commentState = CommentState::ExpectClose;
+                }
+                p = tagEnd;
+                break;
+                
+            case SwitchMarkup::CaseEnd:
+                _capture = Capture::Discard;
+                p = tagEnd;
+                break;
+                
+            case SwitchMarkup::DefaultEnd:
+                _capture = Capture::Discard;
+                if ( _commentState == CommentState::Uncommented )
+                    _commentState = CommentState::DropClose;
+                p = tagEnd;
+                break;
+                
+            default:
+                // just pass the '<' along and carry on
+                if ( sink != nullptr )
+                    sink->push_back('<');
+                ++p;
+                break;
         }
-        
-        // step forward, and if we get the end let's output the current suffix
-        // this ensures that we don't lose everything following the last match
-        auto here = pos++;
-        if ( pos == end )
-            output += here->suffix();
     }
     
-    *outputLen = output.size();
-    if ( output.size() < len )
-    {
-        output.copy(input, output.size());
-        return input;
-    }
-    
-    char* result = new char[output.size()];
-    output.copy(result, output.size());
-    return result;
+    return p;
 }
 
 EPUB3_END_NAMESPACE
@@ -32,8 +32,8 @@
 
 #include <ePub3/epub3.h>
 #include <ePub3/filter.h>
+#include <string>
 #include <vector>
-#include REGEX_INCLUDE
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -83,14 +83,21 @@ public:
     SwitchPreprocessor(SwitchPreprocessor&& o) : ContentFilter(std::move(o)) {}
     
     /**
-     This processor won't work on streamed data, it requires the whole thing at once.
+     This processor works on streamed data: each chunk is scanned once, and anything
+     which can't yet be resolved is held in the filter context until the next chunk.
      */
-    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::RequiresCompleteData; }
+    virtual OperatingMode GetOperatingMode() const OVERRIDE { return OperatingMode::Standard; }
     
     /**
-     Filters the input data using regular expressions to identify epub:switch
-     compounds and replace them wholesale wih the contents of an epub:case or
-     epub:default element.
+     Filters the input data in a single pass, identifying epub:switch compounds and
+     replacing them wholesale with the contents of an epub:case or epub:default
+     element.
+     
+     Markup which can't be resolved within this chunk of data (a partial tag, or
+     the body of a switch compound which hasn't yet been closed) is kept in the
+     filter context and processed along with the next chunk. Once the stream ends,
+     call this with no data to output anything still held. If no context is provided,
+     the data is assumed to be complete.
      
      If the list of supported namespaces is empty, then this takes an optimized path,
      ignoring epub:case elements completely. Otherwise, it will inspect the 
@@ -101,6 +108,16 @@ public:
      */
     virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
     
+    /**
+     Filters the input span as FilterData() does, writing into the output span.
+     
+     Output which doesn't fit is held in the filter context until the next call. The
+     context's output storage is reused from call to call, so steady-state streaming
+     allocates nothing. Anything still unresolved is output once `inputIsFinal` is set.
+     */
+    virtual bool SupportsSpans() const OVERRIDE { return true; }
+    virtual SpanStatus FilterSpan(FilterContext* context, FilterSpans& spans) OVERRIDE;
+    
     ///
     /// Register this filter with the filter manager
     static void Register();
@@ -120,9 +137,10 @@ protected:
     
 private:
     /**
-     A regex to un-comment any epub:switch blocks.
+     The state of the epub:switch tokenizer for a single stream of data.
      
-     For instance, we might see:
+     As well as plain switch compounds, the tokenizer will un-comment epub:switch
+     blocks such as this:
      
          <!--<epub:switch id="bob">
            <epub:case required-namespace="...">
@@ -133,27 +151,66 @@ private:
            </epub:default>
          </epub:switch>-->
      
-     This regex will identify such constructs, but will NOT match an entire
-     commented-out epub:switch block (i.e. where the publisher has chosen to comment
-     out the whole thing and provide only the default content).
-     */
-    static REGEX_NS::regex   CommentedSwitchIdentifier;
-    
-    /**
-     This expression locates and isolates the content of each epub:switch element.
-     */
-    static REGEX_NS::regex   SwitchContentExtractor;
-    
-    /**
-     This expression locates and extracts the contents and types of each epub:case
-     element.
-     */
-    static REGEX_NS::regex   CaseContentExtractor;
-    
-    /**
-     This expression locates and extracts the content of the epub:default element.
+     It will NOT un-comment an epub:switch block which has been commented out in its
+     entirety (i.e. where the publisher has chosen to comment out the whole thing and
+     provide only the default content), although the switch itself is still processed.
      */
-    static REGEX_NS::regex   DefaultContentExtractor;
+    class SwitchContext : public FilterContext
+    {
+    public:
+        SwitchContext();
+        virtual ~SwitchContext() {}
+        
+        ///
+        /// Processes a chunk of data, appending the result to `output`.
+        void            Process(const char* data, size_t len, std::string& output);
+        ///
+        /// Outputs anything still held, when no more data will arrive.
+        void            Flush(std::string& output);
+        ///
+        /// Filters a span's input into the held output, then writes as much of that as fits.
+        SpanStatus      FilterSpan(FilterSpans& spans);
+        
+    private:
+        ///
+        /// Where we are within a commented-out switch block.
+        enum class CommentState
+        {
+            None,               ///< Not within a commented-out switch.
+            Pending,            ///< The switch began inside a comment.
+            ExpectClose,        ///< At the epub:default start tag; the comment should end here.
+            Uncommented,        ///< Within the un-commented default content.
+            DropClose,          ///< The default content is over; drop the next comment terminator.
+        };
+        
+        ///
+        /// Which part of a switch compound is being read.
+        enum class Capture
+        {
+            Discard,            ///< Content which won't be output.
+            Case,               ///< The content of the first supported epub:case.
+            Default,            ///< The content of the epub:default.
+        };
+        
+        std::string     _pending;           ///< Input held over from the previous chunk.
+        bool            _inSwitch;          ///< Whether we're inside an epub:switch element.
+        bool            _matched;           ///< Whether a supported epub:case has been found.
+        bool            _sawDefault;        ///< Whether the epub:default has been found.
+        bool            _uncommented;       ///< Whether the current switch was un-commented.
+        Capture         _capture;           ///< The content currently being read.
+        CommentState    _commentState;      ///< Progress through a commented-out switch.
+        std::string     _heldPrefix;        ///< The comment opener preceding a switch, until we know whether to drop it.
+        std::string     _caseContent;       ///< The content of the matching epub:case.
+        std::string     _defaultContent;    ///< The content of the epub:default.
+        std::string     _output;            ///< Output for FilterSpan(), awaiting space in the caller's span.
+        size_t          _written;           ///< The number of bytes of `_output` written so far.
+        
+        const char*     Scan(const char* p, const char* end, std::string& output);
+        void            EndSwitch(std::string& output);
+        
+    };
+    
+    virtual FilterContext *InnerMakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new SwitchContext; }
     
 };
 
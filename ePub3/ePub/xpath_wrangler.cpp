@@ -30,21 +30,230 @@
 #include "xpath_wrangler.h"
 #include <ePub3/xml/xpath.h>
 #include <ePub3/xml/document.h>
+#if EPUB_USE(LIBXML2)
+#include <libxml/xpathInternals.h>
+#include <mutex>
+#include <unordered_map>
+#endif
 
 EPUB3_BEGIN_NAMESPACE
 
+#if EPUB_USE(LIBXML2)
+
+// The number of compiled expressions kept before further ones are compiled for a single use.
+static const size_t gMaxCachedXPaths = 512;
+
+/**
+ The compiled form of every XPath evaluated by a wrangler, keyed by the expression
+ and the namespaces it was compiled against.
+ 
+ Beyond remembering the functions it looked up, which resolve the same way in every
+ context, libxml2 doesn't modify a compiled expression while evaluating it, so each
+ one is shared by any number of threads once it's in the cache. Entries live as
+ long as the process does.
+ */
+class CompiledXPathCache
+{
+public:
+    static CompiledXPathCache& Shared()
+    {
+        static std::once_flag __once;
+        static std::unique_ptr<CompiledXPathCache> __cache;
+        std::call_once(__once, []{ __cache.reset(new CompiledXPathCache); });
+        return *__cache;
+    }
+    
+    ///
+    /// The compiled form of `xpath`; `*owned` is set to `true` if the caller must free it.
+    xmlXPathCompExprPtr Get(const string& xpath, const std::string& nsKey, xmlXPathContextPtr ctx, bool* owned)
+    {
+        std::string key(nsKey);
+        key += '\n';
+        key += xpath.stl_str();
+        
+        *owned = false;
+        {
+            std::lock_guard<std::mutex> _(_lock);
+            auto pos = _expressions.find(key);
+            if ( pos != _expressions.end() )
+                return pos->second;
+        }
+        
+        // compile outside the lock; if another thread got there first, keep theirs
+        xmlXPathCompExprPtr compiled = xmlXPathCtxtCompile(ctx, xpath.xml_str());
+        if ( compiled == nullptr )
+            return nullptr;
+        
+        std::lock_guard<std::mutex> _(_lock);
+        auto pos = _expressions.find(key);
+        if ( pos != _expressions.end() )
+        {
+            xmlXPathFreeCompExpr(compiled);
+            return pos->second;
+        }
+        if ( _expressions.size() >= gMaxCachedXPaths )
+        {
+            *owned = true;
+            return compiled;
+        }
+        
+        _expressions.emplace(key, compiled);
+        return compiled;
+    }
+    
+private:
+    std::mutex                                              _lock;
+    std::unordered_map<std::string, xmlXPathCompExprPtr>    _expressions;
+    
+};
+
+/**
+ Evaluates a compiled XPath using one of the document's pooled contexts, whose
+ namespaces are registered only when the context is first created.
+ */
+class PooledXPathEvaluation
+{
+public:
+    PooledXPathEvaluation(shared_ptr<xml::Document> doc, const XPathWrangler::NamespaceList& namespaces)
+        : _doc(doc), _ctx(nullptr), _result(nullptr)
+    {
+        for ( auto& item : namespaces )
+        {
+            _nsKey += item.first.stl_str();
+            _nsKey += '=';
+            _nsKey += item.second.stl_str();
+            _nsKey += ' ';
+        }
+        
+        bool created = false;
+        _ctx = _doc->AcquireXPathContext(_nsKey, &created);
+        if ( _ctx != nullptr && created )
+        {
+            for ( auto& item : namespaces )
+                xmlXPathRegisterNs(_ctx, item.first.xml_str(), item.second.xml_str());
+        }
+    }
+    ~PooledXPathEvaluation()
+    {
+        if ( _result != nullptr )
+            xmlXPathFreeObject(_result);
+        _doc->RelinquishXPathContext(_nsKey, _ctx);
+    }
+    
+    xmlXPathObjectPtr Evaluate(const string& xpath, shared_ptr<xml::Node> node)
+    {
+        bool owned = false;
+        xmlXPathCompExprPtr compiled = Compile(xpath, &owned);
+        if ( compiled == nullptr )
+            return nullptr;
+        
+        _ctx->node = const_cast<xmlNodePtr>(node->xml());
+        _result = xmlXPathCompiledEval(compiled, _ctx);
+        if ( owned )
+            xmlXPathFreeCompExpr(compiled);
+        return _result;
+    }
+    bool EvaluateAsBoolean(const string& xpath, shared_ptr<xml::Node> node)
+    {
+        bool owned = false;
+        xmlXPathCompExprPtr compiled = Compile(xpath, &owned);
+        if ( compiled == nullptr )
+            return false;
+        
+        _ctx->node = const_cast<xmlNodePtr>(node->xml());
+        int r = xmlXPathCompiledEvalToBoolean(compiled, _ctx);
+        if ( owned )
+            xmlXPathFreeCompExpr(compiled);
+        return ( r == 1 );
+    }
+    
+private:
+    shared_ptr<xml::Document>   _doc;
+    std::string                 _nsKey;
+    xmlXPathContextPtr          _ctx;
+    xmlXPathObjectPtr           _result;
+    
+    xmlXPathCompExprPtr Compile(const string& xpath, bool* owned)
+    {
+        if ( _ctx == nullptr )
+            return nullptr;
+        return CompiledXPathCache::Shared().Get(xpath, _nsKey, _ctx, owned);
+    }
+    
+};
+
+static xml::NodeSet WrappedNodes(xmlNodeSetPtr ns)
+{
+    xml::NodeSet nodes;
+    for ( int i = 0; i < xmlXPathNodeSetGetLength(ns); i++ )
+    {
+        auto node = xml::Wrapped<xml::Node>(xmlXPathNodeSetItem(ns, i));
+        if ( bool(node) )
+            nodes.push_back(node);
+    }
+    return nodes;
+}
+
+#endif
+
 XPathWrangler::XPathWrangler(shared_ptr<xml::Document> doc, const NamespaceList& namespaces) : _doc(doc), _namespaces(namespaces)
 {
 }
 XPathWrangler::XPathWrangler(const XPathWrangler& o) : _doc(o._doc), _namespaces(o._namespaces)
 {
 }
-XPathWrangler::XPathWrangler(XPathWrangler&& o) : _doc(std::move(o._doc))
+XPathWrangler::XPathWrangler(XPathWrangler&& o) : _doc(std::move(o._doc)), _namespaces(std::move(o._namespaces))
 {
 }
 XPathWrangler::~XPathWrangler()
 {
 }
+#if EPUB_USE(LIBXML2)
+XPathWrangler::StringList XPathWrangler::Strings(const string& xpath, shared_ptr<xml::Node> node)
+{
+    StringList strings;
+    
+    PooledXPathEvaluation eval(_doc, _namespaces);
+    xmlXPathObjectPtr result = eval.Evaluate(xpath, (bool(node) ? node : _doc));
+    if ( result == nullptr )
+        return strings;
+    
+    switch ( result->type )
+    {
+        case XPATH_STRING:
+            // a single string
+            strings.emplace_back(result->stringval);
+            break;
+        case XPATH_NODESET:
+        {
+            // a list of strings (I hope)
+            for ( shared_ptr<xml::Node> node : WrappedNodes(result->nodesetval) )
+            {
+                strings.emplace_back(node->StringValue());
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    
+    return strings;
+}
+bool XPathWrangler::Matches(const string& xpath, shared_ptr<xml::Node> node)
+{
+    PooledXPathEvaluation eval(_doc, _namespaces);
+    return eval.EvaluateAsBoolean(xpath, (bool(node) ? node : _doc));
+}
+xml::NodeSet XPathWrangler::Nodes(const string& xpath, shared_ptr<xml::Node> node)
+{
+    PooledXPathEvaluation eval(_doc, _namespaces);
+    xmlXPathObjectPtr result = eval.Evaluate(xpath, (bool(node) ? node : _doc));
+    if ( result == nullptr || result->type != XPATH_NODESET )
+        return xml::NodeSet();
+    
+    return WrappedNodes(result->nodesetval);
+}
+#else
 XPathWrangler::StringList XPathWrangler::Strings(const string& xpath, shared_ptr<xml::Node> node)
 {
     StringList strings;
@@ -102,6 +311,7 @@ xml::NodeSet XPathWrangler::Nodes(const string& xpath, shared_ptr<xml::Node> nod
     
     return result;
 }
+#endif
 void XPathWrangler::RegisterNamespaces(const NamespaceList &namespaces)
 {
     for ( auto item : namespaces )
@@ -28,7 +28,9 @@
 //  OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "zip_archive.h"
+extern "C" {
 #include <libzip/zipint.h>
+}
 #include "byte_stream.h"
 #include "make_unique.h"
 #include <sstream>
@@ -36,6 +38,8 @@
 #include <iostream>
 #if EPUB_OS(UNIX)
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 #include <fcntl.h>
 #if EPUB_OS(WINDOWS)
@@ -112,12 +116,209 @@ static string GetTempFilePath(const string& ext)
 
 #endif //ENABLE_ZIP_ARCHIVE_WRITER
 
+// FNV-1a, optionally folding ASCII case to match strcasecmp()
+static inline uint32_t HashItemName(const char* name, bool foldCase)
+{
+    uint32_t hash = 2166136261U;
+    for ( const unsigned char* p = reinterpret_cast<const unsigned char*>(name); *p != 0; p++ )
+    {
+        unsigned char ch = *p;
+        if ( foldCase && ch >= 'A' && ch <= 'Z' )
+            ch += 'a' - 'A';
+        hash = (hash ^ ch) * 16777619U;
+    }
+    return hash;
+}
+
+ZipNameIndex::ZipNameIndex(struct zip* archive) : _zip(nullptr)
+{
+    Rebuild(archive);
+}
+ZipNameIndex::ZipNameIndex(ZipNameIndex&& o) : _zip(o._zip)
+{
+    for ( int i = 0; i < TableCount; i++ )
+        _tables[i] = std::move(o._tables[i]);
+    o.Rebuild(nullptr);
+}
+ZipNameIndex& ZipNameIndex::operator=(ZipNameIndex&& o)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _zip = o._zip;
+    for ( int i = 0; i < TableCount; i++ )
+        _tables[i] = std::move(o._tables[i]);
+    o.Rebuild(nullptr);
+    return *this;
+}
+void ZipNameIndex::Rebuild(struct zip* archive)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _zip = archive;
+    for ( int i = 0; i < TableCount; i++ )
+        _tables[i] = Table();
+    
+    if ( _zip != nullptr )
+        Build(_tables[0], 0);
+}
+const char* ZipNameIndex::NameForIndex(int index, int flags) const
+{
+    // deleted items and newly-added (unnamed) items yield NULL
+    const char* name = _zip_get_name(_zip, index, 0, nullptr);
+    if ( name != nullptr && (flags & ZIP_FL_NODIR) != 0 )
+    {
+        const char* p = strrchr(name, '/');
+        if ( p != nullptr )
+            name = p+1;
+    }
+    return name;
+}
+void ZipNameIndex::Build(Table& table, int flags) const
+{
+    bool foldCase = ((flags & ZIP_FL_NOCASE) != 0);
+    int n = zip_get_num_files(_zip);
+    
+    // keep the load factor at or below one half
+    size_t capacity = 16;
+    while ( capacity < size_t(n) * 2 )
+        capacity <<= 1;
+    size_t mask = capacity - 1;
+    
+    table.entries.assign(capacity, -1);
+    table.hashes.assign(capacity, 0);
+    
+    for ( int i = 0; i < n; i++ )
+    {
+        const char* name = NameForIndex(i, flags);
+        if ( name == nullptr )
+            continue;
+        
+        uint32_t hash = HashItemName(name, foldCase);
+        size_t slot = hash & mask;
+        bool duplicate = false;
+        while ( table.entries[slot] != -1 )
+        {
+            // zip_name_locate() returns the first match, so earlier items win
+            if ( table.hashes[slot] == hash )
+            {
+                const char* other = NameForIndex(table.entries[slot], flags);
+                if ( (foldCase ? strcasecmp(name, other) : strcmp(name, other)) == 0 )
+                {
+                    duplicate = true;
+                    break;
+                }
+            }
+            slot = (slot + 1) & mask;
+        }
+        
+        if ( duplicate )
+            continue;
+        
+        table.entries[slot] = i;
+        table.hashes[slot] = hash;
+    }
+    
+    table.built = true;
+}
+int ZipNameIndex::Locate(const char* name, int flags) const
+{
+    if ( _zip == nullptr )
+        return -1;
+    if ( name == nullptr || (flags & ~(ZIP_FL_NOCASE|ZIP_FL_NODIR)) != 0 )
+        return zip_name_locate(_zip, name, flags);
+    
+    // the exact-match table is always present; the others are built on demand
+    if ( flags != 0 )
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        if ( !_tables[flags].built )
+            Build(_tables[flags], flags);
+    }
+    
+    const Table& table = _tables[flags];
+    bool foldCase = ((flags & ZIP_FL_NOCASE) != 0);
+    uint32_t hash = HashItemName(name, foldCase);
+    size_t mask = table.entries.size() - 1;
+    for ( size_t slot = hash & mask; table.entries[slot] != -1; slot = (slot + 1) & mask )
+    {
+        if ( table.hashes[slot] != hash )
+            continue;
+        
+        int index = table.entries[slot];
+        const char* candidate = NameForIndex(index, flags);
+        if ( (foldCase ? strcasecmp(name, candidate) : strcmp(name, candidate)) == 0 )
+            return index;
+    }
+    
+    _zip_error_set(&_zip->error, ZIP_ER_NOENT, 0);
+    return -1;
+}
+
+// returns a read-only mapping of a whole file, which is unmapped once released
+static std::shared_ptr<const uint8_t> MapArchiveFile(const string& path, size_t* outSize)
+{
+#if EPUB_OS(UNIX)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if ( fd == -1 )
+        return nullptr;
+    
+    struct stat sb;
+    if ( ::fstat(fd, &sb) != 0 || sb.st_size <= 0 )
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    
+    size_t size = static_cast<size_t>(sb.st_size);
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);        // the mapping holds its own reference to the file
+    if ( addr == MAP_FAILED )
+        return nullptr;
+    
+    *outSize = size;
+    return std::shared_ptr<const uint8_t>(reinterpret_cast<const uint8_t*>(addr), [size](const uint8_t* p) {
+        ::munmap(const_cast<uint8_t*>(p), size);
+    });
+#elif EPUB_PLATFORM(WIN)
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if ( file == INVALID_HANDLE_VALUE )
+        return nullptr;
+    
+    LARGE_INTEGER fileSize;
+    if ( !::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0 || uint64_t(fileSize.QuadPart) > SIZE_MAX )
+    {
+        ::CloseHandle(file);
+        return nullptr;
+    }
+    
+    HANDLE mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    ::CloseHandle(file);
+    if ( mapping == NULL )
+        return nullptr;
+    
+    void* addr = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(mapping);     // the view holds its own reference to the mapping
+    if ( addr == NULL )
+        return nullptr;
+    
+    *outSize = static_cast<size_t>(fileSize.QuadPart);
+    return std::shared_ptr<const uint8_t>(reinterpret_cast<const uint8_t*>(addr), [](const uint8_t* p) {
+        ::UnmapViewOfFile(p);
+    });
+#else
+    return nullptr;
+#endif
+}
+
 class ZipReader : public ArchiveReader
 {
 public:
-    ZipReader(struct zip_file* file) : _file(file), _total_size(_file->bytes_left) {}
-    ZipReader(ZipReader&& o) : _file(o._file) { o._file = nullptr; }
-    virtual ~ZipReader() { if (_file != nullptr) zip_fclose(_file); }
+    ZipReader(struct zip_file* file, std::shared_ptr<std::mutex> lock) : _file(file), _total_size(_file->bytes_left), _lock(lock) {}
+    ZipReader(ZipReader&& o) : _file(o._file), _total_size(o._total_size), _lock(std::move(o._lock)) { o._file = nullptr; }
+    virtual ~ZipReader() {
+        if (_file == nullptr)
+            return;
+        std::lock_guard<std::mutex> _(*_lock);
+        zip_fclose(_file);
+    }
     
     virtual bool operator !() const { return _file == nullptr || _file->bytes_left == 0; }
 	virtual ssize_t read(void* p, size_t len) const { return zip_fread(_file, p, len); }
@@ -128,6 +329,7 @@ public:
 private:
     struct zip_file * _file;
 	size_t _total_size;
+    std::shared_ptr<std::mutex> _lock;
 };
 
 #if ENABLE_ZIP_ARCHIVE_WRITER
@@ -200,13 +402,14 @@ string ZipArchive::TempFilePath()
     return GetTempFilePath("zip");
 }
 #endif //ENABLE_ZIP_ARCHIVE_WRITER
-ZipArchive::ZipArchive(const string & path)
+ZipArchive::ZipArchive(const string & path) : _fileLock(std::make_shared<std::mutex>())
 {
     int zerr = 0;
     _zip = zip_open(path.c_str(), ZIP_CREATE, &zerr);
     if ( _zip == nullptr )
         throw std::runtime_error(std::string("zip_open() failed: ") + zError(zerr));
     _path = path;
+    _nameIndex.Rebuild(_zip);
 }
 ZipArchive::~ZipArchive()
 {
@@ -219,6 +422,9 @@ Archive & ZipArchive::operator = (ZipArchive &&o)
         zip_close(_zip);
     _zip = o._zip;
     o._zip = nullptr;
+    _nameIndex = std::move(o._nameIndex);
+    _fileLock = std::move(o._fileLock);
+    _inflateIndices = std::move(o._inflateIndices);
     return dynamic_cast<Archive&>(*this);
 }
 void ZipArchive::EachItem(std::function<void (const ArchiveItemInfo &)> fn) const
@@ -234,44 +440,150 @@ void ZipArchive::EachItem(std::function<void (const ArchiveItemInfo &)> fn) cons
         fn(info);
     }
 }
+int ZipArchive::IndexOfItem(const string & path, int flags) const
+{
+    return _nameIndex.Locate(Sanitized(path).c_str(), flags);
+}
 bool ZipArchive::ContainsItem(const string & path) const
 {
-    return (zip_name_locate(_zip, Sanitized(path).c_str(), 0) >= 0);
+    return (IndexOfItem(path) >= 0);
 }
 bool ZipArchive::DeleteItem(const string & path)
 {
-    int idx = zip_name_locate(_zip, Sanitized(path).c_str(), 0);
-    if ( idx >= 0 )
-        return (zip_delete(_zip, idx) >= 0);
-    return false;
+    int idx = IndexOfItem(path);
+    if ( idx < 0 || zip_delete(_zip, idx) < 0 )
+        return false;
+    _nameIndex.Rebuild(_zip);
+    return true;
 }
 bool ZipArchive::CreateFolder(const string & path)
 {
-    return (zip_add_dir(_zip, Sanitized(path).c_str()) >= 0);
+    if ( zip_add_dir(_zip, Sanitized(path).c_str()) < 0 )
+        return false;
+    _nameIndex.Rebuild(_zip);
+    return true;
 }
 unique_ptr<ByteStream> ZipArchive::ByteStreamAtPath(const string &path) const
 {
-    return make_unique<ZipFileByteStream>(_zip, path);
+    auto stream = make_unique<ZipFileByteStream>();
+    stream->SetArchiveLock(_fileLock);
+    int idx = IndexOfItem(path);
+    if ( idx >= 0 && stream->Open(_zip, idx) )
+        stream->SetInflateIndex(InflateIndexForItem(idx));
+    return std::move(stream);
 }
 
 #ifdef SUPPORT_ASYNC
 unique_ptr<AsyncByteStream> ZipArchive::AsyncByteStreamAtPath(const string& path) const
 {
-    return make_unique<AsyncZipFileByteStream>(_zip, path);
+    auto stream = make_unique<AsyncZipFileByteStream>();
+    stream->SetArchiveLock(_fileLock);
+    int idx = IndexOfItem(path);
+    if ( idx < 0 || !stream->Open(_zip, idx) )
+        throw std::invalid_argument("AsyncZipFileByteStream: failed to Open() archive");
+    stream->SetInflateIndex(InflateIndexForItem(idx));
+    return std::move(stream);
 }
 #endif /* SUPPORT_ASYNC */
 
+std::shared_ptr<ZipInflateIndex> ZipArchive::InflateIndexForItem(int index) const
+{
+    if ( _zip == nullptr || index < 0 )
+        return nullptr;
+    
+    std::lock_guard<std::mutex> _(_inflateIndexLock);
+    auto found = _inflateIndices.find(index);
+    if ( found != _inflateIndices.end() )
+        return found->second;
+    
+    struct zip_stat sbuf;
+    if ( zip_stat_index(_zip, index, 0, &sbuf) < 0 )
+        return nullptr;
+    
+    // small or stored items can be seeked cheaply already
+    if ( sbuf.comp_method != ZIP_CM_DEFLATE || size_t(sbuf.size) <= ZipInflateIndex::DefaultSpan )
+        return nullptr;
+    
+    auto result = std::make_shared<ZipInflateIndex>();
+    _inflateIndices[index] = result;
+    return result;
+}
+
+MappedZipArchive::MappedZipArchive(const string & path) : ZipArchive(path), _mapping(), _mappingSize(0)
+{
+    _mapping = MapArchiveFile(path, &_mappingSize);
+}
+size_t MappedZipArchive::DataOffsetForItem(int index) const
+{
+    if ( !bool(_mapping) || index < 0 || _zip->cdir == nullptr || index >= _zip->cdir->nentry )
+        return 0;
+    if ( ZIP_ENTRY_DATA_CHANGED(_zip->entry+index) )
+        return 0;       // the new data isn't in the mapping
+    
+    const struct zip_dirent& entry = _zip->cdir->entry[index];
+    if ( (entry.bitflags & ZIP_GPBF_ENCRYPTED) != 0 )
+        return 0;
+    if ( entry.comp_method == ZIP_CM_STORE )
+    {
+        if ( entry.comp_size != entry.uncomp_size )
+            return 0;
+    }
+    else if ( entry.comp_method != ZIP_CM_DEFLATE )
+    {
+        return 0;
+    }
+    
+    // the data follows the local header, whose variable-length fields may differ
+    // from those in the central directory
+    size_t offset = entry.offset;
+    if ( offset > _mappingSize || _mappingSize - offset < LENTRYSIZE )
+        return 0;
+    
+    const uint8_t* header = _mapping.get() + offset;
+    if ( ::memcmp(header, LOCAL_MAGIC, 4) != 0 )
+        return 0;
+    
+    size_t nameLen = size_t(header[26]) | (size_t(header[27]) << 8);
+    size_t extraLen = size_t(header[28]) | (size_t(header[29]) << 8);
+    size_t dataOffset = offset + LENTRYSIZE + nameLen + extraLen;
+    if ( dataOffset > _mappingSize || _mappingSize - dataOffset < entry.comp_size )
+        return 0;
+    
+    return dataOffset;
+}
+unique_ptr<ByteStream> MappedZipArchive::ByteStreamAtPath(const string &path) const
+{
+    int idx = IndexOfItem(path);
+    size_t dataOffset = DataOffsetForItem(idx);
+    if ( dataOffset == 0 )
+        return ZipArchive::ByteStreamAtPath(path);
+    
+    const struct zip_dirent& entry = _zip->cdir->entry[idx];
+    auto stream = make_unique<MappedZipFileByteStream>(_mapping, dataOffset, entry.comp_size, entry.uncomp_size,
+                                                       entry.comp_method, entry.crc);
+    stream->SetInflateIndex(InflateIndexForItem(idx));
+    return std::move(stream);
+}
+
 unique_ptr<ArchiveReader> ZipArchive::ReaderAtPath(const string & path) const
 {
     if (_zip == nullptr)
         return nullptr;
     
-    struct zip_file* file = zip_fopen(_zip, Sanitized(path).c_str(), 0);
+    int idx = IndexOfItem(path);
+    if (idx < 0)
+        return nullptr;
+    
+    struct zip_file* file = nullptr;
+    {
+        std::lock_guard<std::mutex> _(*_fileLock);
+        file = zip_fopen_index(_zip, idx, 0);
+    }
 
     if (file == nullptr)
         return nullptr;
     
-    return unique_ptr<ZipReader>(new ZipReader(file));
+    return unique_ptr<ZipReader>(new ZipReader(file, _fileLock));
 }
 #if ENABLE_ZIP_ARCHIVE_WRITER
 unique_ptr<ArchiveWriter> ZipArchive::WriterAtPath(const string & path, bool compressed, bool create)
@@ -279,7 +591,7 @@ unique_ptr<ArchiveWriter> ZipArchive::WriterAtPath(const string & path, bool com
     if (_zip == nullptr)
         return nullptr;
     
-    int idx = zip_name_locate(_zip, Sanitized(path).c_str(), (create ? ZIP_CREATE : 0));
+    int idx = IndexOfItem(path, (create ? ZIP_CREATE : 0));
     if (idx == -1)
         return nullptr;
     
@@ -296,7 +608,8 @@ unique_ptr<ArchiveWriter> ZipArchive::WriterAtPath(const string & path, bool com
 ArchiveItemInfo ZipArchive::InfoAtPath(const string & path) const
 {
     struct zip_stat sbuf;
-    if ( zip_stat(_zip, Sanitized(path).c_str(), 0, &sbuf) < 0 )
+    int idx = IndexOfItem(path);
+    if ( idx < 0 || zip_stat_index(_zip, idx, 0, &sbuf) < 0 )
         throw std::runtime_error(std::string("zip_stat("+path.stl_str()+") - " + zip_strerror(_zip)));
     return ZipItemInfo(sbuf);
 }
@@ -33,9 +33,89 @@
 #include <ePub3/archive.h>
 #include <libzip/zip.h>
 #include <list>
+#include <map>
+#include <mutex>
+#include <vector>
 
 EPUB3_BEGIN_NAMESPACE
 
+class ZipInflateIndex;
+
+/**
+ A hashed lookup table of the item names within a ZIP archive.
+ 
+ `zip_name_locate()` compares the requested name against every entry in the
+ central directory in turn, which gets expensive for archives holding thousands
+ of items. This builds an open-addressed hash table of the names once, and
+ answers the same queries (with the same result: the lowest matching index) in
+ constant time.
+ 
+ The case-insensitive and filename-only variants (`ZIP_FL_NOCASE` and
+ `ZIP_FL_NODIR`) each use a separate table, built on first use.
+ 
+ @note The table refers to names owned by the archive, so it must be rebuilt
+ whenever items are added, renamed or deleted.
+ @ingroup archives
+ */
+class ZipNameIndex
+{
+public:
+    ///
+    /// Builds an index of the names in the given archive.
+    explicit                ZipNameIndex(struct zip* archive=nullptr);
+                            ZipNameIndex(ZipNameIndex&& o);
+                            ~ZipNameIndex() {}
+    
+    ZipNameIndex&           operator=(ZipNameIndex&& o);
+    
+private:
+                            ZipNameIndex(const ZipNameIndex&)               _DELETED_;
+    ZipNameIndex&           operator=(const ZipNameIndex&)                  _DELETED_;
+    
+public:
+    ///
+    /// Discards all tables and rebuilds the exact-match table for an archive.
+    void                    Rebuild(struct zip* archive);
+    
+    /**
+     Looks up the index of an item by name.
+     @param name The name of the item within the archive.
+     @param flags Any combination of `ZIP_FL_NOCASE` and `ZIP_FL_NODIR`. Any other
+     flags are handed off to `zip_name_locate()`.
+     @result The index of the first item with a matching name, or `-1` if there
+     is none. In that case the archive's error is set to `ZIP_ER_NOENT`, as with
+     `zip_name_locate()`.
+     */
+    int                     Locate(const char* name, int flags=0)       const;
+    
+protected:
+    ///
+    /// A single open-addressed table, using linear probing.
+    struct Table
+    {
+        std::vector<int>        entries;    ///< Item index in each slot, or -1 if empty.
+        std::vector<uint32_t>   hashes;     ///< Full hash of the name in each slot.
+        bool                    built;      ///< Whether the table has been populated.
+        
+        Table() : entries(), hashes(), built(false) {}
+    };
+    
+    // one table per combination of ZIP_FL_NOCASE & ZIP_FL_NODIR
+    static const int        TableCount = 4;
+    
+    struct zip*             _zip;                   ///< The archive whose names are indexed.
+    mutable Table           _tables[TableCount];    ///< Tables, indexed by lookup flags.
+    mutable std::mutex      _lock;                  ///< Guards lazy construction of the variant tables.
+    
+    ///
+    /// Fills in a table using the archive's current item names.
+    void                    Build(Table& table, int flags)              const;
+    ///
+    /// Returns the name of an item as it should be compared for a set of flags.
+    const char*             NameForIndex(int index, int flags)          const;
+    
+};
+
 /**
  An Archive implementation for ZIP files, as used by the OCF 3.0 standard.
  
@@ -43,6 +123,10 @@ EPUB3_BEGIN_NAMESPACE
  @note The underlying implementation, `libzip`, writes data only when the archive
  is closed. Any data written to a zip file will therefore be kept in temporary
  storage until the archive object is closed.
+ @note Streams and readers for items within the archive may be used from several
+ threads at once, including multiple streams on the same item. Each reads using
+ positional I/O on the archive's file, and has its own decompression state.
+ Modifying the archive while it is being read is not supported.
  @see http://www.idpf.org/epub/30/spec/epub30-ocf.html#physical-container-zip
  @ingroup archives
  */
@@ -66,10 +150,10 @@ public:
     ZipArchive(const string & path="");
     ///
     /// move constructos.
-    ZipArchive(ZipArchive &&o) : _zip(o._zip) { o._zip = nullptr; }
+    ZipArchive(ZipArchive &&o) : _zip(o._zip), _nameIndex(std::move(o._nameIndex)), _fileLock(std::move(o._fileLock)), _inflateIndices(std::move(o._inflateIndices)) { o._zip = nullptr; }
     ///
     /// Initialize directly from a `libzip` internal structure.
-    explicit ZipArchive(struct zip * aZip) : _zip(aZip) {}
+    explicit ZipArchive(struct zip * aZip) : _zip(aZip), _nameIndex(aZip), _fileLock(std::make_shared<std::mutex>()) {}
     virtual ~ZipArchive();
     
     ///
@@ -96,12 +180,81 @@ public:
 #endif //ENABLE_ZIP_ARCHIVE_WRITER
     virtual ArchiveItemInfo InfoAtPath(const string & path) const;
     
+    /**
+     Looks up the index of an item within the archive.
+     @param path The path of the item.
+     @param flags `ZIP_FL_NOCASE` to ignore case, `ZIP_FL_NODIR` to match only the
+     last path component. Other `zip_name_locate()` flags are also accepted.
+     @result The index of the item, or `-1` if no item matches.
+     */
+    int IndexOfItem(const string & path, int flags=0) const;
+    
 protected:
     struct zip *    _zip;           ///< Pointer to the underlying `libzip` data type.
+    ZipNameIndex    _nameIndex;     ///< Hashed lookup table for item names.
+    
+    ///
+    /// Serializes opening and closing items, which updates the archive's list of open files.
+    std::shared_ptr<std::mutex> _fileLock;
     
     typedef std::list<zip_source*>  ZipSourceList;
     ZipSourceList   _liveSources;   ///< A list of live zip sources, which must be cleaned up upon closing.
+    
+    typedef std::map<int, std::shared_ptr<ZipInflateIndex>>  InflateIndexMap;
+    mutable InflateIndexMap _inflateIndices;    ///< Seek indices for large deflated items, by item index.
+    mutable std::mutex      _inflateIndexLock;  ///< Guards `_inflateIndices`.
+    
+    /**
+     Returns the seek index shared by all streams reading a given item.
+     
+     Indices are only created for deflated items large enough to contain at least
+     one checkpoint; for anything else, this returns `nullptr`.
+     @param index The index of the item within the archive.
+     */
+    std::shared_ptr<ZipInflateIndex> InflateIndexForItem(int index) const;
+
+};
 
+/**
+ A ZipArchive which maps the whole archive file into memory.
+ 
+ Items are read using MappedZipFileByteStream: stored items are copied straight out
+ of the mapped pages, and deflated items are inflated directly from them, avoiding
+ the seek/read system calls and intermediate buffers of the stdio-based reader.
+ 
+ The central directory is still read using `libzip`, and anything which can't be
+ read from the mapping (items modified since opening, unsupported compression
+ methods, or the whole archive if mapping fails or is unsupported on the platform)
+ is handled by ZipArchive as usual.
+ @ingroup archives
+ */
+class MappedZipArchive : public ZipArchive
+{
+public:
+    ///
+    /// Opens and maps the ZipArchive at a given filesystem path.
+    EPUB3_EXPORT
+    MappedZipArchive(const string & path);
+    virtual ~MappedZipArchive() {}
+    
+    virtual unique_ptr<ByteStream> ByteStreamAtPath(const string& path) const OVERRIDE;
+    
+    ///
+    /// Whether the archive file was mapped successfully.
+    bool IsMapped() const { return bool(_mapping); }
+    
+protected:
+    std::shared_ptr<const uint8_t>  _mapping;       ///< The mapped archive file; unmapped when the last user releases it.
+    size_t                          _mappingSize;   ///< The length of the mapping.
+    
+    /**
+     Locates an item's data within the mapping.
+     @param index The index of the item.
+     @result The offset of the item's data within the mapping, or `0` if the item
+     can't be read from the mapping.
+     */
+    size_t DataOffsetForItem(int index) const;
+    
 };
 
 EPUB3_END_NAMESPACE
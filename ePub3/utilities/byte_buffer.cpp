@@ -53,29 +53,29 @@ EPUB3_BEGIN_NAMESPACE
 
 const prealloc_buf_t prealloc_buf = {};
 
-ByteBuffer::ByteBuffer(size_t bufferSize) : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0)
+ByteBuffer::ByteBuffer(size_t bufferSize) : m_storage(nullptr), m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0), m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
-	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
+	m_buffer = m_storage = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
     m_bufferSize = bufferSize;
     m_bufferCapacity = cap;
 }
-ByteBuffer::ByteBuffer(size_t bufferSize, prealloc_buf_t) : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0)
+ByteBuffer::ByteBuffer(size_t bufferSize, prealloc_buf_t) : m_storage(nullptr), m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0), m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
-	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
+	m_buffer = m_storage = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
     m_bufferCapacity = cap;
 }
-ByteBuffer::ByteBuffer(const unsigned char* buffer, size_t bufferSize)
+ByteBuffer::ByteBuffer(const unsigned char* buffer, size_t bufferSize) : m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
-	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
+	m_buffer = m_storage = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
@@ -84,9 +84,9 @@ ByteBuffer::ByteBuffer(const unsigned char* buffer, size_t bufferSize)
     m_bufferCapacity = cap;
 }
 #if !EPUB_COMPILER_SUPPORTS(CXX_DELEGATING_CONSTRUCTORS)
-ByteBuffer::ByteBuffer(const ByteBuffer& o)
+ByteBuffer::ByteBuffer(const ByteBuffer& o) : m_secure(false)
 {
-    m_buffer = reinterpret_cast<unsigned char*>(malloc(o.m_bufferCapacity));
+    m_buffer = m_storage = reinterpret_cast<unsigned char*>(malloc(o.m_bufferCapacity));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
@@ -98,14 +98,14 @@ ByteBuffer::ByteBuffer(const ByteBuffer& o)
 ByteBuffer::~ByteBuffer()
 {
     
-    if ( m_buffer != nullptr )
+    if ( m_storage != nullptr )
     {
         if ( m_secure )
-            Clean(m_buffer, m_bufferCapacity);
-        free(m_buffer);
+            Clean(m_storage, size_t(m_buffer - m_storage) + m_bufferCapacity);
+        free(m_storage);
     }
     
-    m_buffer = nullptr;
+    m_storage = m_buffer = nullptr;
     m_bufferSize = 0;
     m_bufferCapacity = 0;
 }
@@ -122,19 +122,23 @@ ByteBuffer& ByteBuffer::operator=(const ByteBuffer& o)
 }
 ByteBuffer& ByteBuffer::operator=(ByteBuffer&& o)
 {
-    if ( m_buffer != nullptr )
+    if ( this == &o )
+        return *this;
+    
+    if ( m_storage != nullptr )
     {
         if ( m_secure )
-            Clean(m_buffer, m_bufferCapacity);
-        ::free(m_buffer);
+            Clean(m_storage, size_t(m_buffer - m_storage) + m_bufferCapacity);
+        ::free(m_storage);
     }
     
+    m_storage = o.m_storage;
     m_buffer = o.m_buffer;
     m_bufferSize = o.m_bufferSize;
     m_bufferCapacity = o.m_bufferCapacity;
     m_secure = o.m_secure;
     
-    o.m_buffer = nullptr;
+    o.m_storage = o.m_buffer = nullptr;
     o.m_bufferSize = o.m_bufferCapacity = 0;
     o.m_secure = false;
     
@@ -163,27 +167,14 @@ size_t ByteBuffer::MoveTo(unsigned char *targetBuffer, size_t targetBufferSize)
         bzero(targetBuffer+m_bufferSize, targetBufferSize-m_bufferSize);
         resultLen = m_bufferSize;
         
-        if ( m_secure )
-            Clean(m_buffer, m_bufferCapacity);
-        m_bufferSize = 0;       // allocation & capacity remain until Compact() is called
+        // allocation & capacity remain until Compact() is called
+        RemoveBytes(m_bufferSize);
     }
     else
     {
-        // move some bytes out
+        // move some bytes out, then step past them
         ::memmove(targetBuffer, m_buffer, targetBufferSize);
-        
-        // determine the remainder
-        unsigned char *remainderBuffer = m_buffer+targetBufferSize;
-        size_t remainderLen = m_bufferSize-targetBufferSize;
-        
-        // move the remainder down
-        ::memmove(m_buffer, remainderBuffer, remainderLen);
-        
-        // set the new length
-        m_bufferSize = remainderLen;
-        
-        if ( m_secure )
-            Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
+        RemoveBytes(targetBufferSize);
         
         resultLen = targetBufferSize;
         // capacity remains until Compact() is called
@@ -201,34 +192,59 @@ void ByteBuffer::AddBytes(unsigned char *extraBytes, size_t extraBytesSize)
 
 void ByteBuffer::RemoveBytes(size_t numBytesToRemove, size_t pos)
 {
-	if (numBytesToRemove >= m_bufferSize && pos == 0)
+    if ( pos >= m_bufferSize )
+        return;
+    
+	numBytesToRemove = std::min(numBytesToRemove, m_bufferSize - pos);
+    
+    if ( pos == 0 )
     {
-        m_bufferSize = 0;
+        // consume from the front by advancing the start of the content
+        m_buffer += numBytesToRemove;
+        m_bufferSize -= numBytesToRemove;
+        m_bufferCapacity -= numBytesToRemove;
+        
+        if ( m_bufferSize == 0 )
+            Reclaim();
         return;
     }
-
-	numBytesToRemove = std::min(numBytesToRemove, m_bufferSize - pos);
     
-    size_t newBufferSize = m_bufferSize - numBytesToRemove;
-	if (pos < m_bufferSize - numBytesToRemove)
-	{
-		::memmove(m_buffer + pos, m_buffer + pos + numBytesToRemove, newBufferSize);
-	}
-
-    m_bufferSize = newBufferSize;
+    size_t tailLen = m_bufferSize - pos - numBytesToRemove;
+    if ( tailLen > 0 )
+        ::memmove(m_buffer + pos, m_buffer + pos + numBytesToRemove, tailLen);
+    
+    m_bufferSize -= numBytesToRemove;
     
+    // everything past the old size is already clean
     if ( m_secure )
-        Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
+        Clean(m_buffer+m_bufferSize, numBytesToRemove);
+}
+
+void ByteBuffer::Resize(size_t newSize)
+{
+    if ( newSize > m_bufferSize )
+    {
+        EnsureCapacity(newSize);
+        bzero(m_buffer+m_bufferSize, newSize-m_bufferSize);
+    }
+    else if ( m_secure )
+    {
+        Clean(m_buffer+newSize, m_bufferSize-newSize);
+    }
+    
+    m_bufferSize = newSize;
 }
 
 void ByteBuffer::Compact()
 {
+    Reclaim();
+    
     if ( m_bufferCapacity > m_bufferSize )
     {
         if ( m_secure )
             Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
         
-        m_buffer = reinterpret_cast<unsigned char*>(realloc(m_buffer, m_bufferSize));
+        m_buffer = m_storage = reinterpret_cast<unsigned char*>(realloc(m_storage, m_bufferSize));
         if ( m_buffer == nullptr )
             throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
         m_bufferCapacity = m_bufferSize;
@@ -240,8 +256,13 @@ void ByteBuffer::EnsureCapacity(size_t desired)
     if ( m_bufferCapacity >= desired )
         return;
     
+    // consumed bytes at the front may provide enough room
+    Reclaim();
+    if ( m_bufferCapacity >= desired )
+        return;
+    
     size_t newCap = GoodSize(desired);
-    m_buffer = reinterpret_cast<unsigned char*>(realloc(m_buffer, newCap));
+    m_buffer = m_storage = reinterpret_cast<unsigned char*>(realloc(m_storage, newCap));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     m_bufferCapacity = newCap;
@@ -251,6 +272,23 @@ void ByteBuffer::EnsureCapacity(size_t desired)
         Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
 }
 
+void ByteBuffer::Reclaim()
+{
+    size_t consumed = size_t(m_buffer - m_storage);
+    if ( consumed == 0 )
+        return;
+    
+    if ( m_bufferSize > 0 )
+        ::memmove(m_storage, m_buffer, m_bufferSize);
+    
+    // erase the consumed bytes and the stale copy of the content, all in one go
+    if ( m_secure )
+        Clean(m_storage+m_bufferSize, consumed);
+    
+    m_buffer = m_storage;
+    m_bufferCapacity += consumed;
+}
+
 void ByteBuffer::Clean(unsigned char *ptr, size_t len)
 {
     bzero(ptr, len);
@@ -58,7 +58,7 @@ class ByteBuffer
 {
 public:
     
-    ByteBuffer() : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0) {}
+    ByteBuffer() : m_storage(nullptr), m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0), m_secure(false) {}
     ByteBuffer(size_t bufferSize);
     ByteBuffer(size_t bufferSize, prealloc_buf_t);
     ByteBuffer(const unsigned char *buffer, size_t bufferSize);   // copy-in
@@ -67,7 +67,7 @@ public:
 #else
     ByteBuffer(const ByteBuffer& o);
 #endif
-    ByteBuffer(ByteBuffer &&o) : m_buffer(std::move(o.m_buffer)), m_bufferSize(o.m_bufferSize), m_bufferCapacity(o.m_bufferCapacity) { o.m_bufferSize = o.m_bufferCapacity = 0; }
+    ByteBuffer(ByteBuffer &&o) : m_storage(o.m_storage), m_buffer(o.m_buffer), m_bufferSize(o.m_bufferSize), m_bufferCapacity(o.m_bufferCapacity), m_secure(o.m_secure) { o.m_storage = o.m_buffer = nullptr; o.m_bufferSize = o.m_bufferCapacity = 0; }
     virtual ~ByteBuffer();
     
     ByteBuffer& operator=(const ByteBuffer&);
@@ -89,8 +89,8 @@ public:
      Moves bytes from the receiver into another memory range.
      
      The receiver keeps its allocation and storage, though its size will be reduced.
-     If data remains in the receiver, the remainder will be moved to the start of its
-     internal storage.
+     Any remaining data is not moved; the start of the receiver's content simply
+     advances, so the cost is proportional to the number of bytes moved out.
      
      Call Compact() to collapse the size of the receiver's buffer.
      
@@ -110,9 +110,13 @@ public:
     
     /**
      Removes a number of bytes from the the buffer.
+     
+     Removing bytes from the front of the buffer (i.e. with `pos` of zero) is O(1):
+     the start of the content advances through the allocation, which is reclaimed
+     once the buffer empties or more room is needed. If secure erasure is enabled,
+     the consumed bytes are erased at that point, once, rather than on every call.
      @param numBytesToRemove The number of bytes to remove.
-     @note If this is used a lot, would be useful to maintain a start/end range rather
-     than just a size-- this would make 'removal' much simpler and O(1).
+     @param pos The offset of the first byte to remove.
      */
     void RemoveBytes(size_t numBytesToRemove, size_t pos=0);
     
@@ -120,6 +124,14 @@ public:
     const unsigned char* GetBytes() const { return m_buffer; }
     size_t GetBufferSize() const { return m_bufferSize; }
     
+    /**
+     Sets the number of bytes in the buffer.
+     
+     Any bytes added are zeroed; the receiver's capacity is never reduced.
+     @param newSize The new size of the buffer's content.
+     */
+    void Resize(size_t newSize);
+    
     /**
      Ensures that the receiver takes up only the amount of memory that is actually
      required.
@@ -129,13 +141,16 @@ public:
 private:
     
     void EnsureCapacity(size_t desired);
+    void Reclaim();
     void Clean(unsigned char* ptr, size_t len);
     
     // the object is managing this memory, so a raw pointer is acceptable here
+    unsigned char* m_storage;
+    // start of actual data, somewhere within m_storage; bytes before it have been consumed
     unsigned char* m_buffer;
     // size of actual data
     size_t m_bufferSize;
-    // actual allocated capacity (may be more)
+    // allocated capacity following m_buffer (may be more)
     size_t m_bufferCapacity;
     // whether to zero unused bytes
     bool m_secure;
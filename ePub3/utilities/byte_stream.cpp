@@ -29,9 +29,13 @@
 
 #include "byte_stream.h"
 #include <cstdio>
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <libzip/zip.h>
+extern "C" {
 #include <libzip/zipint.h>          // for internals of zip_file
+}
 #include <sys/stat.h>
 #if EPUB_OS(ANDROID) || EPUB_OS(LINUX) || EPUB_OS(WINDOWS)
 # include <condition_variable>
@@ -63,6 +67,56 @@ extern "C" _LIBCPP_NORETURN void __cxa_deleted_virtual()
 
 EPUB3_BEGIN_NAMESPACE
 
+ByteBuffer ByteStream::ReadAllBytes()
+{
+    // when the stream can't tell us its size, start here and double as needed
+    static const size_type kInitialCapacity = 16*1024;
+    
+    size_type expected = BytesAvailable();
+    ByteBuffer result;
+    result.Resize(expected != UnknownSize ? expected : kInitialCapacity);
+    
+    size_type total = 0;
+    while ( true )
+    {
+        if ( total == result.GetBufferSize() )
+        {
+            // the buffer is full: only grow it if there's actually more to come
+            uint8_t probe[4096];
+            size_type count = ReadBytes(probe, sizeof(probe));
+            if ( count == 0 )
+                break;
+            
+            result.Resize(std::max(total * 2, total + count));
+            ::memcpy(result.GetBytes() + total, probe, count);
+            total += count;
+            continue;
+        }
+        
+        size_type count = ReadBytes(result.GetBytes() + total, result.GetBufferSize() - total);
+        if ( count == 0 )
+            break;
+        total += count;
+    }
+    
+    result.Resize(total);
+    return result;
+}
+ByteStream::size_type ByteStream::ReadAllBytes(void** buf)
+{
+    ByteBuffer bytes = ReadAllBytes();
+    if ( bytes.IsEmpty() )
+        return 0;
+    
+    void* result = ::malloc(bytes.GetBufferSize());
+    if ( result == nullptr )
+        throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteStream::ReadAllBytes");
+    
+    ::memcpy(result, bytes.GetBytes(), bytes.GetBufferSize());
+    *buf = result;
+    return bytes.GetBufferSize();
+}
+
 #ifdef SUPPORT_ASYNC
 std::thread         AsyncByteStream::_asyncIOThread;
 RunLoopPtr          AsyncByteStream::_asyncRunLoop(nullptr);
@@ -749,7 +803,68 @@ std::shared_ptr<SeekableByteStream> FileByteStream::Clone() const
 #pragma mark -
 #endif
 
-ZipFileByteStream::ZipFileByteStream(struct zip* archive, const string& path, int flags) : SeekableByteStream(), _file(nullptr), _mode(std::ios::in | std::ios::out | std::ios::app | std::ios::binary)
+ByteStream::size_type ZipInflateIndex::Count() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _checkpoints.size();
+}
+bool ZipInflateIndex::WantsCheckpointAt(size_type offset) const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    size_type last = (_checkpoints.empty() ? 0 : _checkpoints.back()->uncompressedOffset);
+    return offset >= last + _span;
+}
+void ZipInflateIndex::AddCheckpoint(CheckpointPtr checkpoint)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    size_type last = (_checkpoints.empty() ? 0 : _checkpoints.back()->uncompressedOffset);
+    if ( checkpoint->uncompressedOffset >= last + _span )
+        _checkpoints.push_back(checkpoint);
+}
+ZipInflateIndex::CheckpointPtr ZipInflateIndex::CheckpointBefore(size_type offset) const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    auto pos = std::upper_bound(_checkpoints.begin(), _checkpoints.end(), offset, [](size_type off, const CheckpointPtr& cp) {
+        return off < cp->uncompressedOffset;
+    });
+    if ( pos == _checkpoints.begin() )
+        return nullptr;
+    return *(--pos);
+}
+void ZipInflateIndex::RecordCheckpoint(z_stream *zstr, size_type uncompressedOffset, size_type archiveOffset, size_type compressedRemaining)
+{
+    if ( !WantsCheckpointAt(uncompressedOffset) )
+        return;
+    
+    auto checkpoint = std::make_shared<Checkpoint>();
+    checkpoint->uncompressedOffset = uncompressedOffset;
+    checkpoint->archiveOffset = archiveOffset;
+    checkpoint->compressedRemaining = compressedRemaining;
+    checkpoint->bits = zstr->data_type & 7;
+    checkpoint->partialByte = (checkpoint->bits != 0 ? zstr->next_in[-1] : 0);
+    
+    uInt windowLen = 1U << MAX_WBITS;
+    checkpoint->window.resize(windowLen);
+    if ( inflateGetDictionary(zstr, checkpoint->window.data(), &windowLen) != Z_OK )
+        return;
+    checkpoint->window.resize(windowLen);
+    
+    AddCheckpoint(checkpoint);
+}
+int ZipInflateIndex::ResumeInflater(z_stream *zstr, const Checkpoint *checkpoint)
+{
+    int ret = inflateReset(zstr);
+    if ( ret == Z_OK && checkpoint != nullptr )
+    {
+        if ( checkpoint->bits != 0 )
+            ret = inflatePrime(zstr, checkpoint->bits, checkpoint->partialByte >> (8 - checkpoint->bits));
+        if ( ret == Z_OK )
+            ret = inflateSetDictionary(zstr, checkpoint->window.data(), static_cast<uInt>(checkpoint->window.size()));
+    }
+    return ret;
+}
+
+ZipFileByteStream::ZipFileByteStream(struct zip* archive, const string& path, int flags) : SeekableByteStream(), _file(nullptr), _mode(std::ios::in | std::ios::out | std::ios::app | std::ios::binary), _zipFlags(flags)
 {
     Open(archive, path, flags);
 }
@@ -778,7 +893,19 @@ bool ZipFileByteStream::Open(struct zip *archive, const string &path, int flags)
     if ( _file != nullptr )
         Close();
     
+    auto lock = LockArchive();
     _file = zip_fopen(archive, Sanitized(path).c_str(), flags);
+    _zipFlags = flags;
+    return ( _file != nullptr );
+}
+bool ZipFileByteStream::Open(struct zip *archive, int index, int flags)
+{
+    if ( _file != nullptr )
+        Close();
+    
+    auto lock = LockArchive();
+    _file = zip_fopen_index(archive, index, flags);
+    _zipFlags = flags;
     return ( _file != nullptr );
 }
 void ZipFileByteStream::Close()
@@ -786,9 +913,16 @@ void ZipFileByteStream::Close()
     if ( _file == nullptr )
         return;
 
+    auto lock = LockArchive();
     zip_fclose(_file);
     _file = nullptr;
 }
+std::unique_lock<std::mutex> ZipFileByteStream::LockArchive() const
+{
+    if ( !bool(_archiveLock) )
+        return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(*_archiveLock);
+}
 ByteStream::size_type ZipFileByteStream::ReadBytes(void *buf, size_type len)
 {
     if (len == 0) return 0;
@@ -796,7 +930,12 @@ ByteStream::size_type ZipFileByteStream::ReadBytes(void *buf, size_type len)
     if ( _file == nullptr )
         return 0;
     
-    ssize_t numRead = zip_fread(_file, buf, len);
+    ssize_t numRead = 0;
+    if ( (_file->flags & ZIP_ZF_DECOMP) != 0 )
+        numRead = InflateBytes(buf, len);
+    else
+        numRead = zip_fread(_file, buf, len);
+    
     if ( numRead < 0 )
     {
         Close();
@@ -814,6 +953,9 @@ ByteStream::size_type ZipFileByteStream::WriteBytes(const void *buf, size_type l
 }
 ByteStream::size_type ZipFileByteStream::Seek(size_type by, std::ios::seekdir dir)
 {
+    if ( _file == nullptr )
+        return 0;
+    
     int whence = ZIP_SEEK_SET;
     switch (dir)
     {
@@ -829,7 +971,22 @@ ByteStream::size_type ZipFileByteStream::Seek(size_type by, std::ios::seekdir di
             return Position();
     }
     
-    zip_fseek(_file, long(by), whence);
+    if ( (_file->flags & ZIP_ZF_DECOMP) != 0 )
+    {
+        // same arithmetic as zip_fseek(), but resuming from the nearest checkpoint
+        off_t target = off_t(long(by));
+        if ( whence == ZIP_SEEK_CUR )
+            target += _file->file_fpos;
+        else if ( whence == ZIP_SEEK_END )
+            target += _file->za->cdir->entry[_file->file_index].uncomp_size;
+        
+        if ( target >= 0 )
+            SeekInflated(size_type(target));
+    }
+    else
+    {
+        zip_fseek(_file, long(by), whence);
+    }
 	_eof = (_file->bytes_left == 0);
     return Position();
 }
@@ -842,21 +999,415 @@ std::shared_ptr<SeekableByteStream> ZipFileByteStream::Clone() const
 	if (_file == nullptr)
 		return nullptr;
 
-	struct zip_file* newFile = zip_fopen_index(_file->za, _file->file_index, _file->flags);
+	struct zip_file* newFile = nullptr;
+	{
+		auto lock = LockArchive();
+		newFile = zip_fopen_index(_file->za, _file->file_index, _zipFlags);
+	}
 	if (newFile == nullptr)
 		return nullptr;
-    
-    zip_fseek(newFile, Position(), ZIP_SEEK_SET);
 
 	auto result = std::make_shared<ZipFileByteStream>();
 	if (bool(result))
 	{
 		result->_file = newFile;
 		result->_mode = _mode;
+        result->_zipFlags = _zipFlags;
+        result->_inflateIndex = _inflateIndex;
+        result->_archiveLock = _archiveLock;
+        result->Seek(Position(), std::ios::beg);
 	}
 
 	return result;
 }
+int ZipFileByteStream::EntryIndex() const _NOEXCEPT
+{
+    if ( _file == nullptr )
+        return -1;
+    return _file->file_index;
+}
+ssize_t ZipFileByteStream::InflateBytes(void *buf, size_type len)
+{
+    // this follows the logic of zip_fread(), but uses Z_BLOCK so we see every
+    // deflate block boundary, and therefore every opportunity for a checkpoint
+    struct zip_file* zf = _file;
+    if ( zf->error.zip_err != 0 )
+        return -1;
+    if ( (zf->flags & ZIP_ZF_EOF) != 0 || len == 0 )
+        return 0;
+    
+    if ( zf->bytes_left == 0 )
+    {
+        zf->flags |= ZIP_ZF_EOF;
+        if ( (zf->flags & ZIP_ZF_CRC) != 0 && zf->crc != zf->crc_orig )
+        {
+            _zip_error_set(&zf->error, ZIP_ER_CRC, 0);
+            return -1;
+        }
+        return 0;
+    }
+    
+    // never produce more than the central directory says we have
+    len = std::min(len, size_type(zf->bytes_left));
+    
+    z_stream* zstr = zf->zstr;
+    zstr->next_out = reinterpret_cast<Bytef*>(buf);
+    zstr->avail_out = static_cast<uInt>(len);
+    
+    while ( zstr->avail_out > 0 )
+    {
+        if ( zstr->avail_in == 0 )
+        {
+            int numRead = _zip_file_fillbuf(zf->buffer, BUFSIZE, zf);
+            if ( numRead < 0 )
+                return -1;      // error already set
+            if ( numRead == 0 )
+            {
+                _zip_error_set(&zf->error, ZIP_ER_INCONS, 0);
+                return -1;
+            }
+            
+            zstr->next_in = reinterpret_cast<Bytef*>(zf->buffer);
+            zstr->avail_in = numRead;
+        }
+        
+        int ret = inflate(zstr, Z_BLOCK);
+        if ( ret == Z_STREAM_END )
+            break;
+        if ( ret != Z_OK )
+        {
+            _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
+            return -1;
+        }
+        
+        // bit 7 set: stopped at the end of a block; bit 6 set: that was the last block
+        if ( (zstr->data_type & 128) != 0 && (zstr->data_type & 64) == 0 )
+            RecordCheckpoint(size_type(zf->file_fpos) + (len - zstr->avail_out));
+    }
+    
+    size_type numInflated = len - zstr->avail_out;
+    if ( numInflated == 0 )
+    {
+        // the deflate stream ended before the central directory said it would
+        _zip_error_set(&zf->error, ZIP_ER_INCONS, 0);
+        return -1;
+    }
+    
+    if ( (zf->flags & ZIP_ZF_CRC) != 0 )
+        zf->crc = crc32(zf->crc, reinterpret_cast<Bytef*>(buf), static_cast<uInt>(numInflated));
+    zf->bytes_left -= static_cast<unsigned long>(numInflated);
+    zf->file_fpos += static_cast<off_t>(numInflated);
+    
+    return static_cast<ssize_t>(numInflated);
+}
+void ZipFileByteStream::RecordCheckpoint(size_type uncompressedOffset)
+{
+    if ( !bool(_inflateIndex) )
+        return;
+    
+    struct zip_file* zf = _file;
+    z_stream* zstr = zf->zstr;
+    
+    if ( (zstr->data_type & 7) != 0 && zstr->next_in == reinterpret_cast<Bytef*>(zf->buffer) )
+        return;     // the partially-consumed byte is no longer in our buffer; try the next block
+    
+    _inflateIndex->RecordCheckpoint(zstr, uncompressedOffset, size_type(zf->fpos) - zstr->avail_in,
+                                    size_type(zf->cbytes_left) + zstr->avail_in);
+}
+bool ZipFileByteStream::RestartInflate(const ZipInflateIndex::Checkpoint *checkpoint)
+{
+    struct zip_file* zf = _file;
+    z_stream* zstr = zf->zstr;
+    struct zip_dirent* entry = &zf->za->cdir->entry[zf->file_index];
+    
+    int ret = ZipInflateIndex::ResumeInflater(zstr, checkpoint);
+    if ( ret != Z_OK )
+    {
+        _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
+        return false;
+    }
+    
+    zstr->next_in = reinterpret_cast<Bytef*>(zf->buffer);
+    zstr->avail_in = 0;
+    zf->flags &= ~ZIP_ZF_EOF;
+    
+    if ( checkpoint != nullptr )
+    {
+        zf->fpos = off_t(checkpoint->archiveOffset);
+        zf->cbytes_left = static_cast<unsigned long>(checkpoint->compressedRemaining);
+        zf->bytes_left = static_cast<unsigned long>(entry->uncomp_size - checkpoint->uncompressedOffset);
+        zf->file_fpos = off_t(checkpoint->uncompressedOffset);
+        
+        // we won't see all the data, so we can't verify its checksum
+        zf->flags &= ~ZIP_ZF_CRC;
+    }
+    else
+    {
+        zf->fpos = zf->data_fpos;
+        zf->cbytes_left = entry->comp_size;
+        zf->bytes_left = entry->uncomp_size;
+        zf->file_fpos = 0;
+        zf->crc = crc32(0L, Z_NULL, 0);
+        zf->flags |= ZIP_ZF_CRC;
+    }
+    
+    return true;
+}
+bool ZipFileByteStream::SeekInflated(size_type pos)
+{
+    struct zip_file* zf = _file;
+    if ( zf->error.zip_err != 0 )
+        return false;
+    
+    size_type current = size_type(zf->file_fpos);
+    if ( pos == current )
+        return true;
+    
+    size_type length = zf->za->cdir->entry[zf->file_index].uncomp_size;
+    if ( pos >= length )
+    {
+        // simple case -- set EOF
+        zf->flags |= ZIP_ZF_EOF;
+        zf->bytes_left = 0;
+        zf->file_fpos = off_t(pos);
+        return true;
+    }
+    
+    ZipInflateIndex::CheckpointPtr checkpoint;
+    if ( bool(_inflateIndex) )
+        checkpoint = _inflateIndex->CheckpointBefore(pos);
+    
+    // only go back if we must, or if a checkpoint would let us skip ahead
+    bool movingForward = (pos > current && current < length);
+    if ( !movingForward || (bool(checkpoint) && checkpoint->uncompressedOffset > current) )
+    {
+        if ( !RestartInflate(checkpoint.get()) )
+            return false;
+    }
+    
+    uint8_t scratch[16*1024];
+    while ( size_type(zf->file_fpos) < pos )
+    {
+        size_type toSkip = std::min(sizeof(scratch), pos - size_type(zf->file_fpos));
+        if ( InflateBytes(scratch, toSkip) <= 0 )
+            return false;
+    }
+    
+    return true;
+}
+
+MappedZipFileByteStream::MappedZipFileByteStream(std::shared_ptr<const uint8_t> archiveData, size_type dataOffset, size_type compressedSize, size_type uncompressedSize, int method, uint32_t crc)
+  : SeekableByteStream(),
+    _archive(archiveData),
+    _dataOffset(dataOffset),
+    _compressedSize(compressedSize),
+    _size(uncompressedSize),
+    _method(method),
+    _expectedCRC(crc),
+    _position(0),
+    _crc(static_cast<uint32_t>(crc32(0L, Z_NULL, 0))),
+    _crcOffset(0),
+    _zstr(nullptr),
+    _inflatedOffset(0),
+    _inflateIndex()
+{
+}
+MappedZipFileByteStream::~MappedZipFileByteStream()
+{
+    Close();
+}
+ByteStream::size_type MappedZipFileByteStream::BytesAvailable() _NOEXCEPT
+{
+    if ( !IsOpen() || _position >= _size )
+        return 0;
+    return _size - _position;
+}
+void MappedZipFileByteStream::Close()
+{
+    if ( _zstr != nullptr )
+    {
+        inflateEnd(_zstr);
+        delete _zstr;
+        _zstr = nullptr;
+    }
+    _archive.reset();
+}
+ByteStream::size_type MappedZipFileByteStream::ReadBytes(void *buf, size_type len)
+{
+    if ( !IsOpen() || len == 0 || _position >= _size )
+        return 0;
+    
+    len = std::min(len, _size - _position);
+    if ( _method == ZIP_CM_STORE )
+    {
+        ::memcpy(buf, _archive.get() + _dataOffset + _position, len);
+    }
+    else
+    {
+        if ( _inflatedOffset != _position && !SeekInflated(_position) )
+        {
+            Close();
+            return 0;
+        }
+        
+        ssize_t numInflated = InflateBytes(buf, len);
+        if ( numInflated <= 0 )
+        {
+            Close();
+            return 0;
+        }
+        len = size_type(numInflated);
+    }
+    
+    if ( !UpdateCRC(_position, buf, len) )
+    {
+        Close();
+        return 0;
+    }
+    
+    _position += len;
+    _eof = (_position >= _size);
+    return len;
+}
+ByteStream::size_type MappedZipFileByteStream::Seek(size_type by, std::ios::seekdir dir)
+{
+    if ( !IsOpen() )
+        return 0;
+    
+    // inflation is deferred until the next read, so seeking is just arithmetic
+    off_t target = off_t(long(by));
+    switch ( dir )
+    {
+        case std::ios::beg:
+            break;
+        case std::ios::cur:
+            target += off_t(_position);
+            break;
+        case std::ios::end:
+            target += off_t(_size);
+            break;
+        default:
+            return _position;
+    }
+    
+    if ( target >= 0 )
+        _position = std::min(size_type(target), _size);
+    _eof = (_position >= _size);
+    return _position;
+}
+std::shared_ptr<SeekableByteStream> MappedZipFileByteStream::Clone() const
+{
+    if ( !IsOpen() )
+        return nullptr;
+    
+    auto result = std::make_shared<MappedZipFileByteStream>(_archive, _dataOffset, _compressedSize, _size, _method, _expectedCRC);
+    result->_inflateIndex = _inflateIndex;
+    result->_position = _position;
+    return result;
+}
+ByteView MappedZipFileByteStream::ReadView(size_type offset, size_type len)
+{
+    if ( !IsOpen() || _method != ZIP_CM_STORE )
+        return ByteView();
+    return ByteView(_archive.get() + _dataOffset, _size).subview(offset, len);
+}
+bool MappedZipFileByteStream::UpdateCRC(size_type offset, const void *buf, size_type len)
+{
+    // the checksum can only be verified if every byte is seen in order, as with a
+    // straight read from the start; anything read out of order is skipped
+    if ( offset != _crcOffset )
+        return true;
+    
+    _crc = static_cast<uint32_t>(crc32(_crc, reinterpret_cast<const Bytef*>(buf), static_cast<uInt>(len)));
+    _crcOffset += len;
+    return (_crcOffset < _size || _crc == _expectedCRC);
+}
+ssize_t MappedZipFileByteStream::InflateBytes(void *buf, size_type len)
+{
+    const Bytef* start = reinterpret_cast<const Bytef*>(_archive.get() + _dataOffset);
+    if ( _zstr == nullptr && !SeekInflated(0) )
+        return -1;
+    
+    z_stream* zstr = _zstr;
+    zstr->next_out = reinterpret_cast<Bytef*>(buf);
+    zstr->avail_out = static_cast<uInt>(len);
+    
+    while ( zstr->avail_out > 0 )
+    {
+        if ( zstr->avail_in == 0 )
+        {
+            // the whole file is available, but avail_in is only 32 bits wide
+            size_type consumed = size_type(zstr->next_in - start);
+            if ( consumed >= _compressedSize )
+                return -1;
+            zstr->avail_in = static_cast<uInt>(std::min(_compressedSize - consumed, size_type(UINT_MAX)));
+        }
+        
+        int ret = inflate(zstr, Z_BLOCK);
+        if ( ret == Z_STREAM_END )
+            break;
+        if ( ret != Z_OK )
+            return -1;
+        
+        // bit 7 set: stopped at the end of a block; bit 6 set: that was the last block
+        if ( bool(_inflateIndex) && (zstr->data_type & 128) != 0 && (zstr->data_type & 64) == 0 )
+        {
+            size_type archiveOffset = size_type(zstr->next_in - reinterpret_cast<const Bytef*>(_archive.get()));
+            _inflateIndex->RecordCheckpoint(zstr, _inflatedOffset + (len - zstr->avail_out), archiveOffset,
+                                            _dataOffset + _compressedSize - archiveOffset);
+        }
+    }
+    
+    size_type numInflated = len - zstr->avail_out;
+    _inflatedOffset += numInflated;
+    return (numInflated == 0 ? -1 : static_cast<ssize_t>(numInflated));
+}
+bool MappedZipFileByteStream::SeekInflated(size_type pos)
+{
+    ZipInflateIndex::CheckpointPtr checkpoint;
+    if ( bool(_inflateIndex) )
+        checkpoint = _inflateIndex->CheckpointBefore(pos);
+    
+    // only go back if we must, or if a checkpoint would let us skip ahead
+    bool restart = (_zstr == nullptr || pos < _inflatedOffset ||
+                    (bool(checkpoint) && checkpoint->uncompressedOffset > _inflatedOffset));
+    if ( restart )
+    {
+        if ( _zstr == nullptr )
+        {
+            _zstr = new z_stream;
+            ::memset(_zstr, 0, sizeof(z_stream));
+            
+            // negative value to tell zlib that there is no header
+            if ( inflateInit2(_zstr, -MAX_WBITS) != Z_OK )
+            {
+                delete _zstr;
+                _zstr = nullptr;
+                return false;
+            }
+        }
+        
+        if ( ZipInflateIndex::ResumeInflater(_zstr, checkpoint.get()) != Z_OK )
+            return false;
+        
+        size_type archiveOffset = (bool(checkpoint) ? checkpoint->archiveOffset : _dataOffset);
+        _zstr->next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(_archive.get() + archiveOffset));
+        _zstr->avail_in = 0;
+        _inflatedOffset = (bool(checkpoint) ? checkpoint->uncompressedOffset : 0);
+    }
+    
+    uint8_t scratch[16*1024];
+    while ( _inflatedOffset < pos )
+    {
+        size_type offset = _inflatedOffset;
+        size_type toSkip = std::min(sizeof(scratch), pos - offset);
+        ssize_t numInflated = InflateBytes(scratch, toSkip);
+        if ( numInflated <= 0 || !UpdateCRC(offset, scratch, size_type(numInflated)) )
+            return false;
+    }
+    
+    return true;
+}
 
 #ifdef SUPPORT_ASYNC
 #if 0
@@ -940,6 +1491,14 @@ bool AsyncZipFileByteStream::Open(struct zip *archive, const string &path, int f
     __A::Open(std::ios::in|std::ios::out);
     return true;
 }
+bool AsyncZipFileByteStream::Open(struct zip *archive, int index, int flags)
+{
+    if ( __F::Open(archive, index, flags) == false )
+        return false;
+    
+    __A::Open(std::ios::in|std::ios::out);
+    return true;
+}
 void AsyncZipFileByteStream::Close()
 {
     __A::Close();
@@ -951,7 +1510,11 @@ std::shared_ptr<SeekableByteStream> AsyncZipFileByteStream::Clone() const
 		return nullptr;
 
 
-	struct zip_file* newFile = zip_fopen_index(_file->za, _file->file_index, _file->flags);
+	struct zip_file* newFile = nullptr;
+	{
+		auto lock = LockArchive();
+		newFile = zip_fopen_index(_file->za, _file->file_index, _zipFlags);
+	}
 	if (newFile == nullptr)
 		return nullptr;
 
@@ -960,6 +1523,9 @@ std::shared_ptr<SeekableByteStream> AsyncZipFileByteStream::Clone() const
 	{
 		result->_file = newFile;
 		result->_mode = _mode;
+        result->_zipFlags = _zipFlags;
+        result->_inflateIndex = _inflateIndex;
+        result->_archiveLock = _archiveLock;
 	}
 
 	return result;
@@ -31,9 +31,14 @@
 #define __ePub3__byte_stream__
 
 #include <ePub3/epub3.h>
+#include <ePub3/utilities/byte_buffer.h>
 #include <ePub3/utilities/ring_buffer.h>
+#include <algorithm>
 #include <functional>
 #include <ios>
+#include <mutex>
+#include <vector>
+#include <zlib.h>
 
 #if FUTURE_ENABLED
 #include <thread>
@@ -76,6 +81,57 @@ static string Sanitized(const string& path)
 }
 
     /**
+ A read-only view of a range of bytes owned by some other object.
+ 
+ A ByteView does not own or copy the bytes it refers to; see the documentation of
+ whatever returned it to find out how long they remain valid.
+ @ingroup utilities
+ */
+class ByteView
+{
+public:
+    typedef std::size_t             size_type;
+    typedef const uint8_t*          const_iterator;
+    
+public:
+                            ByteView()                                      : _data(nullptr), _size(0) {}
+                            ByteView(const uint8_t* data, size_type size)   : _data(data), _size(data == nullptr ? 0 : size) {}
+                            ByteView(const ByteView& o)                     : _data(o._data), _size(o._size) {}
+                            ~ByteView() {}
+    
+    ByteView&               operator=(const ByteView& o)                    { _data = o._data; _size = o._size; return *this; }
+    
+    ///
+    /// The first byte of the view, or `nullptr` if it is empty.
+    const uint8_t*          data()                                  const _NOEXCEPT { return _data; }
+    ///
+    /// The number of bytes in the view.
+    size_type               size()                                  const _NOEXCEPT { return _size; }
+    ///
+    /// Returns `true` if the view contains no bytes.
+    bool                    empty()                                 const _NOEXCEPT { return _size == 0; }
+    
+    const_iterator          begin()                                 const _NOEXCEPT { return _data; }
+    const_iterator          end()                                   const _NOEXCEPT { return _data + _size; }
+    
+    uint8_t                 operator[](size_type i)                 const           { return _data[i]; }
+    
+    ///
+    /// Returns a view of part of this view, clamped to its bounds.
+    ByteView                subview(size_type offset, size_type len) const _NOEXCEPT
+        {
+            if ( offset >= _size )
+                return ByteView();
+            return ByteView(_data + offset, std::min(len, _size - offset));
+        }
+    
+protected:
+    const uint8_t*          _data;
+    size_type               _size;
+    
+};
+
+/**
  The abstract base class for all stream and pipe objects used by the Readium SDK.
  
  This class declares the standard interface for a stream-- that is, an object to
@@ -137,44 +193,43 @@ public:
      @result Returns the number of bytes actually copied into `buf`.
      */
     virtual size_type       ReadBytes(void* buf, size_type len)                     = 0;
+    
+    /**
+     Obtain direct access to some of the stream's data, without copying it.
+     
+     Streams which hold their content in memory (for example an uncompressed item
+     in a memory-mapped archive, or fully-filtered content) can return a view of it
+     directly. Other streams return an empty view, and the caller should use
+     ReadBytes() instead.
+     
+     The stream's read position is not affected. The returned bytes remain valid
+     until the stream is closed or destroyed.
+     @param offset The offset of the first byte required, from the start of the
+     stream's content.
+     @param len The number of bytes required.
+     @result A view of up to `len` bytes at `offset`, or an empty view if the stream
+     doesn't support direct access or `offset` is beyond the end of the data.
+     */
+    virtual ByteView        ReadView(size_type offset, size_type len)                { return ByteView(); }
+	
+    /**
+     Read all remaining data from the stream.
+     
+     If the stream can report how much data remains (see BytesAvailable()), the
+     result is allocated once at that size. Otherwise its storage grows
+     geometrically as data arrives.
+     @result A buffer containing every byte read.
+     */
+    virtual ByteBuffer      ReadAllBytes();
 	
 	/**
 	 Read all data from the stream.
-	 @param buf A pointer to a buffer which will be allocated
+	 @param buf A pointer to a buffer which will be allocated using `malloc()`.
+	 The caller is responsible for calling `free()` on it.
 	 @result Returns the number of bytes copied into `buf`.
+	 @deprecated Use ReadAllBytes(), which returns an owning ByteBuffer.
 	 */
-	virtual size_type       ReadAllBytes(void** buf)
-	{
-        unsigned char* resbuf = nullptr;
-        unsigned char* temp;
-        size_t resbuflen = 0;
-        
-        unsigned char rdbuf [4096] = {0};
-        size_t rdbuflen = 4096;
-        std::size_t count = this->ReadBytes(rdbuf, rdbuflen);
-        if(count)
-        {
-            resbuf = (unsigned char*)malloc(count);
-            memcpy(resbuf, rdbuf, count);
-            resbuflen = count;
-        }
-        while(count)
-        {
-            count = this->ReadBytes(rdbuf, rdbuflen);
-            
-            temp = (unsigned char*)malloc(count + resbuflen);
-            memcpy(temp, resbuf, resbuflen);
-            free(resbuf);
-            resbuf = temp;
-            memcpy(resbuf+resbuflen, rdbuf, count);
-            resbuflen += count;
-        }
-		
-		if (resbuflen > 0)
-			*buf = resbuf;
-		
-		return resbuflen;
-	}
+	virtual size_type       ReadAllBytes(void** buf);
 	
     /**
      Write some data to the stream.
@@ -604,8 +659,113 @@ protected:
 	std::ios::openmode		_mode;	///< The mode used to open the file (used by Clone()).
 };
 
+/**
+ A random-access index into a single deflated file within a Zip archive.
+
+ A deflate stream can only be decoded from its beginning, so seeking backwards
+ within a compressed file would otherwise mean inflating everything up to the
+ target offset all over again. As a ZipFileByteStream inflates data it records a
+ checkpoint at a deflate block boundary roughly every Span() bytes of output: the
+ location of the next compressed byte, any unused bits of the preceding byte, and
+ the 32KiB window needed to resume decompression from that point. A seek then
+ resumes from the nearest checkpoint preceding its target. This is the technique
+ used by the `zran.c` example which ships with zlib.
+
+ A single index is shared by every stream reading the same file, including those
+ created through ZipFileByteStream::Clone(), and may be used from multiple threads.
+ @ingroup utilities
+ */
+class ZipInflateIndex
+{
+public:
+    typedef ByteStream::size_type   size_type;
+
+    ///
+    /// The default distance between checkpoints, in uncompressed bytes.
+    static const size_type          DefaultSpan = 1024*1024;
+
+    ///
+    /// The state required to resume inflating from a given point.
+    struct Checkpoint
+    {
+        size_type               uncompressedOffset;     ///< The offset within the inflated data.
+        size_type               archiveOffset;          ///< The offset within the archive of the next compressed byte.
+        size_type               compressedRemaining;    ///< The number of compressed bytes from `archiveOffset` to the end of the file.
+        int                     bits;                   ///< The number of unused bits (0-7) in the byte preceding `archiveOffset`.
+        uint8_t                 partialByte;            ///< The byte preceding `archiveOffset`, if `bits` is non-zero.
+        std::vector<uint8_t>    window;                 ///< The inflate dictionary (up to 32KiB) at this point.
+    };
+    typedef std::shared_ptr<const Checkpoint>   CheckpointPtr;
+
+public:
+    EPUB3_EXPORT            ZipInflateIndex(size_type span=DefaultSpan) : _span(span), _checkpoints() {}
+                            ~ZipInflateIndex() {}
+
+private:
+                            ZipInflateIndex(const ZipInflateIndex&)             _DELETED_;
+                            ZipInflateIndex(ZipInflateIndex&&)                  _DELETED_;
+    ZipInflateIndex&        operator=(const ZipInflateIndex&)                   _DELETED_;
+    ZipInflateIndex&        operator=(ZipInflateIndex&&)                        _DELETED_;
+
+public:
+    ///
+    /// The distance between checkpoints, in uncompressed bytes.
+    size_type               Span()                                  const _NOEXCEPT { return _span; }
+    ///
+    /// The number of checkpoints recorded so far.
+    size_type               Count()                                 const;
+
+    ///
+    /// Whether a checkpoint at the given uncompressed offset would extend the index.
+    bool                    WantsCheckpointAt(size_type offset)     const;
+    /**
+     Adds a checkpoint to the index.
+
+     Checkpoints are only ever appended, so a checkpoint which does not lie at least
+     Span() bytes beyond the last one recorded (perhaps because another stream got
+     there first) is silently dropped.
+     */
+    void                    AddCheckpoint(CheckpointPtr checkpoint);
+    ///
+    /// Returns the last checkpoint at or before the given offset, or `nullptr`.
+    CheckpointPtr           CheckpointBefore(size_type offset)      const;
+
+    /**
+     Records a checkpoint for an inflater which has just stopped at a block boundary.
+
+     Does nothing if the index doesn't want a checkpoint at this offset. The caller
+     must ensure that, if the inflater has unused bits, the byte before `next_in`
+     is still valid.
+     @param zstr The inflater, stopped by `inflate(..., Z_BLOCK)` at the end of a
+     block.
+     @param uncompressedOffset The offset of the next byte the inflater will produce.
+     @param archiveOffset The offset within the archive of `zstr->next_in`.
+     @param compressedRemaining The number of compressed bytes from `archiveOffset`
+     to the end of the file.
+     */
+    void                    RecordCheckpoint(z_stream* zstr, size_type uncompressedOffset,
+                                             size_type archiveOffset, size_type compressedRemaining);
+    /**
+     Resets an inflater to resume from a checkpoint, or from the start of the data.
+     @param zstr The inflater to reset. Its input must then be set to begin at the
+     checkpoint's `archiveOffset`.
+     @param checkpoint The checkpoint, or `nullptr` to start from the beginning.
+     @result A zlib status code.
+     */
+    static int              ResumeInflater(z_stream* zstr, const Checkpoint* checkpoint);
+
+protected:
+    size_type                   _span;          ///< Minimum distance between checkpoints.
+    std::vector<CheckpointPtr>  _checkpoints;   ///< Checkpoints, in order of uncompressed offset.
+    mutable std::mutex          _lock;          ///< Guards `_checkpoints`.
+
+};
+
 /**
  A concrete ByteStream providing access to a file within a Zip archive.
+
+ Seeking within a deflated file makes use of a ZipInflateIndex, if one has been
+ attached using SetInflateIndex().
  @ingroup utilities
  */
 class ZipFileByteStream : public SeekableByteStream
@@ -613,7 +773,7 @@ class ZipFileByteStream : public SeekableByteStream
 public:
     ///
     /// Create a new unattached stream.
-                            ZipFileByteStream() : SeekableByteStream(), _file(nullptr) {}
+                            ZipFileByteStream() : SeekableByteStream(), _file(nullptr), _zipFlags(0) {}
     /**
      Create a new stream to a file within a zip archive.
      @param archive The Zip arrchive containing the target file.
@@ -648,6 +808,14 @@ public:
      @result Returns `true` if the file opened successfully, `false` otherwise.
      */
     virtual bool            Open(struct zip* archive, const string& path, int zipFlags=0);
+    /**
+     Opens a file within an archive by its index and attaches the stream.
+     @param archive The Zip arrchive containing the target file.
+     @param index The index of the target file within the archive.
+     @param zipFlags Flags such as whether to read the raw compressed data.
+     @result Returns `true` if the file opened successfully, `false` otherwise.
+     */
+    virtual bool            Open(struct zip* archive, int index, int zipFlags=0);
     ///
     /// @copydoc ByteStream::Close()
     virtual void            Close();
@@ -682,11 +850,166 @@ public:
 	@result A new FileByteStream instance.
 	*/
 	virtual std::shared_ptr<SeekableByteStream> Clone() const OVERRIDE;
+
+    ///
+    /// The index of the open file within its archive, or -1 if not open.
+    int                     EntryIndex()                            const _NOEXCEPT;
+
+    ///
+    /// The seek index in use by this stream, if any.
+    std::shared_ptr<ZipInflateIndex> InflateIndex()                 const _NOEXCEPT { return _inflateIndex; }
+    /**
+     Attaches a seek index to this stream.
+
+     The index must belong to the same file within the same archive. It has no
+     effect on files which are stored uncompressed, or opened to read raw compressed
+     data.
+     */
+    void                    SetInflateIndex(std::shared_ptr<ZipInflateIndex> index) _NOEXCEPT { _inflateIndex = index; }
     
+    /**
+     Sets a lock to hold while opening or closing files within the archive.
+     
+     Reading uses positional I/O and needs no lock, but opening and closing a file
+     updates state shared by the whole archive. Streams used concurrently on the
+     same archive must share a lock, which is inherited by Clone().
+     */
+    void                    SetArchiveLock(std::shared_ptr<std::mutex> lock) _NOEXCEPT { _archiveLock = lock; }
+
 protected:
     struct zip_file*        _file;      ///< The underlying Zip file stream.
 	std::ios::openmode		_mode;		///< The mode used to open the file (used by Clone()).
+    int                     _zipFlags;  ///< The flags used to open the file (used by Clone()).
+    std::shared_ptr<ZipInflateIndex>    _inflateIndex;  ///< Checkpoints for seeking within deflated data.
+    std::shared_ptr<std::mutex>         _archiveLock;   ///< Guards opening/closing files in a shared archive.
+    
+    ///
+    /// Acquires the archive lock, if any.
+    std::unique_lock<std::mutex> LockArchive()                      const;
+
+    ///
+    /// Inflates data into a buffer, recording checkpoints in the seek index as it goes.
+    ssize_t                 InflateBytes(void* buf, size_type len);
+    ///
+    /// Moves to a position within the inflated data, using the seek index if possible.
+    bool                    SeekInflated(size_type pos);
+    ///
+    /// Resets the decompressor to resume from a checkpoint, or from the start of the file.
+    bool                    RestartInflate(const ZipInflateIndex::Checkpoint* checkpoint);
+    ///
+    /// Records a checkpoint at the current (block-aligned) decompressor state, if required.
+    void                    RecordCheckpoint(size_type uncompressedOffset);
+
+};
 
+/**
+ A concrete SeekableByteStream subclass providing access to a file within a Zip
+ archive which is held in memory, typically by mapping the archive file.
+ 
+ Stored files are copied directly from the archive's memory, and deflated files are
+ inflated directly from it, without any intermediate buffering or file I/O. Seeking
+ within a deflated file makes use of a ZipInflateIndex, if one has been attached.
+ 
+ The stream keeps the archive's memory alive until it is closed.
+ @ingroup utilities
+ */
+class MappedZipFileByteStream : public SeekableByteStream
+{
+public:
+    /**
+     Create a new stream to a file within a Zip archive in memory.
+     @param archiveData The start of the archive's data.
+     @param dataOffset The offset of the file's (possibly compressed) data.
+     @param compressedSize The size of the file's data within the archive.
+     @param uncompressedSize The size of the file once inflated.
+     @param method The compression method: `ZIP_CM_STORE` or `ZIP_CM_DEFLATE`.
+     @param crc The CRC-32 of the uncompressed file, as recorded in the archive.
+     */
+    EPUB3_EXPORT            MappedZipFileByteStream(std::shared_ptr<const uint8_t> archiveData, size_type dataOffset,
+                                                    size_type compressedSize, size_type uncompressedSize,
+                                                    int method, uint32_t crc);
+    virtual                 ~MappedZipFileByteStream();
+    
+private:
+                            MappedZipFileByteStream(const MappedZipFileByteStream&)     _DELETED_;
+                            MappedZipFileByteStream(MappedZipFileByteStream&&)          _DELETED_;
+    MappedZipFileByteStream& operator=(const MappedZipFileByteStream&)                  _DELETED_;
+    MappedZipFileByteStream& operator=(MappedZipFileByteStream&&)                       _DELETED_;
+    
+public:
+    ///
+    /// @copydoc ByteStream::BytesAvailable()
+    virtual size_type       BytesAvailable()                        _NOEXCEPT;
+    ///
+    /// @copydoc ByteStream::SpaceAvailable
+    virtual size_type       SpaceAvailable()                        const _NOEXCEPT { return 0; }
+    
+    ///
+    /// @copydoc ByteStream::IsOpen()
+    virtual bool            IsOpen()                                const _NOEXCEPT { return bool(_archive); }
+    ///
+    /// @copydoc ByteStream::Close()
+    virtual void            Close();
+    
+    ///
+    /// @copydoc ByteStream::ReadBytes()
+    virtual size_type       ReadBytes(void* buf, size_type len);
+    ///
+    /// @copydoc ByteStream::WriteBytes()
+    virtual size_type       WriteBytes(const void* buf, size_type len)      { return 0; }
+    
+    ///
+    /// @copydoc ZipFileByteStream::Seek()
+    virtual size_type       Seek(size_type by, std::ios::seekdir dir) OVERRIDE;
+    ///
+    /// @copydoc ZipFileByteStream::Position()
+    virtual size_type       Position()                              const OVERRIDE  { return _position; }
+    ///
+    /// @copydoc ZipFileByteStream::Clone()
+    virtual std::shared_ptr<SeekableByteStream> Clone()             const OVERRIDE;
+    
+    /**
+     Obtain direct access to the data of a stored (uncompressed) file.
+     
+     The view points into the archive's mapped memory, and remains valid until this
+     stream is closed or destroyed. Deflated files return an empty view.
+     @see ByteStream::ReadView()
+     */
+    virtual ByteView        ReadView(size_type offset, size_type len)       OVERRIDE;
+    
+    ///
+    /// The seek index in use by this stream, if any.
+    std::shared_ptr<ZipInflateIndex> InflateIndex()                 const _NOEXCEPT { return _inflateIndex; }
+    ///
+    /// @copydoc ZipFileByteStream::SetInflateIndex()
+    void                    SetInflateIndex(std::shared_ptr<ZipInflateIndex> index) _NOEXCEPT { _inflateIndex = index; }
+    
+protected:
+    std::shared_ptr<const uint8_t>  _archive;           ///< The archive's data; `nullptr` once closed.
+    size_type                       _dataOffset;        ///< Offset of the file's data within the archive.
+    size_type                       _compressedSize;    ///< Size of the file's data within the archive.
+    size_type                       _size;              ///< Size of the uncompressed file.
+    int                             _method;            ///< The compression method.
+    uint32_t                        _expectedCRC;       ///< The checksum recorded in the archive.
+    size_type                       _position;          ///< The current read position.
+    
+    uint32_t                        _crc;               ///< Checksum of all bytes up to `_crcOffset`.
+    size_type                       _crcOffset;         ///< The amount of data verified so far.
+    
+    z_stream*                       _zstr;              ///< The inflater, created on first read.
+    size_type                       _inflatedOffset;    ///< Offset of the next byte the inflater will produce.
+    std::shared_ptr<ZipInflateIndex>    _inflateIndex;  ///< Checkpoints for seeking within deflated data.
+    
+    ///
+    /// Inflates data at `_inflatedOffset` into a buffer.
+    ssize_t                 InflateBytes(void* buf, size_type len);
+    ///
+    /// Moves the inflater to a position, using the seek index if possible.
+    bool                    SeekInflated(size_type pos);
+    ///
+    /// Adds newly-read data to the running checksum, and validates it at the end of the file.
+    bool                    UpdateCRC(size_type offset, const void* buf, size_type len);
+    
 };
 
 #ifdef SUPPORT_ASYNC
@@ -832,6 +1155,9 @@ public:
     /// @copydoc ZipFileByteStream::Open()
     virtual bool            Open(struct zip* archive, const string& path, int zipFlags=0) OVERRIDE;
     ///
+    /// @copydoc ZipFileByteStream::Open(struct zip*,int,int)
+    virtual bool            Open(struct zip* archive, int index, int zipFlags=0) OVERRIDE;
+    ///
     /// @copydoc ByteStream::Close()
 	virtual void            Close();
 
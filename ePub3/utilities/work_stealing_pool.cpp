@@ -0,0 +1,157 @@
+//
+//  work_stealing_pool.cpp
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, 
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this 
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, 
+//  this list of conditions and the following disclaimer in the documentation and/or 
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be 
+//  used to endorse or promote products derived from this software without specific 
+//  prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "work_stealing_pool.h"
+#include <algorithm>
+
+EPUB3_BEGIN_NAMESPACE
+
+WorkStealingPool::WorkStealingPool(size_t numThreads) : _workers(), _next(0), _pending(0), _sleepLock(), _wake(), _exiting(false)
+{
+    if ( numThreads == 0 )
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    
+    // the workers wait for this lock before starting, so they all see each other's ids
+    std::lock_guard<std::mutex> _(_sleepLock);
+    for ( size_t i = 0; i < numThreads; i++ )
+    {
+        _workers.emplace_back(new Worker);
+        _workers.back()->thread = std::thread(&WorkStealingPool::Run, this, i);
+        _workers.back()->id = _workers.back()->thread.get_id();
+    }
+}
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> _(_sleepLock);
+        _exiting = true;
+    }
+    _wake.notify_all();
+    
+    for ( auto& worker : _workers )
+    {
+        if ( worker->thread.joinable() )
+            worker->thread.join();
+    }
+}
+void WorkStealingPool::Add(Task task)
+{
+    size_t index = CurrentWorker();
+    if ( index == NoWorker )
+        index = _next++ % _workers.size();
+    
+    // counted first, so a worker which finds the count raised keeps looking until the task appears
+    ++_pending;
+    {
+        Worker& worker = *_workers[index];
+        std::lock_guard<std::mutex> _(worker.lock);
+        worker.tasks.push_back(std::move(task));
+    }
+    
+    std::lock_guard<std::mutex> _(_sleepLock);
+    _wake.notify_one();
+}
+WorkStealingPool& WorkStealingPool::Shared()
+{
+    static std::unique_ptr<WorkStealingPool> __shared(nullptr);
+    static std::once_flag __once;
+    std::call_once(__once, []{
+        __shared.reset(new WorkStealingPool);
+    });
+    return *__shared;
+}
+size_t WorkStealingPool::CurrentWorker() const
+{
+    std::thread::id self = std::this_thread::get_id();
+    for ( size_t i = 0; i < _workers.size(); i++ )
+    {
+        if ( _workers[i]->id == self )
+            return i;
+    }
+    return NoWorker;
+}
+bool WorkStealingPool::TakeTask(size_t index, Task& task)
+{
+    {
+        Worker& own = *_workers[index];
+        std::lock_guard<std::mutex> _(own.lock);
+        if ( !own.tasks.empty() )
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --_pending;
+            return true;
+        }
+    }
+    
+    for ( size_t i = 1; i < _workers.size(); i++ )
+    {
+        Worker& victim = *_workers[(index + i) % _workers.size()];
+        std::lock_guard<std::mutex> _(victim.lock);
+        if ( !victim.tasks.empty() )
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --_pending;
+            return true;
+        }
+    }
+    
+    return false;
+}
+void WorkStealingPool::Run(size_t index)
+{
+    {
+        std::lock_guard<std::mutex> _(_sleepLock);
+    }
+    
+    for ( ;; )
+    {
+        Task task;
+        if ( TakeTask(index, task) )
+        {
+            task();
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(_sleepLock);
+        if ( _pending > 0 )
+        {
+            // a task is on its way into a queue
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+        if ( _exiting )
+            return;
+        _wake.wait(lock);
+    }
+}
+
+EPUB3_END_NAMESPACE
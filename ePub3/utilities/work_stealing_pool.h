@@ -0,0 +1,125 @@
+//
+//  work_stealing_pool.h
+//  ePub3
+//
+//  Created by the Readium Foundation on 2026-10-17.
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, 
+//  are permitted provided that the following conditions are met:
+//  1. Redistributions of source code must retain the above copyright notice, this 
+//  list of conditions and the following disclaimer.
+//  2. Redistributions in binary form must reproduce the above copyright notice, 
+//  this list of conditions and the following disclaimer in the documentation and/or 
+//  other materials provided with the distribution.
+//  3. Neither the name of the organization nor the names of its contributors may be 
+//  used to endorse or promote products derived from this software without specific 
+//  prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+//  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+//  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+//  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+//  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+//  OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+//  OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef __ePub3__work_stealing_pool__
+#define __ePub3__work_stealing_pool__
+
+#include <ePub3/epub3.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ A pool of worker threads which balance their load by stealing tasks from one another.
+ 
+ Each worker has its own queue of tasks. A task added from within a worker goes on
+ that worker's queue, where it is run last-in, first-out, while its data is still
+ warm in the cache; tasks added from other threads are spread across the queues in
+ turn. A worker whose queue is empty takes the oldest task from another's.
+ 
+ Tasks are expected to be short, and must not block waiting for one another: a
+ long-running job should be split into tasks which each add the next one when done.
+ Tasks must not throw.
+ 
+ All methods are thread-safe.
+ */
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()>   Task;
+    
+public:
+    /**
+     Creates a pool and starts its workers.
+     @param numThreads The number of workers; zero uses one per hardware thread.
+     */
+    EPUB3_EXPORT explicit   WorkStealingPool(size_t numThreads=0);
+    /**
+     Runs any tasks still queued, then stops the workers.
+     */
+    EPUB3_EXPORT            ~WorkStealingPool();
+    
+    /**
+     Queues a task to run on one of the workers.
+     */
+    EPUB3_EXPORT void       Add(Task task);
+    
+    size_t                  ThreadCount()       const   { return _workers.size(); }
+    
+    ///
+    /// Returns `true` if called from one of this pool's workers.
+    bool                    IsWorkerThread()    const   { return CurrentWorker() != NoWorker; }
+    
+    /**
+     The pool shared by the library, with one worker per hardware thread.
+     
+     It is created on first use.
+     */
+    EPUB3_EXPORT static WorkStealingPool&  Shared();
+    
+private:
+    struct Worker
+    {
+        std::mutex              lock;
+        std::deque<Task>        tasks;      ///< The owner takes from the back, thieves from the front.
+        std::thread             thread;
+        std::thread::id         id;
+    };
+    
+    static const size_t NoWorker = size_t(-1);
+    
+    std::vector<std::unique_ptr<Worker>>    _workers;
+    std::atomic<size_t>     _next;          ///< The queue for the next task added from outside the pool.
+    std::atomic<size_t>     _pending;       ///< The number of queued tasks.
+    std::mutex              _sleepLock;
+    std::condition_variable _wake;
+    bool                    _exiting;
+    
+    ///
+    /// The index of the calling worker, or NoWorker; found by thread id, as thread-local storage isn't available everywhere.
+    size_t                  CurrentWorker()     const;
+    ///
+    /// Takes the newest task from a worker's own queue, or else the oldest from another's.
+    bool                    TakeTask(size_t index, Task& task);
+    void                    Run(size_t index);
+    
+    WorkStealingPool(const WorkStealingPool&)               _DELETED_;
+    WorkStealingPool&       operator=(const WorkStealingPool&)  _DELETED_;
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__work_stealing_pool__) */
@@ -129,6 +129,9 @@ Document::Document(std::shared_ptr<Element> rootElement) : Node(reinterpret_cast
 }
 Document::~Document()
 {
+    for ( auto& item : _xpathContexts )
+        xmlXPathFreeContext(item.second);
+    
     xmlDocPtr doc = xml();
     Unwrap(_xml);
     _xml = nullptr;
@@ -215,6 +218,32 @@ void Document::DeclareEntity(const string &name, EntityType type, const string &
     if ( xmlAddDocEntity(xml(), name.utf8(), static_cast<int>(type), publicID.utf8(), systemID.utf8(), value.utf8()) == nullptr )
         throw InternalError(std::string("Unable to add entity declaration for ") + name.c_str());
 }
+xmlXPathContextPtr Document::AcquireXPathContext(const std::string & key, bool * created) const
+{
+    {
+        std::lock_guard<std::mutex> _(_xpathLock);
+        auto pos = _xpathContexts.find(key);
+        if ( pos != _xpathContexts.end() )
+        {
+            xmlXPathContextPtr ctx = pos->second;
+            _xpathContexts.erase(pos);
+            *created = false;
+            return ctx;
+        }
+    }
+    
+    *created = true;
+    return xmlXPathNewContext(const_cast<xmlDocPtr>(xml()));
+}
+void Document::RelinquishXPathContext(const std::string & key, xmlXPathContextPtr ctx) const
+{
+    if ( ctx == nullptr )
+        return;
+    
+    ctx->node = nullptr;
+    std::lock_guard<std::mutex> _(_xpathLock);
+    _xpathContexts.emplace(key, ctx);
+}
 int Document::ProcessXInclude(bool generateXIncludeNodes)
 {
     NodeMap nmap;
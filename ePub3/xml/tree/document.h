@@ -36,6 +36,9 @@
 #if EPUB_USE(LIBXML2)
 #include <ePub3/xml/io.h>
 #include <ePub3/xml/c14n.h>
+#include <libxml/xpath.h>
+#include <map>
+#include <mutex>
 #endif
 
 EPUB3_XML_BEGIN_NAMESPACE
@@ -111,6 +114,21 @@ public:
 
 #if EPUB_USE(LIBXML2)
     int ProcessXInclude(bool generateXIncludeNodes = true);
+    
+    //////////////////////////////////////////////////////////////////////////////
+    // XPath evaluation contexts
+    
+    /**
+     Takes an XPath evaluation context for this document, reusing one handed back
+     earlier with the same key if there is one.
+     @param key Identifies the setup of the context, such as its registered namespaces.
+     @param created Set to `true` if the context is new and still needs that setup.
+     */
+    xmlXPathContextPtr AcquireXPathContext(const std::string & key, bool * created) const;
+    
+    ///
+    /// Hands back a context from AcquireXPathContext() so it can be reused.
+    void RelinquishXPathContext(const std::string & key, xmlXPathContextPtr ctx) const;
 #endif
 
     NativeDocPtr xml() { return xml_native_cast<NativeDocPtr>(Node::xml()); }
@@ -135,6 +153,14 @@ public:
     
     string XMLString() const { string __s; WriteXML(__s); return __s; }
     
+#if EPUB_USE(LIBXML2)
+private:
+    typedef std::multimap<std::string, xmlXPathContextPtr>  XPathContextPool;
+    
+    mutable std::mutex          _xpathLock;
+    mutable XPathContextPool    _xpathContexts;     ///< Idle XPath contexts, by key.
+#endif
+    
 };
 
 EPUB3_XML_END_NAMESPACE
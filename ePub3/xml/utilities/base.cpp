@@ -84,6 +84,8 @@ void __resetLibXMLOverrides(void)
     
     xmlSubstituteEntitiesDefault(0);
     xmlLoadExtDtdDefaultValue = 0;
+    xmlThrDefSubstituteEntitiesDefaultValue(0);
+    xmlThrDefLoadExtDtdDefaultValue(0);
 }
 
 //INITIALIZER(__setupLibXML)
@@ -97,6 +99,10 @@ void __setupLibXML(void)
 
     xmlSubstituteEntitiesDefault(1);
     xmlLoadExtDtdDefaultValue = 1;
+    
+    // these are per-thread in a threaded libxml2: documents may be parsed on worker threads too
+    xmlThrDefSubstituteEntitiesDefaultValue(1);
+    xmlThrDefLoadExtDtdDefaultValue(1);
 //#if EPUB_COMPILER(MSVC)
 //    atexit(__resetLibXMLOverrides);
 //#endif